@@ -30,6 +30,7 @@
 	#include <fcntl.h>
 	#include <pthread.h>
 	#include <arpa/inet.h>
+	#include <sys/mman.h>
 
 	#include <dirent.h>
 
@@ -55,6 +56,7 @@
 	#include <winsock2.h>
 	#include <ws2tcpip.h>
 	#include <fcntl.h>
+	#include <io.h>
 	#include <direct.h>
 	#include <errno.h>
 	#include <process.h>
@@ -470,6 +472,8 @@ IOHANDLE io_open(const char *filename, int flags)
 		return (IOHANDLE)fopen(filename, "rb");
 	if(flags == IOFLAG_WRITE)
 		return (IOHANDLE)fopen(filename, "wb");
+	if(flags == IOFLAG_APPEND)
+		return (IOHANDLE)fopen(filename, "ab");
 	return 0x0;
 }
 
@@ -546,6 +550,56 @@ int io_flush(IOHANDLE io)
 	return 0;
 }
 
+void *io_map(IOHANDLE io, unsigned *size)
+{
+#if defined(CONF_FAMILY_UNIX)
+	struct stat st;
+	void *data;
+	int fd = fileno((FILE*)io);
+	*size = 0;
+	if(fstat(fd, &st) != 0 || st.st_size <= 0)
+		return 0;
+	data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED)
+		return 0;
+	*size = (unsigned)st.st_size;
+	return data;
+#elif defined(CONF_FAMILY_WINDOWS)
+	HANDLE file = (HANDLE)_get_osfhandle(_fileno((FILE*)io));
+	HANDLE mapping;
+	DWORD length;
+	void *data;
+	*size = 0;
+	length = GetFileSize(file, NULL);
+	if(length == INVALID_FILE_SIZE || length == 0)
+		return 0;
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!mapping)
+		return 0;
+	/* the view keeps the mapping alive */
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if(!data)
+		return 0;
+	*size = (unsigned)length;
+	return data;
+#else
+	*size = 0;
+	return 0;
+#endif
+}
+
+void io_unmap(void *data, unsigned size)
+{
+	if(!data)
+		return;
+#if defined(CONF_FAMILY_UNIX)
+	munmap(data, size);
+#elif defined(CONF_FAMILY_WINDOWS)
+	UnmapViewOfFile(data);
+#endif
+}
+
 struct thread_data
 {
 	void (*threadfunc)(void *);
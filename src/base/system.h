@@ -187,6 +187,7 @@ enum {
 	IOFLAG_READ = 1,
 	IOFLAG_WRITE = 2,
 	IOFLAG_RANDOM = 4,
+	IOFLAG_APPEND = 8,
 
 	IOSEEK_START = 0,
 	IOSEEK_CUR = 1,
@@ -201,7 +202,7 @@ typedef struct IOINTERNAL *IOHANDLE;
 
 	Parameters:
 		filename - File to open.
-		flags - A set of flags. IOFLAG_READ, IOFLAG_WRITE, IOFLAG_RANDOM.
+		flags - A set of flags. IOFLAG_READ, IOFLAG_WRITE, IOFLAG_RANDOM, IOFLAG_APPEND.
 
 	Returns:
 		Returns a handle to the file on success and 0 on failure.
@@ -325,6 +326,35 @@ int io_close(IOHANDLE io);
 */
 int io_flush(IOHANDLE io);
 
+/*
+	Function: io_map
+		Maps a whole file read only into memory.
+
+	Parameters:
+		io - Handle to the file.
+		size - Pointer to an unsigned that receives the size of the mapping.
+
+	Returns:
+		Returns a pointer to the file contents, 0 if the file is empty or
+		the platform can't map files. The mapping stays valid after the
+		file is closed.
+
+	Remarks:
+		The file must not be truncated or rewritten in place while it is
+		mapped.
+*/
+void *io_map(IOHANDLE io, unsigned *size);
+
+/*
+	Function: io_unmap
+		Releases a mapping created by <io_map>.
+
+	Parameters:
+		data - Pointer returned by <io_map>.
+		size - Size returned by <io_map>.
+*/
+void io_unmap(void *data, unsigned size);
+
 
 /*
 	Function: io_stdin
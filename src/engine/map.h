@@ -26,6 +26,13 @@ class IEngineMap : public IMap
 	MACRO_INTERFACE("enginemap", 0)
 public:
 	virtual bool Load(const char *pMapName) = 0;
+	// for maps that are not registered with the kernel, e.g. loaded on another thread.
+	// Mapped reads the file through a memory mapping, see MappedData
+	virtual bool Load(class IStorage *pStorage, const char *pMapName, bool Mapped) = 0;
+	// the unmodified map file if it is mapped, 0 otherwise
+	virtual const unsigned char *MappedData(unsigned *pSize) = 0;
+	// exchanges the loaded map data with another map
+	virtual void Swap(IEngineMap *pOther) = 0;
 	virtual bool IsLoaded() = 0;
 	virtual void Unload() = 0;
 	virtual unsigned Crc() = 0;
@@ -7,6 +7,23 @@
 #include <game/generated/protocol.h>
 #include <engine/shared/protocol.h>
 
+/*
+	Class: CClientMask
+		A set of client ids, one bit per client.
+*/
+class CClientMask
+{
+	unsigned m_aBits[(MAX_CLIENTS+31)/32];
+
+public:
+	CClientMask() { Clear(); }
+
+	void Clear() { mem_zero(m_aBits, sizeof(m_aBits)); }
+	void Set(int ClientID) { m_aBits[ClientID>>5] |= 1u<<(ClientID&31); }
+	void Unset(int ClientID) { m_aBits[ClientID>>5] &= ~(1u<<(ClientID&31)); }
+	bool Has(int ClientID) const { return (m_aBits[ClientID>>5]>>(ClientID&31))&1; }
+};
+
 class IServer : public IInterface
 {
 	MACRO_INTERFACE("server", 0)
@@ -39,26 +56,83 @@ public:
 
 	virtual int SendMsg(CMsgPacker *pMsg, int Flags, int ClientID) = 0;
 
+	/*
+		Function: SendMsgMask
+			Queues the same packed message for every client in the
+			mask. It is recorded once into the server demo and into
+			the demos of the recipients. The packer can be sent again
+			afterwards.
+	*/
+	virtual int SendMsgMask(CMsgPacker *pMsg, int Flags, const CClientMask &Recipients) = 0;
+
 	template<class T>
 	int SendPackMsg(T *pMsg, int Flags, int ClientID)
 	{
-		int result = 0;
-		T tmp;
 		if (ClientID == -1)
 		{
+			CClientMask Recipients;
 			for(int i = 0; i < MAX_CLIENTS; i++)
 				if(ClientIngame(i))
+					Recipients.Set(i);
+			return SendPackMsgMask(pMsg, Flags, Recipients);
+		}
+
+		T tmp;
+		mem_copy(&tmp, pMsg, sizeof(T));
+		return SendPackMsgTranslate(&tmp, Flags, ClientID);
+	}
+
+	/*
+		Function: SendPackMsgMask
+			Packs the message once for all recipients. Only clients
+			that see translated ids get their own copy of the messages
+			that refer to other clients.
+	*/
+	template<class T>
+	int SendPackMsgMask(T *pMsg, int Flags, const CClientMask &Recipients)
+	{
+		CMsgPacker Packer(pMsg->MsgID());
+		if(pMsg->Pack(&Packer))
+			return -1;
+
+		CClientMask Translated;
+		bool AnyTranslated = false;
+		if(NeedsTranslation(pMsg))
+		{
+			for(int i = 0; i < MAX_CLIENTS; i++)
+				if(Recipients.Has(i) && !KnowsAllIds(i))
 				{
-					mem_copy(&tmp, pMsg, sizeof(T));
-					result = SendPackMsgTranslate(&tmp, Flags, i);
+					Translated.Set(i);
+					AnyTranslated = true;
 				}
-		} else {
+		}
+		if(!AnyTranslated)
+			return SendMsgMask(&Packer, Flags, Recipients);
+
+		// the demo of a translating client has to get its own copy, the
+		// server demo gets the untranslated message once
+		CClientMask Shared = Recipients;
+		T tmp;
+		for(int i = 0; i < MAX_CLIENTS; i++)
+		{
+			if(!Translated.Has(i))
+				continue;
+			Shared.Unset(i);
 			mem_copy(&tmp, pMsg, sizeof(T));
-			result = SendPackMsgTranslate(&tmp, Flags, ClientID);
+			SendPackMsgTranslate(&tmp, Flags|MSGFLAG_NOSERVERRECORD, i);
 		}
-		return result;
+		SendMsgMask(&Packer, Flags|MSGFLAG_NOSERVERRECORD, Shared);
+		if(!(Flags&MSGFLAG_NORECORD))
+			SendMsg(&Packer, Flags|MSGFLAG_NOSEND, -1);
+		return 0;
 	}
 
+	template<class T>
+	bool NeedsTranslation(T *pMsg) { return false; }
+	bool NeedsTranslation(CNetMsg_Sv_Emoticon *pMsg) { return true; }
+	bool NeedsTranslation(CNetMsg_Sv_Chat *pMsg) { return pMsg->m_ClientID >= 0; }
+	bool NeedsTranslation(CNetMsg_Sv_KillMsg *pMsg) { return true; }
+
 	template<class T>
 	int SendPackMsgTranslate(T *pMsg, int Flags, int ClientID)
 	{
@@ -99,11 +173,16 @@ public:
 		return SendMsg(&Packer, Flags, ClientID);
 	}
 
-	bool Translate(int& target, int client)
+	bool KnowsAllIds(int client)
 	{
 		CClientInfo info;
 		GetClientInfo(client, &info);
-		if (info.m_ClientVersion >= VERSION_DDNET_OLD)
+		return info.m_ClientVersion >= VERSION_DDNET_OLD;
+	}
+
+	bool Translate(int& target, int client)
+	{
+		if (KnowsAllIds(client))
 			return true;
 		int* map = GetIdMap(client);
 		bool found = false;
@@ -175,6 +254,8 @@ public:
 	virtual void OnInit() = 0;
 	virtual void OnConsoleInit() = 0;
 	virtual void OnMapChange(char *pNewMapName, int MapNameSize) = 0;
+	// runs on the map loading thread with the map that OnInit will use, must not touch the running game
+	virtual void OnMapPrepare(class IMap *pMap) = 0;
 	virtual void OnShutdown() = 0;
 
 	virtual void OnTick() = 0;
@@ -200,6 +281,11 @@ public:
 	// DDRace
 
 	virtual void OnSetAuthed(int ClientID, int Level) = 0;
+
+	// journal support, zone -1 is the global tuning
+	virtual int GetTuningParams(int Zone, int *pParams, int MaxParams) = 0;
+	virtual void SetTuningParams(int Zone, const int *pParams, int NumParams) = 0;
+	virtual unsigned StateHash() = 0;
 };
 
 extern IGameServer *CreateGameServer();
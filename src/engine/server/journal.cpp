@@ -0,0 +1,300 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#include <base/math.h>
+#include <base/system.h>
+
+#include <engine/storage.h>
+#include <engine/shared/compression.h>
+
+#include "journal.h"
+
+static const char s_aJournalMagic[] = "TWJOURNAL";
+
+CJournalWriter::CJournalWriter()
+{
+	m_File = 0;
+	m_RecordType = -1;
+	m_InputInts = 0;
+}
+
+void CJournalWriter::Begin(int Type)
+{
+	m_Packer.Reset();
+	m_Packer.AddInt(Type);
+	m_RecordType = Type;
+}
+
+void CJournalWriter::Flush()
+{
+	if(!m_File)
+		return;
+
+	// a missing record would make the replay drift, a shorter journal is better
+	if(m_Packer.Error())
+	{
+		dbg_msg("journal", "record of type %d is too big", m_RecordType);
+		Stop();
+		return;
+	}
+
+	unsigned char aSize[8];
+	unsigned char *pEnd = CVariableInt::Pack(aSize, m_Packer.Size());
+	io_write(m_File, aSize, pEnd-aSize);
+	io_write(m_File, m_Packer.Data(), m_Packer.Size());
+}
+
+bool CJournalWriter::Start(IStorage *pStorage, const char *pFilename, const char *pMapName, unsigned MapCrc, unsigned MapSize, unsigned Seed, int InputInts, const char *pNetVersion)
+{
+	Stop();
+
+	m_File = pStorage->OpenFile(pFilename, IOFLAG_WRITE, IStorage::TYPE_SAVE);
+	if(!m_File)
+	{
+		dbg_msg("journal", "failed to open '%s' for writing", pFilename);
+		return false;
+	}
+
+	m_InputInts = min(InputInts, (int)JOURNAL_MAX_INPUT_INTS);
+	mem_zero(m_aaLastInput, sizeof(m_aaLastInput));
+
+	Begin(JOURNALREC_HEADER);
+	m_Packer.AddString(s_aJournalMagic, 0);
+	m_Packer.AddInt(JOURNAL_VERSION);
+	m_Packer.AddString(pNetVersion, 0);
+	m_Packer.AddString(pMapName, 0);
+	m_Packer.AddInt(MapCrc);
+	m_Packer.AddInt(MapSize);
+	m_Packer.AddInt(Seed);
+	m_Packer.AddInt(m_InputInts);
+	Flush();
+
+	dbg_msg("journal", "recording to '%s'", pFilename);
+	return true;
+}
+
+void CJournalWriter::Stop()
+{
+	if(!m_File)
+		return;
+
+	Begin(JOURNALREC_END);
+	Flush();
+	io_close(m_File);
+	m_File = 0;
+	dbg_msg("journal", "recording stopped");
+}
+
+void CJournalWriter::AddConfig(const char *pName, const char *pValue)
+{
+	Begin(JOURNALREC_CONFIG);
+	m_Packer.AddString(pName, 0);
+	m_Packer.AddString(pValue, 0);
+	Flush();
+}
+
+void CJournalWriter::AddTuning(int Zone, const int *pParams, int NumParams)
+{
+	Begin(JOURNALREC_TUNING);
+	m_Packer.AddInt(Zone);
+	m_Packer.AddInt(NumParams);
+	for(int i = 0; i < NumParams; i++)
+		m_Packer.AddInt(pParams[i]);
+	Flush();
+}
+
+void CJournalWriter::AddTick(int Tick)
+{
+	Begin(JOURNALREC_TICK);
+	m_Packer.AddInt(Tick);
+	Flush();
+}
+
+void CJournalWriter::AddInput(int Type, int ClientID, const int *pInput)
+{
+	int *pLast = m_aaLastInput[ClientID];
+	int Mask = 0;
+	for(int i = 0; i < m_InputInts; i++)
+		if(pInput[i] != pLast[i])
+			Mask |= 1<<i;
+
+	Begin(Type);
+	m_Packer.AddInt(ClientID);
+	m_Packer.AddInt(Mask);
+	for(int i = 0; i < m_InputInts; i++)
+	{
+		if(Mask&(1<<i))
+		{
+			m_Packer.AddInt(pInput[i]);
+			pLast[i] = pInput[i];
+		}
+	}
+	Flush();
+}
+
+void CJournalWriter::AddEvent(int Type, int ClientID)
+{
+	Begin(Type);
+	m_Packer.AddInt(ClientID);
+	Flush();
+}
+
+void CJournalWriter::AddDrop(int ClientID, const char *pReason)
+{
+	Begin(JOURNALREC_DROP);
+	m_Packer.AddInt(ClientID);
+	m_Packer.AddString(pReason ? pReason : "", 0);
+	Flush();
+	mem_zero(m_aaLastInput[ClientID], sizeof(m_aaLastInput[ClientID]));
+}
+
+void CJournalWriter::AddGameMsg(int ClientID, const void *pData, int Size)
+{
+	Begin(JOURNALREC_GAMEMSG);
+	m_Packer.AddInt(ClientID);
+	m_Packer.AddInt(Size);
+	m_Packer.AddRaw(pData, Size);
+	Flush();
+}
+
+void CJournalWriter::AddRcon(int ClientID, int AuthLevel, const char *pCmd)
+{
+	Begin(JOURNALREC_RCON);
+	m_Packer.AddInt(ClientID);
+	m_Packer.AddInt(AuthLevel);
+	m_Packer.AddString(pCmd, 0);
+	Flush();
+}
+
+void CJournalWriter::AddAuth(int ClientID, int AuthLevel)
+{
+	Begin(JOURNALREC_AUTH);
+	m_Packer.AddInt(ClientID);
+	m_Packer.AddInt(AuthLevel);
+	Flush();
+}
+
+
+CJournalReader::CJournalReader()
+{
+	m_File = 0;
+	m_BufferPos = 0;
+	m_BufferSize = 0;
+	m_InputInts = 0;
+}
+
+CJournalReader::~CJournalReader()
+{
+	Close();
+}
+
+bool CJournalReader::Fill(int Size)
+{
+	if(m_BufferSize-m_BufferPos >= Size)
+		return true;
+
+	// move the remaining bytes to the front and top up the buffer
+	int Left = m_BufferSize-m_BufferPos;
+	mem_move(m_aBuffer, m_aBuffer+m_BufferPos, Left);
+	m_BufferPos = 0;
+	m_BufferSize = Left + io_read(m_File, m_aBuffer+Left, BUFFER_SIZE-Left);
+	return m_BufferSize >= Size;
+}
+
+bool CJournalReader::Open(IStorage *pStorage, const char *pFilename, CHeader *pHeader)
+{
+	Close();
+
+	m_File = pStorage->OpenFile(pFilename, IOFLAG_READ, IStorage::TYPE_ALL);
+	if(!m_File)
+	{
+		dbg_msg("journal", "failed to open '%s'", pFilename);
+		return false;
+	}
+
+	m_BufferPos = 0;
+	m_BufferSize = 0;
+	m_InputInts = 0;
+	mem_zero(m_aaLastInput, sizeof(m_aaLastInput));
+
+	CUnpacker Unpacker;
+	if(NextRecord(&Unpacker) != JOURNALREC_HEADER || str_comp(Unpacker.GetString(), s_aJournalMagic) != 0)
+	{
+		dbg_msg("journal", "'%s' is not a journal", pFilename);
+		Close();
+		return false;
+	}
+
+	int Version = Unpacker.GetInt();
+	if(Version != JOURNAL_VERSION)
+	{
+		dbg_msg("journal", "unsupported journal version %d", Version);
+		Close();
+		return false;
+	}
+
+	str_copy(pHeader->m_aNetVersion, Unpacker.GetString(), sizeof(pHeader->m_aNetVersion));
+	str_copy(pHeader->m_aMapName, Unpacker.GetString(), sizeof(pHeader->m_aMapName));
+	pHeader->m_MapCrc = Unpacker.GetInt();
+	pHeader->m_MapSize = Unpacker.GetInt();
+	pHeader->m_Seed = Unpacker.GetInt();
+	m_InputInts = Unpacker.GetInt();
+	if(Unpacker.Error() || m_InputInts < 0 || m_InputInts > JOURNAL_MAX_INPUT_INTS)
+	{
+		dbg_msg("journal", "corrupt journal header");
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CJournalReader::Close()
+{
+	if(m_File)
+		io_close(m_File);
+	m_File = 0;
+}
+
+int CJournalReader::NextRecord(CUnpacker *pUnpacker)
+{
+	if(!m_File || !Fill(1))
+		return -1;
+
+	// the size varint is at most 5 bytes, the buffer may hold less at the end of the file
+	Fill(5);
+	int Size = 0;
+	const unsigned char *pData = CVariableInt::Unpack(m_aBuffer+m_BufferPos, &Size);
+	m_BufferPos = pData-m_aBuffer;
+	if(Size <= 0 || Size > JOURNAL_MAX_RECORD_SIZE || !Fill(Size))
+	{
+		dbg_msg("journal", "truncated record");
+		return -1;
+	}
+
+	mem_copy(m_aRecord, m_aBuffer+m_BufferPos, Size);
+	m_BufferPos += Size;
+
+	pUnpacker->Reset(m_aRecord, Size);
+	int Type = pUnpacker->GetInt();
+	return pUnpacker->Error() ? -1 : Type;
+}
+
+int CJournalReader::ReadInput(CUnpacker *pUnpacker, int *pInput)
+{
+	int ClientID = pUnpacker->GetInt();
+	int Mask = pUnpacker->GetInt();
+	if(pUnpacker->Error() || ClientID < 0 || ClientID >= MAX_CLIENTS)
+		return -1;
+
+	int *pLast = m_aaLastInput[ClientID];
+	for(int i = 0; i < m_InputInts; i++)
+		if(Mask&(1<<i))
+			pLast[i] = pUnpacker->GetInt();
+	mem_copy(pInput, pLast, m_InputInts*sizeof(int));
+	return pUnpacker->Error() ? -1 : ClientID;
+}
+
+void CJournalReader::ResetInput(int ClientID)
+{
+	if(ClientID >= 0 && ClientID < MAX_CLIENTS)
+		mem_zero(m_aaLastInput[ClientID], sizeof(m_aaLastInput[ClientID]));
+}
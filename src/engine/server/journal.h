@@ -0,0 +1,122 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#ifndef ENGINE_SERVER_JOURNAL_H
+#define ENGINE_SERVER_JOURNAL_H
+
+#include <base/system.h>
+#include <engine/shared/packer.h>
+#include <engine/shared/protocol.h>
+
+/*
+	Input journal
+
+	A journal is a flat sequence of records, each stored as a varint payload
+	size followed by a CPacker payload that starts with the record type.
+	It holds everything the game server needs to replay a session without
+	network: the map, the config variables by name and the tuning at
+	start, client joins and
+	leaves, game messages, rcon commands and every applied player input.
+	Inputs are delta coded against the previous input of the same client.
+*/
+enum
+{
+	JOURNAL_VERSION=2,
+	JOURNAL_MAX_INPUT_INTS=32,
+	JOURNAL_MAX_RECORD_SIZE=2048,
+
+	JOURNALREC_HEADER=0,
+	JOURNALREC_CONFIG,
+	JOURNALREC_TUNING,
+	JOURNALREC_TICK,
+	JOURNALREC_PREDICTED_INPUT,
+	JOURNALREC_DIRECT_INPUT,
+	JOURNALREC_ONTICK,
+	JOURNALREC_SNAP,
+	JOURNALREC_CONNECTED,
+	JOURNALREC_ENTER,
+	JOURNALREC_DROP,
+	JOURNALREC_GAMEMSG,
+	JOURNALREC_RCON,
+	JOURNALREC_AUTH,
+	JOURNALREC_END,
+};
+
+class CJournalWriter
+{
+	IOHANDLE m_File;
+	CPacker m_Packer;
+	int m_RecordType;
+	int m_InputInts;
+	int m_aaLastInput[MAX_CLIENTS][JOURNAL_MAX_INPUT_INTS];
+
+	void Begin(int Type);
+	void Flush();
+
+public:
+	CJournalWriter();
+
+	bool Start(class IStorage *pStorage, const char *pFilename, const char *pMapName, unsigned MapCrc, unsigned MapSize, unsigned Seed, int InputInts, const char *pNetVersion);
+	void Stop();
+	bool IsRecording() const { return m_File != 0; }
+
+	void AddConfig(const char *pName, const char *pValue);
+	void AddTuning(int Zone, const int *pParams, int NumParams);
+	void AddTick(int Tick);
+	void AddInput(int Type, int ClientID, const int *pInput);
+	void AddEvent(int Type, int ClientID);
+	void AddDrop(int ClientID, const char *pReason);
+	void AddGameMsg(int ClientID, const void *pData, int Size);
+	void AddRcon(int ClientID, int AuthLevel, const char *pCmd);
+	void AddAuth(int ClientID, int AuthLevel);
+};
+
+class CJournalReader
+{
+	enum
+	{
+		BUFFER_SIZE=64*1024,
+	};
+
+	IOHANDLE m_File;
+	unsigned char m_aBuffer[BUFFER_SIZE];
+	int m_BufferPos;
+	int m_BufferSize;
+	unsigned char m_aRecord[JOURNAL_MAX_RECORD_SIZE];
+	int m_InputInts;
+	int m_aaLastInput[MAX_CLIENTS][JOURNAL_MAX_INPUT_INTS];
+
+	bool Fill(int Size);
+
+public:
+	struct CHeader
+	{
+		char m_aMapName[128];
+		char m_aNetVersion[64];
+		unsigned m_MapCrc;
+		unsigned m_MapSize;
+		unsigned m_Seed;
+	};
+
+	CJournalReader();
+	~CJournalReader();
+
+	bool Open(class IStorage *pStorage, const char *pFilename, CHeader *pHeader);
+	void Close();
+
+	/*
+		Function: NextRecord
+			Reads the next record and leaves its payload, after the
+			type, in pUnpacker.
+
+		Returns:
+			The record type, or -1 at the end of the journal.
+	*/
+	int NextRecord(CUnpacker *pUnpacker);
+
+	// decodes an input record into the full input of the client
+	int ReadInput(CUnpacker *pUnpacker, int *pInput);
+	void ResetInput(int ClientID);
+	int InputInts() const { return m_InputInts; }
+};
+
+#endif
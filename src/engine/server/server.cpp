@@ -307,12 +307,17 @@ CServer::CServer()
 
 	m_pCurrentMapData = 0;
 	m_CurrentMapSize = 0;
+	m_CurrentMapMapped = false;
 
 	m_MapReload = 0;
 	m_ReloadedWhenEmpty = false;
 
+	m_JournalSeed = 0;
+	m_Replaying = false;
+
 	m_RconClientID = IServer::RCON_CID_SERV;
 	m_RconAuthLevel = AUTHED_ADMIN;
+	m_RconCmdStreamStart = 0;
 
 	m_RconRestrict = -1;
 	m_GeneratedRconPassword = 0;
@@ -321,9 +326,30 @@ CServer::CServer()
 	m_ServerInfoNumRequests = 0;
 	m_ServerInfoHighLoad = false;
 
+	mem_zero(&m_MapPrepare, sizeof(m_MapPrepare));
+	m_MapPrepare.m_pMap = CreateEngineMap();
+	m_pMapPrepareThread = 0;
+	m_MapPrepareLock = lock_create();
+	m_MapPrepareDone = false;
+
+	m_NumDemoRecording = 0;
+	m_DemoStatsTick = 0;
+	m_DemoRecordTime = 0;
+	m_DemoSnapshots = 0;
+	m_DemoLastTicks = 1;
+	m_DemoLastRecordTime = 0;
+	m_DemoLastSnapshots = 0;
+
 	Init();
 }
 
+CServer::~CServer()
+{
+	StopMapPrepare();
+	delete m_MapPrepare.m_pMap;
+	lock_destroy(m_MapPrepareLock);
+}
+
 
 int CServer::TrySetClientName(int ClientID, const char *pName)
 {
@@ -406,6 +432,10 @@ void CServer::SetClientScore(int ClientID, int Score)
 
 void CServer::Kick(int ClientID, const char *pReason)
 {
+	// a replay drops clients where the journal recorded it
+	if(m_Replaying)
+		return;
+
 	if(ClientID < 0 || ClientID >= MAX_CLIENTS || m_aClients[ClientID].m_State == CClient::STATE_EMPTY)
 	{
 		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", "invalid client id to kick");
@@ -598,10 +628,11 @@ int CServer::SendMsgEx(CMsgPacker *pMsg, int Flags, int ClientID, bool System)
 	{
 		if(ClientID > -1)
 			m_aDemoRecorder[ClientID].RecordMessage(pMsg->Data(), pMsg->Size());
-		m_aDemoRecorder[MAX_CLIENTS].RecordMessage(pMsg->Data(), pMsg->Size());
+		if(!(Flags&MSGFLAG_NOSERVERRECORD))
+			m_aDemoRecorder[MAX_CLIENTS].RecordMessage(pMsg->Data(), pMsg->Size());
 	}
 
-	if(!(Flags&MSGFLAG_NOSEND))
+	if(!(Flags&MSGFLAG_NOSEND) && !m_Replaying)
 	{
 		if(ClientID == -1)
 		{
@@ -620,10 +651,80 @@ int CServer::SendMsgEx(CMsgPacker *pMsg, int Flags, int ClientID, bool System)
 	return 0;
 }
 
+int CServer::SendMsgMask(CMsgPacker *pMsg, int Flags, const CClientMask &Recipients)
+{
+	CNetChunk Packet;
+	if(!pMsg)
+		return -1;
+
+	mem_zero(&Packet, sizeof(CNetChunk));
+	Packet.m_pData = pMsg->Data();
+	Packet.m_DataSize = pMsg->Size();
+
+	// same message id HACK as in SendMsgEx, undone below so the packer stays reusable
+	unsigned char *pMsgID = (unsigned char*)Packet.m_pData;
+	unsigned char OrigMsgID = *pMsgID;
+	*pMsgID <<= 1;
+
+	if(Flags&MSGFLAG_VITAL)
+		Packet.m_Flags |= NETSENDFLAG_VITAL;
+	if(Flags&MSGFLAG_FLUSH)
+		Packet.m_Flags |= NETSENDFLAG_FLUSH;
+
+	// write message to demo recorder, the server demo gets it only once
+	if(!(Flags&MSGFLAG_NORECORD))
+	{
+		bool Recorded = false;
+		for(int i = 0; i < MAX_CLIENTS; i++)
+		{
+			if(!Recipients.Has(i))
+				continue;
+			m_aDemoRecorder[i].RecordMessage(pMsg->Data(), pMsg->Size());
+			Recorded = true;
+		}
+		if(Recorded && !(Flags&MSGFLAG_NOSERVERRECORD))
+			m_aDemoRecorder[MAX_CLIENTS].RecordMessage(pMsg->Data(), pMsg->Size());
+	}
+
+	if(!(Flags&MSGFLAG_NOSEND) && !m_Replaying)
+	{
+		for(int i = 0; i < MAX_CLIENTS; i++)
+		{
+			if(!Recipients.Has(i))
+				continue;
+			Packet.m_ClientID = i;
+			m_NetServer.Send(&Packet);
+		}
+	}
+
+	*pMsgID = OrigMsgID;
+	return 0;
+}
+
+void CServer::RecordDemoSnapshot(int Recorder, const void *pData, int Size)
+{
+	int64 RecordStart = time_get();
+
+	// for antiping: if the projectile netobjects contains extra data, this is removed and the original content restored before recording demo
+	unsigned char aExtraInfoRemoved[CSnapshot::MAX_SIZE];
+	mem_copy(aExtraInfoRemoved, pData, Size);
+	SnapshotRemoveExtraInfo(aExtraInfoRemoved);
+	// write snapshot
+	m_aDemoRecorder[Recorder].RecordSnapshot(Tick(), aExtraInfoRemoved, Size);
+
+	m_DemoSnapshots++;
+	m_DemoRecordTime += time_get()-RecordStart;
+}
+
 void CServer::DoSnapshot()
 {
 	GameServer()->OnPreSnap();
 
+	m_NumDemoRecording = 0;
+	for(int i = 0; i < MAX_CLIENTS+1; i++)
+		if(m_aDemoRecorder[i].IsRecording())
+			m_NumDemoRecording++;
+
 	// create snapshot for demo recording
 	if(m_aDemoRecorder[MAX_CLIENTS].IsRecording())
 	{
@@ -635,12 +736,7 @@ void CServer::DoSnapshot()
 		GameServer()->OnSnap(-1);
 		SnapshotSize = m_SnapshotBuilder.Finish(aData);
 
-		// for antiping: if the projectile netobjects contains extra data, this is removed and the original content restored before recording demo
-		unsigned char aExtraInfoRemoved[CSnapshot::MAX_SIZE];
-		mem_copy(aExtraInfoRemoved, aData, SnapshotSize);
-		SnapshotRemoveExtraInfo(aExtraInfoRemoved);
-		// write snapshot
-		m_aDemoRecorder[MAX_CLIENTS].RecordSnapshot(Tick(), aExtraInfoRemoved, SnapshotSize);
+		RecordDemoSnapshot(MAX_CLIENTS, aData, SnapshotSize);
 	}
 
 	// create snapshots for all clients
@@ -679,14 +775,7 @@ void CServer::DoSnapshot()
 			SnapshotSize = m_SnapshotBuilder.Finish(pData);
 
 			if(m_aDemoRecorder[i].IsRecording())
-			{
-				// for antiping: if the projectile netobjects contains extra data, this is removed and the original content restored before recording demo
-				unsigned char aExtraInfoRemoved[CSnapshot::MAX_SIZE];
-				mem_copy(aExtraInfoRemoved, aData, SnapshotSize);
-				SnapshotRemoveExtraInfo(aExtraInfoRemoved);
-				// write snapshot
-				m_aDemoRecorder[i].RecordSnapshot(Tick(), aExtraInfoRemoved, SnapshotSize);
-			}
+				RecordDemoSnapshot(i, aData, SnapshotSize);
 
 			Crc = pData->Crc();
 
@@ -765,6 +854,16 @@ void CServer::DoSnapshot()
 	}
 
 	GameServer()->OnPostSnap();
+
+	if(Tick() >= m_DemoStatsTick+SERVER_TICK_SPEED || Tick() < m_DemoStatsTick)
+	{
+		m_DemoLastTicks = max(Tick()-m_DemoStatsTick, 1);
+		m_DemoLastRecordTime = m_DemoRecordTime;
+		m_DemoLastSnapshots = m_DemoSnapshots;
+		m_DemoStatsTick = Tick();
+		m_DemoRecordTime = 0;
+		m_DemoSnapshots = 0;
+	}
 }
 
 int CServer::ClientRejoinCallback(int ClientID, void *pUser)
@@ -830,7 +929,11 @@ int CServer::DelClientCallback(int ClientID, const char *pReason, void *pUser)
 
 	// notify the mod about the drop
 	if(pThis->m_aClients[ClientID].m_State >= CClient::STATE_READY)
+	{
+		if(pThis->m_Journal.IsRecording())
+			pThis->m_Journal.AddDrop(ClientID, pReason);
 		pThis->GameServer()->OnClientDrop(ClientID, pReason);
+	}
 
 	pThis->m_aClients[ClientID].m_State = CClient::STATE_EMPTY;
 	pThis->m_aClients[ClientID].m_aName[0] = 0;
@@ -893,12 +996,19 @@ void CServer::SendRconLineAuthed(const char *pLine, void *pUser, bool Highlighte
 	ReentryGuard--;
 }
 
+void CServer::PackRconCmdAdd(CMsgPacker *pMsg, const IConsole::CCommandInfo *pCommandInfo)
+{
+	pMsg->Reset();
+	pMsg->AddInt(NETMSG_RCON_CMD_ADD);
+	pMsg->AddString(pCommandInfo->m_pName, IConsole::TEMPCMD_NAME_LENGTH);
+	pMsg->AddString(pCommandInfo->m_pHelp, IConsole::TEMPCMD_HELP_LENGTH);
+	pMsg->AddString(pCommandInfo->m_pParams, IConsole::TEMPCMD_PARAMS_LENGTH);
+}
+
 void CServer::SendRconCmdAdd(const IConsole::CCommandInfo *pCommandInfo, int ClientID)
 {
 	CMsgPacker Msg(NETMSG_RCON_CMD_ADD);
-	Msg.AddString(pCommandInfo->m_pName, IConsole::TEMPCMD_NAME_LENGTH);
-	Msg.AddString(pCommandInfo->m_pHelp, IConsole::TEMPCMD_HELP_LENGTH);
-	Msg.AddString(pCommandInfo->m_pParams, IConsole::TEMPCMD_PARAMS_LENGTH);
+	PackRconCmdAdd(&Msg, pCommandInfo);
 	SendMsgEx(&Msg, MSGFLAG_VITAL, ClientID, true);
 }
 
@@ -909,8 +1019,62 @@ void CServer::SendRconCmdRem(const IConsole::CCommandInfo *pCommandInfo, int Cli
 	SendMsgEx(&Msg, MSGFLAG_VITAL, ClientID, true);
 }
 
+void CServer::StreamClientRconCommands()
+{
+	// the protocol carries one command per message, but the network layer
+	// puts as many messages into a packet as fit. every authed client gets
+	// up to a packet each tick, the first client rotates so a small global
+	// budget is shared fairly
+	int Budget = g_Config.m_SvRconCmdBudget;
+	int Start = m_RconCmdStreamStart;
+	m_RconCmdStreamStart = (m_RconCmdStreamStart+1) % MAX_CLIENTS;
+
+	for(int j = 0; j < MAX_CLIENTS && Budget > 0; j++)
+	{
+		int ClientID = (Start+j) % MAX_CLIENTS;
+		CClient *pClient = &m_aClients[ClientID];
+		if(pClient->m_State == CClient::STATE_EMPTY || !pClient->m_Authed || !pClient->m_pRconCmdToSend)
+			continue;
+		// keep the resend buffer from overflowing on slow connections
+		if(m_NetServer.UnackedChunks(ClientID) >= MAX_RCONCMD_UNACKED)
+			continue;
+
+		int ConsoleAccessLevel = pClient->m_Authed == AUTHED_ADMIN ? IConsole::ACCESS_LEVEL_ADMIN : pClient->m_Authed == AUTHED_MOD ? IConsole::ACCESS_LEVEL_MOD : IConsole::ACCESS_LEVEL_HELPER;
+		int ClientBudget = min(Budget, (int)NET_MAX_PAYLOAD);
+
+		// hold back one message, so the last one of the batch can flush the packet
+		CMsgPacker aMsgs[2] = {CMsgPacker(NETMSG_RCON_CMD_ADD), CMsgPacker(NETMSG_RCON_CMD_ADD)};
+		int Pending = -1;
+		int Used = 0;
+		while(pClient->m_pRconCmdToSend)
+		{
+			int Cur = Pending == 0 ? 1 : 0;
+			PackRconCmdAdd(&aMsgs[Cur], pClient->m_pRconCmdToSend);
+			int Size = aMsgs[Cur].Size() + NET_MAX_CHUNKHEADERSIZE;
+			if(Pending >= 0 && Used+Size > ClientBudget)
+				break;
+
+			if(Pending >= 0)
+				SendMsgEx(&aMsgs[Pending], MSGFLAG_VITAL, ClientID, true);
+			Pending = Cur;
+			Used += Size;
+			pClient->m_pRconCmdToSend = pClient->m_pRconCmdToSend->NextCommandInfo(ConsoleAccessLevel, CFGFLAG_SERVER);
+		}
+
+		if(Pending >= 0)
+			SendMsgEx(&aMsgs[Pending], MSGFLAG_VITAL|MSGFLAG_FLUSH, ClientID, true);
+		Budget -= Used;
+	}
+}
+
 void CServer::UpdateClientRconCommands()
 {
+	if(g_Config.m_SvRconCmdStream)
+	{
+		StreamClientRconCommands();
+		return;
+	}
+
 	int ClientID = Tick() % MAX_CLIENTS;
 
 	if(m_aClients[ClientID].m_State != CClient::STATE_EMPTY && m_aClients[ClientID].m_Authed)
@@ -1057,6 +1221,8 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 				str_format(aBuf, sizeof(aBuf), "player is ready. ClientID=%d addr=%s secure=%s", ClientID, aAddrStr, m_NetServer.HasSecurityToken(ClientID)?"yes":"no");
 				Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBuf);
 				m_aClients[ClientID].m_State = CClient::STATE_READY;
+				if(m_Journal.IsRecording())
+					m_Journal.AddEvent(JOURNALREC_CONNECTED, ClientID);
 				GameServer()->OnClientConnected(ClientID);
 			}
 
@@ -1073,6 +1239,8 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 				str_format(aBuf, sizeof(aBuf), "player has entered the game. ClientID=%d addr=%s", ClientID, aAddrStr);
 				Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
 				m_aClients[ClientID].m_State = CClient::STATE_INGAME;
+				if(m_Journal.IsRecording())
+					m_Journal.AddEvent(JOURNALREC_ENTER, ClientID);
 				GameServer()->OnClientEnter(ClientID);
 			}
 		}
@@ -1126,7 +1294,11 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 
 			// call the mod with the fresh input data
 			if(m_aClients[ClientID].m_State == CClient::STATE_INGAME)
+			{
+				if(m_Journal.IsRecording())
+					m_Journal.AddInput(JOURNALREC_DIRECT_INPUT, ClientID, m_aClients[ClientID].m_LatestInput.m_aData);
 				GameServer()->OnClientDirectInput(ClientID, m_aClients[ClientID].m_LatestInput.m_aData);
+			}
 		}
 		else if(Msg == NETMSG_RCON_CMD)
 		{
@@ -1149,6 +1321,8 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 					char aBuf[256];
 					str_format(aBuf, sizeof(aBuf), "ClientID=%d rcon='%s'", ClientID, pCmd);
 					Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBuf);
+					if(m_Journal.IsRecording())
+						m_Journal.AddRcon(ClientID, m_aClients[ClientID].m_Authed, pCmd);
 					m_RconClientID = ClientID;
 					m_RconAuthLevel = m_aClients[ClientID].m_Authed;
 					Console()->SetAccessLevel(m_aClients[ClientID].m_Authed == AUTHED_ADMIN ? IConsole::ACCESS_LEVEL_ADMIN : m_aClients[ClientID].m_Authed == AUTHED_MOD ? IConsole::ACCESS_LEVEL_MOD : m_aClients[ClientID].m_Authed == AUTHED_HELPER ? IConsole::ACCESS_LEVEL_HELPER : IConsole::ACCESS_LEVEL_USER);
@@ -1224,6 +1398,8 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 						Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
 
 						// DDRace
+						if(m_Journal.IsRecording())
+							m_Journal.AddAuth(ClientID, AuthLevel);
 						GameServer()->OnSetAuthed(ClientID, AuthLevel);
 					}
 				}
@@ -1278,7 +1454,11 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 	{
 		// game message
 		if((pPacket->m_Flags&NET_CHUNKFLAG_VITAL) != 0 && m_aClients[ClientID].m_State >= CClient::STATE_READY)
+		{
+			if(m_Journal.IsRecording())
+				m_Journal.AddGameMsg(ClientID, pPacket->m_pData, pPacket->m_DataSize);
 			GameServer()->OnMessage(Msg, &Unpacker, ClientID);
+		}
 	}
 }
 
@@ -1536,28 +1716,68 @@ char *CServer::GetMapName()
 	return pMapShortName;
 }
 
-int CServer::LoadMap(const char *pMapName)
+void CServer::FreeMapData(const unsigned char *pData, bool Mapped)
+{
+	// mapped data goes away with the map it belongs to
+	if(pData && !Mapped)
+		mem_free((void *)pData);
+}
+
+void CServer::PrepareMap(CMapPrepare *pPrepare)
 {
-	//DATAFILE *df;
-	char aBuf[512];
-	str_format(aBuf, sizeof(aBuf), "maps/%s.map", pMapName);
-	GameServer()->OnMapChange(aBuf, sizeof(aBuf));
+	int64 Start = time_get();
+	pPrepare->m_Result = MAPPREPARE_FAILED;
+	pPrepare->m_pData = 0;
+	pPrepare->m_DataSize = 0;
+	pPrepare->m_DataMapped = false;
 
-	/*df = datafile_load(buf);
-	if(!df)
-		return 0;*/
+	str_format(pPrepare->m_aPath, sizeof(pPrepare->m_aPath), "maps/%s.map", pPrepare->m_aName);
+	GameServer()->OnMapChange(pPrepare->m_aPath, sizeof(pPrepare->m_aPath));
 
 	// check for valid standard map
-	if(!m_MapChecker.ReadAndValidateMap(Storage(), aBuf, IStorage::TYPE_ALL))
+	if(!m_MapChecker.ReadAndValidateMap(Storage(), pPrepare->m_aPath, IStorage::TYPE_ALL))
 	{
-		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "mapchecker", "invalid standard map");
-		return 0;
+		pPrepare->m_Result = MAPPREPARE_INVALID;
+		return;
+	}
+
+	if(!pPrepare->m_pMap->Load(Storage(), pPrepare->m_aPath, g_Config.m_SvMapMmap))
+		return;
+	pPrepare->m_Crc = pPrepare->m_pMap->Crc();
+
+	// the download is served from the mapping if there is one
+	pPrepare->m_pData = pPrepare->m_pMap->MappedData(&pPrepare->m_DataSize);
+	pPrepare->m_DataMapped = pPrepare->m_pData != 0;
+	if(!pPrepare->m_DataMapped)
+	{
+		// load complete map into memory for download
+		IOHANDLE File = Storage()->OpenFile(pPrepare->m_aPath, IOFLAG_READ, IStorage::TYPE_ALL);
+		if(!File)
+		{
+			pPrepare->m_pMap->Unload();
+			return;
+		}
+		pPrepare->m_DataSize = (unsigned int)io_length(File);
+		unsigned char *pData = (unsigned char *)mem_alloc(pPrepare->m_DataSize, 1);
+		io_read(File, pData, pPrepare->m_DataSize);
+		io_close(File);
+		pPrepare->m_pData = pData;
 	}
 
-	if(!m_pMap->Load(aBuf))
+	GameServer()->OnMapPrepare(pPrepare->m_pMap);
+
+	pPrepare->m_Time = time_get()-Start;
+	pPrepare->m_Result = MAPPREPARE_OK;
+}
+
+int CServer::ActivateMap(CMapPrepare *pPrepare)
+{
+	if(pPrepare->m_Result == MAPPREPARE_INVALID)
+		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "mapchecker", "invalid standard map");
+	if(pPrepare->m_Result != MAPPREPARE_OK)
 		return 0;
 
-	// stop recording when we change map
+	// stop recording when we change map, the demos still write the old map data
 	for(int i = 0; i < MAX_CLIENTS+1; i++)
 	{
 		m_aDemoRecorder[i].Stop();
@@ -1571,28 +1791,29 @@ int CServer::LoadMap(const char *pMapName)
 		}
 	}
 
+	// the old map data ends up in the prepare map and is unloaded with it
+	FreeMapData(m_pCurrentMapData, m_CurrentMapMapped);
+	m_pCurrentMapData = 0;
+	m_pMap->Swap(pPrepare->m_pMap);
+	pPrepare->m_pMap->Unload();
+
 	// reinit snapshot ids
 	m_IDPool.TimeoutIDs();
 
 	// get the crc of the map
-	m_CurrentMapCrc = m_pMap->Crc();
+	m_CurrentMapCrc = pPrepare->m_Crc;
 	char aBufMsg[256];
-	str_format(aBufMsg, sizeof(aBufMsg), "%s crc is %08x", aBuf, m_CurrentMapCrc);
+	str_format(aBufMsg, sizeof(aBufMsg), "%s crc is %08x", pPrepare->m_aPath, m_CurrentMapCrc);
+	Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBufMsg);
+	str_format(aBufMsg, sizeof(aBufMsg), "map prepared in %.2fms", pPrepare->m_Time*1000.0/time_freq());
 	Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBufMsg);
 
-	str_copy(m_aCurrentMap, pMapName, sizeof(m_aCurrentMap));
-	//map_set(df);
+	str_copy(m_aCurrentMap, pPrepare->m_aName, sizeof(m_aCurrentMap));
 
-	// load complete map into memory for download
-	{
-		IOHANDLE File = Storage()->OpenFile(aBuf, IOFLAG_READ, IStorage::TYPE_ALL);
-		m_CurrentMapSize = (unsigned int)io_length(File);
-		if(m_pCurrentMapData)
-			mem_free(m_pCurrentMapData);
-		m_pCurrentMapData = (unsigned char *)mem_alloc(m_CurrentMapSize, 1);
-		io_read(File, m_pCurrentMapData, m_CurrentMapSize);
-		io_close(File);
-	}
+	m_pCurrentMapData = pPrepare->m_pData;
+	m_CurrentMapSize = pPrepare->m_DataSize;
+	m_CurrentMapMapped = pPrepare->m_DataMapped;
+	pPrepare->m_pData = 0;
 
 	for(int i=0; i<MAX_CLIENTS; i++)
 		m_aPrevStates[i] = m_aClients[i].m_State;
@@ -1600,6 +1821,77 @@ int CServer::LoadMap(const char *pMapName)
 	return 1;
 }
 
+int CServer::LoadMap(const char *pMapName)
+{
+	StopMapPrepare();
+	str_copy(m_MapPrepare.m_aName, pMapName, sizeof(m_MapPrepare.m_aName));
+	PrepareMap(&m_MapPrepare);
+	return ActivateMap(&m_MapPrepare);
+}
+
+void CServer::MapPrepareThread(void *pUser)
+{
+	CServer *pThis = (CServer *)pUser;
+	pThis->PrepareMap(&pThis->m_MapPrepare);
+
+	lock_wait(pThis->m_MapPrepareLock);
+	pThis->m_MapPrepareDone = true;
+	lock_unlock(pThis->m_MapPrepareLock);
+}
+
+void CServer::StartMapPrepare(const char *pMapName)
+{
+	str_copy(m_MapPrepare.m_aName, pMapName, sizeof(m_MapPrepare.m_aName));
+	m_MapPrepareDone = false;
+	m_pMapPrepareThread = thread_init(MapPrepareThread, this);
+	if(!m_pMapPrepareThread)
+	{
+		// no thread, load it right away
+		PrepareMap(&m_MapPrepare);
+		m_MapPrepareDone = true;
+	}
+}
+
+int CServer::FinishMapPrepare()
+{
+	lock_wait(m_MapPrepareLock);
+	bool Done = m_MapPrepareDone;
+	lock_unlock(m_MapPrepareLock);
+	if(!Done)
+		return -1;
+
+	if(m_pMapPrepareThread)
+		thread_wait(m_pMapPrepareThread);
+	m_pMapPrepareThread = 0;
+	m_MapPrepareDone = false;
+
+	// sv_map changed while loading, the next poll starts over with the new one
+	if(str_comp(m_MapPrepare.m_aName, g_Config.m_SvMap) != 0)
+	{
+		FreeMapData(m_MapPrepare.m_pData, m_MapPrepare.m_DataMapped);
+		m_MapPrepare.m_pData = 0;
+		m_MapPrepare.m_pMap->Unload();
+		return -1;
+	}
+
+	return ActivateMap(&m_MapPrepare);
+}
+
+void CServer::StopMapPrepare()
+{
+	if(!m_pMapPrepareThread && !m_MapPrepareDone)
+		return;
+
+	if(m_pMapPrepareThread)
+		thread_wait(m_pMapPrepareThread);
+	m_pMapPrepareThread = 0;
+	m_MapPrepareDone = false;
+
+	FreeMapData(m_MapPrepare.m_pData, m_MapPrepare.m_DataMapped);
+	m_MapPrepare.m_pData = 0;
+	m_MapPrepare.m_pMap->Unload();
+}
+
 void CServer::InitRegister(CNetServer *pNetServer, IEngineMasterServer *pMasterServer, IConsole *pConsole)
 {
 	m_Register.Init(pNetServer, pMasterServer, pConsole);
@@ -1610,6 +1902,9 @@ int CServer::Run()
 	//
 	m_PrintCBIndex = Console()->RegisterPrintCallback(g_Config.m_ConsoleOutputLevel, SendRconLineAuthed, this);
 
+	if(g_Config.m_SvJournalReplay[0])
+		return RunJournalReplay();
+
 	// load map
 	if(!LoadMap(g_Config.m_SvMap))
 	{
@@ -1646,6 +1941,13 @@ int CServer::Run()
 	str_format(aBuf, sizeof(aBuf), "server name is '%s'", g_Config.m_SvName);
 	Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
 
+	// the server never seeds rand(), a journal needs to know the seed to be replayable
+	if(g_Config.m_SvInputJournal[0])
+	{
+		m_JournalSeed = (unsigned)time_timestamp();
+		srand(m_JournalSeed);
+	}
+
 	GameServer()->OnInit();
 	str_format(aBuf, sizeof(aBuf), "version %s", GameServer()->NetVersion());
 	Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
@@ -1653,6 +1955,9 @@ int CServer::Run()
 	// process pending commands
 	m_pConsole->StoreCommands(false);
 
+	if(g_Config.m_SvInputJournal[0])
+		StartJournal();
+
 	if(m_GeneratedRconPassword)
 	{
 		dbg_msg("server", "+-------------------------+");
@@ -1684,14 +1989,29 @@ int CServer::Run()
 			int NewTicks = 0;
 
 			// load new map TODO: don't poll this
-			if(str_comp(g_Config.m_SvMap, m_aCurrentMap) != 0 || m_MapReload)
+			int MapLoaded = -1;
+			if(m_pMapPrepareThread || m_MapPrepareDone)
+				MapLoaded = FinishMapPrepare();
+			else if(str_comp(g_Config.m_SvMap, m_aCurrentMap) != 0 || m_MapReload)
 			{
 				m_MapReload = 0;
 
+				// the map loads on a thread while the game goes on, it is switched at a later tick
+				if(g_Config.m_SvMapLoadAsync)
+					StartMapPrepare(g_Config.m_SvMap);
+				else
+					MapLoaded = LoadMap(g_Config.m_SvMap);
+			}
+
+			if(MapLoaded != -1)
+			{
 				// load map
-				if(LoadMap(g_Config.m_SvMap))
+				if(MapLoaded)
 				{
 					// new map loaded
+					if(m_Journal.IsRecording())
+						dbg_msg("journal", "the map changed, '%s' ends here and the new map is not recorded", g_Config.m_SvInputJournal);
+					m_Journal.Stop();
 					GameServer()->OnShutdown();
 
 					for(int c = 0; c < MAX_CLIENTS; c++)
@@ -1724,6 +2044,9 @@ int CServer::Run()
 				m_CurrentGameTick++;
 				NewTicks++;
 
+				if(m_Journal.IsRecording())
+					m_Journal.AddTick(m_CurrentGameTick);
+
 				// apply new input
 				for(int c = 0; c < MAX_CLIENTS; c++)
 				{
@@ -1733,12 +2056,16 @@ int CServer::Run()
 					{
 						if(m_aClients[c].m_aInputs[i].m_GameTick == Tick())
 						{
+							if(m_Journal.IsRecording())
+								m_Journal.AddInput(JOURNALREC_PREDICTED_INPUT, c, m_aClients[c].m_aInputs[i].m_aData);
 							GameServer()->OnClientPredictedInput(c, m_aClients[c].m_aInputs[i].m_aData);
 							break;
 						}
 					}
 				}
 
+				if(m_Journal.IsRecording())
+					m_Journal.AddEvent(JOURNALREC_ONTICK, -1);
 				GameServer()->OnTick();
 			}
 
@@ -1746,7 +2073,11 @@ int CServer::Run()
 			if(NewTicks)
 			{
 				if(g_Config.m_SvHighBandwidth || (m_CurrentGameTick%2) == 0)
+				{
+					if(m_Journal.IsRecording())
+						m_Journal.AddEvent(JOURNALREC_SNAP, -1);
 					DoSnapshot();
+				}
 
 				UpdateClientRconCommands();
 			}
@@ -1806,11 +2137,271 @@ int CServer::Run()
 		m_Econ.Shutdown();
 	}
 
+	StopMapPrepare();
+	m_Journal.Stop();
 	GameServer()->OnShutdown();
+	FreeMapData(m_pCurrentMapData, m_CurrentMapMapped);
+	m_pCurrentMapData = 0;
 	m_pMap->Unload();
+	return 0;
+}
+
+static const int s_JournalInputInts = sizeof(CNetObj_PlayerInput)/sizeof(int);
 
-	if(m_pCurrentMapData)
-		mem_free(m_pCurrentMapData);
+static bool IsJournalSecret(const char *pName)
+{
+	static const char *s_apSecrets[] = {"password", "sv_rcon_password", "sv_rcon_mod_password", "sv_rcon_helper_password", "ec_password", "sv_reserved_slots_pass", "sv_sql_pw"};
+	for(unsigned i = 0; i < sizeof(s_apSecrets)/sizeof(s_apSecrets[0]); i++)
+		if(str_comp(pName, s_apSecrets[i]) == 0)
+			return true;
+	return false;
+}
+
+// sets a config variable of a journal, returns false for names this build doesn't have
+static bool ApplyJournalConfig(const char *pName, const char *pValue)
+{
+	#define MACRO_CONFIG_INT(Name,ScriptName,def,min,max,flags,desc) if(str_comp(pName, #ScriptName) == 0) { int Val = str_toint(pValue); if(min != max) { if(Val < min) Val = min; if(max != 0 && Val > max) Val = max; } g_Config.m_##Name = Val; return true; }
+	#define MACRO_CONFIG_STR(Name,ScriptName,len,def,flags,desc) if(str_comp(pName, #ScriptName) == 0) { str_copy(g_Config.m_##Name, pValue, len); return true; }
+
+	#include <engine/shared/config_variables.h>
+
+	#undef MACRO_CONFIG_INT
+	#undef MACRO_CONFIG_STR
+
+	return false;
+}
+
+void CServer::StartJournal()
+{
+	if(!m_Journal.Start(Storage(), g_Config.m_SvInputJournal, m_aCurrentMap, m_CurrentMapCrc, m_CurrentMapSize, m_JournalSeed, s_JournalInputInts, GameServer()->NetVersion()))
+		return;
+
+	// the config by name, without the secrets
+	char aValue[16];
+	#define MACRO_CONFIG_INT(Name,ScriptName,def,min,max,flags,desc) str_format(aValue, sizeof(aValue), "%d", g_Config.m_##Name); m_Journal.AddConfig(#ScriptName, aValue);
+	#define MACRO_CONFIG_STR(Name,ScriptName,len,def,flags,desc) if(!IsJournalSecret(#ScriptName)) m_Journal.AddConfig(#ScriptName, g_Config.m_##Name);
+
+	#include <engine/shared/config_variables.h>
+
+	#undef MACRO_CONFIG_INT
+	#undef MACRO_CONFIG_STR
+
+	int aParams[128];
+	for(int Zone = -1; ; Zone++)
+	{
+		int Num = GameServer()->GetTuningParams(Zone, aParams, 128);
+		if(!Num)
+			break;
+		m_Journal.AddTuning(Zone, aParams, Num);
+	}
+}
+
+int CServer::RunJournalReplay()
+{
+	char aJournal[128];
+	char aHashes[128];
+	str_copy(aJournal, g_Config.m_SvJournalReplay, sizeof(aJournal));
+	str_copy(aHashes, g_Config.m_SvJournalReplayHashes, sizeof(aHashes));
+
+	CJournalReader *pReader = new CJournalReader();
+	CJournalReader::CHeader Header;
+	if(!pReader->Open(Storage(), aJournal, &Header))
+	{
+		delete pReader;
+		return -1;
+	}
+	if(pReader->InputInts() != s_JournalInputInts)
+	{
+		dbg_msg("journal", "input size mismatch. journal=%d server=%d", pReader->InputInts(), s_JournalInputInts);
+		delete pReader;
+		return -1;
+	}
+	if(str_comp(Header.m_aNetVersion, GameServer()->NetVersion()) != 0)
+		dbg_msg("journal", "recorded with net version '%s', replaying with '%s'", Header.m_aNetVersion, GameServer()->NetVersion());
+
+	// the config follows the header, the secrets keep their local values
+	CUnpacker Unpacker;
+	int NumUnknown = 0;
+	int Type = pReader->NextRecord(&Unpacker);
+	while(Type == JOURNALREC_CONFIG)
+	{
+		const char *pName = Unpacker.GetString(CUnpacker::SANITIZE_CC);
+		const char *pValue = Unpacker.GetString(CUnpacker::SANITIZE_CC);
+		if(!Unpacker.Error() && !ApplyJournalConfig(pName, pValue))
+			NumUnknown++;
+		Type = pReader->NextRecord(&Unpacker);
+	}
+	if(NumUnknown)
+		dbg_msg("journal", "skipped %d config variables this build doesn't know", NumUnknown);
+	str_copy(g_Config.m_SvJournalReplay, aJournal, sizeof(g_Config.m_SvJournalReplay));
+	str_copy(g_Config.m_SvJournalReplayHashes, aHashes, sizeof(g_Config.m_SvJournalReplayHashes));
+	g_Config.m_SvInputJournal[0] = 0;
+#if defined(CONF_SQL)
+	g_Config.m_SvUseSQL = 0;
+#endif
+
+	m_Replaying = true;
+	str_copy(g_Config.m_SvMap, Header.m_aMapName, sizeof(g_Config.m_SvMap));
+	if(!LoadMap(Header.m_aMapName))
+	{
+		dbg_msg("journal", "failed to load map. mapname='%s'", Header.m_aMapName);
+		delete pReader;
+		return -1;
+	}
+	if(m_CurrentMapCrc != Header.m_MapCrc)
+	{
+		dbg_msg("journal", "map crc mismatch. journal=%08x map=%08x", Header.m_MapCrc, m_CurrentMapCrc);
+		delete pReader;
+		return -1;
+	}
+
+	srand(Header.m_Seed);
+	GameServer()->OnInit();
+	m_pConsole->StoreCommands(false);
+
+	while(Type == JOURNALREC_TUNING)
+	{
+		int aParams[128];
+		int Zone = Unpacker.GetInt();
+		int Num = Unpacker.GetInt();
+		if(Num < 0 || Num > 128)
+			break;
+		for(int i = 0; i < Num; i++)
+			aParams[i] = Unpacker.GetInt();
+		if(!Unpacker.Error())
+			GameServer()->SetTuningParams(Zone, aParams, Num);
+		Type = pReader->NextRecord(&Unpacker);
+	}
+
+	IOHANDLE HashFile = 0;
+	if(aHashes[0])
+		HashFile = Storage()->OpenFile(aHashes, IOFLAG_WRITE, IStorage::TYPE_SAVE);
+
+	dbg_msg("journal", "replaying '%s' on map '%s'", aJournal, Header.m_aMapName);
+
+	int aInput[MAX_INPUT_SIZE] = {0};
+	int64 InputTime = 0, TickTime = 0, SnapTime = 0, HashTime = 0;
+	int NumTicks = 0;
+	unsigned StateHash = 2166136261u;
+	int64 StartTime = time_get();
+
+	for(; Type >= 0 && Type != JOURNALREC_END; Type = pReader->NextRecord(&Unpacker))
+	{
+		int64 t = time_get();
+
+		if(Type == JOURNALREC_TICK)
+			m_CurrentGameTick = Unpacker.GetInt();
+		else if(Type == JOURNALREC_PREDICTED_INPUT || Type == JOURNALREC_DIRECT_INPUT)
+		{
+			int ClientID = pReader->ReadInput(&Unpacker, aInput);
+			if(ClientID >= 0 && m_aClients[ClientID].m_State == CClient::STATE_INGAME)
+			{
+				if(Type == JOURNALREC_PREDICTED_INPUT)
+					GameServer()->OnClientPredictedInput(ClientID, aInput);
+				else
+					GameServer()->OnClientDirectInput(ClientID, aInput);
+			}
+			InputTime += time_get()-t;
+		}
+		else if(Type == JOURNALREC_ONTICK)
+		{
+			GameServer()->OnTick();
+			int64 TickEnd = time_get();
+			TickTime += TickEnd-t;
+
+			unsigned Hash = GameServer()->StateHash();
+			StateHash = (StateHash ^ Hash) * 16777619u;
+			NumTicks++;
+			if(HashFile)
+			{
+				char aBuf[64];
+				str_format(aBuf, sizeof(aBuf), "%d %08x\n", m_CurrentGameTick, Hash);
+				io_write(HashFile, aBuf, str_length(aBuf));
+			}
+			HashTime += time_get()-TickEnd;
+		}
+		else if(Type == JOURNALREC_SNAP)
+		{
+			DoSnapshot();
+			SnapTime += time_get()-t;
+		}
+		else if(Type == JOURNALREC_CONNECTED || Type == JOURNALREC_ENTER || Type == JOURNALREC_DROP ||
+			Type == JOURNALREC_GAMEMSG || Type == JOURNALREC_RCON || Type == JOURNALREC_AUTH)
+		{
+			int ClientID = Unpacker.GetInt();
+			if(Unpacker.Error() || ClientID < 0 || ClientID >= MAX_CLIENTS)
+				continue;
+
+			if(Type == JOURNALREC_CONNECTED)
+			{
+				NewClientCallback(ClientID, this);
+				m_aClients[ClientID].m_State = CClient::STATE_READY;
+				GameServer()->OnClientConnected(ClientID);
+			}
+			else if(Type == JOURNALREC_ENTER)
+			{
+				m_aClients[ClientID].m_State = CClient::STATE_INGAME;
+				GameServer()->OnClientEnter(ClientID);
+			}
+			else if(Type == JOURNALREC_DROP)
+			{
+				const char *pReason = Unpacker.GetString();
+				DelClientCallback(ClientID, pReason, this);
+				pReader->ResetInput(ClientID);
+			}
+			else if(Type == JOURNALREC_GAMEMSG)
+			{
+				int Size = Unpacker.GetInt();
+				const unsigned char *pData = Unpacker.GetRaw(Size);
+				if(Unpacker.Error() || m_aClients[ClientID].m_State < CClient::STATE_READY)
+					continue;
+
+				CUnpacker MsgUnpacker;
+				MsgUnpacker.Reset(pData, Size);
+				int Msg = MsgUnpacker.GetInt() >> 1;
+				GameServer()->OnMessage(Msg, &MsgUnpacker, ClientID);
+			}
+			else if(Type == JOURNALREC_RCON)
+			{
+				int AuthLevel = Unpacker.GetInt();
+				const char *pCmd = Unpacker.GetString(CUnpacker::SANITIZE_CC);
+				if(Unpacker.Error())
+					continue;
+
+				m_RconClientID = ClientID;
+				m_RconAuthLevel = AuthLevel;
+				Console()->SetAccessLevel(AuthLevel == AUTHED_ADMIN ? IConsole::ACCESS_LEVEL_ADMIN : AuthLevel == AUTHED_MOD ? IConsole::ACCESS_LEVEL_MOD : AuthLevel == AUTHED_HELPER ? IConsole::ACCESS_LEVEL_HELPER : IConsole::ACCESS_LEVEL_USER);
+				Console()->ExecuteLineFlag(pCmd, CFGFLAG_SERVER, ClientID);
+				Console()->SetAccessLevel(IConsole::ACCESS_LEVEL_ADMIN);
+				m_RconClientID = IServer::RCON_CID_SERV;
+				m_RconAuthLevel = AUTHED_ADMIN;
+			}
+			else if(Type == JOURNALREC_AUTH)
+			{
+				int AuthLevel = Unpacker.GetInt();
+				m_aClients[ClientID].m_Authed = AuthLevel;
+				GameServer()->OnSetAuthed(ClientID, AuthLevel);
+			}
+			InputTime += time_get()-t;
+		}
+	}
+
+	int64 TotalTime = time_get()-StartTime;
+	if(HashFile)
+		io_close(HashFile);
+	delete pReader;
+
+	double Freq = (double)time_freq();
+	double Ticks = NumTicks > 0 ? NumTicks : 1;
+	dbg_msg("journal", "replayed %d ticks in %.3fs, %.1f ticks/s", NumTicks, TotalTime/Freq, NumTicks/(TotalTime > 0 ? TotalTime/Freq : 1.0));
+	dbg_msg("journal", "per tick: input %.3fms, tick %.3fms, snap %.3fms, hash %.3fms",
+		InputTime*1000.0/Freq/Ticks, TickTime*1000.0/Freq/Ticks, SnapTime*1000.0/Freq/Ticks, HashTime*1000.0/Freq/Ticks);
+	dbg_msg("journal", "state hash %08x", StateHash);
+
+	GameServer()->OnShutdown();
+	FreeMapData(m_pCurrentMapData, m_CurrentMapMapped);
+	m_pCurrentMapData = 0;
+	m_pMap->Unload();
 	return 0;
 }
 
@@ -1880,6 +2471,7 @@ void CServer::DemoRecorder_HandleAutoStart()
 		char aDate[20];
 		str_timestamp(aDate, sizeof(aDate));
 		str_format(aFilename, sizeof(aFilename), "demos/%s_%s.demo", "auto/autorecord", aDate);
+		m_aDemoRecorder[MAX_CLIENTS].SetAsync(g_Config.m_SvDemoAsync);
 		m_aDemoRecorder[MAX_CLIENTS].Start(Storage(), m_pConsole, aFilename, GameServer()->NetVersion(), m_aCurrentMap, m_CurrentMapCrc, "server");
 		if(g_Config.m_SvAutoDemoMax)
 		{
@@ -1916,6 +2508,7 @@ void CServer::StartRecord(int ClientID)
 	{
 		char aFilename[128];
 		str_format(aFilename, sizeof(aFilename), "demos/%s_%d_%d_tmp.demo", m_aCurrentMap, g_Config.m_SvPort, ClientID);
+		m_aDemoRecorder[ClientID].SetAsync(g_Config.m_SvDemoAsync);
 		m_aDemoRecorder[ClientID].Start(Storage(), Console(), aFilename, GameServer()->NetVersion(), m_aCurrentMap, m_CurrentMapCrc, "client", m_CurrentMapSize, m_pCurrentMapData);
 	}
 }
@@ -1950,6 +2543,7 @@ void CServer::ConRecord(IConsole::IResult *pResult, void *pUser)
 		str_timestamp(aDate, sizeof(aDate));
 		str_format(aFilename, sizeof(aFilename), "demos/demo_%s.demo", aDate);
 	}
+	pServer->m_aDemoRecorder[MAX_CLIENTS].SetAsync(g_Config.m_SvDemoAsync);
 	pServer->m_aDemoRecorder[MAX_CLIENTS].Start(pServer->Storage(), pServer->Console(), aFilename, pServer->GameServer()->NetVersion(), pServer->m_aCurrentMap, pServer->m_CurrentMapCrc, "server");
 }
 
@@ -1958,6 +2552,17 @@ void CServer::ConStopRecord(IConsole::IResult *pResult, void *pUser)
 	((CServer *)pUser)->m_aDemoRecorder[MAX_CLIENTS].Stop();
 }
 
+void CServer::ConDemoStats(IConsole::IResult *pResult, void *pUser)
+{
+	CServer *pSelf = (CServer *)pUser;
+	char aBuf[256];
+	str_format(aBuf, sizeof(aBuf), "recorders=%d snapshots=%d in the last second",
+		pSelf->m_NumDemoRecording, pSelf->m_DemoLastSnapshots);
+	pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "demo_recorder", aBuf);
+	str_format(aBuf, sizeof(aBuf), "recording time per tick %.3fms", (pSelf->m_DemoLastRecordTime*1000.0f/time_freq())/pSelf->m_DemoLastTicks);
+	pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "demo_recorder", aBuf);
+}
+
 void CServer::ConMapReload(IConsole::IResult *pResult, void *pUser)
 {
 	((CServer *)pUser)->m_MapReload = 1;
@@ -2110,6 +2715,7 @@ void CServer::RegisterCommands()
 
 	Console()->Register("record", "?s[file]", CFGFLAG_SERVER|CFGFLAG_STORE, ConRecord, this, "Record to a file");
 	Console()->Register("stoprecord", "", CFGFLAG_SERVER, ConStopRecord, this, "Stop recording");
+	Console()->Register("demo_stats", "", CFGFLAG_SERVER, ConDemoStats, this, "Show how many demo snapshots were recorded in the last second and the recording time per tick");
 
 	Console()->Register("reload", "", CFGFLAG_SERVER, ConMapReload, this, "Reload the map");
 
@@ -11,6 +11,7 @@
 #include <engine/shared/snapshot.h>
 #include <engine/shared/network.h>
 #include <engine/server/register.h>
+#include <engine/server/journal.h>
 #include <engine/shared/console.h>
 #include <base/math.h>
 #include <engine/shared/mapchecker.h>
@@ -88,6 +89,8 @@ public:
 		AUTHED_ADMIN,
 
 		MAX_RCONCMD_SEND=16,
+		// stop streaming commands while this many vital chunks wait for an ack
+		MAX_RCONCMD_UNACKED=128,
 	};
 
 	class CClient
@@ -165,6 +168,7 @@ public:
 	bool m_ReloadedWhenEmpty;
 	int m_RconClientID;
 	int m_RconAuthLevel;
+	int m_RconCmdStreamStart;
 	int m_PrintCBIndex;
 
 	int64 m_Lastheartbeat;
@@ -172,12 +176,26 @@ public:
 
 	char m_aCurrentMap[64];
 	unsigned m_CurrentMapCrc;
-	unsigned char *m_pCurrentMapData;
+	const unsigned char *m_pCurrentMapData;
 	unsigned int m_CurrentMapSize;
+	bool m_CurrentMapMapped; // m_pCurrentMapData points into the mapping of m_pMap
 
 	int m_GeneratedRconPassword;
 
 	CDemoRecorder m_aDemoRecorder[MAX_CLIENTS+1];
+
+	// recording cost over the last second, shown by demo_stats
+	int m_NumDemoRecording;
+	int m_DemoStatsTick;
+	int64 m_DemoRecordTime;
+	int m_DemoSnapshots;
+	int m_DemoLastTicks;
+	int64 m_DemoLastRecordTime;
+	int m_DemoLastSnapshots;
+
+	CJournalWriter m_Journal;
+	unsigned m_JournalSeed;
+	bool m_Replaying;
 	CRegister m_Register;
 	CMapChecker m_MapChecker;
 
@@ -188,6 +206,7 @@ public:
 	int m_ServerInfoNumRequests;
 
 	CServer();
+	~CServer();
 
 	int TrySetClientName(int ClientID, const char *pName);
 
@@ -220,8 +239,10 @@ public:
 	int MaxClients() const;
 
 	virtual int SendMsg(CMsgPacker *pMsg, int Flags, int ClientID);
+	virtual int SendMsgMask(CMsgPacker *pMsg, int Flags, const CClientMask &Recipients);
 	int SendMsgEx(CMsgPacker *pMsg, int Flags, int ClientID, bool System);
 
+	void RecordDemoSnapshot(int Recorder, const void *pData, int Size);
 	void DoSnapshot();
 
 	static int NewClientCallback(int ClientID, void *pUser);
@@ -236,8 +257,10 @@ public:
 	static void SendRconLineAuthed(const char *pLine, void *pUser, bool Highlighted = false);
 
 	void SendRconCmdAdd(const IConsole::CCommandInfo *pCommandInfo, int ClientID);
+	static void PackRconCmdAdd(CMsgPacker *pMsg, const IConsole::CCommandInfo *pCommandInfo);
 	void SendRconCmdRem(const IConsole::CCommandInfo *pCommandInfo, int ClientID);
 	void UpdateClientRconCommands();
+	void StreamClientRconCommands();
 
 	void ProcessClientPacket(CNetChunk *pPacket);
 
@@ -250,6 +273,40 @@ public:
 	char *GetMapName();
 	int LoadMap(const char *pMapName);
 
+	enum
+	{
+		MAPPREPARE_FAILED=0,
+		MAPPREPARE_INVALID,
+		MAPPREPARE_OK,
+	};
+
+	// everything about the next map that can be done without touching the running one
+	struct CMapPrepare
+	{
+		char m_aName[128];
+		char m_aPath[512];
+		IEngineMap *m_pMap;
+		unsigned m_Crc;
+		const unsigned char *m_pData;
+		unsigned m_DataSize;
+		bool m_DataMapped;
+		int m_Result;
+		int64 m_Time;
+	};
+
+	CMapPrepare m_MapPrepare;
+	void *m_pMapPrepareThread;
+	LOCK m_MapPrepareLock;
+	bool m_MapPrepareDone;
+
+	static void FreeMapData(const unsigned char *pData, bool Mapped);
+	void PrepareMap(CMapPrepare *pPrepare);
+	int ActivateMap(CMapPrepare *pPrepare);
+	static void MapPrepareThread(void *pUser);
+	void StartMapPrepare(const char *pMapName);
+	int FinishMapPrepare();
+	void StopMapPrepare();
+
 	void SaveDemo(int ClientID, float Time);
 	void StartRecord(int ClientID);
 	void StopRecord(int ClientID);
@@ -258,6 +315,9 @@ public:
 	void InitRegister(CNetServer *pNetServer, IEngineMasterServer *pMasterServer, IConsole *pConsole);
 	int Run();
 
+	void StartJournal();
+	int RunJournalReplay();
+
 	static void ConTestingCommands(IConsole::IResult *pResult, void *pUser);
 	static void ConRescue(IConsole::IResult *pResult, void *pUser);
 	static void ConKick(IConsole::IResult *pResult, void *pUser);
@@ -265,6 +325,7 @@ public:
 	static void ConShutdown(IConsole::IResult *pResult, void *pUser);
 	static void ConRecord(IConsole::IResult *pResult, void *pUser);
 	static void ConStopRecord(IConsole::IResult *pResult, void *pUser);
+	static void ConDemoStats(IConsole::IResult *pResult, void *pUser);
 	static void ConMapReload(IConsole::IResult *pResult, void *pUser);
 	static void ConLogout(IConsole::IResult *pResult, void *pUser);
 	static void ConchainSpecialInfoupdate(IConsole::IResult *pResult, void *pUserData, IConsole::FCommandCallback pfnCallback, void *pCallbackUserData);
@@ -136,6 +136,8 @@ MACRO_CONFIG_STR(Bindaddr, bindaddr, 128, "", CFGFLAG_CLIENT|CFGFLAG_SERVER|CFGF
 MACRO_CONFIG_INT(SvPort, sv_port, 8303, 0, 0, CFGFLAG_SERVER, "Port to use for the server (Only ports 8303-8310 work in LAN server browser)")
 MACRO_CONFIG_INT(SvExternalPort, sv_external_port, 0, 0, 0, CFGFLAG_SERVER, "External port to report to the master servers")
 MACRO_CONFIG_STR(SvMap, sv_map, 128, "Kobra 4", CFGFLAG_SERVER, "Map to use on the server")
+MACRO_CONFIG_INT(SvMapMmap, sv_map_mmap, 0, 0, 1, CFGFLAG_SERVER, "Memory map the map file and serve downloads from the mapping. Don't overwrite map files in place while they are in use")
+MACRO_CONFIG_INT(SvMapLoadAsync, sv_map_load_async, 0, 0, 1, CFGFLAG_SERVER, "Load the next map on a thread and switch to it once it is ready")
 MACRO_CONFIG_INT(SvMaxClients, sv_max_clients, MAX_CLIENTS, 1, MAX_CLIENTS, CFGFLAG_SERVER, "Maximum number of clients that are allowed on a server")
 MACRO_CONFIG_INT(SvMaxClientsPerIP, sv_max_clients_per_ip, 4, 1, MAX_CLIENTS, CFGFLAG_SERVER, "Maximum number of clients with the same IP that can connect to the server")
 MACRO_CONFIG_INT(SvHighBandwidth, sv_high_bandwidth, 0, 0, 1, CFGFLAG_SERVER, "Use high bandwidth mode. Doubles the bandwidth required for the server. LAN use only")
@@ -145,12 +147,15 @@ MACRO_CONFIG_STR(SvRconModPassword, sv_rcon_mod_password, 32, "", CFGFLAG_SERVER
 MACRO_CONFIG_STR(SvRconHelperPassword, sv_rcon_helper_password, 32, "", CFGFLAG_SERVER, "Remote console password for helpers (limited access)")
 MACRO_CONFIG_INT(SvRconMaxTries, sv_rcon_max_tries, 30, 0, 100, CFGFLAG_SERVER, "Maximum number of tries for remote console authentication")
 MACRO_CONFIG_INT(SvRconBantime, sv_rcon_bantime, 5, 0, 1440, CFGFLAG_SERVER, "The time a client gets banned if remote console authentication fails. 0 makes it just use kick")
+MACRO_CONFIG_INT(SvRconCmdStream, sv_rcon_cmd_stream, 1, 0, 1, CFGFLAG_SERVER, "Send the command list to every authed client each tick, as many commands as fit into a packet")
+MACRO_CONFIG_INT(SvRconCmdBudget, sv_rcon_cmd_budget, 8192, 1024, 65536, CFGFLAG_SERVER, "Bytes of command list streamed per tick to all authed clients together")
 MACRO_CONFIG_INT(SvAutoDemoRecord, sv_auto_demo_record, 0, 0, 1, CFGFLAG_SERVER, "Automatically record demos")
 MACRO_CONFIG_INT(SvAutoDemoMax, sv_auto_demo_max, 10, 0, 1000, CFGFLAG_SERVER, "Maximum number of automatically recorded demos (0 = no limit)")
 MACRO_CONFIG_INT(SvVanillaAntiSpoof, sv_vanilla_antispoof, 1, 0, 1, CFGFLAG_SERVER, "Enable vanilla Antispoof")
 
 MACRO_CONFIG_INT(SvPlayerDemoRecord, sv_player_demo_record, 0, 0, 1, CFGFLAG_SERVER, "Automatically record demos for each player")
 MACRO_CONFIG_INT(SvDemoChat, sv_demo_chat, 0, 0, 1, CFGFLAG_SERVER, "Record chat for demos")
+MACRO_CONFIG_INT(SvDemoAsync, sv_demo_async, 0, 0, 1, CFGFLAG_SERVER, "Compress and write demos on a separate thread (drops data until the next keyframe if the disk can't keep up)")
 MACRO_CONFIG_INT(SvServerInfoPerSecond, sv_server_info_per_second, 50, 1, 1000, CFGFLAG_SERVER, "Maximum number of complete server info responses that are sent out per second")
 MACRO_CONFIG_INT(SvVanConnPerSecond, sv_van_conn_per_second, 10, 1, 1000, CFGFLAG_SERVER, "Antispoof specific ratelimit")
 
@@ -215,6 +220,7 @@ MACRO_CONFIG_INT(SvShotgunBulletSound, sv_shotgun_bullet_sound, 0, 0, 1, CFGFLAG
 
 MACRO_CONFIG_INT(SvCheckpointSave, sv_checkpoint_save, 1, 0, 1, CFGFLAG_SERVER, "Whether to save checkpoint times to the score file")
 MACRO_CONFIG_STR(SvScoreFolder, sv_score_folder, 32, "records", CFGFLAG_SERVER, "Folder to save score files to")
+MACRO_CONFIG_INT(SvSaveGamesBinary, sv_savegames_binary, 0, 0, 1, CFGFLAG_SERVER, "Store new savegames in the compact binary format, only enable it once every server sharing the database can load it")
 
 #if defined(CONF_SQL)
 MACRO_CONFIG_INT(SvUseSQL, sv_use_sql, 0, 0, 1, CFGFLAG_SERVER, "Enables SQL DB instead of record file")
@@ -226,6 +232,11 @@ MACRO_CONFIG_INT(SvSqlCreateTables, sv_sql_create_tables, 1, 0, 1, CFGFLAG_SERVE
 MACRO_CONFIG_STR(SvSqlDatabase, sv_sql_database, 16, "teeworlds", CFGFLAG_SERVER, "SQL Database name")
 MACRO_CONFIG_STR(SvSqlServerName, sv_sql_servername, 5, "UNK", CFGFLAG_SERVER, "SQL Server name that is inserted into record table")
 MACRO_CONFIG_STR(SvSqlPrefix, sv_sql_prefix, 16, "record", CFGFLAG_SERVER, "SQL Database table prefix")
+MACRO_CONFIG_INT(SvSqlWorkers, sv_sql_workers, 2, 1, 8, CFGFLAG_SERVER, "Number of SQL worker threads, each with its own connection (takes effect on map change)")
+MACRO_CONFIG_INT(SvSqlBatchDelay, sv_sql_batch_delay, 250, 0, 5000, CFGFLAG_SERVER, "Milliseconds finishes are collected before they are inserted together")
+MACRO_CONFIG_INT(SvSqlTimeout, sv_sql_timeout, 10, 1, 300, CFGFLAG_SERVER, "Seconds a rank or top request may wait in the SQL queue, also the network timeout of the connections")
+MACRO_CONFIG_INT(SvSqlRankCache, sv_sql_rank_cache, 1, 0, 1, CFGFLAG_SERVER, "Load the ranks once per map and answer rank and top requests from memory")
+MACRO_CONFIG_INT(SvSqlRankCacheRefresh, sv_sql_rank_cache_refresh, 0, 0, 3600, CFGFLAG_SERVER, "Seconds between merging the times other servers added since the last load into the rank cache (0 = only load on map start)")
 MACRO_CONFIG_INT(SvSaveGames, sv_savegames, 1, 0, 1, CFGFLAG_SERVER, "Enables savegames (/save and /load)")
 MACRO_CONFIG_INT(SvSaveGamesDelay, sv_savegames_delay, 60, 0, 10000, CFGFLAG_SERVER, "Delay in seconds for loading a savegame")
 #endif
@@ -339,7 +350,12 @@ MACRO_CONFIG_INT(SvRankCheats, sv_rank_cheats, 0, 0, 1, CFGFLAG_SERVER, "Enable
 MACRO_CONFIG_INT(SvShutdownWhenEmpty, sv_shutdown_when_empty, 0, 0, 1, CFGFLAG_SERVER, "Shutdown server as soon as noone is on it anymore")
 MACRO_CONFIG_INT(SvReloadWhenEmpty, sv_reload_when_empty, 0, 0, 2, CFGFLAG_SERVER, "Reload map when server is empty (1 = reload once, 2 = reload everytime server gets empty)")
 MACRO_CONFIG_INT(SvKillProtection, sv_kill_protection, 20, 0, 9999, CFGFLAG_SERVER, "0 - Disable, 1-9999 minutes")
+MACRO_CONFIG_INT(SvTeamTickThreads, sv_team_tick_threads, 0, 0, 16, CFGFLAG_SERVER, "Worker threads that tick and move tees of teams that can't collide with each other in parallel (0 = tick all tees on the main thread)")
+MACRO_CONFIG_INT(DbgTeamTickVerify, dbg_team_tick_verify, 0, 0, 1, CFGFLAG_SERVER, "Tick and move the tees both serially and in team partitions and report when the core hashes differ")
 MACRO_CONFIG_INT(SvSoloServer, sv_solo_server, 0, 0, 1, CFGFLAG_SERVER|CFGFLAG_GAME, "Set server to solo mode (no player interactions, has to be set before loading the map)")
+MACRO_CONFIG_STR(SvInputJournal, sv_input_journal, 128, "", CFGFLAG_SERVER, "Record the applied inputs and client events to this file for headless replay")
+MACRO_CONFIG_STR(SvJournalReplay, sv_journal_replay, 128, "", CFGFLAG_SERVER, "Replay this input journal headless instead of running the server")
+MACRO_CONFIG_STR(SvJournalReplayHashes, sv_journal_replay_hashes, 128, "", CFGFLAG_SERVER, "Write the per tick state hash of a journal replay to this file")
 MACRO_CONFIG_STR(SvClientSuggestion, sv_client_suggestion, 128, "Get DDNet client from DDNet.tw to use all features on DDNet!", CFGFLAG_SERVER, "Broadcast to display to players without DDNet client")
 MACRO_CONFIG_STR(SvClientSuggestionOld, sv_client_suggestion_old, 128, "Your DDNet client is old, update it on DDNet.tw!", CFGFLAG_SERVER, "Broadcast to display to players with an old version of DDNet client")
 MACRO_CONFIG_STR(SvClientSuggestionBot, sv_client_suggestion_bot, 128, "Your client has bots and can be remote controlled!\nPlease use another client like DDNet client from DDNet.tw", CFGFLAG_SERVER, "Broadcast to display to players with a known botting client")
@@ -58,6 +58,8 @@ struct CDatafileInfo
 struct CDatafile
 {
 	IOHANDLE m_File;
+	unsigned char *m_pMapped;
+	unsigned m_MappedSize;
 	unsigned m_Crc;
 	CDatafileInfo m_Info;
 	CDatafileHeader m_Header;
@@ -66,20 +68,36 @@ struct CDatafile
 	char *m_pData;
 };
 
-bool CDataFileReader::Open(class IStorage *pStorage, const char *pFilename, int StorageType)
+static void CloseSource(IOHANDLE File, void *pMapped, unsigned MappedSize)
+{
+	if(File)
+		io_close(File);
+	io_unmap(pMapped, MappedSize);
+}
+
+bool CDataFileReader::Open(class IStorage *pStorage, const char *pFilename, int StorageType, bool Map)
 {
 	dbg_msg("datafile", "loading. filename='%s'", pFilename);
 
-	IOHANDLE File = pStorage->OpenFile(pFilename, IOFLAG_READ, StorageType);
-	if(!File)
+	// with a mapping everything is read from it and no file handle is kept
+	unsigned MappedSize = 0;
+	unsigned char *pMapped = Map ? (unsigned char *)pStorage->MapFile(pFilename, StorageType, &MappedSize) : 0;
+	IOHANDLE File = 0;
+	if(!pMapped)
 	{
-		dbg_msg("datafile", "could not open '%s'", pFilename);
-		return false;
+		File = pStorage->OpenFile(pFilename, IOFLAG_READ, StorageType);
+		if(!File)
+		{
+			dbg_msg("datafile", "could not open '%s'", pFilename);
+			return false;
+		}
 	}
 
-
 	// take the CRC of the file and store it
 	unsigned Crc = 0;
+	if(pMapped)
+		Crc = crc32(Crc, pMapped, MappedSize); // ignore_convention
+	else
 	{
 		enum
 		{
@@ -102,9 +120,21 @@ bool CDataFileReader::Open(class IStorage *pStorage, const char *pFilename, int
 
 	// TODO: change this header
 	CDatafileHeader Header;
-	if (sizeof(Header) != io_read(File, &Header, sizeof(Header)))
+	unsigned ReadPos = 0;
+	if(pMapped)
+	{
+		if(MappedSize >= sizeof(Header))
+		{
+			mem_copy(&Header, pMapped, sizeof(Header));
+			ReadPos = sizeof(Header);
+		}
+	}
+	else
+		ReadPos = io_read(File, &Header, sizeof(Header));
+	if(ReadPos != sizeof(Header))
 	{
 		dbg_msg("datafile", "couldn't load header");
+		CloseSource(File, pMapped, MappedSize);
 		return 0;
 	}
 	if(Header.m_aID[0] != 'A' || Header.m_aID[1] != 'T' || Header.m_aID[2] != 'A' || Header.m_aID[3] != 'D')
@@ -112,6 +142,7 @@ bool CDataFileReader::Open(class IStorage *pStorage, const char *pFilename, int
 		if(Header.m_aID[0] != 'D' || Header.m_aID[1] != 'A' || Header.m_aID[2] != 'T' || Header.m_aID[3] != 'A')
 		{
 			dbg_msg("datafile", "wrong signature. %x %x %x %x", Header.m_aID[0], Header.m_aID[1], Header.m_aID[2], Header.m_aID[3]);
+			CloseSource(File, pMapped, MappedSize);
 			return 0;
 		}
 	}
@@ -122,6 +153,7 @@ bool CDataFileReader::Open(class IStorage *pStorage, const char *pFilename, int
 	if(Header.m_Version != 3 && Header.m_Version != 4)
 	{
 		dbg_msg("datafile", "wrong version. version=%x", Header.m_Version);
+		CloseSource(File, pMapped, MappedSize);
 		return 0;
 	}
 
@@ -143,16 +175,27 @@ bool CDataFileReader::Open(class IStorage *pStorage, const char *pFilename, int
 	pTmpDataFile->m_ppDataPtrs = (char**)(pTmpDataFile+1);
 	pTmpDataFile->m_pData = (char *)(pTmpDataFile+1)+Header.m_NumRawData*sizeof(char *);
 	pTmpDataFile->m_File = File;
+	pTmpDataFile->m_pMapped = pMapped;
+	pTmpDataFile->m_MappedSize = MappedSize;
 	pTmpDataFile->m_Crc = Crc;
 
 	// clear the data pointers
 	mem_zero(pTmpDataFile->m_ppDataPtrs, Header.m_NumRawData*sizeof(void*));
 
-	// read types, offsets, sizes and item data
-	unsigned ReadSize = io_read(File, pTmpDataFile->m_pData, Size);
+	// read types, offsets, sizes and item data. they are copied out of a
+	// mapping as well, the map code patches items and the mapping is shared
+	// with the map download
+	unsigned ReadSize = 0;
+	if(pMapped)
+	{
+		ReadSize = min(Size, MappedSize-ReadPos);
+		mem_copy(pTmpDataFile->m_pData, pMapped+ReadPos, ReadSize);
+	}
+	else
+		ReadSize = io_read(File, pTmpDataFile->m_pData, Size);
 	if(ReadSize != Size)
 	{
-		io_close(pTmpDataFile->m_File);
+		CloseSource(File, pMapped, MappedSize);
 		mem_free(pTmpDataFile);
 		pTmpDataFile = 0;
 		dbg_msg("datafile", "couldn't load the whole thing, wanted=%d got=%d", Size, ReadSize);
@@ -294,10 +337,20 @@ void *CDataFileReader::GetDataImpl(int Index, int Swap)
 		int SwapSize = DataSize;
 #endif
 
+		unsigned Offset = m_pDataFile->m_DataStartOffset+m_pDataFile->m_Info.m_pDataOffsets[Index];
+		const unsigned char *pMapped = 0;
+		if(m_pDataFile->m_pMapped)
+		{
+			if(Offset > m_pDataFile->m_MappedSize)
+				Offset = m_pDataFile->m_MappedSize;
+			DataSize = min(DataSize, (int)(m_pDataFile->m_MappedSize-Offset));
+			pMapped = m_pDataFile->m_pMapped+Offset;
+		}
+
 		if(m_pDataFile->m_Header.m_Version == 4)
 		{
-			// v4 has compressed data
-			void *pTemp = (char *)mem_alloc(DataSize, 1);
+			// v4 has compressed data, a mapping is decompressed from directly
+			void *pTemp = 0;
 			unsigned long UncompressedSize = m_pDataFile->m_Info.m_pDataSizes[Index];
 			unsigned long s;
 
@@ -305,26 +358,36 @@ void *CDataFileReader::GetDataImpl(int Index, int Swap)
 			m_pDataFile->m_ppDataPtrs[Index] = (char *)mem_alloc(UncompressedSize, 1);
 
 			// read the compressed data
-			io_seek(m_pDataFile->m_File, m_pDataFile->m_DataStartOffset+m_pDataFile->m_Info.m_pDataOffsets[Index], IOSEEK_START);
-			io_read(m_pDataFile->m_File, pTemp, DataSize);
+			if(!pMapped)
+			{
+				pTemp = (char *)mem_alloc(DataSize, 1);
+				io_seek(m_pDataFile->m_File, Offset, IOSEEK_START);
+				io_read(m_pDataFile->m_File, pTemp, DataSize);
+			}
 
 			// decompress the data, TODO: check for errors
 			s = UncompressedSize;
-			uncompress((Bytef*)m_pDataFile->m_ppDataPtrs[Index], &s, (Bytef*)pTemp, DataSize); // ignore_convention
+			uncompress((Bytef*)m_pDataFile->m_ppDataPtrs[Index], &s, pMapped ? (const Bytef*)pMapped : (Bytef*)pTemp, DataSize); // ignore_convention
 #if defined(CONF_ARCH_ENDIAN_BIG)
 			SwapSize = s;
 #endif
 
 			// clean up the temporary buffers
-			mem_free(pTemp);
+			if(pTemp)
+				mem_free(pTemp);
 		}
 		else
 		{
 			// load the data
 			dbg_msg("datafile", "loading data index=%d size=%d", Index, DataSize);
 			m_pDataFile->m_ppDataPtrs[Index] = (char *)mem_alloc(DataSize, 1);
-			io_seek(m_pDataFile->m_File, m_pDataFile->m_DataStartOffset+m_pDataFile->m_Info.m_pDataOffsets[Index], IOSEEK_START);
-			io_read(m_pDataFile->m_File, m_pDataFile->m_ppDataPtrs[Index], DataSize);
+			if(pMapped)
+				mem_copy(m_pDataFile->m_ppDataPtrs[Index], pMapped, DataSize);
+			else
+			{
+				io_seek(m_pDataFile->m_File, Offset, IOSEEK_START);
+				io_read(m_pDataFile->m_File, m_pDataFile->m_ppDataPtrs[Index], DataSize);
+			}
 		}
 
 #if defined(CONF_ARCH_ENDIAN_BIG)
@@ -348,6 +411,28 @@ void *CDataFileReader::GetDataSwapped(int Index)
 	return GetDataImpl(Index, 1);
 }
 
+const void *CDataFileReader::GetRawData(int Index)
+{
+	if(!m_pDataFile || !m_pDataFile->m_pMapped || m_pDataFile->m_Header.m_Version != 4)
+		return 0;
+
+	unsigned Offset = m_pDataFile->m_DataStartOffset+m_pDataFile->m_Info.m_pDataOffsets[Index];
+	if(Offset+GetDataSize(Index) > m_pDataFile->m_MappedSize)
+		return 0;
+	return m_pDataFile->m_pMapped+Offset;
+}
+
+const unsigned char *CDataFileReader::MappedData(unsigned *pSize)
+{
+	if(!m_pDataFile || !m_pDataFile->m_pMapped)
+	{
+		*pSize = 0;
+		return 0;
+	}
+	*pSize = m_pDataFile->m_MappedSize;
+	return m_pDataFile->m_pMapped;
+}
+
 void CDataFileReader::UnloadData(int Index)
 {
 	if(Index < 0)
@@ -431,7 +516,7 @@ bool CDataFileReader::Close()
 	for(i = 0; i < m_pDataFile->m_Header.m_NumRawData; i++)
 		mem_free(m_pDataFile->m_ppDataPtrs[i]);
 
-	io_close(m_pDataFile->m_File);
+	CloseSource(m_pDataFile->m_File, m_pDataFile->m_pMapped, m_pDataFile->m_MappedSize);
 	mem_free(m_pDataFile);
 	m_pDataFile = 0;
 	return true;
@@ -542,6 +627,7 @@ int CDataFileWriter::AddData(int Size, void *pData)
 	pInfo->m_UncompressedSize = Size;
 	pInfo->m_CompressedSize = (int)s;
 	pInfo->m_pCompressedData = mem_alloc(pInfo->m_CompressedSize, 1);
+	pInfo->m_Owned = true;
 	mem_copy(pInfo->m_pCompressedData, pCompData, pInfo->m_CompressedSize);
 	mem_free(pCompData);
 
@@ -549,6 +635,20 @@ int CDataFileWriter::AddData(int Size, void *pData)
 	return m_NumDatas-1;
 }
 
+int CDataFileWriter::AddRawData(int UncompressedSize, int CompressedSize, const void *pData)
+{
+	dbg_assert(m_NumDatas < 1024, "too much data");
+
+	CDataInfo *pInfo = &m_pDatas[m_NumDatas];
+	pInfo->m_UncompressedSize = UncompressedSize;
+	pInfo->m_CompressedSize = CompressedSize;
+	pInfo->m_pCompressedData = (void *)pData;
+	pInfo->m_Owned = false;
+
+	m_NumDatas++;
+	return m_NumDatas-1;
+}
+
 int CDataFileWriter::AddDataSwapped(int Size, void *pData)
 {
 	dbg_assert(Size%sizeof(int) == 0, "incorrect boundary");
@@ -736,7 +836,8 @@ int CDataFileWriter::Finish()
 	for(int i = 0; i < m_NumItems; i++)
 		mem_free(m_pItems[i].m_pData);
 	for(int i = 0; i < m_NumDatas; ++i)
-		mem_free(m_pDatas[i].m_pCompressedData);
+		if(m_pDatas[i].m_Owned)
+			mem_free(m_pDatas[i].m_pCompressedData);
 
 	io_close(m_File);
 	m_File = 0;
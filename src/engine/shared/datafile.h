@@ -13,13 +13,19 @@ public:
 	~CDataFileReader() { Close(); }
 
 	bool IsOpen() const { return m_pDataFile != 0; }
+	void Swap(CDataFileReader *pOther) { struct CDatafile *pTemp = m_pDataFile; m_pDataFile = pOther->m_pDataFile; pOther->m_pDataFile = pTemp; }
 
-	bool Open(class IStorage *pStorage, const char *pFilename, int StorageType);
+	// Map reads the file through a memory mapping instead of the file handle, if the platform can
+	bool Open(class IStorage *pStorage, const char *pFilename, int StorageType, bool Map = false);
 	bool Close();
 
 	static bool GetCrcSize(class IStorage *pStorage, const char *pFilename, int StorageType, unsigned *pCrc, unsigned *pSize);
 
 	void *GetData(int Index);
+	// the compressed bytes of a version 4 data block in the mapping, 0 if the file isn't mapped
+	const void *GetRawData(int Index);
+	// the whole file, 0 if it isn't mapped
+	const unsigned char *MappedData(unsigned *pSize);
 	void *GetDataSwapped(int Index); // makes sure that the data is 32bit LE ints when saved
 	int GetDataSize(int Index);
 	int GetUncompressedDataSize(int Index);
@@ -43,6 +49,7 @@ class CDataFileWriter
 		int m_UncompressedSize;
 		int m_CompressedSize;
 		void *m_pCompressedData;
+		bool m_Owned;
 	};
 
 	struct CItemInfo
@@ -85,6 +92,8 @@ public:
 	bool Open(class IStorage *pStorage, const char *Filename);
 	int AddData(int Size, void *pData);
 	int AddDataSwapped(int Size, void *pData);
+	// adds already compressed data without copying it, it has to stay valid until Finish
+	int AddRawData(int UncompressedSize, int CompressedSize, const void *pData);
 	int AddItem(int Type, int ID, int Size, void *pData);
 	int Finish();
 };
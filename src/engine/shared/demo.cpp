@@ -2,6 +2,7 @@
 /* If you are missing that file, acquire a complete release at teeworlds.com.                */
 #include <base/math.h>
 #include <base/system.h>
+#include <base/tl/threading.h>
 
 #include <engine/console.h>
 #include <engine/storage.h>
@@ -21,6 +22,93 @@ static const unsigned char gs_VersionTickCompression = 5; // demo files with thi
 static const int gs_LengthOffset = 152;
 static const int gs_NumMarkersOffset = 176;
 
+// the keyframe index is the last chunk of a demo, it ends with its offset and this marker
+static const unsigned char gs_aKeyFrameIndexMarker[4] = {'T', 'W', 'K', 'I'};
+static const int gs_KeyFrameIndexVersion = 1;
+static const int gs_MaxKeyFrameIndex = 4000; // the packed ints have to fit into the chunk buffers of the player
+
+
+/*
+	Class: CDemoWriter
+		One thread for all asynchronously writing recorders. Recorders
+		hand their filled buffer over and keep recording into the other
+		one, the thread compresses the chunks and writes them to disk.
+*/
+class CDemoWriter
+{
+	lock m_Lock;
+	semaphore m_Pending;
+	CDemoRecorder *m_pFirstPending;
+	CDemoRecorder *m_pLastPending;
+	void *m_pThread;
+
+	static void WriterThread(void *pUser)
+	{
+		CDemoWriter *pSelf = (CDemoWriter *)pUser;
+		while(1)
+		{
+			pSelf->m_Pending.wait();
+
+			CDemoRecorder *pRecorder;
+			{
+				scope_lock Lock(&pSelf->m_Lock);
+				pRecorder = pSelf->m_pFirstPending;
+				if(!pRecorder)
+					continue;
+				pSelf->m_pFirstPending = pRecorder->m_pNextPending;
+				if(!pSelf->m_pFirstPending)
+					pSelf->m_pLastPending = 0;
+			}
+
+			// only this thread touches the back buffer and the file until it is released
+			pRecorder->WriteAsyncBuffer(&pRecorder->m_aAsyncBuffers[pRecorder->m_Back]);
+
+			scope_lock Lock(&pSelf->m_Lock);
+			pRecorder->m_BackPending = false;
+		}
+	}
+
+public:
+	CDemoWriter()
+	{
+		m_pFirstPending = 0;
+		m_pLastPending = 0;
+		m_pThread = 0;
+	}
+
+	// hands the front buffer over if the writer is done with the back buffer
+	void Submit(CDemoRecorder *pRecorder)
+	{
+		scope_lock Lock(&m_Lock);
+		if(pRecorder->m_BackPending)
+			return;
+
+		if(!m_pThread)
+		{
+			m_pThread = thread_init(WriterThread, this);
+			thread_detach(m_pThread);
+		}
+
+		pRecorder->m_Back = pRecorder->m_Front;
+		pRecorder->m_Front ^= 1;
+		pRecorder->m_BackPending = true;
+		pRecorder->m_pNextPending = 0;
+		if(m_pLastPending)
+			m_pLastPending->m_pNextPending = pRecorder;
+		else
+			m_pFirstPending = pRecorder;
+		m_pLastPending = pRecorder;
+		m_Pending.signal();
+	}
+
+	bool IsPending(CDemoRecorder *pRecorder)
+	{
+		scope_lock Lock(&m_Lock);
+		return pRecorder->m_BackPending;
+	}
+};
+
+static CDemoWriter gs_DemoWriter;
 
 CDemoRecorder::CDemoRecorder(class CSnapshotDelta *pSnapshotDelta, bool DelayedMapData)
 {
@@ -28,10 +116,14 @@ CDemoRecorder::CDemoRecorder(class CSnapshotDelta *pSnapshotDelta, bool DelayedM
 	m_LastTickMarker = -1;
 	m_pSnapshotDelta = pSnapshotDelta;
 	m_DelayedMapData = DelayedMapData;
+	m_Async = false;
+	m_UseAsync = false;
+	m_pKeyFrameIndex = 0;
+	m_KeyFrameIndexCapacity = 0;
 }
 
 // Record
-int CDemoRecorder::Start(class IStorage *pStorage, class IConsole *pConsole, const char *pFilename, const char *pNetVersion, const char *pMap, unsigned Crc, const char *pType, unsigned int MapSize, unsigned char *pMapData)
+int CDemoRecorder::Start(class IStorage *pStorage, class IConsole *pConsole, const char *pFilename, const char *pNetVersion, const char *pMap, unsigned Crc, const char *pType, unsigned int MapSize, const unsigned char *pMapData)
 {
 	m_MapSize = MapSize;
 	m_pMapData = pMapData;
@@ -128,6 +220,26 @@ int CDemoRecorder::Start(class IStorage *pStorage, class IConsole *pConsole, con
 	m_LastTickMarker = -1;
 	m_FirstTick = -1;
 	m_NumTimelineMarkers = 0;
+	m_Dropping = false;
+	m_NumKeyFrameIndex = 0;
+	m_IndexFirstTick = -1;
+	m_IndexLastTick = -1;
+
+	m_Async = m_UseAsync;
+	if(m_Async)
+	{
+		for(int i = 0; i < 2; i++)
+		{
+			m_aAsyncBuffers[i].m_pData = (unsigned char *)mem_alloc(ASYNC_BUFFER_SIZE, 1);
+			m_aAsyncBuffers[i].m_Size = 0;
+		}
+		m_Front = 0;
+		m_Back = 1;
+		m_BackPending = false;
+		m_pNextPending = 0;
+		m_DroppedChunks = 0;
+		m_DroppedBytes = 0;
+	}
 
 	char aBuf[256];
 	str_format(aBuf, sizeof(aBuf), "Recording to '%s'", pFilename);
@@ -160,6 +272,7 @@ enum
 	CHUNKMASK_TYPE = 0x60,
 	CHUNKMASK_SIZE = 0x1f,
 
+	CHUNKTYPE_KEYFRAMEINDEX = 0, // players that don't know it decompress and ignore it
 	CHUNKTYPE_SNAPSHOT = 1,
 	CHUNKTYPE_MESSAGE = 2,
 	CHUNKTYPE_DELTA = 3,
@@ -169,6 +282,16 @@ enum
 
 void CDemoRecorder::WriteTickMarker(int Tick, int Keyframe)
 {
+	if(m_Async)
+	{
+		// hand over what the last tick recorded
+		Submit();
+
+		// after dropping, start again at a keyframe once there is enough room
+		if(m_Dropping && Keyframe && m_aAsyncBuffers[m_Front].m_Size < ASYNC_BUFFER_SIZE/2)
+			m_Dropping = false;
+	}
+
 	if(m_LastTickMarker == -1 || Tick-m_LastTickMarker > CHUNKMASK_TICK || Keyframe)
 	{
 		unsigned char aChunk[5];
@@ -181,21 +304,165 @@ void CDemoRecorder::WriteTickMarker(int Tick, int Keyframe)
 		if(Keyframe)
 			aChunk[0] |= CHUNKTICKFLAG_KEYFRAME;
 
-		io_write(m_File, aChunk, sizeof(aChunk));
+		WriteRaw(aChunk, sizeof(aChunk));
 	}
 	else
 	{
 		unsigned char aChunk[1];
 		aChunk[0] = CHUNKTYPEFLAG_TICKMARKER | CHUNKTICKFLAG_TICK_COMPRESSED | (Tick-m_LastTickMarker);
-		io_write(m_File, aChunk, sizeof(aChunk));
+		WriteRaw(aChunk, sizeof(aChunk));
 	}
 
 	m_LastTickMarker = Tick;
 	if(m_FirstTick < 0)
 		m_FirstTick = Tick;
+
+	// nothing got written, the next marker has to carry the full tick
+	if(m_Dropping)
+		m_LastTickMarker = -1;
+}
+
+void CDemoRecorder::WriteRaw(const void *pData, int Size)
+{
+	if(m_Async)
+		Enqueue(ASYNC_RECORD_RAW, pData, Size);
+	else
+		WriteTickMarkerData((const unsigned char *)pData, Size);
+}
+
+void CDemoRecorder::WriteTickMarkerData(const unsigned char *pData, int Size)
+{
+	// follow the ticks as they are in the file, dropped markers never get here
+	if(pData[0]&CHUNKTICKFLAG_TICK_COMPRESSED)
+		m_IndexLastTick += pData[0]&CHUNKMASK_TICK;
+	else
+	{
+		m_IndexLastTick = (pData[1]<<24) | (pData[2]<<16) | (pData[3]<<8) | pData[4];
+		if(pData[0]&CHUNKTICKFLAG_KEYFRAME)
+		{
+			if(m_NumKeyFrameIndex == m_KeyFrameIndexCapacity)
+			{
+				int NewCapacity = max(m_KeyFrameIndexCapacity*2, 256);
+				CKeyFrameIndexEntry *pNew = (CKeyFrameIndexEntry *)mem_alloc(NewCapacity*sizeof(CKeyFrameIndexEntry), 1);
+				if(m_pKeyFrameIndex)
+				{
+					mem_copy(pNew, m_pKeyFrameIndex, m_NumKeyFrameIndex*sizeof(CKeyFrameIndexEntry));
+					mem_free(m_pKeyFrameIndex);
+				}
+				m_pKeyFrameIndex = pNew;
+				m_KeyFrameIndexCapacity = NewCapacity;
+			}
+			m_pKeyFrameIndex[m_NumKeyFrameIndex].m_Filepos = io_tell(m_File);
+			m_pKeyFrameIndex[m_NumKeyFrameIndex].m_Tick = m_IndexLastTick;
+			m_NumKeyFrameIndex++;
+		}
+	}
+	if(m_IndexFirstTick < 0)
+		m_IndexFirstTick = m_IndexLastTick;
+
+	io_write(m_File, pData, Size);
+}
+
+void CDemoRecorder::WriteKeyFrameIndex()
+{
+	// very long demos only index every n-th keyframe, seeking replays a bit more then
+	while(m_NumKeyFrameIndex > gs_MaxKeyFrameIndex)
+	{
+		for(int i = 0; i < m_NumKeyFrameIndex/2; i++)
+			m_pKeyFrameIndex[i] = m_pKeyFrameIndex[i*2];
+		m_NumKeyFrameIndex /= 2;
+	}
+
+	// version, first and last tick, then the keyframes as deltas
+	static int s_aIndex[4+gs_MaxKeyFrameIndex*2];
+	int NumInts = 0;
+	s_aIndex[NumInts++] = gs_KeyFrameIndexVersion;
+	s_aIndex[NumInts++] = m_IndexFirstTick;
+	s_aIndex[NumInts++] = m_IndexLastTick;
+	s_aIndex[NumInts++] = m_NumKeyFrameIndex;
+	for(int i = 0, LastPos = 0, LastTick = 0; i < m_NumKeyFrameIndex; i++)
+	{
+		s_aIndex[NumInts++] = m_pKeyFrameIndex[i].m_Filepos-LastPos;
+		s_aIndex[NumInts++] = m_pKeyFrameIndex[i].m_Tick-LastTick;
+		LastPos = m_pKeyFrameIndex[i].m_Filepos;
+		LastTick = m_pKeyFrameIndex[i].m_Tick;
+	}
+
+	int Offset = io_tell(m_File);
+	unsigned char aTrailer[8];
+	aTrailer[0] = (Offset>>24)&0xff;
+	aTrailer[1] = (Offset>>16)&0xff;
+	aTrailer[2] = (Offset>>8)&0xff;
+	aTrailer[3] = (Offset)&0xff;
+	mem_copy(aTrailer+4, gs_aKeyFrameIndexMarker, sizeof(gs_aKeyFrameIndexMarker));
+	WriteChunk(CHUNKTYPE_KEYFRAMEINDEX, s_aIndex, NumInts*sizeof(int), aTrailer, sizeof(aTrailer));
 }
 
 void CDemoRecorder::Write(int Type, const void *pData, int Size)
+{
+	if(m_Async)
+		Enqueue(Type, pData, Size);
+	else
+		WriteChunk(Type, pData, Size);
+}
+
+void CDemoRecorder::Enqueue(int Type, const void *pData, int Size)
+{
+	if(!m_File || Size > 64*1024)
+		return;
+
+	CAsyncBuffer *pBuffer = &m_aAsyncBuffers[m_Front];
+	int RecordSize = 2*sizeof(int) + ((Size+3)&~3);
+	if(!m_Dropping && pBuffer->m_Size+RecordSize > ASYNC_BUFFER_SIZE)
+	{
+		Submit();
+		pBuffer = &m_aAsyncBuffers[m_Front];
+		if(pBuffer->m_Size+RecordSize > ASYNC_BUFFER_SIZE)
+		{
+			// the disk can't keep up. drop everything until the next
+			// keyframe, the deltas in between would be useless anyway
+			m_Dropping = true;
+			m_LastTickMarker = -1;
+		}
+	}
+
+	if(m_Dropping)
+	{
+		m_DroppedChunks++;
+		m_DroppedBytes += Size;
+		return;
+	}
+
+	int *pHeader = (int *)(pBuffer->m_pData+pBuffer->m_Size);
+	pHeader[0] = Type;
+	pHeader[1] = Size;
+	mem_copy(pHeader+2, pData, Size);
+	pBuffer->m_Size += RecordSize;
+}
+
+void CDemoRecorder::Submit()
+{
+	if(m_aAsyncBuffers[m_Front].m_Size)
+		gs_DemoWriter.Submit(this);
+}
+
+void CDemoRecorder::WriteAsyncBuffer(CAsyncBuffer *pBuffer)
+{
+	for(int Pos = 0; Pos < pBuffer->m_Size; )
+	{
+		const int *pHeader = (const int *)(pBuffer->m_pData+Pos);
+		int Type = pHeader[0];
+		int Size = pHeader[1];
+		if(Type == ASYNC_RECORD_RAW)
+			WriteTickMarkerData((const unsigned char *)(pHeader+2), Size);
+		else
+			WriteChunk(Type, pHeader+2, Size);
+		Pos += 2*sizeof(int) + ((Size+3)&~3);
+	}
+	pBuffer->m_Size = 0;
+}
+
+void CDemoRecorder::WriteChunk(int Type, const void *pData, int Size, const void *pTrailer, int TrailerSize)
 {
 	char aBuffer[64*1024];
 	char aBuffer2[64*1024];
@@ -213,8 +480,16 @@ void CDemoRecorder::Write(int Type, const void *pData, int Size)
 	while(Size&3)
 		aBuffer2[Size++] = 0;
 	Size = CVariableInt::Compress(aBuffer2, Size, aBuffer); // buffer2 -> buffer
-	Size = CNetBase::Compress(aBuffer, Size, aBuffer2, sizeof(aBuffer2)); // buffer -> buffer2
+	Size = CNetBase::Compress(aBuffer, Size, aBuffer2, sizeof(aBuffer2)-TrailerSize); // buffer -> buffer2
+	if(Size < 0 || Size+TrailerSize > 0xffff)
+		return;
 
+	// the decompression stops at the end of the compressed data, the trailer is only seen by who looks for it
+	if(TrailerSize)
+	{
+		mem_copy(aBuffer2+Size, pTrailer, TrailerSize);
+		Size += TrailerSize;
+	}
 
 	aChunk[0] = ((Type&0x3)<<5);
 	if(Size < 30)
@@ -272,6 +547,10 @@ void CDemoRecorder::RecordSnapshot(int Tick, const void *pData, int Size)
 			mem_copy(m_aLastSnapshotData, pData, Size);
 		}
 	}
+
+	// nothing got written, try again with a keyframe on the next tick
+	if(m_Dropping)
+		m_LastKeyFrame = -1;
 }
 
 void CDemoRecorder::RecordMessage(const void *pData, int Size)
@@ -284,6 +563,34 @@ int CDemoRecorder::Stop(bool Finalize)
 	if(!m_File)
 		return -1;
 
+	if(m_Async)
+	{
+		// let the writer finish the back buffer, the rest is written here
+		while(gs_DemoWriter.IsPending(this))
+			thread_sleep(1);
+		WriteAsyncBuffer(&m_aAsyncBuffers[m_Front]);
+		for(int i = 0; i < 2; i++)
+		{
+			mem_free(m_aAsyncBuffers[i].m_pData);
+			m_aAsyncBuffers[i].m_pData = 0;
+		}
+		m_Async = false;
+
+		if(m_DroppedChunks)
+		{
+			char aBuf[256];
+			str_format(aBuf, sizeof(aBuf), "Dropped %d chunks (%d bytes), the disk couldn't keep up", m_DroppedChunks, m_DroppedBytes);
+			m_pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "demo_recorder", aBuf);
+		}
+	}
+
+	if(m_NumKeyFrameIndex)
+		WriteKeyFrameIndex();
+	mem_free(m_pKeyFrameIndex);
+	m_pKeyFrameIndex = 0;
+	m_KeyFrameIndexCapacity = 0;
+	m_NumKeyFrameIndex = 0;
+
 	// add the demo length to the header
 	io_seek(m_File, gs_LengthOffset, IOSEEK_START);
 	int DemoLength = Length();
@@ -482,6 +789,65 @@ void CDemoPlayer::ScanFile()
 	io_seek(m_File, StartPos, IOSEEK_START);
 }
 
+bool CDemoPlayer::ReadKeyFrameIndex()
+{
+	static char aCompressed[CSnapshot::MAX_SIZE];
+	static char aDecompressed[CSnapshot::MAX_SIZE];
+	static int s_aIndex[CSnapshot::MAX_SIZE/sizeof(int)];
+
+	long StartPos = io_tell(m_File);
+	long Length = io_length(m_File);
+	bool Found = false;
+
+	// the file ends with the offset of the index chunk and the marker
+	unsigned char aTrailer[8];
+	if(Length-StartPos > (long)sizeof(aTrailer) && io_seek(m_File, Length-sizeof(aTrailer), IOSEEK_START) == 0 &&
+		io_read(m_File, aTrailer, sizeof(aTrailer)) == sizeof(aTrailer) &&
+		mem_comp(aTrailer+4, gs_aKeyFrameIndexMarker, sizeof(gs_aKeyFrameIndexMarker)) == 0)
+	{
+		long Offset = (aTrailer[0]<<24) | (aTrailer[1]<<16) | (aTrailer[2]<<8) | aTrailer[3];
+		int ChunkType, ChunkSize, ChunkTick = 0;
+		if(Offset >= StartPos && Offset < Length && io_seek(m_File, Offset, IOSEEK_START) == 0 &&
+			ReadChunkHeader(&ChunkType, &ChunkSize, &ChunkTick) == 0 && ChunkType == CHUNKTYPE_KEYFRAMEINDEX &&
+			io_tell(m_File)+ChunkSize == Length && io_read(m_File, aCompressed, ChunkSize) == (unsigned)ChunkSize)
+		{
+			int Size = CNetBase::Decompress(aCompressed, ChunkSize-sizeof(aTrailer), aDecompressed, sizeof(aDecompressed));
+			if(Size >= 0)
+				Size = CVariableInt::Decompress(aDecompressed, Size, s_aIndex);
+			int NumInts = Size/(int)sizeof(int);
+			if(Size >= 0 && NumInts >= 4 && s_aIndex[0] == gs_KeyFrameIndexVersion && s_aIndex[3] >= 0 && NumInts >= 4+s_aIndex[3]*2)
+			{
+				int Num = s_aIndex[3];
+				CKeyFrame *pKeyFrames = (CKeyFrame*)mem_alloc(max(Num, 1)*sizeof(CKeyFrame), 1);
+				long Pos = 0;
+				int Tick = 0;
+				Found = true;
+				for(int i = 0; i < Num && Found; i++)
+				{
+					Pos += s_aIndex[4+i*2];
+					Tick += s_aIndex[4+i*2+1];
+					pKeyFrames[i].m_Filepos = Pos;
+					pKeyFrames[i].m_Tick = Tick;
+					Found = Pos >= StartPos && Pos < Offset;
+				}
+
+				if(Found)
+				{
+					m_pKeyFrames = pKeyFrames;
+					m_Info.m_SeekablePoints = Num;
+					m_Info.m_Info.m_FirstTick = s_aIndex[1];
+					m_Info.m_Info.m_LastTick = s_aIndex[2];
+				}
+				else
+					mem_free(pKeyFrames);
+			}
+		}
+	}
+
+	io_seek(m_File, StartPos, IOSEEK_START);
+	return Found;
+}
+
 void CDemoPlayer::DoTick()
 {
 	static char aCompresseddata[CSnapshot::MAX_SIZE];
@@ -723,8 +1089,9 @@ int CDemoPlayer::Load(class IStorage *pStorage, class IConsole *pConsole, const
 		}
 	}
 
-	// scan the file for interessting points
-	ScanFile();
+	// use the keyframe index of the recorder or scan the file for interessting points
+	if(!ReadKeyFrameIndex())
+		ScanFile();
 
 	// reset slice markers
 	g_Config.m_ClDemoSliceBegin = -1;
@@ -10,27 +10,76 @@
 
 class CDemoRecorder : public IDemoRecorder
 {
+	friend class CDemoWriter;
+
+	enum
+	{
+		// each recorder has two of these while writing asynchronously
+		ASYNC_BUFFER_SIZE=128*1024,
+		ASYNC_RECORD_RAW=-1,
+	};
+
+	// raw chunks waiting for compression, records of type, size and the data padded to 4 bytes
+	struct CAsyncBuffer
+	{
+		unsigned char *m_pData;
+		int m_Size;
+	};
+
 	class IConsole *m_pConsole;
 	IOHANDLE m_File;
 	int m_LastTickMarker;
 	int m_LastKeyFrame;
 	int m_FirstTick;
 	unsigned char m_aLastSnapshotData[CSnapshot::MAX_SIZE];
+
+	// the keyframes as they ended up in the file, appended as index chunk on Stop
+	struct CKeyFrameIndexEntry
+	{
+		int m_Filepos;
+		int m_Tick;
+	};
+	CKeyFrameIndexEntry *m_pKeyFrameIndex;
+	int m_NumKeyFrameIndex;
+	int m_KeyFrameIndexCapacity;
+	int m_IndexFirstTick;
+	int m_IndexLastTick;
 	class CSnapshotDelta *m_pSnapshotDelta;
 	int m_NumTimelineMarkers;
 	int m_aTimelineMarkers[MAX_TIMELINE_MARKERS];
 	bool m_DelayedMapData;
 	unsigned int m_MapSize;
-	unsigned char *m_pMapData;
+	const unsigned char *m_pMapData;
+
+	bool m_Async;
+	bool m_UseAsync;
+	CAsyncBuffer m_aAsyncBuffers[2];
+	int m_Front;
+	int m_Back;
+	bool m_BackPending; // the writer thread owns the back buffer, protected by its lock
+	CDemoRecorder *m_pNextPending;
+	bool m_Dropping;
+	int m_DroppedChunks;
+	int m_DroppedBytes;
 
 	void WriteTickMarker(int Tick, int Keyframe);
+	void WriteRaw(const void *pData, int Size);
 	void Write(int Type, const void *pData, int Size);
+	void WriteChunk(int Type, const void *pData, int Size, const void *pTrailer = 0, int TrailerSize = 0);
+	void WriteTickMarkerData(const unsigned char *pData, int Size);
+	void WriteKeyFrameIndex();
+
+	void Enqueue(int Type, const void *pData, int Size);
+	void Submit();
+	void WriteAsyncBuffer(CAsyncBuffer *pBuffer);
 public:
 	CDemoRecorder(class CSnapshotDelta *pSnapshotDelta, bool DelayedMapData = false);
-	CDemoRecorder() {}
+	CDemoRecorder() : m_File(0), m_pKeyFrameIndex(0), m_KeyFrameIndexCapacity(0), m_Async(false), m_UseAsync(false) {}
 
-	int Start(class IStorage *pStorage, class IConsole *pConsole, const char *pFilename, const char *pNetversion, const char *pMap, unsigned MapCrc, const char *pType, unsigned int MapSize = 0, unsigned char *pMapData = 0);
+	int Start(class IStorage *pStorage, class IConsole *pConsole, const char *pFilename, const char *pNetversion, const char *pMap, unsigned MapCrc, const char *pType, unsigned int MapSize = 0, const unsigned char *pMapData = 0);
 	int Stop(bool Finalize = false);
+	// compress and write on a background thread from the next Start on
+	void SetAsync(bool Async) { m_UseAsync = Async; }
 	void AddDemoMarker();
 
 	void RecordSnapshot(int Tick, const void *pData, int Size);
@@ -110,6 +159,7 @@ private:
 	int ReadChunkHeader(int *pType, int *pSize, int *pTick);
 	void DoTick();
 	void ScanFile();
+	bool ReadKeyFrameIndex();
 	int NextFrame();
 
 public:
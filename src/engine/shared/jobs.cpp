@@ -19,6 +19,9 @@ void CJobPool::WorkerThread(void *pUser)
 	{
 		CJob *pJob = 0;
 
+		// sleep until a job is added
+		pPool->m_Pending.wait();
+
 		// fetch job from queue
 		lock_wait(pPool->m_Lock);
 		if(pPool->m_pFirstJob)
@@ -39,8 +42,6 @@ void CJobPool::WorkerThread(void *pUser)
 			pJob->m_Result = pJob->m_pfnFunc(pJob->m_pFuncData);
 			pJob->m_Status = CJob::STATE_DONE;
 		}
-		else
-			thread_sleep(10);
 	}
 
 }
@@ -70,5 +71,8 @@ int CJobPool::Add(CJob *pJob, JOBFUNC pfnFunc, void *pData)
 		m_pFirstJob = pJob;
 
 	lock_unlock(m_Lock);
+
+	// wake one worker
+	m_Pending.signal();
 	return 0;
 }
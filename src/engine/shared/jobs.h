@@ -2,6 +2,8 @@
 /* If you are missing that file, acquire a complete release at teeworlds.com.                */
 #ifndef ENGINE_SHARED_JOBS_H
 #define ENGINE_SHARED_JOBS_H
+#include <base/tl/threading.h>
+
 typedef int (*JOBFUNC)(void *pData);
 
 class CJobPool;
@@ -41,6 +43,7 @@ class CJobPool
 	LOCK m_Lock;
 	CJob *m_pFirstJob;
 	CJob *m_pLastJob;
+	semaphore m_Pending; // one count per queued job, idle workers sleep on it
 
 	static void WorkerThread(void *pUser);
 
@@ -28,10 +28,21 @@ public:
 
 	virtual bool Load(const char *pMapName)
 	{
-		IStorage *pStorage = Kernel()->RequestInterface<IStorage>();
+		return Load(Kernel()->RequestInterface<IStorage>(), pMapName, false);
+	}
+
+	virtual bool Load(IStorage *pStorage, const char *pMapName, bool Mapped)
+	{
 		if(!pStorage)
 			return false;
-		return m_DataFile.Open(pStorage, pMapName, IStorage::TYPE_ALL);
+		return m_DataFile.Open(pStorage, pMapName, IStorage::TYPE_ALL, Mapped);
+	}
+
+	virtual const unsigned char *MappedData(unsigned *pSize) { return m_DataFile.MappedData(pSize); }
+
+	virtual void Swap(IEngineMap *pOther)
+	{
+		m_DataFile.Swap(&static_cast<CMap *>(pOther)->m_DataFile);
 	}
 
 	virtual bool IsLoaded()
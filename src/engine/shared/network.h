@@ -218,6 +218,8 @@ public:
 
 	int AckSequence() const { return m_Ack; }
 	int SeqSequence() const { return m_Sequence; }
+	// vital chunks sent but not acked yet, they still occupy the resend buffer
+	int UnackedChunks() const { return (m_Sequence-m_PeerAck)&NET_SEQUENCE_MASK; }
 	int SecurityToken() const { return m_SecurityToken; }
 	void SetTimedOut(const NETADDR *pAddr, int Sequence, int Ack, SECURITY_TOKEN SecurityToken);
 
@@ -338,6 +340,7 @@ public:
 	// status requests
 	const NETADDR *ClientAddr(int ClientID) const { return m_aSlots[ClientID].m_Connection.PeerAddress(); }
 	bool HasSecurityToken(int ClientID) const { return m_aSlots[ClientID].m_Connection.SecurityToken() != NET_SECURITY_TOKEN_UNSUPPORTED; }
+	int UnackedChunks(int ClientID) const { return m_aSlots[ClientID].m_Connection.UnackedChunks(); }
 	NETSOCKET Socket() const { return m_Socket; }
 	class CNetBan *NetBan() const { return m_pNetBan; }
 	int NetType() const { return m_Socket.type; }
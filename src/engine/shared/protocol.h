@@ -92,7 +92,8 @@ enum
 	MSGFLAG_FLUSH=2,
 	MSGFLAG_NORECORD=4,
 	MSGFLAG_RECORD=8,
-	MSGFLAG_NOSEND=16
+	MSGFLAG_NOSEND=16,
+	MSGFLAG_NOSERVERRECORD=32, // only the demos of the recipients get it
 };
 
 enum
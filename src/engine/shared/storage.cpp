@@ -244,6 +244,17 @@ public:
 		return 0;
 	}
 
+	virtual void *MapFile(const char *pFilename, int Type, unsigned *pSize)
+	{
+		*pSize = 0;
+		IOHANDLE File = OpenFile(pFilename, IOFLAG_READ, Type);
+		if(!File)
+			return 0;
+		void *pData = io_map(File, pSize);
+		io_close(File);
+		return pData;
+	}
+
 	struct CFindCBData
 	{
 		CStorage *pStorage;
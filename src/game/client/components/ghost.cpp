@@ -66,11 +66,12 @@ void CGhost::OnRender()
 	// Check if the race line is crossed then start the render of the ghost if one
 	bool start = false;
 
-	std::list < int > Indices = m_pClient->Collision()->GetMapIndices(m_pClient->m_PredictedPrevChar.m_Pos, m_pClient->m_LocalCharacterPos);
-	if(!Indices.empty())
+	CTilePath Indices(m_pClient->Collision(), m_pClient->m_PredictedPrevChar.m_Pos, m_pClient->m_LocalCharacterPos);
+	int Index = Indices.Next();
+	if(Index != -1)
 	{
-		for(std::list < int >::iterator i = Indices.begin(); i != Indices.end(); i++)
-			if(m_pClient->Collision()->GetTileIndex(*i) == TILE_BEGIN) start = true;
+		for(; Index != -1; Index = Indices.Next())
+			if(m_pClient->Collision()->GetTileIndex(Index) == TILE_BEGIN) start = true;
 	}
 	else
 	{
@@ -48,12 +48,13 @@ void CRaceDemo::OnRender()
 	if(m_DemoStartTick < Client()->GameTick())
 	{
 		bool start = false;
-		std::list < int > Indices = m_pClient->Collision()->GetMapIndices(m_pClient->m_PredictedPrevChar.m_Pos, m_pClient->m_LocalCharacterPos);
-		if(!Indices.empty())
-			for(std::list < int >::iterator i = Indices.begin(); i != Indices.end(); i++)
+		CTilePath Indices(m_pClient->Collision(), m_pClient->m_PredictedPrevChar.m_Pos, m_pClient->m_LocalCharacterPos);
+		int Index = Indices.Next();
+		if(Index != -1)
+			for(; Index != -1; Index = Indices.Next())
 			{
-				if(m_pClient->Collision()->GetTileIndex(*i) == TILE_BEGIN) start = true;
-				if(m_pClient->Collision()->GetFTileIndex(*i) == TILE_BEGIN) start = true;
+				if(m_pClient->Collision()->GetTileIndex(Index) == TILE_BEGIN) start = true;
+				if(m_pClient->Collision()->GetFTileIndex(Index) == TILE_BEGIN) start = true;
 			}
 		else
 		{
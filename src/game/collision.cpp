@@ -28,6 +28,7 @@ CCollision::CCollision()
 	m_pDoor = 0;
 	m_pSwitchers = 0;
 	m_pTune = 0;
+	m_pPacked = 0;
 }
 
 void CCollision::Init(class CLayers *pLayers)
@@ -161,6 +162,13 @@ void CCollision::Init(class CLayers *pLayers)
 				m_pTiles[i].m_Index = Index;
 		}
 	}
+	m_pPacked = new CPackedTile[m_Width*m_Height];
+	mem_zero(m_pPacked, m_Width * m_Height * sizeof(CPackedTile));
+	for(int i = 0; i < m_Width*m_Height; i++)
+		PackTile(i);
+	for(int i = 0; i < m_Width*m_Height; i++)
+		UpdateTileExists(i);
+
 	if(m_NumSwitchers)
 	{
 		m_pSwitchers = new SSwitchers[m_NumSwitchers+1];
@@ -185,50 +193,153 @@ int CCollision::GetTile(int x, int y)
 
 	int Nx = clamp(x/32, 0, m_Width-1);
 	int Ny = clamp(y/32, 0, m_Height-1);
-	int pos = Ny * m_Width + Nx;
+	return GetCollisionAtIndex(Ny * m_Width + Nx);
+}
+
+int CCollision::GetCollisionAtIndex(int Index)
+{
+	if(!m_pTiles)
+		return 0;
 
-	if(m_pTiles[pos].m_Index == COLFLAG_SOLID
-		|| m_pTiles[pos].m_Index == (COLFLAG_SOLID|COLFLAG_NOHOOK)
-		|| m_pTiles[pos].m_Index == COLFLAG_DEATH
-		|| m_pTiles[pos].m_Index == TILE_NOLASER)
-		return m_pTiles[pos].m_Index;
+	int TileIndex = m_pPacked[Index].m_Index;
+	if(TileIndex == COLFLAG_SOLID
+		|| TileIndex == (COLFLAG_SOLID|COLFLAG_NOHOOK)
+		|| TileIndex == COLFLAG_DEATH
+		|| TileIndex == TILE_NOLASER)
+		return TileIndex;
 	return 0;
 }
+
+void CCollision::PackTile(int Index)
+{
+	CPackedTile *pPacked = &m_pPacked[Index];
+	pPacked->m_Index = m_pTiles[Index].m_Index;
+	pPacked->m_Flags = m_pTiles[Index].m_Flags;
+	pPacked->m_FIndex = m_pFront ? m_pFront[Index].m_Index : 0;
+	pPacked->m_FFlags = m_pFront ? m_pFront[Index].m_Flags : 0;
+	pPacked->m_Special &= SPECIAL_EXISTS;
+	if(m_pTele && m_pTele[Index].m_Type)
+		pPacked->m_Special |= SPECIAL_TELE;
+	if(m_pSpeedup && m_pSpeedup[Index].m_Force > 0)
+		pPacked->m_Special |= SPECIAL_SPEEDUP;
+	if(m_pSwitch && m_pSwitch[Index].m_Type > 0)
+		pPacked->m_Special |= SPECIAL_SWITCH;
+	if(m_pTune && m_pTune[Index].m_Type)
+		pPacked->m_Special |= SPECIAL_TUNE;
+	if(m_pDoor && m_pDoor[Index].m_Index)
+		pPacked->m_Special |= SPECIAL_DOOR;
+}
+
+void CCollision::UpdatePackedTile(int Index)
+{
+	PackTile(Index);
+
+	// TileExists also looks at the direct neighbours
+	UpdateTileExists(Index);
+	if(Index - 1 >= 0)
+		UpdateTileExists(Index - 1);
+	if(Index + 1 < m_Width * m_Height)
+		UpdateTileExists(Index + 1);
+	if(Index - m_Width >= 0)
+		UpdateTileExists(Index - m_Width);
+	if(Index + m_Width < m_Width * m_Height)
+		UpdateTileExists(Index + m_Width);
+}
+
+void CCollision::UpdateTileExists(int Index)
+{
+	if(CheckTileExists(Index))
+		m_pPacked[Index].m_Special |= SPECIAL_EXISTS;
+	else
+		m_pPacked[Index].m_Special &= ~SPECIAL_EXISTS;
+}
 /*
 bool CCollision::IsTileSolid(int x, int y)
 {
 	return GetTile(x, y)&COLFLAG_SOLID;
 }
 */
-// TODO: rewrite this smarter!
+
+CLineSampler::CLineSampler(vec2 Pos0, vec2 Pos1, float Div, int Num, int Width, int Height, bool Round)
+{
+	m_Pos0 = Pos0;
+	m_Pos1 = Pos1;
+	m_Delta = Pos1 - Pos0;
+	m_Div = Div;
+	m_Num = Num;
+	m_Width = Width;
+	m_Height = Height;
+	m_Round = Round;
+}
+
+int CLineSampler::NextBorder(float Pos0, float Delta, int Tile, int Size) const
+{
+	// first sample where the coordinate leaves the tile, only an estimate
+	float Border;
+	if(Delta > 0.0f && Tile < Size-1)
+		Border = (Tile+1)*32 - 0.5f;
+	else if(Delta < 0.0f && Tile > 0)
+		Border = Tile*32 - 0.5f;
+	else
+		return m_Num;
+	float Sample = (Border - Pos0) / Delta * m_Div;
+	if(!(Sample < (float)m_Num))
+		return m_Num;
+	return max((int)Sample, 0);
+}
+
+int CLineSampler::NextTile(int i) const
+{
+	vec2 P = Pos(i);
+	int Current = TileY(P)*m_Width+TileX(P);
+	int Next = min(NextBorder(m_Pos0.x, m_Delta.x, TileX(P), m_Width), NextBorder(m_Pos0.y, m_Delta.y, TileY(P), m_Height));
+
+	// fix up the estimate, the samples of a tile are always contiguous
+	Next = clamp(Next, i+1, m_Num);
+	while(Next > i+1 && Tile(Next-1) != Current)
+		Next--;
+	while(Next < m_Num && Tile(Next) == Current)
+		Next++;
+	return Next;
+}
+
 int CCollision::IntersectLine(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision, vec2 *pOutBeforeCollision, bool AllowThrough)
 {
 	float Distance = distance(Pos0, Pos1);
 	int End(Distance+1);
-	vec2 Last = Pos0;
 	int ix = 0, iy = 0; // Temporary position for checking collision
 	int dx = 0, dy = 0; // Offset for checking the "through" tile
 	if (AllowThrough)
 		{
 			ThroughOffset(Pos0, Pos1, &dx, &dy);
 		}
-	for(int i = 0; i <= End; i++)
+	CLineSampler Samples(Pos0, Pos1, (float)End, End+1, m_Width, m_Height);
+	for(int i = 0; i < Samples.Num(); )
 	{
-		float a = i/(float)End;
-		vec2 Pos = mix(Pos0, Pos1, a);
-		ix = round_to_int(Pos.x);
-		iy = round_to_int(Pos.y);
-
-		if((CheckPoint(ix, iy) && !(AllowThrough && IsThrough(ix + dx, iy + dy))))
+		int Index = Samples.Tile(i);
+		if(!(GetCollisionAtIndex(Index)&COLFLAG_SOLID))
 		{
-			if(pOutCollision)
-				*pOutCollision = Pos;
-			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
-			return GetCollisionAt(ix, iy);
+			i = Samples.NextTile(i);
+			continue;
 		}
 
-		Last = Pos;
+		for(; i < Samples.Num(); i++)
+		{
+			vec2 Pos = Samples.Pos(i);
+			ix = round_to_int(Pos.x);
+			iy = round_to_int(Pos.y);
+			if(Samples.TileY(Pos)*m_Width+Samples.TileX(Pos) != Index)
+				break;
+
+			if((CheckPoint(ix, iy) && !(AllowThrough && IsThrough(ix + dx, iy + dy))))
+			{
+				if(pOutCollision)
+					*pOutCollision = Pos;
+				if(pOutBeforeCollision)
+					*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
+				return GetCollisionAt(ix, iy);
+			}
+		}
 	}
 	if(pOutCollision)
 		*pOutCollision = Pos1;
@@ -241,45 +352,54 @@ int CCollision::IntersectLineTeleHook(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision,
 {
 	float Distance = distance(Pos0, Pos1);
 	int End(Distance+1);
-	vec2 Last = Pos0;
 	int ix = 0, iy = 0; // Temporary position for checking collision
 	int dx = 0, dy = 0; // Offset for checking the "through" tile
 	if (AllowThrough)
 		{
 			ThroughOffset(Pos0, Pos1, &dx, &dy);
 		}
-	for(int i = 0; i <= End; i++)
+	*pTeleNr = 0;
+	CLineSampler Samples(Pos0, Pos1, (float)End, End+1, m_Width, m_Height);
+	for(int i = 0; i < Samples.Num(); )
 	{
-		float a = i/(float)End;
-		vec2 Pos = mix(Pos0, Pos1, a);
-		ix = round_to_int(Pos.x);
-		iy = round_to_int(Pos.y);
-
-		int Nx = clamp(ix/32, 0, m_Width-1);
-		int Ny = clamp(iy/32, 0, m_Height-1);
+		int Index = Samples.Tile(i);
 		if (g_Config.m_SvOldTeleportHook)
-			*pTeleNr = IsTeleport(Ny*m_Width+Nx);
+			*pTeleNr = IsTeleport(Index);
 		else
-			*pTeleNr = IsTeleportHook(Ny*m_Width+Nx);
+			*pTeleNr = IsTeleportHook(Index);
 		if(*pTeleNr)
 		{
+			vec2 Pos = Samples.Pos(i);
 			if(pOutCollision)
 				*pOutCollision = Pos;
 			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
+				*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
 			return COLFLAG_TELE;
 		}
 
-		if((CheckPoint(ix, iy) && !(AllowThrough && IsThrough(ix + dx, iy + dy))))
+		if(!(GetCollisionAtIndex(Index)&COLFLAG_SOLID))
 		{
-			if(pOutCollision)
-				*pOutCollision = Pos;
-			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
-			return GetCollisionAt(ix, iy);
+			i = Samples.NextTile(i);
+			continue;
 		}
 
-		Last = Pos;
+		for(; i < Samples.Num(); i++)
+		{
+			vec2 Pos = Samples.Pos(i);
+			ix = round_to_int(Pos.x);
+			iy = round_to_int(Pos.y);
+			if(Samples.TileY(Pos)*m_Width+Samples.TileX(Pos) != Index)
+				break;
+
+			if((CheckPoint(ix, iy) && !(AllowThrough && IsThrough(ix + dx, iy + dy))))
+			{
+				if(pOutCollision)
+					*pOutCollision = Pos;
+				if(pOutBeforeCollision)
+					*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
+				return GetCollisionAt(ix, iy);
+			}
+		}
 	}
 	if(pOutCollision)
 		*pOutCollision = Pos1;
@@ -292,45 +412,54 @@ int CCollision::IntersectLineTeleWeapon(vec2 Pos0, vec2 Pos1, vec2 *pOutCollisio
 {
 	float Distance = distance(Pos0, Pos1);
 	int End(Distance+1);
-	vec2 Last = Pos0;
 	int ix = 0, iy = 0; // Temporary position for checking collision
 	int dx = 0, dy = 0; // Offset for checking the "through" tile
 	if (AllowThrough)
 		{
 			ThroughOffset(Pos0, Pos1, &dx, &dy);
 		}
-	for(int i = 0; i <= End; i++)
+	*pTeleNr = 0;
+	CLineSampler Samples(Pos0, Pos1, (float)End, End+1, m_Width, m_Height);
+	for(int i = 0; i < Samples.Num(); )
 	{
-		float a = i/(float)End;
-		vec2 Pos = mix(Pos0, Pos1, a);
-		ix = round_to_int(Pos.x);
-		iy = round_to_int(Pos.y);
-
-		int Nx = clamp(ix/32, 0, m_Width-1);
-		int Ny = clamp(iy/32, 0, m_Height-1);
+		int Index = Samples.Tile(i);
 		if (g_Config.m_SvOldTeleportWeapons)
-			*pTeleNr = IsTeleport(Ny*m_Width+Nx);
+			*pTeleNr = IsTeleport(Index);
 		else
-			*pTeleNr = IsTeleportWeapon(Ny*m_Width+Nx);
+			*pTeleNr = IsTeleportWeapon(Index);
 		if(*pTeleNr)
 		{
+			vec2 Pos = Samples.Pos(i);
 			if(pOutCollision)
 				*pOutCollision = Pos;
 			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
+				*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
 			return COLFLAG_TELE;
 		}
 
-		if((CheckPoint(ix, iy) && !(AllowThrough && IsThrough(ix + dx, iy + dy))))
+		if(!(GetCollisionAtIndex(Index)&COLFLAG_SOLID))
 		{
-			if(pOutCollision)
-				*pOutCollision = Pos;
-			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
-			return GetCollisionAt(ix, iy);
+			i = Samples.NextTile(i);
+			continue;
 		}
 
-		Last = Pos;
+		for(; i < Samples.Num(); i++)
+		{
+			vec2 Pos = Samples.Pos(i);
+			ix = round_to_int(Pos.x);
+			iy = round_to_int(Pos.y);
+			if(Samples.TileY(Pos)*m_Width+Samples.TileX(Pos) != Index)
+				break;
+
+			if((CheckPoint(ix, iy) && !(AllowThrough && IsThrough(ix + dx, iy + dy))))
+			{
+				if(pOutCollision)
+					*pOutCollision = Pos;
+				if(pOutBeforeCollision)
+					*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
+				return GetCollisionAt(ix, iy);
+			}
+		}
 	}
 	if(pOutCollision)
 		*pOutCollision = Pos1;
@@ -392,6 +521,34 @@ bool CCollision::TestBox(vec2 Pos, vec2 Size)
 	return false;
 }
 
+bool CCollision::FreeArea(vec2 Min, vec2 Max, vec2 *pOutMin, vec2 *pOutMax)
+{
+	if(!m_pTiles)
+		return false;
+
+	int MinX = clamp(round_to_int(Min.x)/32, 0, m_Width-1);
+	int MinY = clamp(round_to_int(Min.y)/32, 0, m_Height-1);
+	int MaxX = clamp(round_to_int(Max.x)/32, 0, m_Width-1);
+	int MaxY = clamp(round_to_int(Max.y)/32, 0, m_Height-1);
+
+	for(int y = MinY; y <= MaxY; y++)
+		for(int x = MinX; x <= MaxX; x++)
+			if(GetCollisionAtIndex(y*m_Width+x)&COLFLAG_SOLID)
+				return false;
+
+	// every point in here rounds into one of the checked tiles, the border tiles extend to infinity
+	pOutMin->x = MinX == 0 ? -1e30f : MinX*32;
+	pOutMin->y = MinY == 0 ? -1e30f : MinY*32;
+	pOutMax->x = MaxX == m_Width-1 ? 1e30f : (MaxX+1)*32-1;
+	pOutMax->y = MaxY == m_Height-1 ? 1e30f : (MaxY+1)*32-1;
+	return true;
+}
+
+static inline bool InsideArea(vec2 Pos, vec2 HalfSize, vec2 Min, vec2 Max)
+{
+	return Pos.x-HalfSize.x >= Min.x && Pos.x+HalfSize.x <= Max.x && Pos.y-HalfSize.y >= Min.y && Pos.y+HalfSize.y <= Max.y;
+}
+
 void CCollision::MoveBox(vec2 *pInoutPos, vec2 *pInoutVel, vec2 Size, float Elasticity)
 {
 	// do the move
@@ -403,6 +560,15 @@ void CCollision::MoveBox(vec2 *pInoutPos, vec2 *pInoutVel, vec2 Size, float Elas
 
 	if(Distance > 0.00001f)
 	{
+		// Sweep the box over the next part of the movement. If that area is
+		// free, the per step box tests can't hit anything as long as the box
+		// stays inside it, so they are skipped. The steps themselves are
+		// still taken to keep the position bit exact.
+		vec2 HalfSize = Size*0.5f;
+		vec2 FreeMin, FreeMax;
+		bool Free = false;
+		int NextSweep = g_Config.m_DbgOldMoveBox || Max == 0 ? Max+1 : 0;
+
 		//vec2 old_pos = pos;
 		float Fraction = 1.0f/(float)(Max+1);
 		for(int i = 0; i <= Max; i++)
@@ -413,6 +579,22 @@ void CCollision::MoveBox(vec2 *pInoutPos, vec2 *pInoutVel, vec2 Size, float Elas
 
 			vec2 NewPos = Pos + Vel*Fraction; // TODO: this row is not nice
 
+			if(!(Free && InsideArea(NewPos, HalfSize, FreeMin, FreeMax)) && i >= NextSweep)
+			{
+				vec2 End = Pos + Vel*(Fraction*min(Max+1-i, (int)SWEEP_STEPS));
+				vec2 SweepMin = vec2(min(Pos.x, End.x), min(Pos.y, End.y)) - HalfSize - vec2(1.0f, 1.0f);
+				vec2 SweepMax = vec2(max(Pos.x, End.x), max(Pos.y, End.y)) + HalfSize + vec2(1.0f, 1.0f);
+				Free = FreeArea(SweepMin, SweepMax, &FreeMin, &FreeMax);
+				if(!Free)
+					NextSweep = i + SWEEP_RETRY; // close to a wall, test step by step for a while
+			}
+
+			if(Free && InsideArea(NewPos, HalfSize, FreeMin, FreeMax))
+			{
+				Pos = NewPos;
+				continue;
+			}
+
 			if(TestBox(vec2(NewPos.x, NewPos.y), Size))
 			{
 				int Hits = 0;
@@ -469,6 +651,9 @@ void CCollision::Dest()
 	m_pTune = 0;
 	m_pDoor = 0;
 	m_pSwitchers = 0;
+	if(m_pPacked)
+		delete[] m_pPacked;
+	m_pPacked = 0;
 }
 
 int CCollision::IsSolid(int x, int y)
@@ -480,10 +665,8 @@ int CCollision::IsThrough(int x, int y)
 {
 	int Nx = clamp(x/32, 0, m_Width-1);
 	int Ny = clamp(y/32, 0, m_Height-1);
-	int Index = m_pTiles[Ny*m_Width+Nx].m_Index;
-	int Findex = 0;
-	if (m_pFront)
-		Findex = m_pFront[Ny*m_Width+Nx].m_Index;
+	int Index = m_pPacked[Ny*m_Width+Nx].m_Index;
+	int Findex = m_pPacked[Ny*m_Width+Nx].m_FIndex;
 	if (Index == TILE_THROUGH)
 		return Index;
 	if (Findex == TILE_THROUGH)
@@ -496,7 +679,7 @@ int CCollision::IsWallJump(int Index)
 	if(Index < 0)
 		return 0;
 
-	return m_pTiles[Index].m_Index == TILE_WALLJUMP;
+	return m_pPacked[Index].m_Index == TILE_WALLJUMP;
 }
 
 int CCollision::IsNoLaser(int x, int y)
@@ -513,6 +696,8 @@ int CCollision::IsTeleport(int Index)
 {
 	if(Index < 0 || !m_pTele)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TELE))
+		return 0;
 
 	if(m_pTele[Index].m_Type == TILE_TELEIN)
 		return m_pTele[Index].m_Number;
@@ -526,6 +711,8 @@ int CCollision::IsEvilTeleport(int Index)
 		return 0;
 	if(!m_pTele)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TELE))
+		return 0;
 
 	if(m_pTele[Index].m_Type == TILE_TELEINEVIL)
 		return m_pTele[Index].m_Number;
@@ -539,6 +726,8 @@ int CCollision::IsCheckTeleport(int Index)
 		return 0;
 	if(!m_pTele)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TELE))
+		return 0;
 
 	if(m_pTele[Index].m_Type == TILE_TELECHECKIN)
 		return m_pTele[Index].m_Number;
@@ -552,6 +741,8 @@ int CCollision::IsCheckEvilTeleport(int Index)
 		return 0;
 	if(!m_pTele)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TELE))
+		return 0;
 
 	if(m_pTele[Index].m_Type == TILE_TELECHECKINEVIL)
 		return m_pTele[Index].m_Number;
@@ -566,6 +757,8 @@ int CCollision::IsTCheckpoint(int Index)
 
 	if(!m_pTele)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TELE))
+		return 0;
 
 	if(m_pTele[Index].m_Type == TILE_TELECHECK)
 		return m_pTele[Index].m_Number;
@@ -577,6 +770,8 @@ int CCollision::IsTeleportWeapon(int Index)
 {
 	if(Index < 0 || !m_pTele)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TELE))
+		return 0;
 
 	if(m_pTele[Index].m_Type == TILE_TELEINWEAPON)
 		return m_pTele[Index].m_Number;
@@ -588,6 +783,8 @@ int CCollision::IsTeleportHook(int Index)
 {
 	if(Index < 0 || !m_pTele)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TELE))
+		return 0;
 
 	if(m_pTele[Index].m_Type == TILE_TELEINHOOK)
 		return m_pTele[Index].m_Number;
@@ -600,6 +797,8 @@ int CCollision::IsSpeedup(int Index)
 {
 	if(Index < 0 || !m_pSpeedup)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_SPEEDUP))
+		return 0;
 
 	if(m_pSpeedup[Index].m_Force > 0)
 		return Index;
@@ -611,6 +810,8 @@ int CCollision::IsTune(int Index)
 {
 	if(Index < 0 || !m_pTune)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_TUNE))
+		return 0;
 
 	if(m_pTune[Index].m_Type)
 		return m_pTune[Index].m_Number;
@@ -634,6 +835,8 @@ int CCollision::IsSwitch(int Index)
 	//dbg_msg("IsSwitch","Index %d, pSwitch %d, m_Type %d, m_Number %d", Index, m_pSwitch, (m_pSwitch)?m_pSwitch[Index].m_Type:0, (m_pSwitch)?m_pSwitch[Index].m_Number:0);
 	if(Index < 0 || !m_pSwitch)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_SWITCH))
+		return 0;
 
 	if(m_pSwitch[Index].m_Type > 0)
 		return m_pSwitch[Index].m_Type;
@@ -646,6 +849,8 @@ int CCollision::GetSwitchNumber(int Index)
 	//dbg_msg("GetSwitchNumber","Index %d, pSwitch %d, m_Type %d, m_Number %d", Index, m_pSwitch, (m_pSwitch)?m_pSwitch[Index].m_Type:0, (m_pSwitch)?m_pSwitch[Index].m_Number:0);
 	if(Index < 0 || !m_pSwitch)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_SWITCH))
+		return 0;
 
 	if(m_pSwitch[Index].m_Type > 0 && m_pSwitch[Index].m_Number > 0)
 		return m_pSwitch[Index].m_Number;
@@ -658,6 +863,8 @@ int CCollision::GetSwitchDelay(int Index)
 	//dbg_msg("GetSwitchNumber","Index %d, pSwitch %d, m_Type %d, m_Number %d", Index, m_pSwitch, (m_pSwitch)?m_pSwitch[Index].m_Type:0, (m_pSwitch)?m_pSwitch[Index].m_Number:0);
 	if(Index < 0 || !m_pSwitch)
 		return 0;
+	if(!(m_pPacked[Index].m_Special&SPECIAL_SWITCH))
+		return 0;
 
 	if(m_pSwitch[Index].m_Type > 0)
 		return m_pSwitch[Index].m_Delay;
@@ -720,6 +927,14 @@ int CCollision::GetPureMapIndex(vec2 Pos)
 }
 
 bool CCollision::TileExists(int Index)
+{
+	if(Index < 0)
+		return false;
+
+	return m_pPacked[Index].m_Special&SPECIAL_EXISTS;
+}
+
+bool CCollision::CheckTileExists(int Index)
 {
 	if(Index < 0)
 		return false;
@@ -798,56 +1013,43 @@ int CCollision::GetMapIndex(vec2 Pos)
 		return -1;
 }
 
-std::list<int> CCollision::GetMapIndices(vec2 PrevPos, vec2 Pos, unsigned MaxIndices)
+CTilePath::CTilePath(CCollision *pCollision, vec2 PrevPos, vec2 Pos) :
+	m_Samples(PrevPos, Pos, distance(PrevPos, Pos), distance(PrevPos, Pos) ? (int)(distance(PrevPos, Pos)+1) : 0, pCollision->GetWidth(), pCollision->GetHeight(), false)
 {
-	std::list< int > Indices;
-	float d = distance(PrevPos, Pos);
-	int End(d + 1);
-	if(!d)
+	m_pCollision = pCollision;
+	m_Sample = 0;
+	m_LastIndex = 0;
+	m_StaticIndex = -1;
+
+	if(!m_Samples.Num())
 	{
-		int Nx = clamp((int)Pos.x / 32, 0, m_Width - 1);
-		int Ny = clamp((int)Pos.y / 32, 0, m_Height - 1);
-		int Index = Ny * m_Width + Nx;
-		/*if (m_pTele && (m_pTele[Index].m_Type == TILE_TELEIN)) dbg_msg("m_pTele && TELEIN","Index %d",Index);
-		else if (m_pTele && m_pTele[Index].m_Type==TILE_TELEOUT) dbg_msg("TELEOUT","Index %d",Index);
-		else dbg_msg("GetMapIndex(","Index %d",Index);//REMOVE */
-
-		if(TileExists(Index))
-		{
-			Indices.push_back(Index);
-			return Indices;
-		}
-		else
-			return Indices;
+		// not moving, only the current tile
+		int Index = m_Samples.TileY(Pos)*pCollision->GetWidth()+m_Samples.TileX(Pos);
+		if(pCollision->TileExists(Index))
+			m_StaticIndex = Index;
 	}
-	else
+}
+
+int CTilePath::Next()
+{
+	if(m_StaticIndex != -1)
+	{
+		int Index = m_StaticIndex;
+		m_StaticIndex = -1;
+		return Index;
+	}
+
+	while(m_Sample < m_Samples.Num())
 	{
-		float a = 0.0f;
-		vec2 Tmp = vec2(0, 0);
-		int Nx = 0;
-		int Ny = 0;
-		int Index,LastIndex = 0;
-		for(int i = 0; i < End; i++)
+		int Index = m_Samples.Tile(m_Sample);
+		m_Sample = m_Samples.NextTile(m_Sample);
+		if(m_pCollision->TileExists(Index) && m_LastIndex != Index)
 		{
-			a = i/d;
-			Tmp = mix(PrevPos, Pos, a);
-			Nx = clamp((int)Tmp.x / 32, 0, m_Width - 1);
-			Ny = clamp((int)Tmp.y / 32, 0, m_Height - 1);
-			Index = Ny * m_Width + Nx;
-			//dbg_msg("lastindex","%d",LastIndex);
-			//dbg_msg("index","%d",Index);
-			if(TileExists(Index) && LastIndex != Index)
-			{
-				if(MaxIndices && Indices.size() > MaxIndices)
-					return Indices;
-				Indices.push_back(Index);
-				LastIndex = Index;
-				//dbg_msg("pushed","%d",Index);
-			}
+			m_LastIndex = Index;
+			return Index;
 		}
-
-		return Indices;
 	}
+	return -1;
 }
 
 vec2 CCollision::GetPos(int Index)
@@ -865,16 +1067,16 @@ int CCollision::GetTileIndex(int Index)
 	/*dbg_msg("GetTileIndex","m_pTiles[%d].m_Index = %d",Index,m_pTiles[Index].m_Index);//Remove*/
 	if(Index < 0)
 		return 0;
-	return m_pTiles[Index].m_Index;
+	return m_pPacked[Index].m_Index;
 }
 
 int CCollision::GetFTileIndex(int Index)
 {
 	/*dbg_msg("GetFTileIndex","m_pFront[%d].m_Index = %d",Index,m_pFront[Index].m_Index);//Remove*/
 
-	if(Index < 0 || !m_pFront)
+	if(Index < 0)
 		return 0;
-	return m_pFront[Index].m_Index;
+	return m_pPacked[Index].m_FIndex;
 }
 
 int CCollision::GetTileFlags(int Index)
@@ -882,16 +1084,16 @@ int CCollision::GetTileFlags(int Index)
 	/*dbg_msg("GetTileIndex","m_pTiles[%d].m_Index = %d",Index,m_pTiles[Index].m_Index);//Remove*/
 	if(Index < 0)
 		return 0;
-	return m_pTiles[Index].m_Flags;
+	return m_pPacked[Index].m_Flags;
 }
 
 int CCollision::GetFTileFlags(int Index)
 {
 	/*dbg_msg("GetFTileIndex","m_pFront[%d].m_Index = %d",Index,m_pFront[Index].m_Index);//Remove*/
 
-	if(Index < 0 || !m_pFront)
+	if(Index < 0)
 		return 0;
-	return m_pFront[Index].m_Flags;
+	return m_pPacked[Index].m_FFlags;
 }
 
 int CCollision::GetIndex(int Nx, int Ny)
@@ -957,9 +1159,16 @@ int CCollision::GetFTile(int x, int y)
 	int Nx = clamp(x/32, 0, m_Width-1);
 	int Ny = clamp(y/32, 0, m_Height-1);
 	/*dbg_msg("GetFTile","m_Index %d",m_pFront[Ny*m_Width+Nx].m_Index);//Remove */
-	if(m_pFront[Ny*m_Width+Nx].m_Index == COLFLAG_DEATH
-		|| m_pFront[Ny*m_Width+Nx].m_Index == TILE_NOLASER)
-		return m_pFront[Ny*m_Width+Nx].m_Index;
+	return GetFCollisionAtIndex(Ny*m_Width+Nx);
+}
+
+int CCollision::GetFCollisionAtIndex(int Index)
+{
+	if(!m_pFront)
+		return 0;
+	if(m_pFront[Index].m_Index == COLFLAG_DEATH
+		|| m_pFront[Index].m_Index == TILE_NOLASER)
+		return m_pFront[Index].m_Index;
 	else
 		return 0;
 }
@@ -1021,6 +1230,7 @@ void CCollision::SetCollisionAt(float x, float y, int flag)
 	int Ny = clamp(round_to_int(y)/32, 0, m_Height-1);
 
 	m_pTiles[Ny * m_Width + Nx].m_Index = flag;
+	UpdatePackedTile(Ny * m_Width + Nx);
 }
 
 void CCollision::SetDCollisionAt(float x, float y, int Type, int Flags, int Number)
@@ -1033,18 +1243,19 @@ void CCollision::SetDCollisionAt(float x, float y, int Type, int Flags, int Numb
 	m_pDoor[Ny * m_Width + Nx].m_Index = Type;
 	m_pDoor[Ny * m_Width + Nx].m_Flags = Flags;
 	m_pDoor[Ny * m_Width + Nx].m_Number = Number;
+	UpdatePackedTile(Ny * m_Width + Nx);
 }
 
 int CCollision::GetDTileIndex(int Index)
 {
-	if(!m_pDoor || Index < 0 || !m_pDoor[Index].m_Index)
+	if(Index < 0 || !(m_pPacked[Index].m_Special&SPECIAL_DOOR))
 		return 0;
 	return m_pDoor[Index].m_Index;
 }
 
 int CCollision::GetDTileNumber(int Index)
 {
-	if(!m_pDoor || Index < 0 || !m_pDoor[Index].m_Index)
+	if(Index < 0 || !(m_pPacked[Index].m_Special&SPECIAL_DOOR))
 		return 0;
 	if(m_pDoor[Index].m_Number) return m_pDoor[Index].m_Number;
 	return 0;
@@ -1052,7 +1263,7 @@ int CCollision::GetDTileNumber(int Index)
 
 int CCollision::GetDTileFlags(int Index)
 {
-	if(!m_pDoor || Index < 0 || !m_pDoor[Index].m_Index)
+	if(Index < 0 || !(m_pPacked[Index].m_Special&SPECIAL_DOOR))
 		return 0;
 	return m_pDoor[Index].m_Flags;
 }
@@ -1092,28 +1303,25 @@ void ThroughOffset(vec2 Pos0, vec2 Pos1, int *Ox, int *Oy)
 int CCollision::IntersectNoLaser(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision, vec2 *pOutBeforeCollision)
 {
 	float d = distance(Pos0, Pos1);
-	vec2 Last = Pos0;
+	CLineSampler Samples(Pos0, Pos1, d, (int)ceilf(d), m_Width, m_Height);
 
-	for(float f = 0; f < d; f++)
+	for(int i = 0; i < Samples.Num(); i = Samples.NextTile(i))
 	{
-		float a = f/d;
-		vec2 Pos = mix(Pos0, Pos1, a);
-		int Nx = clamp(round_to_int(Pos.x)/32, 0, m_Width-1);
-		int Ny = clamp(round_to_int(Pos.y)/32, 0, m_Height-1);
-		if(GetIndex(Nx, Ny) == COLFLAG_SOLID
-			|| GetIndex(Nx, Ny) == (COLFLAG_SOLID|COLFLAG_NOHOOK)
-			|| GetIndex(Nx, Ny) == TILE_NOLASER
-			|| GetFIndex(Nx, Ny) == TILE_NOLASER)
+		int Index = Samples.Tile(i);
+		if(GetTileIndex(Index) == COLFLAG_SOLID
+			|| GetTileIndex(Index) == (COLFLAG_SOLID|COLFLAG_NOHOOK)
+			|| GetTileIndex(Index) == TILE_NOLASER
+			|| GetFTileIndex(Index) == TILE_NOLASER)
 		{
+			vec2 Pos = Samples.Pos(i);
 			if(pOutCollision)
 				*pOutCollision = Pos;
 			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
-			if (GetFIndex(Nx, Ny) == TILE_NOLASER)	return GetFCollisionAt(Pos.x, Pos.y);
-			else return GetCollisionAt(Pos.x, Pos.y);
+				*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
+			if (GetFTileIndex(Index) == TILE_NOLASER)	return GetFCollisionAtIndex(Index);
+			else return GetCollisionAtIndex(Index);
 
 		}
-		Last = Pos;
 	}
 	if(pOutCollision)
 		*pOutCollision = Pos1;
@@ -1125,22 +1333,21 @@ int CCollision::IntersectNoLaser(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision, vec2
 int CCollision::IntersectNoLaserNW(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision, vec2 *pOutBeforeCollision)
 {
 	float d = distance(Pos0, Pos1);
-	vec2 Last = Pos0;
+	CLineSampler Samples(Pos0, Pos1, d, (int)ceilf(d), m_Width, m_Height);
 
-	for(float f = 0; f < d; f++)
+	for(int i = 0; i < Samples.Num(); i = Samples.NextTile(i))
 	{
-		float a = f/d;
-		vec2 Pos = mix(Pos0, Pos1, a);
-		if(IsNoLaser(round_to_int(Pos.x), round_to_int(Pos.y)) || IsFNoLaser(round_to_int(Pos.x), round_to_int(Pos.y)))
+		int Index = Samples.Tile(i);
+		if(GetCollisionAtIndex(Index) == TILE_NOLASER || GetFCollisionAtIndex(Index) == TILE_NOLASER)
 		{
+			vec2 Pos = Samples.Pos(i);
 			if(pOutCollision)
 				*pOutCollision = Pos;
 			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
-			if(IsNoLaser(round_to_int(Pos.x), round_to_int(Pos.y))) return GetCollisionAt(Pos.x, Pos.y);
-			else return  GetFCollisionAt(Pos.x, Pos.y);
+				*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
+			if(GetCollisionAtIndex(Index) == TILE_NOLASER) return GetCollisionAtIndex(Index);
+			else return GetFCollisionAtIndex(Index);
 		}
-		Last = Pos;
 	}
 	if(pOutCollision)
 		*pOutCollision = Pos1;
@@ -1152,25 +1359,24 @@ int CCollision::IntersectNoLaserNW(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision, ve
 int CCollision::IntersectAir(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision, vec2 *pOutBeforeCollision)
 {
 	float d = distance(Pos0, Pos1);
-	vec2 Last = Pos0;
+	CLineSampler Samples(Pos0, Pos1, d, (int)ceilf(d), m_Width, m_Height);
 
-	for(float f = 0; f < d; f++)
+	for(int i = 0; i < Samples.Num(); i = Samples.NextTile(i))
 	{
-		float a = f/d;
-		vec2 Pos = mix(Pos0, Pos1, a);
-		if(IsSolid(round_to_int(Pos.x), round_to_int(Pos.y)) || (!GetTile(round_to_int(Pos.x), round_to_int(Pos.y)) && !GetFTile(round_to_int(Pos.x), round_to_int(Pos.y))))
+		int Index = Samples.Tile(i);
+		if((GetCollisionAtIndex(Index)&COLFLAG_SOLID) || (!GetCollisionAtIndex(Index) && !GetFCollisionAtIndex(Index)))
 		{
+			vec2 Pos = Samples.Pos(i);
 			if(pOutCollision)
 				*pOutCollision = Pos;
 			if(pOutBeforeCollision)
-				*pOutBeforeCollision = Last;
-			if(!GetTile(round_to_int(Pos.x), round_to_int(Pos.y)) && !GetFTile(round_to_int(Pos.x), round_to_int(Pos.y)))
+				*pOutBeforeCollision = i > 0 ? Samples.Pos(i-1) : Pos0;
+			if(!GetCollisionAtIndex(Index) && !GetFCollisionAtIndex(Index))
 				return -1;
 			else
-				if (!GetTile(round_to_int(Pos.x), round_to_int(Pos.y))) return GetTile(round_to_int(Pos.x), round_to_int(Pos.y));
-				else return GetFTile(round_to_int(Pos.x), round_to_int(Pos.y));
+				if (!GetCollisionAtIndex(Index)) return GetCollisionAtIndex(Index);
+				else return GetFCollisionAtIndex(Index);
 		}
-		Last = Pos;
 	}
 	if(pOutCollision)
 		*pOutCollision = Pos1;
@@ -6,7 +6,43 @@
 #include <base/vmath.h>
 #include <engine/shared/protocol.h>
 
-#include <list>
+/*
+	Class: Line Sampler
+		Several collision checks sample a segment once per pixel. To
+		return exactly the same positions without a tile lookup for every
+		sample, this walks the samples tile by tile (a DDA over the sample
+		lattice): callers skip all samples of a tile that can't affect them
+		at once and only look closer at tiles that might.
+*/
+class CLineSampler
+{
+	vec2 m_Pos0;
+	vec2 m_Pos1;
+	vec2 m_Delta;
+	float m_Div;
+	int m_Num;
+	int m_Width;
+	int m_Height;
+	bool m_Round;
+
+	int NextBorder(float Pos0, float Delta, int Tile, int Size) const;
+
+public:
+	/*
+		Sample i is mix(Pos0, Pos1, i/Div), for 0 <= i < Num. Round selects
+		round_to_int or truncation when mapping samples to tiles.
+	*/
+	CLineSampler(vec2 Pos0, vec2 Pos1, float Div, int Num, int Width, int Height, bool Round = true);
+
+	int Num() const { return m_Num; }
+	vec2 Pos(int i) const { return mix(m_Pos0, m_Pos1, i/m_Div); }
+	int TileX(vec2 Pos) const { return clamp((m_Round ? round_to_int(Pos.x) : (int)Pos.x)/32, 0, m_Width-1); }
+	int TileY(vec2 Pos) const { return clamp((m_Round ? round_to_int(Pos.y) : (int)Pos.y)/32, 0, m_Height-1); }
+	int Tile(int i) const { vec2 P = Pos(i); return TileY(P)*m_Width+TileX(P); }
+
+	// returns the first sample after i that lies in another tile, or Num()
+	int NextTile(int i) const;
+};
 
 class CCollision
 {
@@ -30,6 +66,12 @@ public:
 		COLFLAG_TELE=32
 	};
 
+	enum
+	{
+		SWEEP_STEPS=64, // MoveBox steps covered by one free area check
+		SWEEP_RETRY=8,
+	};
+
 	CCollision();
 	void Init(class CLayers *pLayers);
 	bool CheckPoint(float x, float y) { return IsSolid(round_to_int(x), round_to_int(y)); }
@@ -42,6 +84,7 @@ public:
 	int IntersectLineTeleHook(vec2 Pos0, vec2 Pos1, vec2 *pOutCollision, vec2 *pOutBeforeCollision, int *pTeleNr, bool AllowThrough);
 	void MovePoint(vec2 *pInoutPos, vec2 *pInoutVel, float Elasticity, int *pBounces);
 	void MoveBox(vec2 *pInoutPos, vec2 *pInoutVel, vec2 Size, float Elasticity);
+	bool FreeArea(vec2 Min, vec2 Max, vec2 *pOutMin, vec2 *pOutMax);
 	bool TestBox(vec2 Pos, vec2 Size);
 
 	// DDRace
@@ -64,9 +107,10 @@ public:
 
 	int GetTile(int x, int y);
 	int GetFTile(int x, int y);
+	int GetCollisionAtIndex(int Index);
+	int GetFCollisionAtIndex(int Index);
 	int Entity(int x, int y, int Layer);
 	int GetPureMapIndex(vec2 Pos);
-	std::list<int> GetMapIndices(vec2 PrevPos, vec2 Pos, unsigned MaxIndices = 0);
 	int GetMapIndex(vec2 Pos);
 	bool TileExists(int Index);
 	bool TileExistsNext(int Index);
@@ -111,6 +155,33 @@ public:
 
 private:
 
+	enum
+	{
+		SPECIAL_TELE=1,
+		SPECIAL_SPEEDUP=2,
+		SPECIAL_SWITCH=4,
+		SPECIAL_TUNE=8,
+		SPECIAL_DOOR=16,
+		SPECIAL_EXISTS=32,
+	};
+
+	// game and front layer plus a summary of the other layers, built in Init
+	struct CPackedTile
+	{
+		unsigned char m_Index;
+		unsigned char m_Flags;
+		unsigned char m_FIndex;
+		unsigned char m_FFlags;
+		unsigned char m_Special;
+		unsigned char m_Reserved[3];
+	};
+	CPackedTile *m_pPacked;
+
+	void PackTile(int Index);
+	void UpdatePackedTile(int Index);
+	void UpdateTileExists(int Index);
+	bool CheckTileExists(int Index);
+
 	class CTeleTile *m_pTele;
 	class CSpeedupTile *m_pSpeedup;
 	class CTile *m_pFront;
@@ -130,5 +201,26 @@ public:
 	SSwitchers* m_pSwitchers;
 };
 
+/*
+	Class: Tile Path
+		Yields the indices of the tiles with game relevant content that a
+		movement from PrevPos to Pos passes, in order and without
+		duplicates. Lives on the stack and does not allocate.
+*/
+class CTilePath
+{
+	CCollision *m_pCollision;
+	CLineSampler m_Samples;
+	int m_Sample;
+	int m_LastIndex;
+	int m_StaticIndex;
+
+public:
+	CTilePath(CCollision *pCollision, vec2 PrevPos, vec2 Pos);
+
+	// returns the next tile index or -1 when done
+	int Next();
+};
+
 void ThroughOffset(vec2 Pos0, vec2 Pos1, int *Ox, int *Oy);
 #endif
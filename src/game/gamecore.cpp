@@ -69,6 +69,8 @@ void CCharacterCore::Init(CWorldCore *pWorld, CCollision *pCollision, CTeamsCore
 	m_Collision = true;
 	m_JumpedTotal = 0;
 	m_Jumps = 2;
+	m_pTickTuning = 0;
+	m_HookTeleRand = -1;
 }
 
 void CCharacterCore::Init(CWorldCore *pWorld, CCollision *pCollision, CTeamsCore* pTeams, std::map<int, std::vector<vec2> > *pTeleOuts)
@@ -83,6 +85,8 @@ void CCharacterCore::Init(CWorldCore *pWorld, CCollision *pCollision, CTeamsCore
 	m_Collision = true;
 	m_JumpedTotal = 0;
 	m_Jumps = 2;
+	m_pTickTuning = 0;
+	m_HookTeleRand = -1;
 }
 
 void CCharacterCore::Reset()
@@ -103,8 +107,14 @@ void CCharacterCore::Reset()
 	m_Collision = true;
 }
 
+CTuningParams *CCharacterCore::Tuning()
+{
+	return m_pTickTuning ? m_pTickTuning : &m_pWorld->m_Tuning[g_Config.m_ClDummy];
+}
+
 void CCharacterCore::Tick(bool UseInput, bool IsClient)
 {
+	CTuningParams *pTuning = Tuning();
 	float PhysSize = 28.0f;
 	int MapIndex = Collision()->GetPureMapIndex(m_Pos);;
 	int MapIndexL = Collision()->GetPureMapIndex(vec2(m_Pos.x + (28/2)+4,m_Pos.y));
@@ -155,11 +165,11 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 
 	vec2 TargetDirection = normalize(vec2(m_Input.m_TargetX, m_Input.m_TargetY));
 
-	m_Vel.y += m_pWorld->m_Tuning[g_Config.m_ClDummy].m_Gravity;
+	m_Vel.y += pTuning->m_Gravity;
 
-	float MaxSpeed = Grounded ? m_pWorld->m_Tuning[g_Config.m_ClDummy].m_GroundControlSpeed : m_pWorld->m_Tuning[g_Config.m_ClDummy].m_AirControlSpeed;
-	float Accel = Grounded ? m_pWorld->m_Tuning[g_Config.m_ClDummy].m_GroundControlAccel : m_pWorld->m_Tuning[g_Config.m_ClDummy].m_AirControlAccel;
-	float Friction = Grounded ? m_pWorld->m_Tuning[g_Config.m_ClDummy].m_GroundFriction : m_pWorld->m_Tuning[g_Config.m_ClDummy].m_AirFriction;
+	float MaxSpeed = Grounded ? pTuning->m_GroundControlSpeed : pTuning->m_AirControlSpeed;
+	float Accel = Grounded ? pTuning->m_GroundControlAccel : pTuning->m_AirControlAccel;
+	float Friction = Grounded ? pTuning->m_GroundFriction : pTuning->m_AirFriction;
 
 	// handle input
 	if(UseInput)
@@ -186,14 +196,14 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 				if(Grounded)
 				{
 					m_TriggeredEvents |= COREEVENT_GROUND_JUMP;
-					m_Vel.y = -m_pWorld->m_Tuning[g_Config.m_ClDummy].m_GroundJumpImpulse;
+					m_Vel.y = -pTuning->m_GroundJumpImpulse;
 					m_Jumped |= 1;
 					m_JumpedTotal = 1;
 				}
 				else if(!(m_Jumped&2))
 				{
 					m_TriggeredEvents |= COREEVENT_AIR_JUMP;
-					m_Vel.y = -m_pWorld->m_Tuning[g_Config.m_ClDummy].m_AirJumpImpulse;
+					m_Vel.y = -pTuning->m_AirJumpImpulse;
 					m_Jumped |= 3;
 					m_JumpedTotal++;
 				}
@@ -211,7 +221,7 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 				m_HookPos = m_Pos+TargetDirection*PhysSize*1.5f;
 				m_HookDir = TargetDirection;
 				m_HookedPlayer = -1;
-				m_HookTick = SERVER_TICK_SPEED * (1.25f - m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookDuration);
+				m_HookTick = SERVER_TICK_SPEED * (1.25f - pTuning->m_HookDuration);
 				m_TriggeredEvents |= COREEVENT_HOOK_LAUNCH;
 			}
 		}
@@ -259,12 +269,12 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 	}
 	else if(m_HookState == HOOK_FLYING)
 	{
-		vec2 NewPos = m_HookPos+m_HookDir*m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookFireSpeed;
-		if((!m_NewHook && distance(m_Pos, NewPos) > m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookLength)
-		|| (m_NewHook && distance(m_HookTeleBase, NewPos) > m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookLength))
+		vec2 NewPos = m_HookPos+m_HookDir*pTuning->m_HookFireSpeed;
+		if((!m_NewHook && distance(m_Pos, NewPos) > pTuning->m_HookLength)
+		|| (m_NewHook && distance(m_HookTeleBase, NewPos) > pTuning->m_HookLength))
 		{
 			m_HookState = HOOK_RETRACT_START;
-			NewPos = m_Pos + normalize(NewPos-m_Pos) * m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookLength;
+			NewPos = m_Pos + normalize(NewPos-m_Pos) * pTuning->m_HookLength;
 			m_pReset = true;
 		}
 
@@ -289,13 +299,20 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 		}
 
 		// Check against other players first
-		if(this->m_Hook && m_pWorld && m_pWorld->m_Tuning[g_Config.m_ClDummy].m_PlayerHooking)
+		if(this->m_Hook && m_pWorld && pTuning->m_PlayerHooking)
 		{
+			// only characters near the hook's path can be closer than PhysSize+2 to it
+			int aIDs[MAX_CLIENTS];
+			vec2 Margin(PhysSize+3.0f, PhysSize+3.0f);
+			int Num = m_pWorld->FindCharacters(vec2(min(m_HookPos.x, NewPos.x), min(m_HookPos.y, NewPos.y))-Margin,
+				vec2(max(m_HookPos.x, NewPos.x), max(m_HookPos.y, NewPos.y))+Margin, aIDs, m_Id);
+
 			float Distance = 0.0f;
-			for(int i = 0; i < MAX_CLIENTS; i++)
+			for(int k = 0; k < Num; k++)
 			{
+				int i = aIDs[k];
 				CCharacterCore *pCharCore = m_pWorld->m_apCharacters[i];
-				if(!pCharCore || pCharCore == this || !m_pTeams->CanCollide(i, m_Id))
+				if(pCharCore == this || !m_pTeams->CanCollide(i, m_Id))
 					continue;
 
 				vec2 ClosestPoint = closest_point_on_line(m_HookPos, NewPos, pCharCore->m_Pos);
@@ -326,14 +343,17 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 				m_HookState = HOOK_RETRACT_START;
 			}
 
-			if(GoingThroughTele && m_pTeleOuts && m_pTeleOuts->size() && (*m_pTeleOuts)[teleNr-1].size())
+			// find() rather than [], the outs must not change while other threads tick
+			std::map<int, std::vector<vec2> >::const_iterator TeleOuts;
+			if(GoingThroughTele && m_pTeleOuts && (TeleOuts = m_pTeleOuts->find(teleNr-1)) != m_pTeleOuts->end() && TeleOuts->second.size())
 			{
 				m_TriggeredEvents = 0;
 				m_HookedPlayer = -1;
 
 				m_NewHook = true;
-				int Num = (*m_pTeleOuts)[teleNr-1].size();
-				m_HookPos = (*m_pTeleOuts)[teleNr-1][(Num==1)?0:rand() % Num]+TargetDirection*PhysSize*1.5f;
+				int Num = TeleOuts->second.size();
+				int Rand = m_HookTeleRand >= 0 ? m_HookTeleRand : rand();
+				m_HookPos = TeleOuts->second[(Num==1)?0:Rand % Num]+TargetDirection*PhysSize*1.5f;
 				m_HookDir = TargetDirection;
 				m_HookTeleBase = m_HookPos;
 			}
@@ -367,7 +387,7 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 		// don't do this hook rutine when we are hook to a player
 		if(m_HookedPlayer == -1 && distance(m_HookPos, m_Pos) > 46.0f)
 		{
-			vec2 HookVel = normalize(m_HookPos-m_Pos)*m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookDragAccel;
+			vec2 HookVel = normalize(m_HookPos-m_Pos)*pTuning->m_HookDragAccel;
 			// the hook as more power to drag you up then down.
 			// this makes it easier to get on top of an platform
 			if(HookVel.y > 0)
@@ -383,7 +403,7 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 			vec2 NewVel = m_Vel+HookVel;
 
 			// check if we are under the legal limit for the hook
-			if(length(NewVel) < m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookDragSpeed || length(NewVel) < length(m_Vel))
+			if(length(NewVel) < pTuning->m_HookDragSpeed || length(NewVel) < length(m_Vel))
 				m_Vel = NewVel; // no problem. apply
 
 		}
@@ -400,11 +420,28 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 
 	if(m_pWorld)
 	{
-		for(int i = 0; i < MAX_CLIENTS; i++)
+		// only close characters can collide, the hooked one is affected at any distance
+		int aIDs[MAX_CLIENTS];
+		vec2 Margin(PhysSize*1.25f+1.0f, PhysSize*1.25f+1.0f);
+		int Num = m_pWorld->FindCharacters(m_Pos-Margin, m_Pos+Margin, aIDs, m_Id);
+		if(m_HookedPlayer >= 0 && m_HookedPlayer < MAX_CLIENTS && m_pWorld->m_apCharacters[m_HookedPlayer])
+		{
+			int k = 0;
+			while(k < Num && aIDs[k] < m_HookedPlayer)
+				k++;
+			if(k == Num || aIDs[k] != m_HookedPlayer)
+			{
+				for(int j = Num; j > k; j--)
+					aIDs[j] = aIDs[j-1];
+				aIDs[k] = m_HookedPlayer;
+				Num++;
+			}
+		}
+
+		for(int k = 0; k < Num; k++)
 		{
+			int i = aIDs[k];
 			CCharacterCore *pCharCore = m_pWorld->m_apCharacters[i];
-			if(!pCharCore)
-				continue;
 
 			//player *p = (player*)ent;
 			//if(pCharCore == this) // || !(p->flags&FLAG_ALIVE)
@@ -415,7 +452,7 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 			// handle player <-> player collision
 			float Distance = distance(m_Pos, pCharCore->m_Pos);
 			vec2 Dir = normalize(m_Pos - pCharCore->m_Pos);
-			if(pCharCore->m_Collision && this->m_Collision && m_pWorld->m_Tuning[g_Config.m_ClDummy].m_PlayerCollision && Distance < PhysSize*1.25f && Distance > 0.0f)
+			if(pCharCore->m_Collision && this->m_Collision && pTuning->m_PlayerCollision && Distance < PhysSize*1.25f && Distance > 0.0f)
 			{
 				float a = (PhysSize*1.45f - Distance);
 				float Velocity = 0.5f;
@@ -430,12 +467,12 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 			}
 
 			// handle hook influence
-			if(m_Hook && m_HookedPlayer == i && m_pWorld->m_Tuning[g_Config.m_ClDummy].m_PlayerHooking)
+			if(m_Hook && m_HookedPlayer == i && pTuning->m_PlayerHooking)
 			{
 				if(Distance > PhysSize*1.50f) // TODO: fix tweakable variable
 				{
-					float Accel = m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookDragAccel * (Distance/m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookLength);
-					float DragSpeed = m_pWorld->m_Tuning[g_Config.m_ClDummy].m_HookDragSpeed;
+					float Accel = pTuning->m_HookDragAccel * (Distance/pTuning->m_HookLength);
+					float DragSpeed = pTuning->m_HookDragSpeed;
 
 					// add force to the hooked player
 					vec2 Temp = pCharCore->m_Vel;
@@ -547,7 +584,7 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 
 		// jetpack and ninjajetpack prediction
 		if(IsClient && UseInput && (m_Input.m_Fire&1) && (m_ActiveWeapon == WEAPON_GUN || m_ActiveWeapon == WEAPON_NINJA)) {
-			m_Vel += TargetDirection * -1.0f * (m_pWorld->m_Tuning[g_Config.m_ClDummy].m_JetpackStrength / 100.0f / 6.11f);
+			m_Vel += TargetDirection * -1.0f * (pTuning->m_JetpackStrength / 100.0f / 6.11f);
 		}
 
 		if(g_Config.m_ClPredictDDRace && IsClient)
@@ -589,9 +626,151 @@ void CCharacterCore::Tick(bool UseInput, bool IsClient)
 		m_Vel = normalize(m_Vel) * 6000;
 }
 
+int CWorldCore::GridCoord(float Value)
+{
+	// clamp before converting so that far off positions end up in the outermost cells
+	return ((int)floorf(clamp(Value, -1048576.0f, 1048576.0f))) >> GRID_CELL_SHIFT;
+}
+
+int CWorldCore::GridBucket(int x, int y)
+{
+	return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u) & (GRID_BUCKETS-1);
+}
+
+void CWorldCore::LinkCharacter(int ClientID, int Bucket)
+{
+	int First = m_aGridFirst[Bucket];
+	if(First >= 0)
+		m_aGridPrev[First] = ClientID;
+	m_aGridNext[ClientID] = First;
+	m_aGridPrev[ClientID] = -1;
+	m_aGridFirst[Bucket] = ClientID;
+	m_aGridBucket[ClientID] = Bucket;
+	m_NumGridCharacters++;
+}
+
+void CWorldCore::UnlinkCharacter(int ClientID)
+{
+	if(m_aGridPrev[ClientID] >= 0)
+		m_aGridNext[m_aGridPrev[ClientID]] = m_aGridNext[ClientID];
+	else
+		m_aGridFirst[m_aGridBucket[ClientID]] = m_aGridNext[ClientID];
+	if(m_aGridNext[ClientID] >= 0)
+		m_aGridPrev[m_aGridNext[ClientID]] = m_aGridPrev[ClientID];
+	m_aGridBucket[ClientID] = -1;
+	m_NumGridCharacters--;
+}
+
+void CWorldCore::BuildGrid()
+{
+	for(int i = 0; i < GRID_BUCKETS; i++)
+		m_aGridFirst[i] = -1;
+	m_NumGridCharacters = 0;
+
+	// backwards, so every bucket lists its characters in increasing order
+	for(int i = MAX_CLIENTS-1; i >= 0; i--)
+	{
+		m_aGridBucket[i] = -1;
+		if(m_apCharacters[i])
+			LinkCharacter(i, GridBucket(GridCoord(m_apCharacters[i]->m_Pos.x), GridCoord(m_apCharacters[i]->m_Pos.y)));
+	}
+	m_GridValid = true;
+}
+
+void CWorldCore::UpdateCharacterCell(int ClientID)
+{
+	if(!m_GridValid || ClientID < 0 || ClientID >= MAX_CLIENTS)
+		return;
+
+	CCharacterCore *pCore = m_apCharacters[ClientID];
+	int Bucket = pCore ? GridBucket(GridCoord(pCore->m_Pos.x), GridCoord(pCore->m_Pos.y)) : -1;
+	if(Bucket == m_aGridBucket[ClientID])
+		return;
+
+	if(m_aGridBucket[ClientID] >= 0)
+		UnlinkCharacter(ClientID);
+	if(Bucket >= 0)
+		LinkCharacter(ClientID, Bucket);
+}
+
+void CWorldCore::SetPartitions(const int *pPartition)
+{
+	m_Partitioned = pPartition != 0;
+	if(!m_Partitioned)
+		return;
+
+	for(int i = 0; i < MAX_CLIENTS; i++)
+		m_aPartitionFirst[i] = -1;
+
+	// backwards, so every partition lists its members in increasing order
+	for(int i = MAX_CLIENTS-1; i >= 0; i--)
+	{
+		m_aPartition[i] = pPartition[i];
+		if(pPartition[i] < 0)
+			continue;
+		m_aPartitionNext[i] = m_aPartitionFirst[pPartition[i]];
+		m_aPartitionFirst[pPartition[i]] = i;
+	}
+}
+
+int CWorldCore::FindCharacters(vec2 Min, vec2 Max, int *pIDs, int ClientID)
+{
+	int Num = 0;
+
+	// only the own partition, the cores of the others belong to other threads
+	if(m_Partitioned && ClientID >= 0 && ClientID < MAX_CLIENTS && m_aPartition[ClientID] >= 0)
+	{
+		for(int i = m_aPartitionFirst[m_aPartition[ClientID]]; i >= 0; i = m_aPartitionNext[i])
+		{
+			CCharacterCore *pCore = m_apCharacters[i];
+			if(pCore && pCore->m_Pos.x >= Min.x && pCore->m_Pos.x <= Max.x && pCore->m_Pos.y >= Min.y && pCore->m_Pos.y <= Max.y)
+				pIDs[Num++] = i;
+		}
+		return Num;
+	}
+
+	int MinX = GridCoord(Min.x), MinY = GridCoord(Min.y);
+	int MaxX = GridCoord(Max.x), MaxY = GridCoord(Max.y);
+
+	// walking all characters is cheaper than visiting mostly empty cells
+	if(!m_GridValid || (MaxX - MinX + 1) * (MaxY - MinY + 1) > m_NumGridCharacters)
+	{
+		for(int i = 0; i < MAX_CLIENTS; i++)
+		{
+			CCharacterCore *pCore = m_apCharacters[i];
+			if(pCore && pCore->m_Pos.x >= Min.x && pCore->m_Pos.x <= Max.x && pCore->m_Pos.y >= Min.y && pCore->m_Pos.y <= Max.y)
+				pIDs[Num++] = i;
+		}
+		return Num;
+	}
+
+	// cells can share a bucket, the live positions decide and each id is taken once
+	for(int y = MinY; y <= MaxY; y++)
+		for(int x = MinX; x <= MaxX; x++)
+			for(int i = m_aGridFirst[GridBucket(x, y)]; i >= 0; i = m_aGridNext[i])
+			{
+				CCharacterCore *pCore = m_apCharacters[i];
+				if(!pCore || pCore->m_Pos.x < Min.x || pCore->m_Pos.x > Max.x || pCore->m_Pos.y < Min.y || pCore->m_Pos.y > Max.y)
+					continue;
+
+				// insert sorted, the loops expect the ids in increasing order
+				int k = Num;
+				while(k > 0 && pIDs[k-1] >= i)
+					k--;
+				if(k < Num && pIDs[k] == i)
+					continue;
+				for(int j = Num; j > k; j--)
+					pIDs[j] = pIDs[j-1];
+				pIDs[k] = i;
+				Num++;
+			}
+	return Num;
+}
+
 void CCharacterCore::Move()
 {
-	float RampValue = VelocityRamp(length(m_Vel)*50, m_pWorld->m_Tuning[g_Config.m_ClDummy].m_VelrampStart, m_pWorld->m_Tuning[g_Config.m_ClDummy].m_VelrampRange, m_pWorld->m_Tuning[g_Config.m_ClDummy].m_VelrampCurvature);
+	CTuningParams *pTuning = Tuning();
+	float RampValue = VelocityRamp(length(m_Vel)*50, pTuning->m_VelrampStart, pTuning->m_VelrampRange, pTuning->m_VelrampCurvature);
 
 	m_Vel.x = m_Vel.x*RampValue;
 
@@ -613,9 +792,14 @@ void CCharacterCore::Move()
 
 	m_Vel.x = m_Vel.x*(1.0f/RampValue);
 
-	if(m_pWorld && m_pWorld->m_Tuning[g_Config.m_ClDummy].m_PlayerCollision && this->m_Collision)
+	if(m_pWorld && pTuning->m_PlayerCollision && this->m_Collision)
 	{
-		// check player collision
+		// check player collision, only characters near the path can get closer than 28 units
+		int aIDs[MAX_CLIENTS];
+		vec2 Margin(29.0f, 29.0f);
+		int Num = m_pWorld->FindCharacters(vec2(min(m_Pos.x, NewPos.x), min(m_Pos.y, NewPos.y))-Margin,
+			vec2(max(m_Pos.x, NewPos.x), max(m_Pos.y, NewPos.y))+Margin, aIDs, m_Id);
+
 		float Distance = distance(m_Pos, NewPos);
 		int End = Distance+1;
 		vec2 LastPos = m_Pos;
@@ -623,10 +807,11 @@ void CCharacterCore::Move()
 		{
 			float a = i/Distance;
 			vec2 Pos = mix(m_Pos, NewPos, a);
-			for(int p = 0; p < MAX_CLIENTS; p++)
+			for(int k = 0; k < Num; k++)
 			{
+				int p = aIDs[k];
 				CCharacterCore *pCharCore = m_pWorld->m_apCharacters[p];
-				if(!pCharCore || pCharCore == this || !pCharCore->m_Collision || (m_Id != -1 && !m_pTeams->CanCollide(m_Id, p)))
+				if(pCharCore == this || !pCharCore->m_Collision || (m_Id != -1 && !m_pTeams->CanCollide(m_Id, p)))
 					continue;
 				float D = distance(Pos, pCharCore->m_Pos);
 				if(D < 28.0f && D > 0.0f)
@@ -169,14 +169,71 @@ enum
 
 class CWorldCore
 {
+	enum
+	{
+		GRID_CELL_SHIFT=8, // 256 units, 8x8 tiles per cell
+		GRID_BUCKETS=256,
+	};
+
+	// hashed cells, so the world needs no map size and stays cheap to create;
+	// only valid between BuildGrid and InvalidateGrid
+	bool m_GridValid;
+	int m_NumGridCharacters;
+	int m_aGridFirst[GRID_BUCKETS];
+	int m_aGridNext[MAX_CLIENTS];
+	int m_aGridPrev[MAX_CLIENTS];
+	int m_aGridBucket[MAX_CLIENTS];
+
+	// set while partitions are ticked on several threads, the members of
+	// every partition are linked in increasing order
+	bool m_Partitioned;
+	int m_aPartition[MAX_CLIENTS];
+	int m_aPartitionFirst[MAX_CLIENTS];
+	int m_aPartitionNext[MAX_CLIENTS];
+
+	static int GridCoord(float Value);
+	static int GridBucket(int x, int y);
+	void LinkCharacter(int ClientID, int Bucket);
+	void UnlinkCharacter(int ClientID);
+
 public:
 	CWorldCore()
 	{
 		mem_zero(m_apCharacters, sizeof(m_apCharacters));
+		m_GridValid = false;
+		m_Partitioned = false;
 	}
 
 	CTuningParams m_Tuning[2];
 	class CCharacterCore *m_apCharacters[MAX_CLIENTS];
+
+	/*
+		Function: BuildGrid
+			Sorts the characters into the cells of the broadphase grid.
+			Positions that change afterwards have to be passed on with
+			<UpdateCharacterCell> until <InvalidateGrid> is called,
+			without a grid every query tests all characters.
+	*/
+	void BuildGrid();
+	void InvalidateGrid() { m_GridValid = false; }
+	void UpdateCharacterCell(int ClientID);
+
+	/*
+		Function: SetPartitions
+			Restricts the queries of a character to the characters of
+			its own partition, so that threads which tick different
+			partitions never read each other's cores.
+
+		Arguments:
+			pPartition - The partition of every client id, -1 for
+				clients without a character. 0 lifts the restriction.
+	*/
+	void SetPartitions(const int *pPartition);
+
+	// broadphase for the player interaction loops: returns the ids of the
+	// characters inside the box in increasing order, like the loops visit them.
+	// ClientID is the asking character, it selects the partition to search
+	int FindCharacters(vec2 Min, vec2 Max, int *pIDs, int ClientID = -1);
 };
 
 class CCharacterCore
@@ -234,7 +291,13 @@ public:
 	void LimitForce(vec2 *Force);
 	void ApplyForce(vec2 Force);
 
+	// handed in by the server when it ticks the core off the main thread:
+	// the tuning of the character's zone and a rand() drawn up front
+	CTuningParams *m_pTickTuning;
+	int m_HookTeleRand;
+
 private:
+	CTuningParams *Tuning();
 
 	CTeamsCore* m_pTeams;
 	int m_TileIndex;
@@ -51,6 +51,7 @@ bool CCharacter::Spawn(CPlayer *pPlayer, vec2 Pos)
 	m_Core.m_ActiveWeapon = WEAPON_GUN;
 	m_Core.m_Pos = m_Pos;
 	GameServer()->m_World.m_Core.m_apCharacters[m_pPlayer->GetCID()] = &m_Core;
+	GameServer()->m_World.m_Core.UpdateCharacterCell(m_pPlayer->GetCID());
 
 	m_ReckoningTick = 0;
 	mem_zero(&m_SendCore, sizeof(m_SendCore));
@@ -734,14 +735,30 @@ void CCharacter::Tick()
 		m_pPlayer->m_ForceBalanced = false;
 	}*/
 
-	if (m_Paused)
+	if(!TickPrepare())
 		return;
+	TickCore();
+	TickFinish();
+}
+
+bool CCharacter::TickPrepare()
+{
+	if (m_Paused)
+		return false;
 
 	DDRaceTick();
 
 	m_Core.m_Input = m_Input;
+	return true;
+}
+
+void CCharacter::TickCore()
+{
 	m_Core.Tick(true, false);
+}
 
+void CCharacter::TickFinish()
+{
 	/*// handle death-tiles and leaving gamelayer
 	if(GameServer()->Collision()->GetCollisionAt(m_Pos.x+m_ProximityRadius/3.f, m_Pos.y-m_ProximityRadius/3.f)&CCollision::COLFLAG_DEATH ||
 		GameServer()->Collision()->GetCollisionAt(m_Pos.x+m_ProximityRadius/3.f, m_Pos.y+m_ProximityRadius/3.f)&CCollision::COLFLAG_DEATH ||
@@ -765,6 +782,13 @@ void CCharacter::Tick()
 }
 
 void CCharacter::TickDefered()
+{
+	TickDeferedReckoning();
+	TickDeferedMove();
+	TickDeferedFinish();
+}
+
+void CCharacter::TickDeferedReckoning()
 {
 	// advance the dummy
 	{
@@ -775,20 +799,30 @@ void CCharacter::TickDefered()
 		m_ReckoningCore.Move();
 		m_ReckoningCore.Quantize();
 	}
+}
 
+void CCharacter::TickDeferedMove()
+{
+	// only touches this core and reads the cores it can collide with
 	//lastsentcore
-	vec2 StartPos = m_Core.m_Pos;
-	vec2 StartVel = m_Core.m_Vel;
-	bool StuckBefore = GameServer()->Collision()->TestBox(m_Core.m_Pos, vec2(28.0f, 28.0f));
+	m_DeferedStartPos = m_Core.m_Pos;
+	m_DeferedStartVel = m_Core.m_Vel;
+	m_StuckBefore = GameServer()->Collision()->TestBox(m_Core.m_Pos, vec2(28.0f, 28.0f));
 
 	m_Core.m_Id = m_pPlayer->GetCID();
 	m_Core.Move();
-	bool StuckAfterMove = GameServer()->Collision()->TestBox(m_Core.m_Pos, vec2(28.0f, 28.0f));
+	m_StuckAfterMove = GameServer()->Collision()->TestBox(m_Core.m_Pos, vec2(28.0f, 28.0f));
 	m_Core.Quantize();
-	bool StuckAfterQuant = GameServer()->Collision()->TestBox(m_Core.m_Pos, vec2(28.0f, 28.0f));
+	m_StuckAfterQuant = GameServer()->Collision()->TestBox(m_Core.m_Pos, vec2(28.0f, 28.0f));
 	m_Pos = m_Core.m_Pos;
+	GameServer()->m_World.m_Core.UpdateCharacterCell(m_pPlayer->GetCID());
+}
 
-	if(!StuckBefore && (StuckAfterMove || StuckAfterQuant))
+void CCharacter::TickDeferedFinish()
+{
+	GameWorld()->UpdateEntityCell(this);
+
+	if(!m_StuckBefore && (m_StuckAfterMove || m_StuckAfterQuant))
 	{
 		// Hackish solution to get rid of strict-aliasing warning
 		union
@@ -797,18 +831,18 @@ void CCharacter::TickDefered()
 			unsigned u;
 		}StartPosX, StartPosY, StartVelX, StartVelY;
 
-		StartPosX.f = StartPos.x;
-		StartPosY.f = StartPos.y;
-		StartVelX.f = StartVel.x;
-		StartVelY.f = StartVel.y;
+		StartPosX.f = m_DeferedStartPos.x;
+		StartPosY.f = m_DeferedStartPos.y;
+		StartVelX.f = m_DeferedStartVel.x;
+		StartVelY.f = m_DeferedStartVel.y;
 
 		char aBuf[256];
 		str_format(aBuf, sizeof(aBuf), "STUCK!!! %d %d %d %f %f %f %f %x %x %x %x",
-			StuckBefore,
-			StuckAfterMove,
-			StuckAfterQuant,
-			StartPos.x, StartPos.y,
-			StartVel.x, StartVel.y,
+			m_StuckBefore,
+			m_StuckAfterMove,
+			m_StuckAfterQuant,
+			m_DeferedStartPos.x, m_DeferedStartPos.y,
+			m_DeferedStartVel.x, m_DeferedStartVel.y,
 			StartPosX.u, StartPosY.u,
 			StartVelX.u, StartVelY.u);
 		GameServer()->Console()->Print(IConsole::OUTPUT_LEVEL_DEBUG, "game", aBuf);
@@ -2074,12 +2108,13 @@ void CCharacter::DDRacePostCoreTick()
 	HandleSkippableTiles(CurrentIndex);
 
 	// handle Anti-Skip tiles
-	std::list < int > Indices = GameServer()->Collision()->GetMapIndices(m_PrevPos, m_Pos);
-	if(!Indices.empty())
-		for(std::list < int >::iterator i = Indices.begin(); i != Indices.end(); i++)
+	CTilePath Indices(GameServer()->Collision(), m_PrevPos, m_Pos);
+	int Index = Indices.Next();
+	if(Index != -1)
+		for(; Index != -1; Index = Indices.Next())
 		{
-			HandleTiles(*i);
-			//dbg_msg("Running","%d", *i);
+			HandleTiles(Index);
+			//dbg_msg("Running","%d", Index);
 		}
 	else
 	{
@@ -2087,6 +2122,9 @@ void CCharacter::DDRacePostCoreTick()
 		//dbg_msg("Running","%d", CurrentIndex);
 	}
 
+	// teleporters and stoppers may have moved the core
+	GameServer()->m_World.m_Core.UpdateCharacterCell(m_pPlayer->GetCID());
+
 	HandleBroadcast();
 }
 
@@ -2163,6 +2201,7 @@ void CCharacter::Pause(bool Pause)
 	{
 		m_Core.m_Vel = vec2(0,0);
 		GameServer()->m_World.m_Core.m_apCharacters[m_pPlayer->GetCID()] = &m_Core;
+		GameServer()->m_World.m_Core.UpdateCharacterCell(m_pPlayer->GetCID());
 		GameServer()->m_World.InsertEntity(this);
 	}
 }
@@ -2225,6 +2264,8 @@ void CCharacter::Rescue()
 			m_LastRescue = Server()->Tick();
 			m_Core.m_Pos = m_PrevSavePos;
 			m_Pos = m_PrevSavePos;
+			GameWorld()->UpdateEntityCell(this);
+			GameServer()->m_World.m_Core.UpdateCharacterCell(m_pPlayer->GetCID());
 			m_PrevPos = m_PrevSavePos;
 			m_Core.m_Vel = vec2(0, 0);
 			m_Core.m_HookedPlayer = -1;
@@ -46,6 +46,17 @@ public:
 	virtual void Tick();
 	virtual void TickDefered();
 	virtual void TickPaused();
+
+	// the phases of Tick, TickPrepare returns false while paused. The core
+	// phase only touches the cores of the partition, like TickDeferedMove
+	bool TickPrepare();
+	void TickCore();
+	void TickFinish();
+
+	// the phases of TickDefered, split up so that the world can move independent teams in parallel
+	void TickDeferedReckoning();
+	void TickDeferedMove();
+	void TickDeferedFinish();
 	virtual void Snap(int SnappingClient);
 	virtual int NetworkClipped(int SnappingClient);
 	virtual int NetworkClipped(int SnappingClient, vec2 CheckPos);
@@ -155,6 +166,13 @@ private:
 	CCharacterCore m_SendCore; // core that we should send
 	CCharacterCore m_ReckoningCore; // the dead reckoning core
 
+	// state carried from TickDeferedMove to TickDeferedFinish
+	vec2 m_DeferedStartPos;
+	vec2 m_DeferedStartVel;
+	bool m_StuckBefore;
+	bool m_StuckAfterMove;
+	bool m_StuckAfterQuant;
+
 	// DDRace
 
 
@@ -8,6 +8,8 @@ class CTrigger;
 
 class CDoor: public CEntity
 {
+	MACRO_ALLOC_POOL()
+
 	vec2 m_To;
 	int m_EvalTick;
 	void ResetCollision();
@@ -24,6 +26,7 @@ public:
 	virtual void Reset();
 	virtual void Tick();
 	virtual void Snap(int SnappingClient);
+	virtual float SnapReach() { return distance(m_Pos, m_To); }
 };
 
 #endif
@@ -8,6 +8,8 @@
 #include <game/server/gamemodes/DDRace.h>
 #include "dragger.h"
 
+MACRO_ALLOC_POOL_IMPL(CDragger, 256)
+
 CDragger::CDragger(CGameWorld *pGameWorld, vec2 Pos, float Strength, bool NW,
 		int CatchedTeam, int Layer, int Number) :
 		CEntity(pGameWorld, CGameWorld::ENTTYPE_LASER)
@@ -7,6 +7,8 @@ class CCharacter;
 
 class CDragger: public CEntity
 {
+	MACRO_ALLOC_POOL()
+
 	vec2 m_Core;
 	float m_Strength;
 	int m_EvalTick;
@@ -26,6 +28,7 @@ public:
 	virtual void Reset();
 	virtual void Tick();
 	virtual void Snap(int snapping_client);
+	virtual float SnapReach() { return -1.0f; } // frees its solo ids on every snap
 };
 
 class CDraggerTeam
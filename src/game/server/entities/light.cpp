@@ -6,6 +6,8 @@
 #include "light.h"
 #include <game/mapitems.h>
 
+MACRO_ALLOC_POOL_IMPL(CLight, 512)
+
 CLight::CLight(CGameWorld *pGameWorld, vec2 Pos, float Rotation, int Length,
 		int Layer, int Number) :
 		CEntity(pGameWorld, CGameWorld::ENTTYPE_LASER)
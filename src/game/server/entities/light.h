@@ -6,6 +6,8 @@
 
 class CLight: public CEntity
 {
+	MACRO_ALLOC_POOL()
+
 	float m_Rotation;
 	vec2 m_To;
 	vec2 m_Core;
@@ -30,6 +32,7 @@ public:
 	virtual void Reset();
 	virtual void Tick();
 	virtual void Snap(int SnappingClient);
+	virtual float SnapReach() { return distance(m_Pos, m_To); }
 };
 
 #endif
@@ -6,6 +6,8 @@
 
 #include <game/server/teams.h>
 
+MACRO_ALLOC_POOL_IMPL(CPickup, 1024)
+
 CPickup::CPickup(CGameWorld *pGameWorld, int Type, int SubType, int Layer, int Number)
 : CEntity(pGameWorld, CGameWorld::ENTTYPE_PICKUP)
 {
@@ -7,6 +7,8 @@
 #include <game/server/gamemodes/DDRace.h>
 #include "plasma.h"
 
+MACRO_ALLOC_POOL_IMPL(CPlasma, 256)
+
 const float ACCEL = 1.1f;
 
 CPlasma::CPlasma(CGameWorld *pGameWorld, vec2 Pos, vec2 Dir, bool Freeze,
@@ -5,6 +5,8 @@
 
 class CProjectile : public CEntity
 {
+	MACRO_ALLOC_POOL()
+
 public:
 	CProjectile
 	(
@@ -30,6 +32,7 @@ public:
 	virtual void Tick();
 	virtual void TickPaused();
 	virtual void Snap(int SnappingClient);
+	virtual vec2 SnapPos();
 
 private:
 	vec2 m_Direction;
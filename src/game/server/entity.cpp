@@ -4,6 +4,74 @@
 #include "entity.h"
 #include "gamecontext.h"
 
+//////////////////////////////////////////////////
+// Entity pool
+//////////////////////////////////////////////////
+CEntityPool *CEntityPool::ms_pFirst = 0;
+
+CEntityPool::CEntityPool(const char *pName, int ObjSize, int Capacity)
+{
+	m_pName = pName;
+	m_SlotSize = (ObjSize + sizeof(CSlot) - 1) / sizeof(CSlot) * sizeof(CSlot);
+	m_Capacity = Capacity;
+	m_pData = 0;
+	m_pFirstFree = 0;
+	m_NumInitialized = 0;
+	m_Used = 0;
+	m_HighWater = 0;
+	m_HeapAllocs = 0;
+
+	// pools are static objects, they register themselves before main runs
+	m_pNext = ms_pFirst;
+	ms_pFirst = this;
+}
+
+void *CEntityPool::Alloc(int Size)
+{
+	dbg_assert(Size <= m_SlotSize, "size error");
+
+	void *pPtr;
+	if(m_pFirstFree)
+	{
+		pPtr = m_pFirstFree;
+		m_pFirstFree = m_pFirstFree->m_pNextFree;
+	}
+	else if(m_NumInitialized < m_Capacity)
+	{
+		// the slots are only allocated once the type is used
+		if(!m_pData)
+			m_pData = (char *)mem_alloc(m_SlotSize*m_Capacity, sizeof(CSlot));
+		pPtr = m_pData + m_NumInitialized*m_SlotSize;
+		m_NumInitialized++;
+	}
+	else
+	{
+		pPtr = mem_alloc(Size, 1);
+		m_HeapAllocs++;
+	}
+
+	m_Used++;
+	m_HighWater = max(m_HighWater, m_Used);
+	mem_zero(pPtr, Size);
+	return pPtr;
+}
+
+void CEntityPool::Free(void *pPtr)
+{
+	if(!pPtr)
+		return;
+
+	m_Used--;
+	if(m_pData && (char *)pPtr >= m_pData && (char *)pPtr < m_pData + m_SlotSize*m_Capacity)
+	{
+		CSlot *pSlot = (CSlot *)pPtr;
+		pSlot->m_pNextFree = m_pFirstFree;
+		m_pFirstFree = pSlot;
+	}
+	else
+		mem_free(pPtr);
+}
+
 //////////////////////////////////////////////////
 // Entity
 //////////////////////////////////////////////////
@@ -20,6 +88,10 @@ CEntity::CEntity(CGameWorld *pGameWorld, int ObjType)
 
 	m_pPrevTypeEntity = 0;
 	m_pNextTypeEntity = 0;
+	m_pPrevCellEntity = 0;
+	m_pNextCellEntity = 0;
+	m_GridCell = -1;
+	m_InsertOrder = 0;
 }
 
 CEntity::~CEntity()
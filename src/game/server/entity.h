@@ -50,6 +50,67 @@
 		mem_zero(ms_PoolData##POOLTYPE[id], sizeof(POOLTYPE)); \
 	}
 
+/*
+	Class: EntityPool
+		Fixed capacity free list allocator for one entity type. Slots are
+		handed out in O(1) and the memory is zeroed like MACRO_ALLOC_HEAP
+		does. When the pool is full it falls back to the heap.
+*/
+class CEntityPool
+{
+	union CSlot
+	{
+		CSlot *m_pNextFree;
+		char m_aAlign[16];
+	};
+
+	const char *m_pName;
+	int m_SlotSize;
+	int m_Capacity;
+	char *m_pData;
+	CSlot *m_pFirstFree;
+	int m_NumInitialized;
+
+	int m_Used;
+	int m_HighWater;
+	int m_HeapAllocs;
+
+	CEntityPool *m_pNext;
+	static CEntityPool *ms_pFirst;
+
+public:
+	CEntityPool(const char *pName, int ObjSize, int Capacity);
+
+	void *Alloc(int Size);
+	void Free(void *pPtr);
+
+	const char *Name() const { return m_pName; }
+	int Capacity() const { return m_Capacity; }
+	int Used() const { return m_Used; }
+	int HighWater() const { return m_HighWater; }
+	int HeapAllocs() const { return m_HeapAllocs; }
+
+	static CEntityPool *First() { return ms_pFirst; }
+	CEntityPool *Next() const { return m_pNext; }
+};
+
+#define MACRO_ALLOC_POOL() \
+	public: \
+	void *operator new(size_t Size); \
+	void operator delete(void *pPtr); \
+	private:
+
+#define MACRO_ALLOC_POOL_IMPL(POOLTYPE, Capacity) \
+	static CEntityPool gs_Pool##POOLTYPE(#POOLTYPE, sizeof(POOLTYPE), Capacity); \
+	void *POOLTYPE::operator new(size_t Size) \
+	{ \
+		return gs_Pool##POOLTYPE.Alloc(Size); \
+	} \
+	void POOLTYPE::operator delete(void *pPtr) \
+	{ \
+		gs_Pool##POOLTYPE.Free(pPtr); \
+	}
+
 /*
 	Class: Entity
 		Basic entity class.
@@ -62,6 +123,12 @@ class CEntity
 	CEntity *m_pPrevTypeEntity;
 	CEntity *m_pNextTypeEntity;
 
+	// spatial grid handling
+	CEntity *m_pPrevCellEntity;
+	CEntity *m_pNextCellEntity;
+	int m_GridCell;
+	int64 m_InsertOrder;
+
 protected:
 	class CGameWorld *m_pGameWorld;
 	bool m_MarkedForDestroy;
@@ -141,6 +208,24 @@ public:
 	virtual int NetworkClipped(int SnappingClient);
 	virtual int NetworkClipped(int SnappingClient, vec2 CheckPos);
 
+	/*
+		Function: SnapPos
+			Position the world buckets the entity by when building
+			the per client visibility sets.
+	*/
+	virtual vec2 SnapPos() { return m_Pos; }
+
+	/*
+		Function: SnapReach
+			How far from SnapPos the positions passed to NetworkClipped
+			can be.
+
+		Returns:
+			The distance, or a negative value if the entity has to be
+			snapped for every client regardless of its position.
+	*/
+	virtual float SnapReach() { return 0.0f; }
+
 	bool GameLayerClipped(vec2 CheckPos);
 
 	/*
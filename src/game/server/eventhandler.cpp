@@ -2,6 +2,7 @@
 /* If you are missing that file, acquire a complete release at teeworlds.com.                */
 #include "eventhandler.h"
 #include "gamecontext.h"
+#include <algorithm>
 
 //////////////////////////////////////////////////
 // Event handler
@@ -9,9 +10,21 @@
 CEventHandler::CEventHandler()
 {
 	m_pGameServer = 0;
+	m_pCellStart = 0;
+	m_CellsWidth = 0;
+	m_CellsHeight = 0;
+	m_PeakEvents = 0;
+	m_DroppedEvents = 0;
+	m_DroppedData = 0;
 	Clear();
 }
 
+CEventHandler::~CEventHandler()
+{
+	if(m_pCellStart)
+		mem_free(m_pCellStart);
+}
+
 void CEventHandler::SetGameServer(CGameContext *pGameServer)
 {
 	m_pGameServer = pGameServer;
@@ -20,9 +33,15 @@ void CEventHandler::SetGameServer(CGameContext *pGameServer)
 void *CEventHandler::Create(int Type, int Size, int64_t Mask)
 {
 	if(m_NumEvents == MAX_EVENTS)
+	{
+		m_DroppedEvents++;
 		return 0;
+	}
 	if(m_CurrentOffset+Size >= MAX_DATASIZE)
+	{
+		m_DroppedData++;
 		return 0;
+	}
 
 	void *p = &m_aData[m_CurrentOffset];
 	m_aOffsets[m_NumEvents] = m_CurrentOffset;
@@ -31,28 +50,107 @@ void *CEventHandler::Create(int Type, int Size, int64_t Mask)
 	m_aClientMasks[m_NumEvents] = Mask;
 	m_CurrentOffset += Size;
 	m_NumEvents++;
+	m_BucketsValid = false;
 	return p;
 }
 
 void CEventHandler::Clear()
 {
+	m_PeakEvents = max(m_PeakEvents, m_NumEvents);
 	m_NumEvents = 0;
 	m_CurrentOffset = 0;
+	m_BucketsValid = false;
 }
 
-void CEventHandler::Snap(int SnappingClient)
+void CEventHandler::Stats(int *pPeak, int *pDroppedEvents, int *pDroppedData) const
 {
+	*pPeak = max(m_PeakEvents, m_NumEvents);
+	*pDroppedEvents = m_DroppedEvents;
+	*pDroppedData = m_DroppedData;
+}
+
+void CEventHandler::BuildBuckets()
+{
+	// the creator fills in the position after Create() returns, so the
+	// buckets can only be built once the snapping starts
+	int Width = (GameServer()->Collision()->GetWidth()*32 >> CELL_SHIFT) + 1;
+	int Height = (GameServer()->Collision()->GetHeight()*32 >> CELL_SHIFT) + 1;
+	if(!m_pCellStart || Width != m_CellsWidth || Height != m_CellsHeight)
+	{
+		if(m_pCellStart)
+			mem_free(m_pCellStart);
+		m_CellsWidth = Width;
+		m_CellsHeight = Height;
+		m_pCellStart = (int *)mem_alloc((Width*Height+2)*sizeof(int), 1);
+	}
+
+	// counting sort by cell. Afterwards the events of cell c are
+	// m_aSorted[m_pCellStart[c+1]] up to m_aSorted[m_pCellStart[c+2]],
+	// filling backwards keeps each bucket in creation order.
+	int aCells[MAX_EVENTS];
+	mem_zero(m_pCellStart, (Width*Height+2)*sizeof(int));
 	for(int i = 0; i < m_NumEvents; i++)
 	{
-		if(SnappingClient == -1 || CmaskIsSet(m_aClientMasks[i], SnappingClient))
+		CNetEvent_Common *pEvent = (CNetEvent_Common *)&m_aData[m_aOffsets[i]];
+		aCells[i] = clamp(pEvent->m_Y >> CELL_SHIFT, 0, Height-1)*Width + clamp(pEvent->m_X >> CELL_SHIFT, 0, Width-1);
+		m_pCellStart[aCells[i]+1]++;
+	}
+	for(int c = 2; c <= Width*Height; c++)
+		m_pCellStart[c] += m_pCellStart[c-1];
+	for(int i = m_NumEvents-1; i >= 0; i--)
+		m_aSorted[--m_pCellStart[aCells[i]+1]] = i;
+	m_pCellStart[Width*Height+1] = m_NumEvents;
+	m_BucketsValid = true;
+}
+
+void CEventHandler::SnapEvent(int Index, int SnappingClient)
+{
+	if(SnappingClient == -1 || CmaskIsSet(m_aClientMasks[Index], SnappingClient))
+	{
+		CNetEvent_Common *ev = (CNetEvent_Common *)&m_aData[m_aOffsets[Index]];
+		if(SnappingClient == -1 || distance(GameServer()->m_apPlayers[SnappingClient]->m_ViewPos, vec2(ev->m_X, ev->m_Y)) < 1500.0f)
+		{
+			void *d = GameServer()->Server()->SnapNewItem(m_aTypes[Index], Index, m_aSizes[Index]);
+			if(d)
+				mem_copy(d, &m_aData[m_aOffsets[Index]], m_aSizes[Index]);
+		}
+	}
+}
+
+void CEventHandler::Snap(int SnappingClient)
+{
+	if(SnappingClient != -1)
+	{
+		if(!m_BucketsValid)
+			BuildBuckets();
+
+		vec2 ViewPos = GameServer()->m_apPlayers[SnappingClient]->m_ViewPos;
+		int MinX = clamp(((int)ViewPos.x - 1501) >> CELL_SHIFT, 0, m_CellsWidth-1);
+		int MinY = clamp(((int)ViewPos.y - 1501) >> CELL_SHIFT, 0, m_CellsHeight-1);
+		int MaxX = clamp(((int)ViewPos.x + 1501) >> CELL_SHIFT, 0, m_CellsWidth-1);
+		int MaxY = clamp(((int)ViewPos.y + 1501) >> CELL_SHIFT, 0, m_CellsHeight-1);
+
+		// walking all events is cheaper than visiting mostly empty cells
+		if((MaxX-MinX+1)*(MaxY-MinY+1) < m_NumEvents)
 		{
-			CNetEvent_Common *ev = (CNetEvent_Common *)&m_aData[m_aOffsets[i]];
-			if(SnappingClient == -1 || distance(GameServer()->m_apPlayers[SnappingClient]->m_ViewPos, vec2(ev->m_X, ev->m_Y)) < 1500.0f)
-			{
-				void *d = GameServer()->Server()->SnapNewItem(m_aTypes[i], i, m_aSizes[i]);
-				if(d)
-					mem_copy(d, &m_aData[m_aOffsets[i]], m_aSizes[i]);
-			}
+			int aCandidates[MAX_EVENTS];
+			int Num = 0;
+			for(int y = MinY; y <= MaxY; y++)
+				for(int x = MinX; x <= MaxX; x++)
+				{
+					int Cell = y*m_CellsWidth + x;
+					for(int i = m_pCellStart[Cell+1]; i < m_pCellStart[Cell+2]; i++)
+						aCandidates[Num++] = m_aSorted[i];
+				}
+
+			// keep the creation order of the full walk
+			std::sort(aCandidates, aCandidates+Num);
+			for(int i = 0; i < Num; i++)
+				SnapEvent(aCandidates[i], SnappingClient);
+			return;
 		}
 	}
+
+	for(int i = 0; i < m_NumEvents; i++)
+		SnapEvent(i, SnappingClient);
 }
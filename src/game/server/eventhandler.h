@@ -14,8 +14,9 @@ typedef unsigned __int64 uint64_t;
 //
 class CEventHandler
 {
-	static const int MAX_EVENTS = 128;
-	static const int MAX_DATASIZE = 128*64;
+	static const int MAX_EVENTS = 512;
+	static const int MAX_DATASIZE = 512*64;
+	static const int CELL_SHIFT = 9;
 
 	int m_aTypes[MAX_EVENTS]; // TODO: remove some of these arrays
 	int m_aOffsets[MAX_EVENTS];
@@ -23,18 +24,36 @@ class CEventHandler
 	int64_t m_aClientMasks[MAX_EVENTS];
 	char m_aData[MAX_DATASIZE];
 
+	// events bucketed by position, built on the first snap after events were created
+	int m_aSorted[MAX_EVENTS];
+	int *m_pCellStart;
+	int m_CellsWidth;
+	int m_CellsHeight;
+	bool m_BucketsValid;
+
 	class CGameContext *m_pGameServer;
 
 	int m_CurrentOffset;
 	int m_NumEvents;
+
+	int m_PeakEvents;
+	int m_DroppedEvents;
+	int m_DroppedData;
+
+	void BuildBuckets();
+	void SnapEvent(int Index, int SnappingClient);
 public:
 	CGameContext *GameServer() const { return m_pGameServer; }
 	void SetGameServer(CGameContext *pGameServer);
 
 	CEventHandler();
+	~CEventHandler();
 	void *Create(int Type, int Size, int64_t Mask = -1LL);
 	void Clear();
 	void Snap(int SnappingClient);
+
+	// most events in a tick and events lost because the event or data buffer was full
+	void Stats(int *pPeak, int *pDroppedEvents, int *pDroppedData) const;
 };
 
 #endif
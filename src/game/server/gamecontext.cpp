@@ -23,6 +23,8 @@
 #include <string.h>
 #include <engine/server/server.h>
 #include "gamemodes/DDRace.h"
+#include "entities/projectile.h"
+#include "save.h"
 #include "score.h"
 #include "score/file_score.h"
 #include <time.h>
@@ -52,6 +54,19 @@ void CGameContext::Construct(int Resetting)
 	m_LastMapVote = 0;
 	//m_LockTeams = 0;
 
+	m_StressProjectiles = 0;
+	m_StressTicks = 0;
+	m_StressTicksDone = 0;
+	m_StressWorldTime = 0;
+
+	for(int i = 0; i < NUM_TUNINGZONES; i++)
+		m_apTuningMsgs[i] = 0;
+	m_TuningGeneration = 1;
+	m_TuningMsgsPacked = 0;
+	m_TuningMsgsSent = 0;
+	m_TuningMsgsSecond = 0;
+	m_TuningMsgsLastSecond = 0;
+
 	if(Resetting==NO_RESET)
 	{
 		m_pVoteOptionHeap = new CHeap();
@@ -80,7 +95,16 @@ CGameContext::~CGameContext()
 		delete m_pVoteOptionHeap;
 
 	if(m_pScore)
-		delete m_pScore;
+		m_pScore->Release();
+#if defined(CONF_SQL)
+	// the process ends, the saves of the last map have to be in the database first
+	if(!m_Resetting)
+		CSqlPool::Shutdown();
+#endif
+
+	for(int i = 0; i < NUM_TUNINGZONES; i++)
+		if(m_apTuningMsgs[i])
+			mem_free(m_apTuningMsgs[i]);
 }
 
 void CGameContext::Clear()
@@ -289,9 +313,19 @@ void CGameContext::SendChatTarget(int To, const char *pText)
 
 void CGameContext::SendChatTeam(int Team, const char *pText)
 {
+	CClientMask Recipients;
 	for(int i = 0; i<MAX_CLIENTS; i++)
 		if(((CGameControllerDDRace*)m_pController)->m_Teams.m_Core.Team(i) == Team)
-			SendChatTarget(i, pText);
+			Recipients.Set(i);
+
+	CNetMsg_Sv_Chat Msg;
+	Msg.m_Team = 0;
+	Msg.m_ClientID = -1;
+	Msg.m_pMessage = pText;
+	if(g_Config.m_SvDemoChat)
+		Server()->SendPackMsgMask(&Msg, MSGFLAG_VITAL, Recipients);
+	else
+		Server()->SendPackMsgMask(&Msg, MSGFLAG_VITAL|MSGFLAG_NORECORD, Recipients);
 }
 
 void CGameContext::SendChat(int ChatterClientID, int Team, const char *pText, int SpamProtectionClientID)
@@ -332,13 +366,15 @@ void CGameContext::SendChat(int ChatterClientID, int Team, const char *pText, in
 			Server()->SendPackMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_NOSEND, -1);
 
 		// send to the clients
+		CClientMask Recipients;
 		for(int i = 0; i < MAX_CLIENTS; i++)
 		{
 			if(m_apPlayers[i] != 0) {
 				if(!m_apPlayers[i]->m_DND)
-					Server()->SendPackMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_NORECORD, i);
+					Recipients.Set(i);
 			}
 		}
+		Server()->SendPackMsgMask(&Msg, MSGFLAG_VITAL|MSGFLAG_NORECORD, Recipients);
 	}
 	else
 	{
@@ -353,20 +389,22 @@ void CGameContext::SendChat(int ChatterClientID, int Team, const char *pText, in
 			Server()->SendPackMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_NOSEND, -1);
 
 		// send to the clients
+		CClientMask Recipients;
 		for(int i = 0; i < MAX_CLIENTS; i++)
 		{
 			if(m_apPlayers[i] != 0) {
 				if(Team == CHAT_SPEC) {
 					if(m_apPlayers[i]->GetTeam() == CHAT_SPEC) {
-						Server()->SendPackMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_NORECORD, i);
+						Recipients.Set(i);
 					}
 				} else {
 					if(Teams->Team(i) == Team && m_apPlayers[i]->GetTeam() != CHAT_SPEC) {
-						Server()->SendPackMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_NORECORD, i);
+						Recipients.Set(i);
 					}
 				}
 			}
 		}
+		Server()->SendPackMsgMask(&Msg, MSGFLAG_VITAL|MSGFLAG_NORECORD, Recipients);
 	}
 }
 
@@ -444,6 +482,29 @@ void CGameContext::SendVoteSet(int ClientID)
 
 void CGameContext::SendVoteStatus(int ClientID, int Total, int Yes, int No)
 {
+	if(ClientID == -1)
+	{
+		// old clients get the scaled down numbers, everyone else shares one message
+		CClientMask Recipients;
+		for(int i = 0; i < MAX_CLIENTS; i++)
+		{
+			if(!Server()->ClientIngame(i))
+				continue;
+			if(Total > VANILLA_MAX_CLIENTS && m_apPlayers[i] && m_apPlayers[i]->m_ClientVersion <= VERSION_DDRACE)
+				SendVoteStatus(i, Total, Yes, No);
+			else
+				Recipients.Set(i);
+		}
+
+		CNetMsg_Sv_VoteStatus Msg = {0};
+		Msg.m_Total = Total;
+		Msg.m_Yes = Yes;
+		Msg.m_No = No;
+		Msg.m_Pass = Total - (Yes+No);
+		Server()->SendPackMsgMask(&Msg, MSGFLAG_VITAL, Recipients);
+		return;
+	}
+
 	if (Total > VANILLA_MAX_CLIENTS && m_apPlayers[ClientID] && m_apPlayers[ClientID]->m_ClientVersion <= VERSION_DDRACE)
 	{
 		Yes = float(Yes) * VANILLA_MAX_CLIENTS / float(Total);
@@ -484,10 +545,58 @@ void CGameContext::CheckPureTuning()
 		{
 			Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", "resetting tuning due to pure server");
 			m_Tuning = p;
+			InvalidateTuningMsgs();
 		}
 	}
 }
 
+const CGameContext::CTuningMsg *CGameContext::GetTuningMsg(int Zone, int Variant)
+{
+	if(!m_apTuningMsgs[Zone])
+	{
+		m_apTuningMsgs[Zone] = (CTuningMsg *)mem_alloc(sizeof(CTuningMsg)*NUM_TUNEVARIANTS, 1);
+		mem_zero(m_apTuningMsgs[Zone], sizeof(CTuningMsg)*NUM_TUNEVARIANTS);
+	}
+
+	CTuningMsg *pTuningMsg = &m_apTuningMsgs[Zone][Variant];
+	if(pTuningMsg->m_Generation == m_TuningGeneration)
+		return pTuningMsg;
+
+	int *pParams = 0;
+	if (Zone == 0)
+		pParams = (int *)&m_Tuning;
+	else
+		pParams = (int *)&(m_TuningList[Zone]);
+
+	// the shorter messages for older clients are prefixes of the full one
+	CPacker Packer;
+	Packer.Reset();
+	unsigned int Num = sizeof(m_Tuning)/sizeof(int);
+	for(unsigned i = 0; i < Num; i++)
+	{
+		if((i==31 && (Variant&TUNEVARIANT_NOCOLL)) || // collision
+			(i==32 && (Variant&TUNEVARIANT_NOHOOK)) || // hooking
+			(i==3 && (Variant&TUNEVARIANT_NOJUMP)) || // ground jump impulse
+			(i==33 && (Variant&TUNEVARIANT_NOJETPACK)) || // jetpack
+			(i==36 && (Variant&TUNEVARIANT_NOHAMMER))) // hammer hit
+			Packer.AddInt(0);
+		else
+			Packer.AddInt(pParams[i]);
+
+		if(i+1 == 33)
+			pTuningMsg->m_aSize[TUNECUT_EXTRATUNES] = Packer.Size();
+		else if(i+1 == 37)
+			pTuningMsg->m_aSize[TUNECUT_HOOKDURATION] = Packer.Size();
+		else if(i+1 == 38)
+			pTuningMsg->m_aSize[TUNECUT_FIREDELAY] = Packer.Size();
+	}
+	pTuningMsg->m_aSize[TUNECUT_ALL] = Packer.Size();
+	mem_copy(pTuningMsg->m_aData, Packer.Data(), Packer.Size());
+	pTuningMsg->m_Generation = m_TuningGeneration;
+	m_TuningMsgsPacked++;
+	return pTuningMsg;
+}
+
 void CGameContext::SendTuningParams(int ClientID, int Zone)
 {
 	if (ClientID == -1)
@@ -512,61 +621,38 @@ void CGameContext::SendTuningParams(int ClientID, int Zone)
 
 	CheckPureTuning();
 
+	CPlayer *pPlayer = m_apPlayers[ClientID];
+	int Cut = TUNECUT_ALL;
+	if (pPlayer && pPlayer->m_ClientVersion < VERSION_DDNET_EXTRATUNES)
+		Cut = TUNECUT_EXTRATUNES;
+	else if (pPlayer && pPlayer->m_ClientVersion < VERSION_DDNET_HOOKDURATION_TUNE)
+		Cut = TUNECUT_HOOKDURATION;
+	else if (pPlayer && pPlayer->m_ClientVersion < VERSION_DDNET_FIREDELAY_TUNE)
+		Cut = TUNECUT_FIREDELAY;
+
+	// if everything is normal just send true tunings
+	int Variant = 0;
+	if (pPlayer && pPlayer->GetCharacter())
+	{
+		int Faketuning = pPlayer->GetCharacter()->NeededFaketuning();
+		if(Faketuning & (FAKETUNE_SOLO|FAKETUNE_NOCOLL))
+			Variant |= TUNEVARIANT_NOCOLL;
+		if(Faketuning & (FAKETUNE_SOLO|FAKETUNE_NOHOOK))
+			Variant |= TUNEVARIANT_NOHOOK;
+		if(Faketuning & FAKETUNE_NOJUMP)
+			Variant |= TUNEVARIANT_NOJUMP;
+		if(!(Faketuning & FAKETUNE_JETPACK))
+			Variant |= TUNEVARIANT_NOJETPACK;
+		if(Faketuning & FAKETUNE_NOHAMMER)
+			Variant |= TUNEVARIANT_NOHAMMER;
+	}
+
+	const CTuningMsg *pTuningMsg = GetTuningMsg(Zone, Variant);
 	CMsgPacker Msg(NETMSGTYPE_SV_TUNEPARAMS);
-	int *pParams = 0;
-	if (Zone == 0)
-		pParams = (int *)&m_Tuning;
-	else
-		pParams = (int *)&(m_TuningList[Zone]);
-
-	unsigned int last = sizeof(m_Tuning)/sizeof(int);
-	if (m_apPlayers[ClientID] && m_apPlayers[ClientID]->m_ClientVersion < VERSION_DDNET_EXTRATUNES)
-		last = 33;
-	else if (m_apPlayers[ClientID] && m_apPlayers[ClientID]->m_ClientVersion < VERSION_DDNET_HOOKDURATION_TUNE)
-		last = 37;
-	else if (m_apPlayers[ClientID] && m_apPlayers[ClientID]->m_ClientVersion < VERSION_DDNET_FIREDELAY_TUNE)
-		last = 38;
-
-	for(unsigned i = 0; i < last; i++)
-		{
-			if (m_apPlayers[ClientID] && m_apPlayers[ClientID]->GetCharacter())
-			{
-				if((i==31) // collision
-				&& (m_apPlayers[ClientID]->GetCharacter()->NeededFaketuning() & FAKETUNE_SOLO
-				 || m_apPlayers[ClientID]->GetCharacter()->NeededFaketuning() & FAKETUNE_NOCOLL))
-				{
-					Msg.AddInt(0);
-				}
-				else if((i==32) // hooking
-				&& (m_apPlayers[ClientID]->GetCharacter()->NeededFaketuning() & FAKETUNE_SOLO
-				 || m_apPlayers[ClientID]->GetCharacter()->NeededFaketuning() & FAKETUNE_NOHOOK))
-				{
-					Msg.AddInt(0);
-				}
-				else if((i==3) // ground jump impulse
-				&& m_apPlayers[ClientID]->GetCharacter()->NeededFaketuning() & FAKETUNE_NOJUMP)
-				{
-					Msg.AddInt(0);
-				}
-				else if((i==33) // jetpack
-				&& !(m_apPlayers[ClientID]->GetCharacter()->NeededFaketuning() & FAKETUNE_JETPACK))
-				{
-					Msg.AddInt(0);
-				}
-				else if((i==36) // hammer hit
-				&& m_apPlayers[ClientID]->GetCharacter()->NeededFaketuning() & FAKETUNE_NOHAMMER)
-				{
-					Msg.AddInt(0);
-				}
-				else
-				{
-					Msg.AddInt(pParams[i]);
-				}
-			}
-			else
-				Msg.AddInt(pParams[i]); // if everything is normal just send true tunings
-		}
-		Server()->SendMsg(&Msg, MSGFLAG_VITAL, ClientID);
+	Msg.AddRaw(pTuningMsg->m_aData, pTuningMsg->m_aSize[Cut]);
+	Server()->SendMsg(&Msg, MSGFLAG_VITAL, ClientID);
+	m_TuningMsgsSent++;
+	m_TuningMsgsSecond++;
 }
 /*
 void CGameContext::SwapTeams()
@@ -592,11 +678,38 @@ void CGameContext::OnTick()
 
 	// copy tuning
 	m_World.m_Core.m_Tuning[0] = m_Tuning;
-	m_World.Tick();
+
+	if(Server()->Tick() % Server()->TickSpeed() == 0)
+	{
+		m_TuningMsgsLastSecond = m_TuningMsgsSecond;
+		m_TuningMsgsSecond = 0;
+	}
+	if(m_StressTicks > 0)
+	{
+		StressProjectiles();
+		int64 WorldStart = time_get();
+		m_World.Tick();
+		m_StressWorldTime += time_get() - WorldStart;
+		m_StressTicksDone++;
+		if(--m_StressTicks == 0)
+		{
+			char aBuf[256];
+			str_format(aBuf, sizeof(aBuf), "fired %d projectiles in %d ticks, world tick took %.3fms on average",
+				m_StressProjectiles*m_StressTicksDone, m_StressTicksDone, m_StressWorldTime*1000.0/time_freq()/m_StressTicksDone);
+			Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "stress", aBuf);
+			PrintPoolStats();
+		}
+	}
+	else
+		m_World.Tick();
 
 	//if(world.paused) // make sure that the game object always updates
 	m_pController->Tick();
 
+	// deliver finished score requests
+	if(m_pScore)
+		m_pScore->OnTick();
+
 	for(int i = 0; i < MAX_CLIENTS; i++)
 	{
 		if(m_apPlayers[i])
@@ -745,9 +858,7 @@ void CGameContext::OnTick()
 			else if(m_VoteUpdate)
 			{
 				m_VoteUpdate = false;
-				for(int i = 0; i < MAX_CLIENTS; ++i)
-					if(Server()->ClientIngame(i))
-						SendVoteStatus(i, Total, Yes, No);
+				SendVoteStatus(-1, Total, Yes, No);
 			}
 		}
 	}
@@ -1734,6 +1845,7 @@ void CGameContext::ConTuneParam(IConsole::IResult *pResult, void *pUserData)
 		char aBuf[256];
 		str_format(aBuf, sizeof(aBuf), "%s changed to %.2f", pParamName, NewValue);
 		pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "tuning", aBuf);
+		pSelf->InvalidateTuningMsgs();
 		pSelf->SendTuningParams(-1);
 	}
 	else
@@ -1764,6 +1876,122 @@ void CGameContext::ConTuneDump(IConsole::IResult *pResult, void *pUserData)
 	}
 }
 
+void CGameContext::ConTuneStats(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	char aBuf[256];
+	str_format(aBuf, sizeof(aBuf), "sent=%d last_second=%d packed=%d", pSelf->m_TuningMsgsSent, pSelf->m_TuningMsgsLastSecond, pSelf->m_TuningMsgsPacked);
+	pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "tuning", aBuf);
+}
+
+void CGameContext::ConSnapStats(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	char aBuf[256];
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if(!pSelf->m_apPlayers[i])
+			continue;
+
+		int Considered, Snapped;
+		pSelf->m_World.SnapStats(i, &Considered, &Snapped);
+		str_format(aBuf, sizeof(aBuf), "id=%d considered=%d snapped=%d", i, Considered, Snapped);
+		pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "snap", aBuf);
+	}
+}
+
+void CGameContext::ConPlayerMapStats(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	pSelf->m_World.PrintPlayerMapStats(pSelf->Console());
+}
+
+void CGameContext::ConEventStats(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	int Peak, DroppedEvents, DroppedData;
+	pSelf->m_Events.Stats(&Peak, &DroppedEvents, &DroppedData);
+	char aBuf[256];
+	str_format(aBuf, sizeof(aBuf), "peak=%d dropped_events=%d dropped_data=%d", Peak, DroppedEvents, DroppedData);
+	pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "events", aBuf);
+}
+
+void CGameContext::PrintPoolStats()
+{
+	char aBuf[256];
+	for(CEntityPool *pPool = CEntityPool::First(); pPool; pPool = pPool->Next())
+	{
+		str_format(aBuf, sizeof(aBuf), "%s used=%d high_water=%d capacity=%d heap=%d",
+			pPool->Name(), pPool->Used(), pPool->HighWater(), pPool->Capacity(), pPool->HeapAllocs());
+		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "pool", aBuf);
+	}
+}
+
+void CGameContext::ConPoolStats(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	pSelf->PrintPoolStats();
+}
+
+void CGameContext::StressProjectiles()
+{
+	// ownerless gun shots from random spots of the map, like turrets fire them
+	int Width = Collision()->GetWidth()*32;
+	int Height = Collision()->GetHeight()*32;
+	for(int i = 0; i < m_StressProjectiles; i++)
+	{
+		vec2 Pos = vec2(rand()%Width, rand()%Height);
+		vec2 Dir = GetDir((rand()%3600)/1800.0f*pi);
+		new CProjectile(&m_World, WEAPON_GUN, -1, Pos, Dir, Server()->TickSpeed(), false, false, 0, -1, WEAPON_GUN);
+	}
+}
+
+void CGameContext::ConStressProjectiles(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	pSelf->m_StressProjectiles = pResult->NumArguments() > 0 ? max(1, pResult->GetInteger(0)) : 100;
+	pSelf->m_StressTicks = (pResult->NumArguments() > 1 ? max(1, pResult->GetInteger(1)) : 10) * pSelf->Server()->TickSpeed();
+	pSelf->m_StressTicksDone = 0;
+	pSelf->m_StressWorldTime = 0;
+}
+
+void CGameContext::ConSaveBench(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	int NumTees = pResult->NumArguments() > 0 ? clamp(pResult->GetInteger(0), 1, (int)MAX_CLIENTS) : MAX_CLIENTS;
+	int Iterations = pResult->NumArguments() > 1 ? max(1, pResult->GetInteger(1)) : 100;
+	CSaveTeam *pSavedTeam = new CSaveTeam(pSelf->m_pController);
+	pSavedTeam->Benchmark(NumTees, Iterations, pSelf->Console());
+	delete pSavedTeam;
+}
+
+void CGameContext::ConScoreStats(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	if(pSelf->m_pScore)
+		pSelf->m_pScore->PrintStats(pSelf->Console());
+}
+
+#if defined(CONF_SQL)
+void CGameContext::ConSqlLoadTest(IConsole::IResult *pResult, void *pUserData)
+{
+	CGameContext *pSelf = (CGameContext *)pUserData;
+	if(!g_Config.m_SvUseSQL || !pSelf->m_pScore)
+	{
+		pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", "the load test needs sv_use_sql 1");
+		return;
+	}
+
+	int Finishes = pResult->NumArguments() > 0 ? max(1, pResult->GetInteger(0)) : 1000;
+	int Players = pResult->NumArguments() > 1 ? max(1, pResult->GetInteger(1)) : 100;
+	((CSqlScore *)pSelf->m_pScore)->LoadTest(Finishes, Players);
+
+	char aBuf[128];
+	str_format(aBuf, sizeof(aBuf), "queued %d finishes of %d players, check score_stats for the results", Finishes, Players);
+	pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", aBuf);
+}
+#endif
+
 void CGameContext::ConTuneZone(IConsole::IResult *pResult, void *pUserData)
 {
 	CGameContext *pSelf = (CGameContext *)pUserData;
@@ -1778,6 +2006,7 @@ void CGameContext::ConTuneZone(IConsole::IResult *pResult, void *pUserData)
 			char aBuf[256];
 			str_format(aBuf, sizeof(aBuf), "%s in zone %d changed to %.2f", pParamName, List, NewValue);
 			pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "tuning", aBuf);
+			pSelf->InvalidateTuningMsgs();
 			pSelf->SendTuningParams(-1, List);
 		}
 		else
@@ -1815,11 +2044,13 @@ void CGameContext::ConTuneResetZone(IConsole::IResult *pResult, void *pUserData)
 			char aBuf[256];
 			str_format(aBuf, sizeof(aBuf), "Tunezone %d resetted", List);
 			pSelf->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "tuning", aBuf);
+			pSelf->InvalidateTuningMsgs();
 			pSelf->SendTuningParams(-1, List);
 		}
 	}
 	else
 	{
+		pSelf->InvalidateTuningMsgs();
 		for (int i = 0; i < NUM_TUNINGZONES; i++)
 		{
 			*(pSelf->TuningList()+i) = TuningParams;
@@ -2311,6 +2542,17 @@ void CGameContext::OnConsoleInit()
 	Console()->Register("tune", "s[tuning] i[value]", CFGFLAG_SERVER|CFGFLAG_GAME, ConTuneParam, this, "Tune variable to value");
 	Console()->Register("tune_reset", "", CFGFLAG_SERVER, ConTuneReset, this, "Reset tuning");
 	Console()->Register("tune_dump", "", CFGFLAG_SERVER, ConTuneDump, this, "Dump tuning");
+	Console()->Register("snap_stats", "", CFGFLAG_SERVER, ConSnapStats, this, "Show how many entities the last snapshot of each client considered and snapped");
+	Console()->Register("event_stats", "", CFGFLAG_SERVER, ConEventStats, this, "Show the most events in a tick and how many were dropped because the buffers were full");
+	Console()->Register("tune_stats", "", CFGFLAG_SERVER, ConTuneStats, this, "Show how many tuning messages were sent, in the last second and how often they had to be packed");
+	Console()->Register("player_map_stats", "", CFGFLAG_SERVER, ConPlayerMapStats, this, "Show how long the vanilla id map updates take and how many maps were rebuilt");
+	Console()->Register("pool_stats", "", CFGFLAG_SERVER, ConPoolStats, this, "Show the occupancy and high water mark of the entity pools");
+	Console()->Register("stress_projectiles", "?i[per tick] ?i[seconds]", CFGFLAG_SERVER, ConStressProjectiles, this, "Fire projectiles from random spots of the map every tick and report the world tick time and entity pools");
+	Console()->Register("savegame_bench", "?i[tees] ?i[iterations]", CFGFLAG_SERVER, ConSaveBench, this, "Time saving and loading a synthetic team in the text and binary savegame formats");
+	Console()->Register("score_stats", "", CFGFLAG_SERVER, ConScoreStats, this, "Show the request queue and latency of the score backend");
+#if defined(CONF_SQL)
+	Console()->Register("sql_load_test", "?i[finishes] ?i[players]", CFGFLAG_SERVER, ConSqlLoadTest, this, "Save synthetic finishes on a separate test map to measure the SQL save path");
+#endif
 	Console()->Register("tune_zone", "i[zone] s[tuning] i[value]", CFGFLAG_SERVER|CFGFLAG_GAME, ConTuneZone, this, "Tune in zone a variable to value");
 	Console()->Register("tune_zone_dump", "i[zone]", CFGFLAG_SERVER, ConTuneDumpZone, this, "Dump zone tuning in zone x");
 	Console()->Register("tune_zone_reset", "?i[zone]", CFGFLAG_SERVER, ConTuneResetZone, this, "reset zone tuning in zone x or in all zones");
@@ -2361,6 +2603,7 @@ void CGameContext::OnInit(/*class IKernel *pKernel*/)
 
 	m_Layers.Init(Kernel());
 	m_Collision.Init(&m_Layers);
+	m_World.InitGrid(m_Collision.GetWidth(), m_Collision.GetHeight());
 
 	// reset everything here
 	//world = new GAMEWORLD;
@@ -2437,7 +2680,7 @@ void CGameContext::OnInit(/*class IKernel *pKernel*/)
 
 	// delete old score object
 	if(m_pScore)
-		delete m_pScore;
+		m_pScore->Release();
 
 	// create score object (add sql later)
 #if defined(CONF_SQL)
@@ -2557,6 +2800,9 @@ void CGameContext::OnInit(/*class IKernel *pKernel*/)
 		}
 	}
 
+	// the map settings and tiles above changed the tunings directly
+	InvalidateTuningMsgs();
+
 	//game.world.insert_entity(game.Controller);
 
 #ifdef CONF_DEBUG
@@ -2586,7 +2832,14 @@ void CGameContext::OnMapChange(char *pNewMapName, int MapNameSize)
 
 	char aConfig[128];
 	char aTemp[128];
-	str_format(aConfig, sizeof(aConfig), "maps/%s.cfg", g_Config.m_SvMap);
+
+	// maps/<name>.map has its settings in maps/<name>.cfg. don't use sv_map
+	// here, it can change while the map is loaded on another thread
+	str_copy(aConfig, pNewMapName, sizeof(aConfig));
+	int NameLength = str_length(aConfig);
+	if(NameLength > 4 && str_comp(aConfig+NameLength-4, ".map") == 0)
+		aConfig[NameLength-4] = 0;
+	str_append(aConfig, ".cfg", sizeof(aConfig));
 	str_format(aTemp, sizeof(aTemp), "%s.temp.%d", pNewMapName, pid());
 
 	IOHANDLE File = pStorage->OpenFile(aConfig, IOFLAG_READ, IStorage::TYPE_ALL);
@@ -2621,7 +2874,7 @@ void CGameContext::OnMapChange(char *pNewMapName, int MapNameSize)
 	}
 
 	CDataFileReader Reader;
-	Reader.Open(pStorage, pNewMapName, IStorage::TYPE_ALL);
+	Reader.Open(pStorage, pNewMapName, IStorage::TYPE_ALL, g_Config.m_SvMapMmap);
 
 	CDataFileWriter Writer;
 	Writer.Init();
@@ -2692,6 +2945,13 @@ void CGameContext::OnMapChange(char *pNewMapName, int MapNameSize)
 			Writer.AddData(TotalLength, pSettings);
 			continue;
 		}
+		const void *pRaw = Reader.GetRawData(i);
+		if(pRaw)
+		{
+			// copy the compressed data straight from the mapping
+			Writer.AddRawData(Reader.GetUncompressedDataSize(i), Reader.GetDataSize(i), pRaw);
+			continue;
+		}
 		unsigned char *pData = (unsigned char *)Reader.GetData(i);
 		int Size = Reader.GetUncompressedDataSize(i);
 		Writer.AddData(Size, pData);
@@ -2699,14 +2959,35 @@ void CGameContext::OnMapChange(char *pNewMapName, int MapNameSize)
 	}
 
 	dbg_msg("mapchange", "imported settings");
-	Reader.Close();
 	Writer.OpenFile(pStorage, aTemp);
 	Writer.Finish();
+	Reader.Close();
 
 	str_copy(pNewMapName, aTemp, MapNameSize);
 	str_copy(m_aDeleteTempfile, aTemp, sizeof(m_aDeleteTempfile));
 }
 
+void CGameContext::OnMapPrepare(IMap *pMap)
+{
+	// decompress the tile data here, so the collision init in OnInit finds it loaded
+	CLayers Layers;
+	Layers.Init(pMap);
+	if(!Layers.GameLayer())
+		return;
+
+	pMap->GetData(Layers.GameLayer()->m_Data);
+	if(Layers.TeleLayer())
+		pMap->GetData(Layers.TeleLayer()->m_Tele);
+	if(Layers.SpeedupLayer())
+		pMap->GetData(Layers.SpeedupLayer()->m_Speedup);
+	if(Layers.FrontLayer())
+		pMap->GetData(Layers.FrontLayer()->m_Front);
+	if(Layers.SwitchLayer())
+		pMap->GetData(Layers.SwitchLayer()->m_Switch);
+	if(Layers.TuneLayer())
+		pMap->GetData(Layers.TuneLayer()->m_Tune);
+}
+
 void CGameContext::OnShutdown()
 {
 	DeleteTempfile();
@@ -2760,10 +3041,9 @@ void CGameContext::OnSnap(int ClientID)
 	CTuningParams StandardTuning;
 	if(ClientID == -1 && Server()->DemoRecorder_IsRecording() && mem_comp(&StandardTuning, &m_Tuning, sizeof(CTuningParams)) != 0)
 	{
+		const CTuningMsg *pTuningMsg = GetTuningMsg(0, 0);
 		CMsgPacker Msg(NETMSGTYPE_SV_TUNEPARAMS);
-		int *pParams = (int *)&m_Tuning;
-		for(unsigned i = 0; i < sizeof(m_Tuning)/sizeof(int); i++)
-			Msg.AddInt(pParams[i]);
+		Msg.AddRaw(pTuningMsg->m_aData, pTuningMsg->m_aSize[TUNECUT_ALL]);
 		Server()->SendMsg(&Msg, MSGFLAG_RECORD|MSGFLAG_NOSEND, ClientID);
 	}
 
@@ -2781,7 +3061,10 @@ void CGameContext::OnSnap(int ClientID)
 		m_apPlayers[ClientID]->FakeSnap(ClientID);
 
 }
-void CGameContext::OnPreSnap() {}
+void CGameContext::OnPreSnap()
+{
+	m_World.PreSnap();
+}
 void CGameContext::OnPostSnap()
 {
 	m_Events.Clear();
@@ -2888,6 +3171,60 @@ void CGameContext::OnSetAuthed(int ClientID, int Level)
 	}
 }
 
+int CGameContext::GetTuningParams(int Zone, int *pParams, int MaxParams)
+{
+	if(Zone < -1 || Zone >= NUM_TUNINGZONES)
+		return 0;
+	CTuningParams *pTuning = Zone == -1 ? &m_Tuning : &m_TuningList[Zone];
+	int Num = min(MaxParams, CTuningParams::Num());
+	mem_copy(pParams, pTuning, Num*sizeof(int));
+	return Num;
+}
+
+void CGameContext::SetTuningParams(int Zone, const int *pParams, int NumParams)
+{
+	if(Zone < -1 || Zone >= NUM_TUNINGZONES)
+		return;
+	CTuningParams *pTuning = Zone == -1 ? &m_Tuning : &m_TuningList[Zone];
+	mem_copy(pTuning, pParams, min(NumParams, CTuningParams::Num())*sizeof(int));
+	InvalidateTuningMsgs();
+}
+
+unsigned CGameContext::StateHash()
+{
+	// FNV-1a over the team and the network core of every player and the
+	// number of entities of each type
+	unsigned Hash = 2166136261u;
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if(!m_apPlayers[i])
+			continue;
+
+		int aData[2] = { i, m_apPlayers[i]->GetTeam() };
+		CNetObj_CharacterCore Core;
+		mem_zero(&Core, sizeof(Core));
+		CCharacter *pChr = m_apPlayers[i]->GetCharacter();
+		if(pChr)
+			pChr->Core()->Write(&Core);
+
+		const unsigned char *pBytes = (const unsigned char *)aData;
+		for(unsigned b = 0; b < sizeof(aData); b++)
+			Hash = (Hash ^ pBytes[b]) * 16777619u;
+		pBytes = (const unsigned char *)&Core;
+		for(unsigned b = 0; b < sizeof(Core); b++)
+			Hash = (Hash ^ pBytes[b]) * 16777619u;
+	}
+
+	for(int Type = 0; Type < CGameWorld::NUM_ENTTYPES; Type++)
+	{
+		unsigned Num = 0;
+		for(CEntity *pEnt = m_World.FindFirst(Type); pEnt; pEnt = pEnt->TypeNext())
+			Num++;
+		Hash = (Hash ^ Num) * 16777619u;
+	}
+	return Hash;
+}
+
 void CGameContext::SendRecord(int ClientID)
 {
 	CNetMsg_Sv_Record RecordsMsg;
@@ -2948,6 +3285,7 @@ void CGameContext::ResetTuning()
 	Tuning()->Set("shotgun_speed", 500);
 	Tuning()->Set("shotgun_speeddiff", 0);
 	Tuning()->Set("shotgun_curvature", 0);
+	InvalidateTuningMsgs();
 	SendTuningParams(-1);
 }
 
@@ -61,9 +61,58 @@ class CGameContext : public IGameServer
 	CTuningParams m_Tuning;
 	CTuningParams m_TuningList[NUM_TUNINGZONES];
 
+	enum
+	{
+		// params the faketuning of a character zeroes
+		TUNEVARIANT_NOCOLL=1,
+		TUNEVARIANT_NOHOOK=2,
+		TUNEVARIANT_NOJUMP=4,
+		TUNEVARIANT_NOJETPACK=8,
+		TUNEVARIANT_NOHAMMER=16,
+		NUM_TUNEVARIANTS=32,
+
+		// older clients only read the first 33, 37 or 38 params
+		TUNECUT_EXTRATUNES=0,
+		TUNECUT_HOOKDURATION,
+		TUNECUT_FIREDELAY,
+		TUNECUT_ALL,
+		NUM_TUNECUTS,
+
+		TUNING_MSG_SIZE=sizeof(CTuningParams)/sizeof(int)*5,
+	};
+
+	// packed NETMSGTYPE_SV_TUNEPARAMS payload of one zone and variant
+	struct CTuningMsg
+	{
+		int m_Generation;
+		int m_aSize[NUM_TUNECUTS];
+		unsigned char m_aData[TUNING_MSG_SIZE];
+	};
+
+	// NUM_TUNEVARIANTS messages per zone, allocated when the zone is first sent
+	CTuningMsg *m_apTuningMsgs[NUM_TUNINGZONES];
+	int m_TuningGeneration;
+	int m_TuningMsgsPacked;
+	int m_TuningMsgsSent;
+	int m_TuningMsgsSecond;
+	int m_TuningMsgsLastSecond;
+
+	const CTuningMsg *GetTuningMsg(int Zone, int Variant);
+
 	static void ConTuneParam(IConsole::IResult *pResult, void *pUserData);
 	static void ConTuneReset(IConsole::IResult *pResult, void *pUserData);
 	static void ConTuneDump(IConsole::IResult *pResult, void *pUserData);
+	static void ConTuneStats(IConsole::IResult *pResult, void *pUserData);
+	static void ConSnapStats(IConsole::IResult *pResult, void *pUserData);
+	static void ConEventStats(IConsole::IResult *pResult, void *pUserData);
+	static void ConPlayerMapStats(IConsole::IResult *pResult, void *pUserData);
+	static void ConPoolStats(IConsole::IResult *pResult, void *pUserData);
+	static void ConStressProjectiles(IConsole::IResult *pResult, void *pUserData);
+	static void ConSaveBench(IConsole::IResult *pResult, void *pUserData);
+	static void ConScoreStats(IConsole::IResult *pResult, void *pUserData);
+#if defined(CONF_SQL)
+	static void ConSqlLoadTest(IConsole::IResult *pResult, void *pUserData);
+#endif
 	static void ConTuneZone(IConsole::IResult *pResult, void *pUserData);
 	static void ConTuneDumpZone(IConsole::IResult *pResult, void *pUserData);
 	static void ConTuneResetZone(IConsole::IResult *pResult, void *pUserData);
@@ -113,6 +162,14 @@ public:
 	IGameController *m_pController;
 	CGameWorld m_World;
 
+	// projectile stress benchmark
+	int m_StressProjectiles;
+	int m_StressTicks;
+	int m_StressTicksDone;
+	int64 m_StressWorldTime;
+	void StressProjectiles();
+	void PrintPoolStats();
+
 	// helper functions
 	class CCharacter *GetPlayerChar(int ClientID);
 
@@ -184,6 +241,8 @@ public:
 	//
 	void CheckPureTuning();
 	void SendTuningParams(int ClientID, int Zone = 0);
+	// has to be called whenever m_Tuning or m_TuningList change
+	void InvalidateTuningMsgs() { m_TuningGeneration++; }
 
 	struct CVoteOptionServer *GetVoteOption(int Index);
 	void ProgressVoteOptions(int ClientID);
@@ -197,6 +256,7 @@ public:
 	virtual void OnInit();
 	virtual void OnConsoleInit();
 	virtual void OnMapChange(char *pNewMapName, int MapNameSize);
+	virtual void OnMapPrepare(class IMap *pMap);
 	virtual void OnShutdown();
 
 	virtual void OnTick();
@@ -357,6 +417,9 @@ public:
 	static void SendChatResponse(const char *pLine, void *pUser, bool Highlighted = false);
 	static void SendChatResponseAll(const char *pLine, void *pUser);
 	virtual void OnSetAuthed(int ClientID,int Level);
+	virtual int GetTuningParams(int Zone, int *pParams, int MaxParams);
+	virtual void SetTuningParams(int Zone, const int *pParams, int NumParams);
+	virtual unsigned StateHash();
 	virtual bool PlayerCollision();
 	virtual bool PlayerHooking();
 	virtual float PlayerJetpack();
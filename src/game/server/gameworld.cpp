@@ -4,6 +4,7 @@
 #include "gameworld.h"
 #include "entity.h"
 #include "gamecontext.h"
+#include "teams.h"
 #include <algorithm>
 #include <utility>
 #include <engine/shared/config.h>
@@ -19,7 +20,52 @@ CGameWorld::CGameWorld()
 	m_Paused = false;
 	m_ResetRequested = false;
 	for(int i = 0; i < NUM_ENTTYPES; i++)
+	{
 		m_apFirstEntityTypes[i] = 0;
+		m_apGrid[i] = 0;
+		m_aNumEntities[i] = 0;
+		m_aMaxProximityRadius[i] = 0.0f;
+	}
+	m_GridWidth = 0;
+	m_GridHeight = 0;
+	m_InsertCounter = 0;
+
+	m_paSnapEntries = 0;
+	m_paSnapScratch = 0;
+	m_ppSnapCandidates = 0;
+	m_NumSnapEntries = 0;
+	m_SnapEntriesSize = 0;
+	m_pSnapCellStart = 0;
+	m_SnapWidth = 0;
+	m_SnapHeight = 0;
+	m_MaxSnapReach = 0.0f;
+	m_SnapTick = -1;
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		m_aSnapConsidered[i] = 0;
+		m_aSnapSnapped[i] = 0;
+	}
+
+	m_NumMapCandidates = 0;
+	m_pMapCellStart = 0;
+	m_MapCellWidth = 0;
+	m_MapCellHeight = 0;
+	mem_zero(m_aaMapTop, sizeof(m_aaMapTop));
+	for(int i = 0; i < MAX_CLIENTS; i++)
+		for(int j = 0; j < VANILLA_MAX_CLIENTS; j++)
+			m_aaLastIdMap[i][j] = -1;
+	m_MapUpdates = 0;
+	m_MapsRebuilt = 0;
+	m_MapsKept = 0;
+	m_MapUpdateTime = 0;
+	m_MapUpdateTotal = 0;
+	m_MapUpdateMax = 0;
+
+	m_RoundPhase = ROUND_CORE;
+	m_NumRoundItems = 0;
+	m_NextRoundItem = 0;
+	m_RoundItemsDone = 0;
+	m_RoundLock = lock_create();
 }
 
 CGameWorld::~CGameWorld()
@@ -28,6 +74,27 @@ CGameWorld::~CGameWorld()
 	for(int i = 0; i < NUM_ENTTYPES; i++)
 		while(m_apFirstEntityTypes[i])
 			delete m_apFirstEntityTypes[i];
+
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+		if(m_apGrid[i])
+			mem_free(m_apGrid[i]);
+
+	if(m_paSnapEntries)
+	{
+		mem_free(m_paSnapEntries);
+		mem_free(m_paSnapScratch);
+		mem_free(m_ppSnapCandidates);
+	}
+	if(m_pSnapCellStart)
+		mem_free(m_pSnapCellStart);
+	if(m_pMapCellStart)
+		mem_free(m_pMapCellStart);
+
+	// helpers that were queued late may still be looking for work items
+	for(int i = 0; i < MAX_TEAM_TICK_THREADS; i++)
+		while(m_aTeamTickJobs[i].Status() != CJob::STATE_DONE)
+			thread_sleep(1);
+	lock_destroy(m_RoundLock);
 }
 
 void CGameWorld::SetGameServer(CGameContext *pGameServer)
@@ -41,13 +108,176 @@ CEntity *CGameWorld::FindFirst(int Type)
 	return Type < 0 || Type >= NUM_ENTTYPES ? 0 : m_apFirstEntityTypes[Type];
 }
 
+//////////////////////////////////////////////////
+// spatial grid
+//////////////////////////////////////////////////
+static int GridCoord(float Value, int Size, int Shift = CGameWorld::GRID_CELL_SHIFT)
+{
+	// clamp before converting so that far off positions end up in the border cells
+	Value = clamp(Value, -1.0f, (float)(Size << Shift));
+	return clamp(((int)Value) >> Shift, 0, Size - 1);
+}
+
+bool CGameWorld::InsertOrderCompare(const CEntity *pA, const CEntity *pB)
+{
+	// newest first, like the type lists
+	return pA->m_InsertOrder > pB->m_InsertOrder;
+}
+
+void CGameWorld::InitGrid(int Width, int Height)
+{
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+		if(m_apGrid[i])
+			mem_free(m_apGrid[i]);
+
+	m_GridWidth = ((Width * 32) >> GRID_CELL_SHIFT) + 1;
+	m_GridHeight = ((Height * 32) >> GRID_CELL_SHIFT) + 1;
+
+	// slot 0 holds the entities that are snapped regardless of their position
+	if(m_pSnapCellStart)
+		mem_free(m_pSnapCellStart);
+	m_SnapWidth = ((Width * 32) >> SNAP_CELL_SHIFT) + 1;
+	m_SnapHeight = ((Height * 32) >> SNAP_CELL_SHIFT) + 1;
+	m_pSnapCellStart = (int *)mem_alloc(sizeof(int) * (m_SnapWidth * m_SnapHeight + 2), 1);
+	m_SnapTick = -1;
+
+	if(m_pMapCellStart)
+		mem_free(m_pMapCellStart);
+	m_MapCellWidth = ((Width * 32) >> MAP_CELL_SHIFT) + 1;
+	m_MapCellHeight = ((Height * 32) >> MAP_CELL_SHIFT) + 1;
+	m_pMapCellStart = (int *)mem_alloc(sizeof(int) * (m_MapCellWidth * m_MapCellHeight + 1), 1);
+
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+	{
+		m_apGrid[i] = (CEntity **)mem_alloc(sizeof(CEntity *) * m_GridWidth * m_GridHeight, 1);
+		mem_zero(m_apGrid[i], sizeof(CEntity *) * m_GridWidth * m_GridHeight);
+
+		// bucket entities that were inserted before the grid existed
+		for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; pEnt = pEnt->m_pNextTypeEntity)
+		{
+			pEnt->m_pPrevCellEntity = 0;
+			pEnt->m_pNextCellEntity = 0;
+			LinkCell(pEnt, GridCell(pEnt->m_Pos));
+		}
+	}
+}
+
+int CGameWorld::GridCell(vec2 Pos)
+{
+	return GridCoord(Pos.y, m_GridHeight) * m_GridWidth + GridCoord(Pos.x, m_GridWidth);
+}
+
+void CGameWorld::LinkCell(CEntity *pEnt, int Cell)
+{
+	CEntity **ppFirst = &m_apGrid[pEnt->m_ObjType][Cell];
+	if(*ppFirst)
+		(*ppFirst)->m_pPrevCellEntity = pEnt;
+	pEnt->m_pNextCellEntity = *ppFirst;
+	pEnt->m_pPrevCellEntity = 0;
+	*ppFirst = pEnt;
+	pEnt->m_GridCell = Cell;
+}
+
+void CGameWorld::UnlinkCell(CEntity *pEnt)
+{
+	if(pEnt->m_pPrevCellEntity)
+		pEnt->m_pPrevCellEntity->m_pNextCellEntity = pEnt->m_pNextCellEntity;
+	else
+		m_apGrid[pEnt->m_ObjType][pEnt->m_GridCell] = pEnt->m_pNextCellEntity;
+	if(pEnt->m_pNextCellEntity)
+		pEnt->m_pNextCellEntity->m_pPrevCellEntity = pEnt->m_pPrevCellEntity;
+
+	pEnt->m_pPrevCellEntity = 0;
+	pEnt->m_pNextCellEntity = 0;
+	pEnt->m_GridCell = -1;
+}
+
+void CGameWorld::UpdateEntityCell(CEntity *pEnt)
+{
+	// not in the grid
+	if(pEnt->m_GridCell < 0)
+		return;
+
+	if(pEnt->m_ProximityRadius > m_aMaxProximityRadius[pEnt->m_ObjType])
+		m_aMaxProximityRadius[pEnt->m_ObjType] = pEnt->m_ProximityRadius;
+
+	int Cell = GridCell(pEnt->m_Pos);
+	if(Cell == pEnt->m_GridCell)
+		return;
+
+	UnlinkCell(pEnt);
+	LinkCell(pEnt, Cell);
+}
+
+void CGameWorld::UpdateGrid()
+{
+	// catch up with positions that were changed without UpdateEntityCell
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+		for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; pEnt = pEnt->m_pNextTypeEntity)
+			UpdateEntityCell(pEnt);
+}
+
+int CGameWorld::QueryGrid(int Type, vec2 Min, vec2 Max, CEntity **ppEnts, int MaxEnts)
+{
+	if(!m_apGrid[Type])
+		return -1;
+
+	// one extra unit to be safe against rounding at the border
+	float Margin = m_aMaxProximityRadius[Type] + 1.0f;
+	int MinX = GridCoord(Min.x - Margin, m_GridWidth);
+	int MinY = GridCoord(Min.y - Margin, m_GridHeight);
+	int MaxX = GridCoord(Max.x + Margin, m_GridWidth);
+	int MaxY = GridCoord(Max.y + Margin, m_GridHeight);
+
+	// walking the list is cheaper than visiting mostly empty cells
+	if((MaxX - MinX + 1) * (MaxY - MinY + 1) > m_aNumEntities[Type])
+		return -1;
+
+	int Num = 0;
+	for(int y = MinY; y <= MaxY; y++)
+		for(int x = MinX; x <= MaxX; x++)
+			for(CEntity *pEnt = m_apGrid[Type][y * m_GridWidth + x]; pEnt; pEnt = pEnt->m_pNextCellEntity)
+			{
+				if(Num == MaxEnts)
+					return -1;
+				ppEnts[Num++] = pEnt;
+			}
+
+	// keep the results in list order so that the queries behave exactly like a list walk
+	std::sort(ppEnts, ppEnts + Num, InsertOrderCompare);
+	return Num;
+}
+
+CGameWorld::CQueryIterator::CQueryIterator(CEntity **ppCandidates, int NumCandidates, CEntity *pFirst)
+{
+	m_ppCandidates = ppCandidates;
+	m_NumCandidates = NumCandidates;
+	m_Index = 0;
+	m_pNext = NumCandidates < 0 ? pFirst : 0;
+}
+
+CEntity *CGameWorld::CQueryIterator::Next()
+{
+	if(m_NumCandidates >= 0)
+		return m_Index < m_NumCandidates ? m_ppCandidates[m_Index++] : 0;
+
+	CEntity *pEnt = m_pNext;
+	if(pEnt)
+		m_pNext = pEnt->TypeNext();
+	return pEnt;
+}
+
 int CGameWorld::FindEntities(vec2 Pos, float Radius, CEntity **ppEnts, int Max, int Type)
 {
 	if(Type < 0 || Type >= NUM_ENTTYPES)
 		return 0;
 
+	CEntity *apCandidates[MAX_QUERY_CANDIDATES];
+	int NumCandidates = QueryGrid(Type, Pos - vec2(Radius, Radius), Pos + vec2(Radius, Radius), apCandidates, MAX_QUERY_CANDIDATES);
+	CQueryIterator Iter(apCandidates, NumCandidates, m_apFirstEntityTypes[Type]);
+
 	int Num = 0;
-	for(CEntity *pEnt = m_apFirstEntityTypes[Type];	pEnt; pEnt = pEnt->m_pNextTypeEntity)
+	for(CEntity *pEnt = Iter.Next(); pEnt; pEnt = Iter.Next())
 	{
 		if(distance(pEnt->m_Pos, Pos) < Radius+pEnt->m_ProximityRadius)
 		{
@@ -75,6 +305,14 @@ void CGameWorld::InsertEntity(CEntity *pEnt)
 	pEnt->m_pNextTypeEntity = m_apFirstEntityTypes[pEnt->m_ObjType];
 	pEnt->m_pPrevTypeEntity = 0x0;
 	m_apFirstEntityTypes[pEnt->m_ObjType] = pEnt;
+
+	pEnt->m_InsertOrder = ++m_InsertCounter;
+	m_SnapTick = -1;
+	m_aNumEntities[pEnt->m_ObjType]++;
+	if(pEnt->m_ProximityRadius > m_aMaxProximityRadius[pEnt->m_ObjType])
+		m_aMaxProximityRadius[pEnt->m_ObjType] = pEnt->m_ProximityRadius;
+	if(m_apGrid[pEnt->m_ObjType])
+		LinkCell(pEnt, GridCell(pEnt->m_Pos));
 }
 
 void CGameWorld::DestroyEntity(CEntity *pEnt)
@@ -96,6 +334,11 @@ void CGameWorld::RemoveEntity(CEntity *pEnt)
 	if(pEnt->m_pNextTypeEntity)
 		pEnt->m_pNextTypeEntity->m_pPrevTypeEntity = pEnt->m_pPrevTypeEntity;
 
+	m_aNumEntities[pEnt->m_ObjType]--;
+	if(pEnt->m_GridCell >= 0)
+		UnlinkCell(pEnt);
+	m_SnapTick = -1;
+
 	// keep list traversing valid
 	if(m_pNextTraverseEntity == pEnt)
 		m_pNextTraverseEntity = pEnt->m_pNextTypeEntity;
@@ -104,16 +347,157 @@ void CGameWorld::RemoveEntity(CEntity *pEnt)
 	pEnt->m_pPrevTypeEntity = 0;
 }
 
-//
+//////////////////////////////////////////////////
+// snap visibility
+//////////////////////////////////////////////////
+bool CGameWorld::SnapOrderCompare(const CSnapEntry *pA, const CSnapEntry *pB)
+{
+	return pA->m_Order < pB->m_Order;
+}
+
+int CGameWorld::SnapCell(vec2 Pos)
+{
+	return GridCoord(Pos.y, m_SnapHeight, SNAP_CELL_SHIFT) * m_SnapWidth + GridCoord(Pos.x, m_SnapWidth, SNAP_CELL_SHIFT);
+}
+
+void CGameWorld::PreSnap()
+{
+	m_SnapTick = -1;
+	if(!m_pSnapCellStart)
+		return;
+
+	int NumEntities = 0;
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+		NumEntities += m_aNumEntities[i];
+
+	if(NumEntities > m_SnapEntriesSize)
+	{
+		if(m_paSnapEntries)
+		{
+			mem_free(m_paSnapEntries);
+			mem_free(m_paSnapScratch);
+			mem_free(m_ppSnapCandidates);
+		}
+		m_SnapEntriesSize = max(NumEntities, m_SnapEntriesSize * 2);
+		m_paSnapEntries = (CSnapEntry *)mem_alloc(sizeof(CSnapEntry) * m_SnapEntriesSize, 1);
+		m_paSnapScratch = (CSnapEntry *)mem_alloc(sizeof(CSnapEntry) * m_SnapEntriesSize, 1);
+		m_ppSnapCandidates = (CSnapEntry **)mem_alloc(sizeof(CSnapEntry *) * m_SnapEntriesSize, 1);
+	}
+
+	// counting sort by cell, the order field remembers the position in the type lists
+	int NumSlots = m_SnapWidth * m_SnapHeight + 1;
+	mem_zero(m_pSnapCellStart, sizeof(int) * (NumSlots + 1));
+	m_MaxSnapReach = 0.0f;
+	m_NumSnapEntries = 0;
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+		for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; pEnt = pEnt->m_pNextTypeEntity)
+		{
+			CSnapEntry *pEntry = &m_paSnapScratch[m_NumSnapEntries];
+			pEntry->m_pEntity = pEnt;
+			pEntry->m_Pos = pEnt->SnapPos();
+			pEntry->m_Reach = pEnt->SnapReach();
+			pEntry->m_Order = m_NumSnapEntries++;
+
+			int Slot = 0;
+			if(pEntry->m_Reach >= 0.0f)
+			{
+				Slot = SnapCell(pEntry->m_Pos) + 1;
+				m_MaxSnapReach = max(m_MaxSnapReach, pEntry->m_Reach);
+			}
+			m_pSnapCellStart[Slot + 1]++;
+		}
+
+	for(int i = 1; i <= NumSlots; i++)
+		m_pSnapCellStart[i] += m_pSnapCellStart[i - 1];
+
+	for(int i = 0; i < m_NumSnapEntries; i++)
+	{
+		CSnapEntry *pEntry = &m_paSnapScratch[i];
+		int Slot = pEntry->m_Reach >= 0.0f ? SnapCell(pEntry->m_Pos) + 1 : 0;
+		m_paSnapEntries[m_pSnapCellStart[Slot]++] = *pEntry;
+	}
+
+	// the scatter advanced every start to the next slot's start, shift them back
+	for(int i = NumSlots; i > 0; i--)
+		m_pSnapCellStart[i] = m_pSnapCellStart[i - 1];
+	m_pSnapCellStart[0] = 0;
+
+	m_SnapTick = Server()->Tick();
+}
+
+int CGameWorld::QuerySnap(int SnappingClient)
+{
+	// the demo snapshot sees everything, show_all clients see every character
+	if(SnappingClient < 0 || m_SnapTick != Server()->Tick() || GameServer()->m_apPlayers[SnappingClient]->m_ShowAll)
+		return -1;
+
+	// same view rectangle as CEntity::NetworkClipped, the extra unit covers rounding in the reach
+	vec2 ViewPos = GameServer()->m_apPlayers[SnappingClient]->m_ViewPos;
+	float Margin = m_MaxSnapReach + 1.0f;
+	int MinX = GridCoord(ViewPos.x - 1000.0f - Margin, m_SnapWidth, SNAP_CELL_SHIFT);
+	int MinY = GridCoord(ViewPos.y - 800.0f - Margin, m_SnapHeight, SNAP_CELL_SHIFT);
+	int MaxX = GridCoord(ViewPos.x + 1000.0f + Margin, m_SnapWidth, SNAP_CELL_SHIFT);
+	int MaxY = GridCoord(ViewPos.y + 800.0f + Margin, m_SnapHeight, SNAP_CELL_SHIFT);
+
+	int Num = 0;
+	for(int i = m_pSnapCellStart[0]; i < m_pSnapCellStart[1]; i++)
+		m_ppSnapCandidates[Num++] = &m_paSnapEntries[i];
+	int Considered = Num;
+
+	for(int y = MinY; y <= MaxY; y++)
+	{
+		int Slot = y * m_SnapWidth + MinX + 1;
+		int End = m_pSnapCellStart[y * m_SnapWidth + MaxX + 2];
+		for(int i = m_pSnapCellStart[Slot]; i < End; i++)
+		{
+			CSnapEntry *pEntry = &m_paSnapEntries[i];
+			Considered++;
+			if(absolute(ViewPos.x - pEntry->m_Pos.x) > 1000.0f + pEntry->m_Reach + 1.0f ||
+				absolute(ViewPos.y - pEntry->m_Pos.y) > 800.0f + pEntry->m_Reach + 1.0f)
+				continue;
+			m_ppSnapCandidates[Num++] = pEntry;
+		}
+	}
+
+	// snap in list order, exactly like the full walk
+	std::sort(m_ppSnapCandidates, m_ppSnapCandidates + Num, SnapOrderCompare);
+
+	m_aSnapConsidered[SnappingClient] = Considered;
+	m_aSnapSnapped[SnappingClient] = Num;
+	return Num;
+}
+
 void CGameWorld::Snap(int SnappingClient)
 {
+	int NumCandidates = QuerySnap(SnappingClient);
+	if(NumCandidates >= 0)
+	{
+		for(int i = 0; i < NumCandidates; i++)
+			m_ppSnapCandidates[i]->m_pEntity->Snap(SnappingClient);
+		return;
+	}
+
+	int Num = 0;
 	for(int i = 0; i < NUM_ENTTYPES; i++)
 		for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; )
 		{
 			m_pNextTraverseEntity = pEnt->m_pNextTypeEntity;
 			pEnt->Snap(SnappingClient);
 			pEnt = m_pNextTraverseEntity;
+			Num++;
 		}
+
+	if(SnappingClient >= 0)
+	{
+		m_aSnapConsidered[SnappingClient] = Num;
+		m_aSnapSnapped[SnappingClient] = Num;
+	}
+}
+
+void CGameWorld::SnapStats(int ClientID, int *pConsidered, int *pSnapped)
+{
+	*pConsidered = m_aSnapConsidered[ClientID];
+	*pSnapped = m_aSnapSnapped[ClientID];
 }
 
 void CGameWorld::Reset()
@@ -155,88 +539,191 @@ bool distCompare(std::pair<float,int> a, std::pair<float,int> b)
 	return (a.first < b.first);
 }
 
+int CGameWorld::SelectMapCandidates(int ClientID, const bool *pValid, std::pair<float, int> *pDist)
+{
+	CPlayer *pPlayer = GameServer()->m_apPlayers[ClientID];
+	vec2 ViewPos = pPlayer->m_ViewPos;
+
+	// the part of character.cpp Snap() that only depends on the viewer
+	CCharacter *pSnapChar = GameServer()->GetPlayerChar(ClientID);
+	bool HideOthers = pSnapChar && !pSnapChar->m_Super &&
+		!pPlayer->m_Paused && pPlayer->GetTeam() != -1 &&
+		(pPlayer->m_ClientVersion == VERSION_VANILLA ||
+			(pPlayer->m_ClientVersion >= VERSION_DDRACE && !pPlayer->m_ShowOthers));
+
+	// walk rings of cells around the view until enough characters are
+	// closer than anything the next ring could contain
+	int Want = VANILLA_MAX_CLIENTS - 1;
+	int Num = 0;
+	int CX = GridCoord(ViewPos.x, m_MapCellWidth, MAP_CELL_SHIFT);
+	int CY = GridCoord(ViewPos.y, m_MapCellHeight, MAP_CELL_SHIFT);
+	int MaxRing = max(max(CX, m_MapCellWidth - 1 - CX), max(CY, m_MapCellHeight - 1 - CY));
+	for(int r = 0; r <= MaxRing && Num < m_NumMapCandidates; r++)
+	{
+		for(int y = max(CY - r, 0); y <= min(CY + r, m_MapCellHeight - 1); y++)
+		{
+			// inner rows only touch the left and right border of the ring
+			int Step = (y == CY - r || y == CY + r) ? 1 : 2 * r;
+			for(int x = CX - r; x <= CX + r; x += Step)
+			{
+				if(x < 0 || x >= m_MapCellWidth)
+					continue;
+				int Cell = y * m_MapCellWidth + x;
+				for(int e = m_pMapCellStart[Cell]; e < m_pMapCellStart[Cell + 1]; e++)
+				{
+					int j = m_aMapCandidates[e].m_ClientID;
+					float Dist = distance(ViewPos, m_aMapCandidates[e].m_Pos);
+					if(HideOthers && !GameServer()->m_apPlayers[j]->GetCharacter()->CanCollide(ClientID))
+						Dist += 1e8;
+					pDist[Num++] = std::pair<float, int>(Dist, j);
+				}
+			}
+		}
+
+		float Bound = (float)(r << MAP_CELL_SHIFT);
+		int Closer = 0;
+		for(int k = 0; k < Num; k++)
+			if(pDist[k].first < Bound)
+				Closer++;
+		if(Closer >= Want)
+			break;
+	}
+
+	// always send the player himself
+	bool Self = false;
+	for(int k = 0; k < Num; k++)
+	{
+		if(pDist[k].second == ClientID)
+		{
+			pDist[k].first = 0;
+			Self = true;
+		}
+	}
+	if(!Self)
+		pDist[Num++] = std::pair<float, int>(0.0f, ClientID);
+
+	// players without a character fill up the map last
+	if(Num < Want)
+		for(int j = 0; j < MAX_CLIENTS; j++)
+			if(j != ClientID && pValid[j] && !GameServer()->m_apPlayers[j]->GetCharacter())
+				pDist[Num++] = std::pair<float, int>(1e9, j);
+
+	if(Num <= Want)
+		return Num;
+	std::nth_element(&pDist[0], &pDist[Want], &pDist[Num], distCompare);
+	return Want;
+}
+
 void CGameWorld::UpdatePlayerMaps()
 {
 	if (Server()->Tick() % g_Config.m_SvMapUpdateRate != 0) return;
+	if (!m_pMapCellStart) return;
+
+	int64 Start = time_get();
+
+	// bucket the characters by cell once for all maps, counting sort over the cells
+	bool aValid[MAX_CLIENTS];
+	int aCell[MAX_CLIENTS];
+	int NumCells = m_MapCellWidth * m_MapCellHeight;
+	mem_zero(m_pMapCellStart, sizeof(int) * (NumCells + 1));
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		aValid[i] = Server()->ClientIngame(i) && GameServer()->m_apPlayers[i];
+		CCharacter *pChr = aValid[i] ? GameServer()->m_apPlayers[i]->GetCharacter() : 0;
+		aCell[i] = -1;
+		if (pChr)
+		{
+			aCell[i] = GridCoord(pChr->m_Pos.y, m_MapCellHeight, MAP_CELL_SHIFT) * m_MapCellWidth + GridCoord(pChr->m_Pos.x, m_MapCellWidth, MAP_CELL_SHIFT);
+			m_pMapCellStart[aCell[i] + 1]++;
+		}
+	}
+	for (int c = 0; c < NumCells; c++)
+		m_pMapCellStart[c + 1] += m_pMapCellStart[c];
+	m_NumMapCandidates = m_pMapCellStart[NumCells];
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if (aCell[i] == -1) continue;
+		CMapCandidate *pCandidate = &m_aMapCandidates[m_pMapCellStart[aCell[i]]++];
+		pCandidate->m_ClientID = i;
+		pCandidate->m_Pos = GameServer()->m_apPlayers[i]->GetCharacter()->m_Pos;
+	}
+	// placing advanced every start to the next cell, shift them back
+	for (int c = NumCells; c > 0; c--)
+		m_pMapCellStart[c] = m_pMapCellStart[c - 1];
+	m_pMapCellStart[0] = 0;
 
-	std::pair<float,int> dist[MAX_CLIENTS];
+	std::pair<float,int> aDist[MAX_CLIENTS];
 	for (int i = 0; i < MAX_CLIENTS; i++)
 	{
-		if (!Server()->ClientIngame(i)) continue;
+		if (!aValid[i]) continue;
 		int* map = Server()->GetIdMap(i);
 
-		// compute distances
-		for (int j = 0; j < MAX_CLIENTS; j++)
-		{
-			dist[j].second = j;
-			if (!Server()->ClientIngame(j) || !GameServer()->m_apPlayers[j])
-			{
-				dist[j].first = 1e10;
-				continue;
-			}
-			CCharacter* ch = GameServer()->m_apPlayers[j]->GetCharacter();
-			if (!ch)
-			{
-				dist[j].first = 1e9;
-				continue;
-			}
-			// copypasted chunk from character.cpp Snap() follows
-			CCharacter* SnapChar = GameServer()->GetPlayerChar(i);
-			if(SnapChar && !SnapChar->m_Super &&
-				!GameServer()->m_apPlayers[i]->m_Paused && GameServer()->m_apPlayers[i]->GetTeam() != -1 &&
-				!ch->CanCollide(i) &&
-				(!GameServer()->m_apPlayers[i] ||
-					GameServer()->m_apPlayers[i]->m_ClientVersion == VERSION_VANILLA ||
-					(GameServer()->m_apPlayers[i]->m_ClientVersion >= VERSION_DDRACE &&
-					!GameServer()->m_apPlayers[i]->m_ShowOthers
-					)
-				)
-			)
-				dist[j].first = 1e8;
-			else
-				dist[j].first = 0;
+		int NumTop = SelectMapCandidates(i, aValid, aDist);
+		unsigned char aTop[MAX_CLIENTS];
+		mem_zero(aTop, sizeof(aTop));
+		for (int k = 0; k < NumTop; k++)
+			aTop[aDist[k].second] = 1;
 
-			dist[j].first += distance(GameServer()->m_apPlayers[i]->m_ViewPos, GameServer()->m_apPlayers[j]->GetCharacter()->m_Pos);
+		// keep the map if it was built from the same candidates and nobody touched it since
+		bool Stale = false;
+		for (int j = 0; j < VANILLA_MAX_CLIENTS; j++)
+			if (map[j] != m_aaLastIdMap[i][j] || (map[j] != -1 && !aValid[map[j]]))
+				Stale = true;
+		if (!Stale && mem_comp(aTop, m_aaMapTop[i], sizeof(aTop)) == 0)
+		{
+			m_MapsKept++;
+			continue;
 		}
 
-		// always send the player himself
-		dist[i].first = 0;
-
-		// compute reverse map
+		// compute reverse map, dropping the players that left
 		int rMap[MAX_CLIENTS];
 		for (int j = 0; j < MAX_CLIENTS; j++)
-		{
 			rMap[j] = -1;
-		}
 		for (int j = 0; j < VANILLA_MAX_CLIENTS; j++)
 		{
 			if (map[j] == -1) continue;
-			if (dist[map[j]].first > 5e9) map[j] = -1;
+			if (!aValid[map[j]]) map[j] = -1;
 			else rMap[map[j]] = j;
 		}
 
-		std::nth_element(&dist[0], &dist[VANILLA_MAX_CLIENTS - 1], &dist[MAX_CLIENTS], distCompare);
-
-		int mapc = 0;
-		int demand = 0;
-		for (int j = 0; j < VANILLA_MAX_CLIENTS - 1; j++)
-		{
-			int k = dist[j].second;
-			if (rMap[k] != -1 || dist[j].first > 5e9) continue;
-			while (mapc < VANILLA_MAX_CLIENTS && map[mapc] != -1) mapc++;
-			if (mapc < VANILLA_MAX_CLIENTS - 1)
-				map[mapc] = k;
-			else
-				demand++;
-		}
-		for (int j = MAX_CLIENTS - 1; j > VANILLA_MAX_CLIENTS - 2; j--)
+		// new candidates take a free slot or the one of a player that is no candidate anymore
+		for (int k = 0; k < NumTop; k++)
 		{
-			int k = dist[j].second;
-			if (rMap[k] != -1 && demand-- > 0)
-				map[rMap[k]] = -1;
+			int Id = aDist[k].second;
+			if (rMap[Id] != -1) continue;
+			int Slot = -1;
+			for (int j = 0; j < VANILLA_MAX_CLIENTS - 1 && Slot == -1; j++)
+				if (map[j] == -1)
+					Slot = j;
+			for (int j = 0; j < VANILLA_MAX_CLIENTS - 1 && Slot == -1; j++)
+				if (!aTop[map[j]])
+					Slot = j;
+			if (Slot == -1) break;
+			if (map[Slot] != -1) rMap[map[Slot]] = -1;
+			map[Slot] = Id;
+			rMap[Id] = Slot;
 		}
 		map[VANILLA_MAX_CLIENTS - 1] = -1; // player with empty name to say chat msgs
+
+		mem_copy(m_aaLastIdMap[i], map, sizeof(m_aaLastIdMap[i]));
+		mem_copy(m_aaMapTop[i], aTop, sizeof(aTop));
+		m_MapsRebuilt++;
 	}
+
+	m_MapUpdateTime = time_get() - Start;
+	m_MapUpdateTotal += m_MapUpdateTime;
+	m_MapUpdateMax = max(m_MapUpdateMax, m_MapUpdateTime);
+	m_MapUpdates++;
+}
+
+void CGameWorld::PrintPlayerMapStats(IConsole *pConsole)
+{
+	char aBuf[256];
+	str_format(aBuf, sizeof(aBuf), "updates=%d last=%.3fms avg=%.3fms max=%.3fms rebuilt=%d kept=%d",
+		m_MapUpdates, m_MapUpdateTime*1000.0/time_freq(),
+		m_MapUpdates ? m_MapUpdateTotal*1000.0/time_freq()/m_MapUpdates : 0.0,
+		m_MapUpdateMax*1000.0/time_freq(), m_MapsRebuilt, m_MapsKept);
+	pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "playermap", aBuf);
 }
 
 void CGameWorld::Tick()
@@ -244,26 +731,57 @@ void CGameWorld::Tick()
 	if(m_ResetRequested)
 		Reset();
 
+	UpdateGrid();
+	m_Core.BuildGrid();
+
 	if(!m_Paused)
 	{
 		if(GameServer()->m_pController->IsForceBalanced())
 			GameServer()->SendChat(-1, CGameContext::CHAT_ALL, "Teams have been balanced");
 		// update all objects
 		for(int i = 0; i < NUM_ENTTYPES; i++)
+		{
+			if(i == ENTTYPE_CHARACTER && (g_Config.m_SvTeamTickThreads || g_Config.m_DbgTeamTickVerify))
+			{
+				int NumPartitions = BuildPartitions();
+				if(NumPartitions > 1)
+				{
+					TickCharacters(NumPartitions);
+					continue;
+				}
+			}
+
 			for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; )
 			{
 				m_pNextTraverseEntity = pEnt->m_pNextTypeEntity;
 				pEnt->Tick();
 				pEnt = m_pNextTraverseEntity;
 			}
+		}
+
+		UpdateGrid();
 
 		for(int i = 0; i < NUM_ENTTYPES; i++)
+		{
+			if(i == ENTTYPE_CHARACTER && (g_Config.m_SvTeamTickThreads || g_Config.m_DbgTeamTickVerify))
+			{
+				int NumPartitions = BuildPartitions();
+				if(NumPartitions > 1)
+				{
+					// the partitions move at the same time, the grid can't follow them
+					m_Core.InvalidateGrid();
+					TickDeferedCharacters(NumPartitions);
+					continue;
+				}
+			}
+
 			for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; )
 			{
 				m_pNextTraverseEntity = pEnt->m_pNextTypeEntity;
 				pEnt->TickDefered();
 				pEnt = m_pNextTraverseEntity;
 			}
+		}
 	}
 	else
 	{
@@ -277,11 +795,350 @@ void CGameWorld::Tick()
 			}
 	}
 
+	// positions change between ticks without telling the grid
+	m_Core.InvalidateGrid();
+
 	RemoveEntities();
+	UpdateGrid();
 
 	UpdatePlayerMaps();
 }
 
+//////////////////////////////////////////////////
+// team partitioned ticks
+//////////////////////////////////////////////////
+// outlives the world, which is recreated on every map change
+static CJobPool s_TeamTickPool;
+static int s_NumTeamTickThreads = 0;
+
+static unsigned HashBytes(unsigned Hash, const void *pData, int Size)
+{
+	// FNV-1a
+	const unsigned char *pBytes = (const unsigned char *)pData;
+	for(int i = 0; i < Size; i++)
+		Hash = (Hash ^ pBytes[i]) * 16777619u;
+	return Hash;
+}
+
+int CGameWorld::TeamTickJob(void *pUser)
+{
+	((CGameWorld *)pUser)->RunRoundItems();
+	return 0;
+}
+
+int CGameWorld::BuildPartitions()
+{
+	CCharacter *pFirst = (CCharacter *)m_apFirstEntityTypes[ENTTYPE_CHARACTER];
+	if(!pFirst)
+		return 0;
+	CTeamsCore *pTeams = &pFirst->Teams()->m_Core;
+	int SuperTeam = pTeams->m_IsDDRace16 ? VANILLA_TEAM_SUPER : TEAM_SUPER;
+
+	// the groups CanCollide makes: one partition per team and one per solo
+	// character, the super team collides with everything
+	CCharacter *apChars[MAX_CLIENTS];
+	int aCharPartition[MAX_CLIENTS];
+	int aTeamPartition[MAX_CLIENTS];
+	int aRoot[MAX_CLIENTS];
+	int Num = 0;
+	int NumGroups = 0;
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		aTeamPartition[i] = -1;
+		m_aClientPartition[i] = -1;
+	}
+	for(CEntity *pEnt = pFirst; pEnt; pEnt = pEnt->m_pNextTypeEntity)
+	{
+		if(Num == MAX_CLIENTS)
+			return 0;
+
+		CCharacter *pChr = (CCharacter *)pEnt;
+		int ClientID = pChr->GetPlayer()->GetCID();
+		int Team = pTeams->Team(ClientID);
+		if(Team == SuperTeam)
+			return 1;
+
+		int Group;
+		if(pTeams->GetSolo(ClientID) || Team < 0 || Team >= MAX_CLIENTS)
+			Group = NumGroups++;
+		else
+		{
+			if(aTeamPartition[Team] < 0)
+				aTeamPartition[Team] = NumGroups++;
+			Group = aTeamPartition[Team];
+		}
+		aRoot[Group] = Group;
+		m_aClientPartition[ClientID] = Group;
+		apChars[Num] = pChr;
+		aCharPartition[Num++] = Group;
+	}
+
+	// a hook that outlived a solo switch still reads the hooked core
+	for(int i = 0; i < Num; i++)
+	{
+		int Hooked = apChars[i]->Core()->m_HookedPlayer;
+		if(Hooked < 0 || Hooked >= MAX_CLIENTS || m_aClientPartition[Hooked] < 0)
+			continue;
+
+		int a = aCharPartition[i], b = m_aClientPartition[Hooked];
+		while(aRoot[a] != a)
+			a = aRoot[a];
+		while(aRoot[b] != b)
+			b = aRoot[b];
+		aRoot[max(a, b)] = min(a, b);
+	}
+
+	// number the partitions in the order their first characters appear in
+	int aNumber[MAX_CLIENTS];
+	int aSize[MAX_CLIENTS];
+	int NumPartitions = 0;
+	for(int g = 0; g < NumGroups; g++)
+		aNumber[g] = -1;
+	for(int i = 0; i < Num; i++)
+	{
+		int r = aCharPartition[i];
+		while(aRoot[r] != r)
+			r = aRoot[r];
+		if(aNumber[r] < 0)
+		{
+			aSize[NumPartitions] = 0;
+			aNumber[r] = NumPartitions++;
+		}
+		aCharPartition[i] = aNumber[r];
+		aSize[aNumber[r]]++;
+		m_aClientPartition[apChars[i]->GetPlayer()->GetCID()] = aNumber[r];
+	}
+
+	m_aPartitionStart[0] = 0;
+	for(int p = 0; p < NumPartitions; p++)
+		m_aPartitionStart[p + 1] = m_aPartitionStart[p] + aSize[p];
+
+	// characters keep their list order within a partition
+	int aFill[MAX_CLIENTS];
+	mem_copy(aFill, m_aPartitionStart, sizeof(int) * NumPartitions);
+	for(int i = 0; i < Num; i++)
+	{
+		int Slot = aFill[aCharPartition[i]]++;
+		m_apPartitionOrder[Slot] = apChars[i];
+		m_aPartitionClient[Slot] = apChars[i]->GetPlayer()->GetCID();
+		m_aPartitionListIndex[Slot] = i;
+	}
+
+	return NumPartitions;
+}
+
+void CGameWorld::RunRoundItems()
+{
+	while(1)
+	{
+		lock_wait(m_RoundLock);
+		int Item = m_NextRoundItem < m_NumRoundItems ? m_NextRoundItem++ : -1;
+		int Phase = m_RoundPhase;
+		lock_unlock(m_RoundLock);
+
+		if(Item < 0)
+			return;
+
+		for(int i = m_aRoundStart[Item]; i < m_aRoundStart[Item + 1]; i++)
+		{
+			if(Phase == ROUND_CORE)
+				m_apRound[i]->TickCore();
+			else
+				m_apRound[i]->TickDeferedMove();
+		}
+
+		lock_wait(m_RoundLock);
+		bool Last = ++m_RoundItemsDone == m_NumRoundItems;
+		lock_unlock(m_RoundLock);
+		if(Last)
+			m_RoundDone.signal();
+	}
+}
+
+void CGameWorld::RunRound(int NumItems, int Phase)
+{
+	lock_wait(m_RoundLock);
+	m_RoundPhase = Phase;
+	m_NumRoundItems = NumItems;
+	m_NextRoundItem = 0;
+	m_RoundItemsDone = 0;
+	lock_unlock(m_RoundLock);
+
+	if(NumItems == 0)
+		return;
+
+	if(s_NumTeamTickThreads < g_Config.m_SvTeamTickThreads)
+	{
+		s_TeamTickPool.Init(g_Config.m_SvTeamTickThreads - s_NumTeamTickThreads);
+		s_NumTeamTickThreads = g_Config.m_SvTeamTickThreads;
+	}
+
+	// the pool wakes a worker per job, a single item isn't worth the handover
+	int NumHelpers = min(g_Config.m_SvTeamTickThreads, NumItems - 1);
+	for(int i = 0; i < MAX_TEAM_TICK_THREADS && NumHelpers > 0; i++)
+		if(m_aTeamTickJobs[i].Status() == CJob::STATE_DONE)
+		{
+			s_TeamTickPool.Add(&m_aTeamTickJobs[i], TeamTickJob, this);
+			NumHelpers--;
+		}
+
+	// the main thread works on the items as well, whoever finishes the last one signals
+	RunRoundItems();
+	m_RoundDone.wait();
+}
+
+unsigned CGameWorld::CoreHash()
+{
+	unsigned Hash = 2166136261u;
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		CCharacterCore *pCore = m_Core.m_apCharacters[i];
+		if(!pCore)
+			continue;
+		Hash = HashBytes(Hash, &pCore->m_Pos, sizeof(pCore->m_Pos));
+		Hash = HashBytes(Hash, &pCore->m_Vel, sizeof(pCore->m_Vel));
+		Hash = HashBytes(Hash, &pCore->m_HookPos, sizeof(pCore->m_HookPos));
+		Hash = HashBytes(Hash, &pCore->m_HookState, sizeof(pCore->m_HookState));
+		Hash = HashBytes(Hash, &pCore->m_HookedPlayer, sizeof(pCore->m_HookedPlayer));
+		Hash = HashBytes(Hash, &pCore->m_Jumped, sizeof(pCore->m_Jumped));
+		Hash = HashBytes(Hash, &pCore->m_TriggeredEvents, sizeof(pCore->m_TriggeredEvents));
+		Hash = HashBytes(Hash, &pCore->m_Colliding, sizeof(pCore->m_Colliding));
+		Hash = HashBytes(Hash, &pCore->m_LeftWall, sizeof(pCore->m_LeftWall));
+	}
+	return Hash;
+}
+
+void CGameWorld::RunRoundVerified(int NumItems, int Phase)
+{
+	if(!g_Config.m_DbgTeamTickVerify || NumItems < 2)
+	{
+		RunRound(NumItems, Phase);
+		return;
+	}
+
+	// run the items serially from the same cores first
+	for(int i = 0; i < MAX_CLIENTS; i++)
+		if(m_Core.m_apCharacters[i])
+			m_aVerifyCores[i] = *m_Core.m_apCharacters[i];
+	for(int Item = 0; Item < NumItems; Item++)
+		for(int i = m_aRoundStart[Item]; i < m_aRoundStart[Item + 1]; i++)
+		{
+			if(Phase == ROUND_CORE)
+				m_apRound[i]->TickCore();
+			else
+				m_apRound[i]->TickDeferedMove();
+		}
+	unsigned SerialHash = CoreHash();
+
+	for(int i = 0; i < MAX_CLIENTS; i++)
+		if(m_Core.m_apCharacters[i])
+			*m_Core.m_apCharacters[i] = m_aVerifyCores[i];
+
+	RunRound(NumItems, Phase);
+	unsigned PartitionedHash = CoreHash();
+	if(SerialHash != PartitionedHash)
+		dbg_msg("gameworld", "team tick mismatch tick=%d phase=%s items=%d serial=%08x partitioned=%08x",
+			Server()->Tick(), Phase == ROUND_CORE ? "core" : "move", NumItems, SerialHash, PartitionedHash);
+}
+
+void CGameWorld::TickCharacters(int NumPartitions)
+{
+	// Wave k ticks the k-th character of every partition, so a partition
+	// keeps the order of the serial tick. Only the cores run in parallel,
+	// the rest (tiles, weapons, events, sounds and rand()) runs on this
+	// thread in partition order and doesn't depend on the thread timing.
+	int NumWaves = 0;
+	for(int p = 0; p < NumPartitions; p++)
+		NumWaves = max(NumWaves, m_aPartitionStart[p + 1] - m_aPartitionStart[p]);
+
+	int aRoundClient[MAX_CLIENTS];
+	int aRoundListIndex[MAX_CLIENTS];
+	int LastListIndex = -1;
+	CTuningParams LastTuning;
+
+	m_Core.SetPartitions(m_aClientPartition);
+	for(int Wave = 0; Wave < NumWaves; Wave++)
+	{
+		int Num = 0;
+		for(int p = 0; p < NumPartitions; p++)
+		{
+			int Slot = m_aPartitionStart[p] + Wave;
+			if(Slot >= m_aPartitionStart[p + 1])
+				continue;
+
+			// an earlier wave of its partition may have killed it
+			CCharacter *pChr = GameServer()->GetPlayerChar(m_aPartitionClient[Slot]);
+			if(pChr != m_apPartitionOrder[Slot] || !pChr->TickPrepare())
+				continue;
+
+			// TickPrepare put the tuning of the character's zone into the world
+			m_aRoundTuning[Num] = m_Core.m_Tuning[g_Config.m_ClDummy];
+			pChr->Core()->m_pTickTuning = &m_aRoundTuning[Num];
+			pChr->Core()->m_HookTeleRand = rand();
+			m_apRound[Num] = pChr;
+			m_aRoundStart[Num] = Num;
+			aRoundClient[Num] = m_aPartitionClient[Slot];
+			aRoundListIndex[Num] = m_aPartitionListIndex[Slot];
+			Num++;
+		}
+		m_aRoundStart[Num] = Num;
+
+		RunRoundVerified(Num, ROUND_CORE);
+
+		for(int i = 0; i < Num; i++)
+		{
+			m_apRound[i]->Core()->m_pTickTuning = 0;
+			m_apRound[i]->Core()->m_HookTeleRand = -1;
+		}
+
+		for(int i = 0; i < Num; i++)
+		{
+			if(GameServer()->GetPlayerChar(aRoundClient[i]) != m_apRound[i])
+				continue;
+
+			m_Core.m_Tuning[g_Config.m_ClDummy] = m_aRoundTuning[i];
+			m_apRound[i]->TickFinish();
+			if(aRoundListIndex[i] > LastListIndex)
+			{
+				LastListIndex = aRoundListIndex[i];
+				LastTuning = m_aRoundTuning[i];
+			}
+		}
+	}
+	m_Core.SetPartitions(0);
+
+	// leave the world with the tuning of the last character in list order, like the serial tick
+	if(LastListIndex >= 0)
+		m_Core.m_Tuning[g_Config.m_ClDummy] = LastTuning;
+}
+
+void CGameWorld::TickDeferedCharacters(int NumPartitions)
+{
+	// Only the movement runs in the partitions. It writes nothing but the
+	// character's own core and reads the cores of its partition, so
+	// characters of different partitions can move at the same time. The
+	// reckoning cores use rand() and the events go to shared state, they
+	// stay serial.
+	for(CEntity *pEnt = m_apFirstEntityTypes[ENTTYPE_CHARACTER]; pEnt; pEnt = pEnt->m_pNextTypeEntity)
+		((CCharacter *)pEnt)->TickDeferedReckoning();
+
+	// one item per partition
+	for(int p = 0; p <= NumPartitions; p++)
+		m_aRoundStart[p] = m_aPartitionStart[p];
+	mem_copy(m_apRound, m_apPartitionOrder, sizeof(CCharacter *) * m_aPartitionStart[NumPartitions]);
+
+	m_Core.SetPartitions(m_aClientPartition);
+	RunRoundVerified(NumPartitions, ROUND_MOVE);
+	m_Core.SetPartitions(0);
+
+	for(CEntity *pEnt = m_apFirstEntityTypes[ENTTYPE_CHARACTER]; pEnt; )
+	{
+		m_pNextTraverseEntity = pEnt->m_pNextTypeEntity;
+		((CCharacter *)pEnt)->TickDeferedFinish();
+		pEnt = m_pNextTraverseEntity;
+	}
+}
+
 // TODO: should be more general
 //CCharacter *CGameWorld::IntersectCharacter(vec2 Pos0, vec2 Pos1, float Radius, vec2& NewPos, CEntity *pNotThis)
 CCharacter *CGameWorld::IntersectCharacter(vec2 Pos0, vec2 Pos1, float Radius, vec2& NewPos, CCharacter *pNotThis, int CollideWith, class CCharacter *pThisOnly)
@@ -290,8 +1147,12 @@ CCharacter *CGameWorld::IntersectCharacter(vec2 Pos0, vec2 Pos1, float Radius, v
 	float ClosestLen = distance(Pos0, Pos1) * 100.0f;
 	CCharacter *pClosest = 0;
 
-	CCharacter *p = (CCharacter *)FindFirst(ENTTYPE_CHARACTER);
-	for(; p; p = (CCharacter *)p->TypeNext())
+	CEntity *apCandidates[MAX_QUERY_CANDIDATES];
+	int NumCandidates = QueryGrid(ENTTYPE_CHARACTER, vec2(min(Pos0.x, Pos1.x) - Radius, min(Pos0.y, Pos1.y) - Radius), vec2(max(Pos0.x, Pos1.x) + Radius, max(Pos0.y, Pos1.y) + Radius), apCandidates, MAX_QUERY_CANDIDATES);
+	CQueryIterator Iter(apCandidates, NumCandidates, FindFirst(ENTTYPE_CHARACTER));
+
+	CCharacter *p = (CCharacter *)Iter.Next();
+	for(; p; p = (CCharacter *)Iter.Next())
 	{
 		if(p == pNotThis)
 			continue;
@@ -323,8 +1184,12 @@ CCharacter *CGameWorld::ClosestCharacter(vec2 Pos, float Radius, CEntity *pNotTh
 	float ClosestRange = Radius*2;
 	CCharacter *pClosest = 0;
 
-	CCharacter *p = (CCharacter *)GameServer()->m_World.FindFirst(ENTTYPE_CHARACTER);
-	for(; p; p = (CCharacter *)p->TypeNext())
+	CEntity *apCandidates[MAX_QUERY_CANDIDATES];
+	int NumCandidates = QueryGrid(ENTTYPE_CHARACTER, Pos - vec2(Radius, Radius), Pos + vec2(Radius, Radius), apCandidates, MAX_QUERY_CANDIDATES);
+	CQueryIterator Iter(apCandidates, NumCandidates, FindFirst(ENTTYPE_CHARACTER));
+
+	CCharacter *p = (CCharacter *)Iter.Next();
+	for(; p; p = (CCharacter *)Iter.Next())
 	{
 		if(p == pNotThis)
 			continue;
@@ -347,8 +1212,12 @@ std::list<class CCharacter *> CGameWorld::IntersectedCharacters(vec2 Pos0, vec2
 {
 	std::list< CCharacter * > listOfChars;
 
-	CCharacter *pChr = (CCharacter *)FindFirst(CGameWorld::ENTTYPE_CHARACTER);
-	for(; pChr; pChr = (CCharacter *)pChr->TypeNext())
+	CEntity *apCandidates[MAX_QUERY_CANDIDATES];
+	int NumCandidates = QueryGrid(ENTTYPE_CHARACTER, vec2(min(Pos0.x, Pos1.x) - Radius, min(Pos0.y, Pos1.y) - Radius), vec2(max(Pos0.x, Pos1.x) + Radius, max(Pos0.y, Pos1.y) + Radius), apCandidates, MAX_QUERY_CANDIDATES);
+	CQueryIterator Iter(apCandidates, NumCandidates, FindFirst(ENTTYPE_CHARACTER));
+
+	CCharacter *pChr = (CCharacter *)Iter.Next();
+	for(; pChr; pChr = (CCharacter *)Iter.Next())
 	{
 		if(pChr == pNotThis)
 			continue;
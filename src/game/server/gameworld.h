@@ -4,8 +4,10 @@
 #define GAME_SERVER_GAMEWORLD_H
 
 #include <game/gamecore.h>
+#include <engine/shared/jobs.h>
 
 #include <list>
+#include <utility>
 
 class CEntity;
 class CCharacter;
@@ -28,6 +30,15 @@ public:
 		NUM_ENTTYPES
 	};
 
+	enum
+	{
+		GRID_CELL_SHIFT = 8, // 256 units, 8x8 tiles per cell
+		MAX_QUERY_CANDIDATES = 256,
+		SNAP_CELL_SHIFT = 9, // 512 units, a view spans about 5x5 cells
+		MAX_TEAM_TICK_THREADS = 16,
+		MAP_CELL_SHIFT = 10, // 1024 units, the buckets of the vanilla id maps
+	};
+
 private:
 	void Reset();
 	void RemoveEntities();
@@ -35,9 +46,123 @@ private:
 	CEntity *m_pNextTraverseEntity;
 	CEntity *m_apFirstEntityTypes[NUM_ENTTYPES];
 
+	// uniform grid over the map, one bucket list per entity type and cell
+	CEntity **m_apGrid[NUM_ENTTYPES];
+	int m_GridWidth;
+	int m_GridHeight;
+	int m_aNumEntities[NUM_ENTTYPES];
+	float m_aMaxProximityRadius[NUM_ENTTYPES];
+	int64 m_InsertCounter;
+
+	static bool InsertOrderCompare(const CEntity *pA, const CEntity *pB);
+	int GridCell(vec2 Pos);
+	void LinkCell(CEntity *pEntity, int Cell);
+	void UnlinkCell(CEntity *pEntity);
+	void UpdateGrid();
+	int QueryGrid(int Type, vec2 Min, vec2 Max, CEntity **ppEnts, int MaxEnts);
+
+	// walks the grid candidates of a query in list order, or the whole type list if the grid can't answer it
+	class CQueryIterator
+	{
+		CEntity **m_ppCandidates;
+		int m_NumCandidates;
+		int m_Index;
+		CEntity *m_pNext;
+
+	public:
+		CQueryIterator(CEntity **ppCandidates, int NumCandidates, CEntity *pFirst);
+		CEntity *Next();
+	};
+
+	// entities bucketed by snap position once per snap tick
+	struct CSnapEntry
+	{
+		CEntity *m_pEntity;
+		vec2 m_Pos;
+		float m_Reach;
+		int m_Order;
+	};
+
+	CSnapEntry *m_paSnapEntries;
+	CSnapEntry *m_paSnapScratch;
+	CSnapEntry **m_ppSnapCandidates;
+	int m_NumSnapEntries;
+	int m_SnapEntriesSize;
+	int *m_pSnapCellStart;
+	int m_SnapWidth;
+	int m_SnapHeight;
+	float m_MaxSnapReach;
+	int m_SnapTick;
+	int m_aSnapConsidered[MAX_CLIENTS];
+	int m_aSnapSnapped[MAX_CLIENTS];
+
+	static bool SnapOrderCompare(const CSnapEntry *pA, const CSnapEntry *pB);
+	int SnapCell(vec2 Pos);
+	int QuerySnap(int SnappingClient);
+
+	// characters grouped into partitions that can't collide with each other,
+	// partition after partition and in list order within one
+	CCharacter *m_apPartitionOrder[MAX_CLIENTS];
+	int m_aPartitionClient[MAX_CLIENTS];
+	int m_aPartitionListIndex[MAX_CLIENTS];
+	int m_aPartitionStart[MAX_CLIENTS + 1];
+	int m_aClientPartition[MAX_CLIENTS];
+
+	// a round of work items that run in parallel, an item is a range of
+	// m_apRound that one thread runs in order
+	enum
+	{
+		ROUND_CORE = 0,
+		ROUND_MOVE,
+	};
+	CCharacter *m_apRound[MAX_CLIENTS];
+	int m_aRoundStart[MAX_CLIENTS + 1];
+	int m_RoundPhase;
+	int m_NumRoundItems;
+	int m_NextRoundItem;
+	int m_RoundItemsDone;
+	LOCK m_RoundLock;
+	semaphore m_RoundDone;
+	CJob m_aTeamTickJobs[MAX_TEAM_TICK_THREADS];
+	CTuningParams m_aRoundTuning[MAX_CLIENTS];
+	CCharacterCore m_aVerifyCores[MAX_CLIENTS];
+
+	static int TeamTickJob(void *pUser);
+	int BuildPartitions();
+	void RunRoundItems();
+	void RunRound(int NumItems, int Phase);
+	void RunRoundVerified(int NumItems, int Phase);
+	unsigned CoreHash();
+	void TickCharacters(int NumPartitions);
+	void TickDeferedCharacters(int NumPartitions);
+
+	// characters bucketed by coarse cell for the vanilla id maps
+	struct CMapCandidate
+	{
+		int m_ClientID;
+		vec2 m_Pos;
+	};
+
+	CMapCandidate m_aMapCandidates[MAX_CLIENTS];
+	int m_NumMapCandidates;
+	int *m_pMapCellStart;
+	int m_MapCellWidth;
+	int m_MapCellHeight;
+
+	// the candidates each id map was built from and the map as it was left
+	unsigned char m_aaMapTop[MAX_CLIENTS][MAX_CLIENTS];
+	int m_aaLastIdMap[MAX_CLIENTS][VANILLA_MAX_CLIENTS];
+	int m_MapUpdates;
+	int m_MapsRebuilt;
+	int m_MapsKept;
+	int64 m_MapUpdateTime;
+	int64 m_MapUpdateTotal;
+	int64 m_MapUpdateMax;
+
 	class CGameContext *m_pGameServer;
 	class IServer *m_pServer;
 
+	int SelectMapCandidates(int ClientID, const bool *pValid, std::pair<float, int> *pDist);
 	void UpdatePlayerMaps();
 
 public:
@@ -53,6 +178,27 @@ public:
 
 	void SetGameServer(CGameContext *pGameServer);
 
+	/*
+		Function: InitGrid
+			Sets up the spatial grid used by the proximity queries.
+
+		Arguments:
+			Width - Map width in tiles.
+			Height - Map height in tiles.
+	*/
+	void InitGrid(int Width, int Height);
+
+	/*
+		Function: UpdateEntityCell
+			Moves an entity to the grid cell of its current position.
+			Must be called when an entity's position changes in the
+			middle of a tick phase.
+
+		Arguments:
+			entity - Entity that moved
+	*/
+	void UpdateEntityCell(CEntity *pEntity);
+
 	CEntity *FindFirst(int Type);
 
 	/*
@@ -140,6 +286,31 @@ public:
 	*/
 	void Snap(int SnappingClient);
 
+	/*
+		Function: PreSnap
+			Buckets the entities by their snap position, so that
+			snap only has to visit the entities around each
+			client's view. Called once per snap tick before the
+			snapshots are created.
+	*/
+	void PreSnap();
+
+	/*
+		Function: SnapStats
+			Returns how many entities the last snap for a client
+			considered and how many of those were passed on to
+			CEntity::Snap.
+	*/
+	void SnapStats(int ClientID, int *pConsidered, int *pSnapped);
+
+	/*
+		Function: PrintPlayerMapStats
+			Prints how long the vanilla id map updates take and how
+			many maps were rebuilt or kept because their candidates
+			did not change.
+	*/
+	void PrintPlayerMapStats(class IConsole *pConsole);
+
 	/*
 		Function: tick
 			Calls tick on all the entities in the world to progress
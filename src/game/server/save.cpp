@@ -6,6 +6,160 @@
 #include <engine/server/server.h>
 #include "./gamemodes/DDRace.h"
 #include <engine/shared/config.h>
+#include <engine/shared/compression.h>
+#include <zlib.h>
+
+// Binary savegames are the fields below packed as variable ints, floats
+// bit exact, optionally deflated and stored as base64 after this prefix
+// so they still fit the text column. Text savegames start with a digit.
+static const char s_aBinarySavePrefix[] = "$B";
+enum
+{
+	SAVE_BINARY_VERSION=1,
+	SAVE_BINARY_FLAG_ZLIB=1,
+	SAVE_BINARY_MAX_SIZE=48*1024,
+};
+
+class CSaveBuffer
+{
+public:
+	unsigned char *m_pData;
+	int m_Size;
+	int m_Capacity;
+	int m_Pos;
+	bool m_Error;
+
+	CSaveBuffer(unsigned char *pData, int Capacity, int Size)
+	{
+		m_pData = pData;
+		m_Capacity = Capacity;
+		m_Size = Size;
+		m_Pos = 0;
+		m_Error = false;
+	}
+
+	void AddInt(int i)
+	{
+		if(m_Size + 5 > m_Capacity)
+		{
+			m_Error = true;
+			return;
+		}
+		m_Size = CVariableInt::Pack(m_pData + m_Size, i) - m_pData;
+	}
+
+	void AddFloat(float f)
+	{
+		union { float f; int i; } Bits;
+		Bits.f = f;
+		AddInt(Bits.i);
+	}
+
+	void AddString(const char *pStr)
+	{
+		int Len = str_length(pStr);
+		AddInt(Len);
+		if(m_Error || m_Size + Len > m_Capacity)
+		{
+			m_Error = true;
+			return;
+		}
+		mem_copy(m_pData + m_Size, pStr, Len);
+		m_Size += Len;
+	}
+
+	int GetInt()
+	{
+		// the buffers are zero padded, so a variable int cut off at the
+		// end stops in the padding
+		if(m_Error || m_Pos >= m_Size)
+		{
+			m_Error = true;
+			return 0;
+		}
+		int i;
+		m_Pos = CVariableInt::Unpack(m_pData + m_Pos, &i) - m_pData;
+		if(m_Pos > m_Size)
+			m_Error = true;
+		return i;
+	}
+
+	float GetFloat()
+	{
+		union { float f; int i; } Bits;
+		Bits.i = GetInt();
+		return Bits.f;
+	}
+
+	void GetString(char *pStr, int StrSize)
+	{
+		int Len = GetInt();
+		if(m_Error || Len < 0 || Len >= StrSize || m_Pos + Len > m_Size)
+		{
+			m_Error = true;
+			pStr[0] = 0;
+			return;
+		}
+		mem_copy(pStr, m_pData + m_Pos, Len);
+		pStr[Len] = 0;
+		m_Pos += Len;
+	}
+};
+
+static const char s_aBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int Base64Encode(char *pDst, int DstSize, const unsigned char *pSrc, int Size)
+{
+	int Len = 0;
+	for(int i = 0; i < Size; i += 3)
+	{
+		if(Len + 5 > DstSize)
+			return -1;
+		int Left = Size - i;
+		unsigned Bits = pSrc[i] << 16 | (Left > 1 ? pSrc[i+1] << 8 : 0) | (Left > 2 ? pSrc[i+2] : 0);
+		pDst[Len++] = s_aBase64[(Bits >> 18) & 63];
+		pDst[Len++] = s_aBase64[(Bits >> 12) & 63];
+		pDst[Len++] = Left > 1 ? s_aBase64[(Bits >> 6) & 63] : '=';
+		pDst[Len++] = Left > 2 ? s_aBase64[Bits & 63] : '=';
+	}
+	pDst[Len] = 0;
+	return Len;
+}
+
+static int Base64Value(char c)
+{
+	if(c >= 'A' && c <= 'Z') return c - 'A';
+	if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+	if(c >= '0' && c <= '9') return c - '0' + 52;
+	if(c == '+') return 62;
+	if(c == '/') return 63;
+	return -1;
+}
+
+static int Base64Decode(unsigned char *pDst, int DstSize, const char *pSrc)
+{
+	int Len = 0;
+	for(; pSrc[0]; pSrc += 4)
+	{
+		if(!pSrc[1] || !pSrc[2] || !pSrc[3])
+			return -1;
+		int a = Base64Value(pSrc[0]), b = Base64Value(pSrc[1]);
+		int c = pSrc[2] == '=' ? 0 : Base64Value(pSrc[2]);
+		int d = pSrc[3] == '=' ? 0 : Base64Value(pSrc[3]);
+		if(a < 0 || b < 0 || c < 0 || d < 0)
+			return -1;
+		unsigned Bits = a << 18 | b << 12 | c << 6 | d;
+		int Num = pSrc[2] == '=' ? 1 : pSrc[3] == '=' ? 2 : 3;
+		if(Len + Num > DstSize)
+			return -1;
+		pDst[Len++] = Bits >> 16;
+		if(Num > 1)
+			pDst[Len++] = (Bits >> 8) & 0xff;
+		if(Num > 2)
+			pDst[Len++] = Bits & 0xff;
+	}
+	return Len;
+}
 
 CSaveTee::CSaveTee()
 {
@@ -192,6 +346,133 @@ int CSaveTee::LoadString(char* String)
 	}
 }
 
+void CSaveTee::Pack(CSaveBuffer *pBuf)
+{
+	pBuf->AddString(m_name);
+	pBuf->AddInt(m_Alive);
+	pBuf->AddInt(m_Paused);
+	pBuf->AddInt(m_NeededFaketuning);
+	pBuf->AddInt(m_TeeFinished);
+	pBuf->AddInt(m_IsSolo);
+	for(int i = 0; i < NUM_WEAPONS; i++)
+	{
+		pBuf->AddInt(m_aWeapons[i].m_AmmoRegenStart);
+		pBuf->AddInt(m_aWeapons[i].m_Ammo);
+		pBuf->AddInt(m_aWeapons[i].m_Ammocost);
+		pBuf->AddInt(m_aWeapons[i].m_Got);
+	}
+	pBuf->AddInt(m_LastWeapon);
+	pBuf->AddInt(m_QueuedWeapon);
+	pBuf->AddInt(m_SuperJump);
+	pBuf->AddInt(m_Jetpack);
+	pBuf->AddInt(m_NinjaJetpack);
+	pBuf->AddInt(m_FreezeTime);
+	pBuf->AddInt(m_FreezeTick);
+	pBuf->AddInt(m_DeepFreeze);
+	pBuf->AddInt(m_EndlessHook);
+	pBuf->AddInt(m_DDRaceState);
+	pBuf->AddInt(m_Hit);
+	pBuf->AddInt(m_Collision);
+	pBuf->AddInt(m_TuneZone);
+	pBuf->AddInt(m_TuneZoneOld);
+	pBuf->AddInt(m_Hook);
+	pBuf->AddInt(m_Time);
+	pBuf->AddFloat(m_Pos.x);
+	pBuf->AddFloat(m_Pos.y);
+	pBuf->AddFloat(m_PrevPos.x);
+	pBuf->AddFloat(m_PrevPos.y);
+	pBuf->AddInt(m_TeleCheckpoint);
+	pBuf->AddInt(m_LastPenalty);
+	pBuf->AddFloat(m_CorePos.x);
+	pBuf->AddFloat(m_CorePos.y);
+	pBuf->AddFloat(m_Vel.x);
+	pBuf->AddFloat(m_Vel.y);
+	pBuf->AddInt(m_ActiveWeapon);
+	pBuf->AddInt(m_Jumped);
+	pBuf->AddInt(m_JumpedTotal);
+	pBuf->AddInt(m_Jumps);
+	pBuf->AddFloat(m_HookPos.x);
+	pBuf->AddFloat(m_HookPos.y);
+	pBuf->AddFloat(m_HookDir.x);
+	pBuf->AddFloat(m_HookDir.y);
+	pBuf->AddFloat(m_HookTeleBase.x);
+	pBuf->AddFloat(m_HookTeleBase.y);
+	pBuf->AddInt(m_HookTick);
+	pBuf->AddInt(m_HookState);
+	pBuf->AddInt(m_CpTime);
+	pBuf->AddInt(m_CpActive);
+	pBuf->AddInt(m_CpLastBroadcast);
+	for(int i = 0; i < 25; i++)
+		pBuf->AddFloat(m_CpCurrent[i]);
+}
+
+int CSaveTee::Unpack(CSaveBuffer *pBuf)
+{
+	pBuf->GetString(m_name, sizeof(m_name));
+	m_Alive = pBuf->GetInt();
+	m_Paused = pBuf->GetInt();
+	m_NeededFaketuning = pBuf->GetInt();
+	m_TeeFinished = pBuf->GetInt();
+	m_IsSolo = pBuf->GetInt();
+	for(int i = 0; i < NUM_WEAPONS; i++)
+	{
+		m_aWeapons[i].m_AmmoRegenStart = pBuf->GetInt();
+		m_aWeapons[i].m_Ammo = pBuf->GetInt();
+		m_aWeapons[i].m_Ammocost = pBuf->GetInt();
+		m_aWeapons[i].m_Got = pBuf->GetInt();
+	}
+	m_LastWeapon = pBuf->GetInt();
+	m_QueuedWeapon = pBuf->GetInt();
+	m_SuperJump = pBuf->GetInt();
+	m_Jetpack = pBuf->GetInt();
+	m_NinjaJetpack = pBuf->GetInt();
+	m_FreezeTime = pBuf->GetInt();
+	m_FreezeTick = pBuf->GetInt();
+	m_DeepFreeze = pBuf->GetInt();
+	m_EndlessHook = pBuf->GetInt();
+	m_DDRaceState = pBuf->GetInt();
+	m_Hit = pBuf->GetInt();
+	m_Collision = pBuf->GetInt();
+	m_TuneZone = pBuf->GetInt();
+	m_TuneZoneOld = pBuf->GetInt();
+	m_Hook = pBuf->GetInt();
+	m_Time = pBuf->GetInt();
+	m_Pos.x = pBuf->GetFloat();
+	m_Pos.y = pBuf->GetFloat();
+	m_PrevPos.x = pBuf->GetFloat();
+	m_PrevPos.y = pBuf->GetFloat();
+	m_TeleCheckpoint = pBuf->GetInt();
+	m_LastPenalty = pBuf->GetInt();
+	m_CorePos.x = pBuf->GetFloat();
+	m_CorePos.y = pBuf->GetFloat();
+	m_Vel.x = pBuf->GetFloat();
+	m_Vel.y = pBuf->GetFloat();
+	m_ActiveWeapon = pBuf->GetInt();
+	m_Jumped = pBuf->GetInt();
+	m_JumpedTotal = pBuf->GetInt();
+	m_Jumps = pBuf->GetInt();
+	m_HookPos.x = pBuf->GetFloat();
+	m_HookPos.y = pBuf->GetFloat();
+	m_HookDir.x = pBuf->GetFloat();
+	m_HookDir.y = pBuf->GetFloat();
+	m_HookTeleBase.x = pBuf->GetFloat();
+	m_HookTeleBase.y = pBuf->GetFloat();
+	m_HookTick = pBuf->GetInt();
+	m_HookState = pBuf->GetInt();
+	m_CpTime = pBuf->GetInt();
+	m_CpActive = pBuf->GetInt();
+	m_CpLastBroadcast = pBuf->GetInt();
+	for(int i = 0; i < 25; i++)
+		m_CpCurrent[i] = pBuf->GetFloat();
+
+	if(pBuf->m_Error)
+	{
+		dbg_msg("Load", "failed to load binary Tee");
+		return 1;
+	}
+	return 0;
+}
+
 CSaveTeam::CSaveTeam(IGameController* Controller)
 {
 	m_pController = Controller;
@@ -334,7 +615,7 @@ CCharacter* CSaveTeam::MatchCharacter(char name[16], int SaveID)
 	return 0;
 }
 
-char* CSaveTeam::GetString()
+char* CSaveTeam::GetTextString()
 {
 	str_format(m_String, sizeof(m_String), "%d\t%d\t%d\t%d", m_TeamState, m_MembersCount, m_NumSwitchers, m_TeamLocked);
 
@@ -359,7 +640,7 @@ char* CSaveTeam::GetString()
 	return m_String;
 }
 
-int CSaveTeam::LoadString(const char* String)
+int CSaveTeam::LoadTextString(const char* String)
 {
 	char TeamStats[MAX_CLIENTS];
 	char Switcher[64];
@@ -504,3 +785,219 @@ int CSaveTeam::LoadString(const char* String)
 
 	return 0;
 }
+
+char* CSaveTeam::GetString()
+{
+	if(g_Config.m_SvSaveGamesBinary)
+		return GetBinaryString();
+	return GetTextString();
+}
+
+char* CSaveTeam::GetBinaryString()
+{
+	// 8 bytes of slack after each buffer, see CSaveBuffer::GetInt
+	unsigned char *pRaw = (unsigned char *)mem_alloc(SAVE_BINARY_MAX_SIZE+8, 1);
+	unsigned char *pPacked = (unsigned char *)mem_alloc(SAVE_BINARY_MAX_SIZE+8, 1);
+
+	CSaveBuffer Buf(pRaw, SAVE_BINARY_MAX_SIZE, 0);
+	Buf.AddInt(m_TeamState);
+	Buf.AddInt(m_MembersCount);
+	Buf.AddInt(m_NumSwitchers);
+	Buf.AddInt(m_TeamLocked);
+	for(int i = 0; i < m_MembersCount; i++)
+		SavedTees[i].Pack(&Buf);
+	for(int i = 1; i < m_NumSwitchers+1; i++)
+	{
+		Buf.AddInt(m_Switchers ? m_Switchers[i].m_Status : 0);
+		Buf.AddInt(m_Switchers ? m_Switchers[i].m_EndTime : 0);
+		Buf.AddInt(m_Switchers ? m_Switchers[i].m_Type : 0);
+	}
+
+	if(Buf.m_Error)
+	{
+		dbg_msg("Save", "savegame too big for the binary format, saving as text");
+		mem_free(pRaw);
+		mem_free(pPacked);
+		return GetTextString();
+	}
+
+	// header, then the payload deflated if that is smaller
+	CSaveBuffer Out(pPacked, SAVE_BINARY_MAX_SIZE, 0);
+	Out.AddInt(SAVE_BINARY_VERSION);
+	uLongf CompSize = SAVE_BINARY_MAX_SIZE - 16;
+	bool Compressed = compress((Bytef *)pPacked + 16, &CompSize, (Bytef *)pRaw, Buf.m_Size) == Z_OK && (int)CompSize < Buf.m_Size; // ignore_convention
+	Out.AddInt(Compressed ? SAVE_BINARY_FLAG_ZLIB : 0);
+	Out.AddInt(Buf.m_Size);
+	if(Compressed)
+		mem_move(pPacked + Out.m_Size, pPacked + 16, CompSize);
+	else
+		mem_copy(pPacked + Out.m_Size, pRaw, Buf.m_Size);
+	int PackedSize = Out.m_Size + (Compressed ? (int)CompSize : Buf.m_Size);
+
+	str_copy(m_String, s_aBinarySavePrefix, sizeof(m_String));
+	int PrefixLen = str_length(s_aBinarySavePrefix);
+	if(Base64Encode(m_String + PrefixLen, sizeof(m_String) - PrefixLen, pPacked, PackedSize) < 0)
+	{
+		mem_free(pRaw);
+		mem_free(pPacked);
+		return GetTextString();
+	}
+
+	mem_free(pRaw);
+	mem_free(pPacked);
+	return m_String;
+}
+
+int CSaveTeam::LoadString(const char* String)
+{
+	if(str_comp_num(String, s_aBinarySavePrefix, str_length(s_aBinarySavePrefix)) == 0)
+		return LoadBinaryString(String);
+	return LoadTextString(String);
+}
+
+int CSaveTeam::LoadBinaryString(const char* String)
+{
+	unsigned char *pRaw = (unsigned char *)mem_alloc(SAVE_BINARY_MAX_SIZE+8, 1);
+	unsigned char *pPacked = (unsigned char *)mem_alloc(SAVE_BINARY_MAX_SIZE+8, 1);
+	mem_zero(pRaw, SAVE_BINARY_MAX_SIZE+8);
+	mem_zero(pPacked, SAVE_BINARY_MAX_SIZE+8);
+	int Result = 1;
+
+	int PackedSize = Base64Decode(pPacked, SAVE_BINARY_MAX_SIZE, String + str_length(s_aBinarySavePrefix));
+	CSaveBuffer In(pPacked, SAVE_BINARY_MAX_SIZE, max(PackedSize, 0));
+	int Version = In.GetInt();
+	int Flags = In.GetInt();
+	int RawSize = In.GetInt();
+	if(PackedSize < 0 || In.m_Error || Version != SAVE_BINARY_VERSION || RawSize < 0 || RawSize > SAVE_BINARY_MAX_SIZE)
+	{
+		dbg_msg("Load", "Savegame: wrong binary format");
+		goto end;
+	}
+
+	if(Flags&SAVE_BINARY_FLAG_ZLIB)
+	{
+		uLongf Size = RawSize;
+		if(uncompress((Bytef *)pRaw, &Size, (Bytef *)pPacked + In.m_Pos, PackedSize - In.m_Pos) != Z_OK || (int)Size != RawSize) // ignore_convention
+		{
+			dbg_msg("Load", "Savegame: couldn't inflate");
+			goto end;
+		}
+	}
+	else
+	{
+		if(PackedSize - In.m_Pos != RawSize)
+		{
+			dbg_msg("Load", "Savegame: wrong binary size");
+			goto end;
+		}
+		mem_copy(pRaw, pPacked + In.m_Pos, RawSize);
+	}
+
+	{
+		CSaveBuffer Buf(pRaw, SAVE_BINARY_MAX_SIZE, RawSize);
+		m_TeamState = Buf.GetInt();
+		m_MembersCount = Buf.GetInt();
+		m_NumSwitchers = Buf.GetInt();
+		m_TeamLocked = Buf.GetInt();
+		if(Buf.m_Error || m_MembersCount < 0 || m_MembersCount > MAX_CLIENTS || m_NumSwitchers < 0 || m_NumSwitchers > 255)
+		{
+			dbg_msg("Load", "Savegame: wrong format (couldn't load TeamStats)");
+			m_MembersCount = 0;
+			m_NumSwitchers = 0;
+			goto end;
+		}
+
+		if(SavedTees)
+		{
+			delete [] SavedTees;
+			SavedTees = 0;
+		}
+		if(m_MembersCount)
+			SavedTees = new CSaveTee[m_MembersCount];
+		for(int n = 0; n < m_MembersCount; n++)
+			if(SavedTees[n].Unpack(&Buf))
+				goto end;
+
+		if(m_Switchers)
+		{
+			delete [] m_Switchers;
+			m_Switchers = 0;
+		}
+		if(m_NumSwitchers)
+			m_Switchers = new SSimpleSwitchers[m_NumSwitchers+1];
+		for(int n = 1; n < m_NumSwitchers+1; n++)
+		{
+			m_Switchers[n].m_Status = Buf.GetInt();
+			m_Switchers[n].m_EndTime = Buf.GetInt();
+			m_Switchers[n].m_Type = Buf.GetInt();
+		}
+
+		if(Buf.m_Error)
+		{
+			dbg_msg("Load", "Savegame: wrong format (couldn't load Switcher)");
+			goto end;
+		}
+	}
+	Result = 0;
+
+end:
+	mem_free(pRaw);
+	mem_free(pPacked);
+	return Result;
+}
+
+void CSaveTeam::Benchmark(int NumTees, int Iterations, IConsole *pConsole)
+{
+	// a synthetic started team in the text format, the tees carry
+	// 95 numbers each after the name
+	static char s_aText[65536];
+	str_format(s_aText, sizeof(s_aText), "%d\t%d\t%d\t%d", (int)CGameTeams::TEAMSTATE_STARTED, NumTees, 0, 0);
+	for(int t = 0; t < NumTees; t++)
+	{
+		char aTee[1024];
+		str_format(aTee, sizeof(aTee), "\nbench tee %d", t);
+		for(int f = 0; f < 95; f++)
+		{
+			char aField[16];
+			str_format(aField, sizeof(aField), "\t%d", (t*131 + f*17) % 2000);
+			str_append(aTee, aField, sizeof(aTee));
+		}
+		str_append(s_aText, aTee, sizeof(s_aText));
+	}
+	if(LoadTextString(s_aText))
+	{
+		pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "save", "failed to build the benchmark team");
+		return;
+	}
+
+	int64 aTime[4] = {0, 0, 0, 0};
+	int TextSize = 0, BinarySize = 0;
+	static char s_aSaved[65536];
+	for(int i = 0; i < Iterations; i++)
+	{
+		int64 Start = time_get();
+		str_copy(s_aSaved, GetTextString(), sizeof(s_aSaved));
+		aTime[0] += time_get() - Start;
+		TextSize = str_length(s_aSaved);
+
+		Start = time_get();
+		LoadTextString(s_aSaved);
+		aTime[1] += time_get() - Start;
+
+		Start = time_get();
+		str_copy(s_aSaved, GetBinaryString(), sizeof(s_aSaved));
+		aTime[2] += time_get() - Start;
+		BinarySize = str_length(s_aSaved);
+
+		Start = time_get();
+		LoadBinaryString(s_aSaved);
+		aTime[3] += time_get() - Start;
+	}
+
+	char aBuf[256];
+	double Scale = 1000000.0 / time_freq() / max(Iterations, 1);
+	str_format(aBuf, sizeof(aBuf), "%d tees, text: %d bytes, save %.1fus, load %.1fus", NumTees, TextSize, aTime[0]*Scale, aTime[1]*Scale);
+	pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "save", aBuf);
+	str_format(aBuf, sizeof(aBuf), "%d tees, binary: %d bytes, save %.1fus, load %.1fus", NumTees, BinarySize, aTime[2]*Scale, aTime[3]*Scale);
+	pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "save", aBuf);
+}
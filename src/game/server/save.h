@@ -13,6 +13,8 @@ public:
 	void load(CCharacter* pchr, int Team);
 	char* GetString();
 	int LoadString(char* String);
+	void Pack(class CSaveBuffer *pBuf);
+	int Unpack(class CSaveBuffer *pBuf);
 	vec2 GetPos() { return m_Pos; }
 	char* GetName() { return m_name; }
 
@@ -86,8 +88,13 @@ public:
 	CSaveTeam(IGameController* Controller);
 	~CSaveTeam();
 	char* GetString();
+	char* GetTextString();
+	char* GetBinaryString();
 	int GetMembersCount() {return m_MembersCount;}
 	int LoadString(const char* String);
+	int LoadTextString(const char* String);
+	int LoadBinaryString(const char* String);
+	void Benchmark(int NumTees, int Iterations, class IConsole *pConsole);
 	int save(int Team);
 	int load(int Team);
 	CSaveTee* SavedTees;
@@ -41,6 +41,9 @@ class IScore
 public:
 	virtual ~IScore() {}
 
+	// called instead of delete, a backend with writes in flight may stay alive until they are done
+	virtual void Release() { delete this; }
+
 	CPlayerData *PlayerData(int ID) { return &m_aPlayerData[ID]; }
 
 	virtual void MapInfo(int ClientID, const char* MapName) = 0;
@@ -65,6 +68,13 @@ public:
 
 	virtual void SaveTeam(int Team, const char* Code, int ClientID, const char* Server) = 0;
 	virtual void LoadTeam(const char* Code, int ClientID) = 0;
+
+	// called on the game thread every tick, backends deliver their results here
+	virtual void OnTick() {}
+	virtual void PrintStats(IConsole *pConsole)
+	{
+		pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "score", "this score backend has no statistics");
+	}
 };
 
 #endif
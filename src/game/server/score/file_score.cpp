@@ -1,7 +1,7 @@
 /* (c) Shereef Marzouk. See "licence DDRace.txt" and the readme.txt in the root of the distribution for more information. */
 /* Based on Race mod stuff and tweaked by GreYFoX@GTi and others to fit our DDRace needs. */
 /* copyright (c) 2008 rajh and gregwar. Score stuff */
-#include <base/tl/sorted_array.h>
+#include <base/math.h>
 
 #include <engine/shared/config.h>
 #include <sstream>
@@ -12,10 +12,12 @@
 #include <engine/shared/console.h>
 
 static LOCK gs_ScoreLock = 0;
+static const char s_aLogMagic[8] = {'D', 'D', 'R', 'E', 'C', 'L', 'O', 'G'};
 
 CFileScore::CPlayerScore::CPlayerScore(const char *pName, float Score,
 		float aCpTime[NUM_CHECKPOINTS])
 {
+	mem_zero(m_aName, sizeof(m_aName));
 	str_copy(m_aName, pName, sizeof(m_aName));
 	m_Score = Score;
 	for (int i = 0; i < NUM_CHECKPOINTS; i++)
@@ -28,32 +30,65 @@ CFileScore::CFileScore(CGameContext *pGameServer) :
 	if (gs_ScoreLock == 0)
 		gs_ScoreLock = lock_create();
 
+	m_RankRoot = -1;
+	m_RankSeed = 0x2545f491;
+	m_pNameHash = 0;
+	m_NameHashSize = 0;
+	m_aLogFilename[0] = 0;
+	m_LogFile = 0;
+	m_LogRecords = 0;
+	m_CompactRetry = 0;
+	m_Compacting = false;
+	m_pCompactData = 0;
+	m_CompactRecords = 0;
+
 	Init();
 }
 
 CFileScore::~CFileScore()
 {
+	// the compaction thread still writes to our log handle
+	while (m_Compacting)
+		thread_sleep(1);
+
 	lock_wait(gs_ScoreLock);
 
+	if (m_LogFile)
+		io_close(m_LogFile);
+	m_LogFile = 0;
+
 	// clear list
-	m_Top.clear();
+	m_lRecords.clear();
+	m_lRankNodes.clear();
+	mem_free(m_pNameHash);
+	m_pNameHash = 0;
 
 	lock_unlock(gs_ScoreLock);
 }
 
-std::string SaveFile()
+static std::string ScoreFile(const char *pSuffix)
 {
 	std::ostringstream oss;
 	char aBuf[256];
 	str_copy(aBuf, g_Config.m_SvMap, sizeof(aBuf));
 	for(int i = 0; i < 256; i++) if(aBuf[i] == '/') aBuf[i] = '-';
 	if (g_Config.m_SvScoreFolder[0])
-		oss << g_Config.m_SvScoreFolder << "/" << aBuf << "_record.dtb";
+		oss << g_Config.m_SvScoreFolder << "/" << aBuf << pSuffix;
 	else
-		oss << g_Config.m_SvMap << "_record.dtb";
+		oss << g_Config.m_SvMap << pSuffix;
 	return oss.str();
 }
 
+std::string SaveFile()
+{
+	return ScoreFile("_record.dtb");
+}
+
+static std::string LogFile()
+{
+	return ScoreFile("_record.log");
+}
+
 void CFileScore::MapInfo(int ClientID, const char* MapName)
 {
 	// TODO: implement
@@ -64,51 +99,373 @@ void CFileScore::MapVote(int ClientID, const char* MapName)
 	// TODO: implement
 }
 
-void CFileScore::SaveScoreThread(void *pUser)
+static unsigned NameHash(const char *pName)
 {
-	CFileScore *pSelf = (CFileScore *) pUser;
-	lock_wait(gs_ScoreLock);
-	std::fstream f;
-	f.open(SaveFile().c_str(), std::ios::out);
-	if (!f.fail())
+	unsigned Hash = 2166136261u;
+	for (; *pName; pName++)
+		Hash = (Hash ^ (unsigned char)*pName) * 16777619u;
+	return Hash;
+}
+
+int CFileScore::FindRecord(const char *pName) const
+{
+	if (!m_NameHashSize)
+		return -1;
+
+	int Mask = m_NameHashSize - 1;
+	for (int i = NameHash(pName) & Mask; m_pNameHash[i]; i = (i + 1) & Mask)
+	{
+		int RecordID = m_pNameHash[i] - 1;
+		if (!str_comp(m_lRecords[RecordID].m_aName, pName))
+			return RecordID;
+	}
+	return -1;
+}
+
+void CFileScore::HashInsert(int RecordID)
+{
+	// keep the load factor at or below one half
+	// the record is in m_lRecords already, so the rehash inserts it as well
+	if ((RecordID + 1) * 2 > m_NameHashSize)
+	{
+		RehashNames(max(m_NameHashSize * 2, 1024));
+		return;
+	}
+
+	int Mask = m_NameHashSize - 1;
+	int i = NameHash(m_lRecords[RecordID].m_aName) & Mask;
+	while (m_pNameHash[i])
+		i = (i + 1) & Mask;
+	m_pNameHash[i] = RecordID + 1;
+}
+
+void CFileScore::RehashNames(int Size)
+{
+	mem_free(m_pNameHash);
+	m_NameHashSize = Size;
+	m_pNameHash = (int *)mem_alloc(Size * sizeof(int), 1);
+	mem_zero(m_pNameHash, Size * sizeof(int));
+
+	int Mask = Size - 1;
+	for (int r = 0; r < m_lRecords.size(); r++)
+	{
+		int i = NameHash(m_lRecords[r].m_aName) & Mask;
+		while (m_pNameHash[i])
+			i = (i + 1) & Mask;
+		m_pNameHash[i] = r + 1;
+	}
+}
+
+bool CFileScore::RankLess(int a, int b) const
+{
+	// equal times keep the order in which they were first set
+	if (m_lRecords[a].m_Score != m_lRecords[b].m_Score)
+		return m_lRecords[a].m_Score < m_lRecords[b].m_Score;
+	return a < b;
+}
+
+void CFileScore::RankUpdate(int Node)
+{
+	CRankNode *pNode = &m_lRankNodes[Node];
+	pNode->m_Size = 1 + RankSize(pNode->m_Left) + RankSize(pNode->m_Right);
+}
+
+int CFileScore::RankMerge(int a, int b)
+{
+	if (a < 0)
+		return b;
+	if (b < 0)
+		return a;
+
+	if (m_lRankNodes[a].m_Priority > m_lRankNodes[b].m_Priority)
+	{
+		m_lRankNodes[a].m_Right = RankMerge(m_lRankNodes[a].m_Right, b);
+		RankUpdate(a);
+		return a;
+	}
+	m_lRankNodes[b].m_Left = RankMerge(a, m_lRankNodes[b].m_Left);
+	RankUpdate(b);
+	return b;
+}
+
+void CFileScore::RankSplit(int Node, int Key, int *pLeft, int *pRight)
+{
+	if (Node < 0)
+	{
+		*pLeft = *pRight = -1;
+		return;
+	}
+
+	if (RankLess(Node, Key))
 	{
-		int t = 0;
-		for (sorted_array<CPlayerScore>::range r = pSelf->m_Top.all();
-				!r.empty(); r.pop_front())
+		RankSplit(m_lRankNodes[Node].m_Right, Key, &m_lRankNodes[Node].m_Right, pRight);
+		*pLeft = Node;
+	}
+	else
+	{
+		RankSplit(m_lRankNodes[Node].m_Left, Key, pLeft, &m_lRankNodes[Node].m_Left);
+		*pRight = Node;
+	}
+	RankUpdate(Node);
+}
+
+int CFileScore::RankInsert(int Node, int RecordID)
+{
+	if (Node < 0)
+		return RecordID;
+
+	CRankNode *pNew = &m_lRankNodes[RecordID];
+	if (pNew->m_Priority > m_lRankNodes[Node].m_Priority)
+	{
+		RankSplit(Node, RecordID, &pNew->m_Left, &pNew->m_Right);
+		RankUpdate(RecordID);
+		return RecordID;
+	}
+
+	if (RankLess(RecordID, Node))
+		m_lRankNodes[Node].m_Left = RankInsert(m_lRankNodes[Node].m_Left, RecordID);
+	else
+		m_lRankNodes[Node].m_Right = RankInsert(m_lRankNodes[Node].m_Right, RecordID);
+	RankUpdate(Node);
+	return Node;
+}
+
+int CFileScore::RankErase(int Node, int RecordID)
+{
+	if (Node < 0)
+		return -1;
+
+	if (Node == RecordID)
+	{
+		int Merged = RankMerge(m_lRankNodes[Node].m_Left, m_lRankNodes[Node].m_Right);
+		m_lRankNodes[Node].m_Left = m_lRankNodes[Node].m_Right = -1;
+		m_lRankNodes[Node].m_Size = 1;
+		return Merged;
+	}
+
+	if (RankLess(RecordID, Node))
+		m_lRankNodes[Node].m_Left = RankErase(m_lRankNodes[Node].m_Left, RecordID);
+	else
+		m_lRankNodes[Node].m_Right = RankErase(m_lRankNodes[Node].m_Right, RecordID);
+	RankUpdate(Node);
+	return Node;
+}
+
+int CFileScore::RankOf(int RecordID) const
+{
+	// 1-based position in the ranking
+	int Rank = 0;
+	int Node = m_RankRoot;
+	while (Node >= 0 && Node != RecordID)
+	{
+		if (RankLess(RecordID, Node))
+			Node = m_lRankNodes[Node].m_Left;
+		else
 		{
-			f << r.front().m_aName << std::endl << r.front().m_Score
-					<< std::endl;
-			if (g_Config.m_SvCheckpointSave)
-			{
-				for (int c = 0; c < NUM_CHECKPOINTS; c++)
-					f << r.front().m_aCpTime[c] << " ";
-				f << std::endl;
-			}
-			t++;
-			if (t % 50 == 0)
-				thread_sleep(1);
+			Rank += RankSize(m_lRankNodes[Node].m_Left) + 1;
+			Node = m_lRankNodes[Node].m_Right;
 		}
 	}
-	f.close();
-	lock_unlock(gs_ScoreLock);
+	if (Node < 0)
+		return -1;
+	return Rank + RankSize(m_lRankNodes[Node].m_Left) + 1;
 }
 
-void CFileScore::Save()
+int CFileScore::RankKth(int k) const
 {
-	void *pSaveThread = thread_init(SaveScoreThread, this);
-	thread_detach(pSaveThread);
+	// 0-based, -1 when out of range
+	int Node = m_RankRoot;
+	while (Node >= 0)
+	{
+		int Left = RankSize(m_lRankNodes[Node].m_Left);
+		if (k < Left)
+			Node = m_lRankNodes[Node].m_Left;
+		else if (k == Left)
+			return Node;
+		else
+		{
+			k -= Left + 1;
+			Node = m_lRankNodes[Node].m_Right;
+		}
+	}
+	return -1;
 }
 
-void CFileScore::Init()
+int CFileScore::AddRecord(const CPlayerScore &Score)
 {
+	int RecordID = m_lRecords.add(Score);
+
+	// separate generator so the game's rand() sequence stays untouched
+	m_RankSeed = m_RankSeed * 1103515245 + 12345;
+	CRankNode Node;
+	Node.m_Left = Node.m_Right = -1;
+	Node.m_Size = 1;
+	Node.m_Priority = m_RankSeed >> 8;
+	m_lRankNodes.add(Node);
+
+	HashInsert(RecordID);
+	return RecordID;
+}
+
+void CFileScore::PackRecord(const CPlayerScore *pScore, unsigned char *pOut)
+{
+	CPlayerScore Record = *pScore;
+	if (!g_Config.m_SvCheckpointSave)
+		mem_zero(Record.m_aCpTime, sizeof(Record.m_aCpTime));
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	swap_endian(&Record.m_Score, sizeof(float), 1 + NUM_CHECKPOINTS);
+#endif
+	mem_copy(pOut, &Record, sizeof(Record));
+}
+
+bool CFileScore::WriteLog(const char *pFilename, const unsigned char *pData, int NumRecords)
+{
+	// write to a temporary file first so a crash never leaves a half log
+	char aTmp[512];
+	str_format(aTmp, sizeof(aTmp), "%s.tmp", pFilename);
+	IOHANDLE File = io_open(aTmp, IOFLAG_WRITE);
+	if (!File)
+		return false;
+
+	unsigned char aHeader[LOG_HEADER_SIZE];
+	int aInfo[2] = { LOG_VERSION, (int)sizeof(CPlayerScore) };
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	swap_endian(aInfo, sizeof(int), 2);
+#endif
+	mem_copy(aHeader, s_aLogMagic, sizeof(s_aLogMagic));
+	mem_copy(aHeader + sizeof(s_aLogMagic), aInfo, sizeof(aInfo));
+
+	bool Ok = io_write(File, aHeader, sizeof(aHeader)) == sizeof(aHeader);
+	unsigned Size = NumRecords * sizeof(CPlayerScore);
+	if (Size)
+		Ok = Ok && io_write(File, pData, Size) == Size;
+	io_close(File);
+
+	if (!Ok || fs_rename(aTmp, pFilename))
+	{
+		fs_remove(aTmp);
+		return false;
+	}
+	return true;
+}
+
+void CFileScore::AppendLog(int RecordID)
+{
+	if (!m_LogFile)
+		return;
+
+	unsigned char aData[sizeof(CPlayerScore)];
+	PackRecord(&m_lRecords[RecordID], aData);
+	io_write(m_LogFile, aData, sizeof(aData));
+	io_flush(m_LogFile);
+	m_LogRecords++;
+
+	if (m_Compacting)
+		m_lCompactPending.add(RecordID);
+}
+
+void CFileScore::CompactThread(void *pUser)
+{
+	CFileScore *pSelf = (CFileScore *) pUser;
+	const char *pFilename = pSelf->m_aLogFilename;
+	bool Ok = WriteLog(pFilename, pSelf->m_pCompactData, pSelf->m_CompactRecords);
+
 	lock_wait(gs_ScoreLock);
+	if (Ok)
+	{
+		// the renamed file misses what was finished since the snapshot
+		if (pSelf->m_LogFile)
+			io_close(pSelf->m_LogFile);
+		pSelf->m_LogFile = io_open(pFilename, IOFLAG_APPEND);
+		pSelf->m_LogRecords = pSelf->m_CompactRecords;
+		pSelf->m_CompactRetry = 0;
+		pSelf->m_Compacting = false;
+		for (int i = 0; i < pSelf->m_lCompactPending.size(); i++)
+			pSelf->AppendLog(pSelf->m_lCompactPending[i]);
+	}
+	else
+	{
+		// don't start a full compaction on every finish while the disk is failing
+		dbg_msg("FileScore", "failed to compact '%s'", pFilename);
+		pSelf->m_CompactRetry = pSelf->m_LogRecords + COMPACT_MIN_GARBAGE;
+	}
+	pSelf->m_lCompactPending.clear();
+	mem_free(pSelf->m_pCompactData);
+	pSelf->m_pCompactData = 0;
+	pSelf->m_Compacting = false;
+	lock_unlock(gs_ScoreLock);
+}
 
-	// create folder if not exist
-	if (g_Config.m_SvScoreFolder[0])
-		fs_makedir(g_Config.m_SvScoreFolder);
+void CFileScore::Compact()
+{
+	// snapshot the live records, the thread only touches the copy
+	m_CompactRecords = m_lRecords.size();
+	m_pCompactData = (unsigned char *)mem_alloc(max(m_CompactRecords, 1) * sizeof(CPlayerScore), 1);
+	for (int i = 0; i < m_CompactRecords; i++)
+		PackRecord(&m_lRecords[i], m_pCompactData + i * sizeof(CPlayerScore));
+	m_Compacting = true;
+
+	void *pCompactThread = thread_init(CompactThread, this);
+	thread_detach(pCompactThread);
+}
+
+bool CFileScore::LoadLog(const char *pFilename)
+{
+	IOHANDLE File = io_open(pFilename, IOFLAG_READ);
+	if (!File)
+		return false;
+
+	int Length = io_length(File);
+	unsigned char *pData = (unsigned char *)mem_alloc(max(Length, 1), 1);
+	Length = io_read(File, pData, Length);
+	io_close(File);
+
+	int aInfo[2] = { 0, 0 };
+	if (Length >= LOG_HEADER_SIZE)
+		mem_copy(aInfo, pData + sizeof(s_aLogMagic), sizeof(aInfo));
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	swap_endian(aInfo, sizeof(int), 2);
+#endif
+	if (Length < LOG_HEADER_SIZE || mem_comp(pData, s_aLogMagic, sizeof(s_aLogMagic)) != 0
+		|| aInfo[0] != LOG_VERSION || aInfo[1] != (int)sizeof(CPlayerScore))
+	{
+		dbg_msg("FileScore", "'%s' is not a valid record log", pFilename);
+		mem_free(pData);
+		return false;
+	}
 
+	// a record cut off by a crash at the end is ignored
+	int NumRecords = (Length - LOG_HEADER_SIZE) / sizeof(CPlayerScore);
+	m_lRecords.hint_size(NumRecords);
+	m_lRankNodes.hint_size(NumRecords);
+	for (int i = 0; i < NumRecords; i++)
+	{
+		CPlayerScore Record;
+		mem_copy(&Record, pData + LOG_HEADER_SIZE + i * sizeof(CPlayerScore), sizeof(Record));
+#if defined(CONF_ARCH_ENDIAN_BIG)
+		swap_endian(&Record.m_Score, sizeof(float), 1 + NUM_CHECKPOINTS);
+#endif
+		Record.m_aName[sizeof(Record.m_aName) - 1] = 0;
+		if (!g_Config.m_SvCheckpointSave)
+			mem_zero(Record.m_aCpTime, sizeof(Record.m_aCpTime));
+
+		// later entries are newer bests of the same player
+		int RecordID = FindRecord(Record.m_aName);
+		if (RecordID >= 0)
+			m_lRecords[RecordID] = Record;
+		else
+			AddRecord(Record);
+	}
+	mem_free(pData);
+
+	m_LogRecords = NumRecords;
+	return true;
+}
+
+void CFileScore::LoadText(const char *pFilename)
+{
 	std::fstream f;
-	f.open(SaveFile().c_str(), std::ios::in);
+	f.open(pFilename, std::ios::in);
 
 	while (!f.eof() && !f.fail())
 	{
@@ -131,50 +488,97 @@ void CFileScore::Init()
 					i++;
 				}
 			}
-			m_Top.add(
-					*new CPlayerScore(TmpName.c_str(), atof(TmpScore.c_str()),
-							aTmpCpTime));
+			CPlayerScore Record(TmpName.c_str(), atof(TmpScore.c_str()), aTmpCpTime);
+			int RecordID = FindRecord(Record.m_aName);
+			if (RecordID < 0)
+				AddRecord(Record);
+			else if (Record.m_Score < m_lRecords[RecordID].m_Score)
+				m_lRecords[RecordID] = Record;
 		}
 	}
 	f.close();
+}
+
+void CFileScore::Init()
+{
+	lock_wait(gs_ScoreLock);
+
+	// create folder if not exist
+	if (g_Config.m_SvScoreFolder[0])
+		fs_makedir(g_Config.m_SvScoreFolder);
+
+	str_copy(m_aLogFilename, LogFile().c_str(), sizeof(m_aLogFilename));
+	if (!LoadLog(m_aLogFilename))
+	{
+		// first start with this backend, import the old text records
+		m_lRecords.clear();
+		m_lRankNodes.clear();
+		RehashNames(1024);
+		LoadText(SaveFile().c_str());
+
+		unsigned char *pData = (unsigned char *)mem_alloc(max(m_lRecords.size(), 1) * sizeof(CPlayerScore), 1);
+		for (int i = 0; i < m_lRecords.size(); i++)
+			PackRecord(&m_lRecords[i], pData + i * sizeof(CPlayerScore));
+		if (!WriteLog(m_aLogFilename, pData, m_lRecords.size()))
+			dbg_msg("FileScore", "failed to write '%s'", m_aLogFilename);
+		mem_free(pData);
+		m_LogRecords = m_lRecords.size();
+	}
+
+	// build the ranking once all records are final
+	for (int i = 0; i < m_lRecords.size(); i++)
+		m_RankRoot = RankInsert(m_RankRoot, i);
+
+	m_LogFile = io_open(m_aLogFilename, IOFLAG_APPEND);
+	if (!m_LogFile)
+		dbg_msg("FileScore", "failed to open '%s' for appending", m_aLogFilename);
+
 	lock_unlock(gs_ScoreLock);
 
 	// save the current best score
-	if (m_Top.size())
+	int Best = RankKth(0);
+	if (Best >= 0)
 		((CGameControllerDDRace*) GameServer()->m_pController)->m_CurrentRecord =
-				m_Top[0].m_Score;
+				m_lRecords[Best].m_Score;
 }
 
 CFileScore::CPlayerScore *CFileScore::SearchName(const char *pName,
 		int *pPosition, bool NoCase)
 {
-	CPlayerScore *pPlayer = 0;
-	int Pos = 1;
+	if (pPosition)
+		*pPosition = 0;
+
+	int RecordID = FindRecord(pName);
+	if (RecordID >= 0)
+	{
+		if (pPosition)
+			*pPosition = RankOf(RecordID);
+		return &m_lRecords[RecordID];
+	}
+	if (!NoCase)
+		return 0;
+
+	// partial names still need a scan, but only for explicit searches
 	int Found = 0;
-	for (sorted_array<CPlayerScore>::range r = m_Top.all(); !r.empty();
-			r.pop_front())
+	for (int i = 0; i < m_lRecords.size(); i++)
 	{
-		if (str_find_nocase(r.front().m_aName, pName))
+		if (str_find_nocase(m_lRecords[i].m_aName, pName))
 		{
-			if (pPosition)
-				*pPosition = Pos;
-			if (NoCase)
+			RecordID = i;
+			if (++Found > 1)
 			{
-				Found++;
-				pPlayer = &r.front();
+				if (pPosition)
+					*pPosition = -1;
+				return 0;
 			}
-			if (!strcmp(r.front().m_aName, pName))
-				return &r.front();
 		}
-		Pos++;
 	}
-	if (Found > 1)
-	{
-		if (pPosition)
-			*pPosition = -1;
+	if (!Found)
 		return 0;
-	}
-	return pPlayer;
+
+	if (pPosition)
+		*pPosition = RankOf(RecordID);
+	return &m_lRecords[RecordID];
 }
 
 void CFileScore::UpdatePlayer(int ID, float Score,
@@ -183,23 +587,27 @@ void CFileScore::UpdatePlayer(int ID, float Score,
 	const char *pName = Server()->ClientName(ID);
 
 	lock_wait(gs_ScoreLock);
-	CPlayerScore *pPlayer = SearchScore(ID, 0);
+	int RecordID = FindRecord(pName);
 
-	if (pPlayer)
+	if (RecordID >= 0)
 	{
+		// reposition the record in the ranking under its new time
+		m_RankRoot = RankErase(m_RankRoot, RecordID);
+
+		CPlayerScore *pPlayer = &m_lRecords[RecordID];
 		for (int c = 0; c < NUM_CHECKPOINTS; c++)
 			pPlayer->m_aCpTime[c] = aCpTime[c];
-
 		pPlayer->m_Score = Score;
-		str_copy(pPlayer->m_aName, pName, sizeof(pPlayer->m_aName));
-
-		sort(m_Top.all());
 	}
 	else
-		m_Top.add(*new CPlayerScore(pName, Score, aCpTime));
+		RecordID = AddRecord(CPlayerScore(pName, Score, aCpTime));
+	m_RankRoot = RankInsert(m_RankRoot, RecordID);
+
+	AppendLog(RecordID);
+	if (!m_Compacting && m_LogRecords > max(m_lRecords.size() * 2 + COMPACT_MIN_GARBAGE, m_CompactRetry))
+		Compact();
 
 	lock_unlock(gs_ScoreLock);
-	Save();
 }
 
 void CFileScore::CheckBirthday(int ClientID)
@@ -210,12 +618,6 @@ void CFileScore::CheckBirthday(int ClientID)
 void CFileScore::LoadScore(int ClientID)
 {
 	CPlayerScore *pPlayer = SearchScore(ClientID, 0);
-	if (pPlayer)
-	{
-		lock_wait(gs_ScoreLock);
-		lock_unlock(gs_ScoreLock);
-		Save();
-	}
 
 	// set score
 	if (pPlayer)
@@ -243,9 +645,10 @@ void CFileScore::ShowTop5(IConsole::IResult *pResult, int ClientID,
 	pSelf->SendChatTarget(ClientID, "----------- Top 5 -----------");
 	for (int i = 0; i < 5; i++)
 	{
-		if (i + Debut > m_Top.size())
+		int RecordID = RankKth(i + Debut - 1);
+		if (RecordID < 0)
 			break;
-		CPlayerScore *r = &m_Top[i + Debut - 1];
+		CPlayerScore *r = &m_lRecords[RecordID];
 		str_format(aBuf, sizeof(aBuf),
 				"%d. %s Time: %d minute(s) %5.2f second(s)", i + Debut,
 				r->m_aName, (int) r->m_Score / 60,
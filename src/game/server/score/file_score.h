@@ -4,15 +4,31 @@
 #ifndef GAME_SERVER_FILESCORE_H
 #define GAME_SERVER_FILESCORE_H
 
-#include <base/tl/sorted_array.h>
+#include <base/tl/array.h>
 
 #include "../score.h"
 
+/*
+	Class: CFileScore
+		File based score backend. Finishes are appended to a binary
+		log next to the old text record file, the records are kept in
+		memory with a name hash and an order statistic treap so lookups,
+		ranks and finishes cost O(log n). The log is compacted in a
+		background thread once it holds mostly outdated entries.
+*/
 class CFileScore: public IScore
 {
 	CGameContext *m_pGameServer;
 	IServer *m_pServer;
 
+	enum
+	{
+		LOG_VERSION=1,
+		LOG_HEADER_SIZE=16,
+		COMPACT_MIN_GARBAGE=1024,
+	};
+
+	// also the on disk layout of a log record, floats stored little endian
 	class CPlayerScore
 	{
 	public:
@@ -26,14 +42,35 @@ class CFileScore: public IScore
 		;
 		CPlayerScore(const char *pName, float Score,
 				float aCpTime[NUM_CHECKPOINTS]);
+	};
 
-		bool operator<(const CPlayerScore& other)
-		{
-			return (this->m_Score < other.m_Score);
-		}
+	struct CRankNode
+	{
+		int m_Left;
+		int m_Right;
+		int m_Size;
+		unsigned m_Priority;
 	};
 
-	sorted_array<CPlayerScore> m_Top;
+	// one rank node per record, both indexed by record id
+	array<CPlayerScore> m_lRecords;
+	array<CRankNode> m_lRankNodes;
+	int m_RankRoot;
+	unsigned m_RankSeed;
+
+	// open addressing, holds record id + 1, 0 marks a free slot
+	int *m_pNameHash;
+	int m_NameHashSize;
+
+	// built once in Init, sv_map already names the next map while this one is still running
+	char m_aLogFilename[512];
+	IOHANDLE m_LogFile;
+	int m_LogRecords;
+	int m_CompactRetry; // log size to reach before compacting again after a failure
+	volatile bool m_Compacting;
+	array<int> m_lCompactPending;
+	unsigned char *m_pCompactData;
+	int m_CompactRecords;
 
 	CGameContext *GameServer()
 	{
@@ -53,9 +90,29 @@ class CFileScore: public IScore
 	CPlayerScore *SearchName(const char *pName, int *pPosition, bool MatchCase);
 	void UpdatePlayer(int ID, float Score, float aCpTime[NUM_CHECKPOINTS]);
 
+	int FindRecord(const char *pName) const;
+	void HashInsert(int RecordID);
+	void RehashNames(int Size);
+
+	bool RankLess(int a, int b) const;
+	int RankSize(int Node) const { return Node < 0 ? 0 : m_lRankNodes[Node].m_Size; }
+	void RankUpdate(int Node);
+	int RankMerge(int a, int b);
+	void RankSplit(int Node, int Key, int *pLeft, int *pRight);
+	int RankInsert(int Node, int RecordID);
+	int RankErase(int Node, int RecordID);
+	int RankOf(int RecordID) const;
+	int RankKth(int k) const;
+	int AddRecord(const CPlayerScore &Score);
+
 	void Init();
-	void Save();
-	static void SaveScoreThread(void *pUser);
+	bool LoadLog(const char *pFilename);
+	void LoadText(const char *pFilename);
+	static void PackRecord(const CPlayerScore *pScore, unsigned char *pOut);
+	static bool WriteLog(const char *pFilename, const unsigned char *pData, int NumRecords);
+	void AppendLog(int RecordID);
+	void Compact();
+	static void CompactThread(void *pUser);
 
 public:
 
@@ -0,0 +1,378 @@
+/* (c) Shereef Marzouk. See "licence DDRace.txt" and the readme.txt in the root of the distribution for more information. */
+#include <algorithm>
+
+#include <base/math.h>
+#include <base/system.h>
+
+#include "rank_cache.h"
+
+void CRankCache::Clear()
+{
+	m_lTimes.clear();
+	m_lTimeOrder.clear();
+	m_lTimeNames.clear();
+	m_lPoints.clear();
+	m_lPointsOrder.clear();
+	m_lPointsNames.clear();
+	m_lTeams.clear();
+	m_lMembers.clear();
+	m_lTeamOrder.clear();
+	m_lMemberNames.clear();
+}
+
+void CRankCache::RemoveValue(array<int> *pList, int Pos, int Value)
+{
+	// Pos is the first entry with the same sort key, the value follows soon
+	while(Pos < pList->size() && (*pList)[Pos] != Value)
+		Pos++;
+	if(Pos < pList->size())
+		pList->remove_index(Pos);
+}
+
+void CRankCache::InsertAt(array<int> *pList, int Pos, int Value)
+{
+	pList->add(Value);
+	int *pData = pList->base_ptr();
+	mem_move(pData+Pos+1, pData+Pos, (pList->size()-1-Pos)*sizeof(int));
+	pData[Pos] = Value;
+}
+
+bool CRankCache::CIndexLess::operator()(int a, int b) const
+{
+	int Comp = 0;
+	switch(m_Sort)
+	{
+	case SORT_TIME:
+		if(m_pCache->m_lTimes[a].m_Time != m_pCache->m_lTimes[b].m_Time)
+			return m_pCache->m_lTimes[a].m_Time < m_pCache->m_lTimes[b].m_Time;
+		break;
+	case SORT_TIME_NAME:
+		Comp = str_comp(m_pCache->m_lTimes[a].m_aName, m_pCache->m_lTimes[b].m_aName);
+		break;
+	case SORT_POINTS:
+		if(m_pCache->m_lPoints[a].m_Points != m_pCache->m_lPoints[b].m_Points)
+			return m_pCache->m_lPoints[a].m_Points > m_pCache->m_lPoints[b].m_Points;
+		break;
+	case SORT_POINTS_NAME:
+		Comp = str_comp(m_pCache->m_lPoints[a].m_aName, m_pCache->m_lPoints[b].m_aName);
+		break;
+	}
+	// equal keys stay in load order, like the inserts keep them
+	return Comp ? Comp < 0 : a < b;
+}
+
+void CRankCache::SortIndices(array<int> *pList, int Num, int Sort)
+{
+	pList->set_size(Num);
+	for(int i = 0; i < Num; i++)
+		(*pList)[i] = i;
+	CIndexLess Less;
+	Less.m_pCache = this;
+	Less.m_Sort = Sort;
+	std::sort(pList->base_ptr(), pList->base_ptr() + Num, Less);
+}
+
+int CRankCache::TimeLowerBound(float Time) const
+{
+	int Low = 0, High = m_lTimeOrder.size();
+	while(Low < High)
+	{
+		int Mid = (Low+High)/2;
+		if(m_lTimes[m_lTimeOrder[Mid]].m_Time < Time)
+			Low = Mid+1;
+		else
+			High = Mid;
+	}
+	return Low;
+}
+
+int CRankCache::TimeNamePos(const char *pName) const
+{
+	int Low = 0, High = m_lTimeNames.size();
+	while(Low < High)
+	{
+		int Mid = (Low+High)/2;
+		if(str_comp(m_lTimes[m_lTimeNames[Mid]].m_aName, pName) < 0)
+			Low = Mid+1;
+		else
+			High = Mid;
+	}
+	return Low;
+}
+
+int CRankCache::PointsLowerBound(int Points) const
+{
+	// sorted by descending points
+	int Low = 0, High = m_lPointsOrder.size();
+	while(Low < High)
+	{
+		int Mid = (Low+High)/2;
+		if(m_lPoints[m_lPointsOrder[Mid]].m_Points > Points)
+			Low = Mid+1;
+		else
+			High = Mid;
+	}
+	return Low;
+}
+
+int CRankCache::PointsNamePos(const char *pName) const
+{
+	int Low = 0, High = m_lPointsNames.size();
+	while(Low < High)
+	{
+		int Mid = (Low+High)/2;
+		if(str_comp(m_lPoints[m_lPointsNames[Mid]].m_aName, pName) < 0)
+			Low = Mid+1;
+		else
+			High = Mid;
+	}
+	return Low;
+}
+
+int CRankCache::TeamLowerBound(float Time) const
+{
+	int Low = 0, High = m_lTeamOrder.size();
+	while(Low < High)
+	{
+		int Mid = (Low+High)/2;
+		if(m_lTeams[m_lTeamOrder[Mid]].m_Time < Time)
+			Low = Mid+1;
+		else
+			High = Mid;
+	}
+	return Low;
+}
+
+int CRankCache::MemberNamePos(const char *pName) const
+{
+	int Low = 0, High = m_lMemberNames.size();
+	while(Low < High)
+	{
+		int Mid = (Low+High)/2;
+		if(str_comp(m_lMembers[m_lMemberNames[Mid]].m_aName, pName) < 0)
+			Low = Mid+1;
+		else
+			High = Mid;
+	}
+	return Low;
+}
+
+void CRankCache::AddTime(const char *pName, float Time)
+{
+	int Index;
+	int NamePos = TimeNamePos(pName);
+	if(NamePos < m_lTimeNames.size() && str_comp(m_lTimes[m_lTimeNames[NamePos]].m_aName, pName) == 0)
+	{
+		Index = m_lTimeNames[NamePos];
+		if(Time >= m_lTimes[Index].m_Time)
+			return;
+		RemoveValue(&m_lTimeOrder, TimeLowerBound(m_lTimes[Index].m_Time), Index);
+		m_lTimes[Index].m_Time = Time;
+	}
+	else
+	{
+		CTimeEntry Entry;
+		str_copy(Entry.m_aName, pName, sizeof(Entry.m_aName));
+		Entry.m_Time = Time;
+		Index = m_lTimes.add(Entry);
+		InsertAt(&m_lTimeNames, NamePos, Index);
+	}
+
+	// behind the equal times, the newest finish comes last
+	int Pos = TimeLowerBound(Time);
+	while(Pos < m_lTimeOrder.size() && TimeAt(Pos) == Time)
+		Pos++;
+	InsertAt(&m_lTimeOrder, Pos, Index);
+}
+
+bool CRankCache::FindTime(const char *pName, float *pTime, int *pRank) const
+{
+	int NamePos = TimeNamePos(pName);
+	if(NamePos >= m_lTimeNames.size() || str_comp(m_lTimes[m_lTimeNames[NamePos]].m_aName, pName) != 0)
+		return false;
+
+	*pTime = m_lTimes[m_lTimeNames[NamePos]].m_Time;
+	*pRank = TimeLowerBound(*pTime) + 1;
+	return true;
+}
+
+void CRankCache::AddPoints(const char *pName, int Points)
+{
+	int Index;
+	int NamePos = PointsNamePos(pName);
+	if(NamePos < m_lPointsNames.size() && str_comp(m_lPoints[m_lPointsNames[NamePos]].m_aName, pName) == 0)
+	{
+		Index = m_lPointsNames[NamePos];
+		RemoveValue(&m_lPointsOrder, PointsLowerBound(m_lPoints[Index].m_Points), Index);
+		m_lPoints[Index].m_Points += Points;
+	}
+	else
+	{
+		CPointsEntry Entry;
+		str_copy(Entry.m_aName, pName, sizeof(Entry.m_aName));
+		Entry.m_Points = Points;
+		Index = m_lPoints.add(Entry);
+		InsertAt(&m_lPointsNames, NamePos, Index);
+	}
+
+	int Total = m_lPoints[Index].m_Points;
+	int Pos = PointsLowerBound(Total);
+	while(Pos < m_lPointsOrder.size() && PointsAt(Pos) == Total)
+		Pos++;
+	InsertAt(&m_lPointsOrder, Pos, Index);
+}
+
+bool CRankCache::FindPoints(const char *pName, int *pPoints, int *pRank) const
+{
+	int NamePos = PointsNamePos(pName);
+	if(NamePos >= m_lPointsNames.size() || str_comp(m_lPoints[m_lPointsNames[NamePos]].m_aName, pName) != 0)
+		return false;
+
+	*pPoints = m_lPoints[m_lPointsNames[NamePos]].m_Points;
+	*pRank = PointsLowerBound(*pPoints) + 1;
+	return true;
+}
+
+void CRankCache::AddTeam(const char *const *ppNames, int Num, float Time)
+{
+	if(Num <= 0 || Num > MAX_CLIENTS)
+		return;
+
+	// the members are compared and listed in name order
+	const char *apSorted[MAX_CLIENTS];
+	for(int i = 0; i < Num; i++)
+	{
+		int j = i;
+		for(; j > 0 && str_comp(apSorted[j-1], ppNames[i]) > 0; j--)
+			apSorted[j] = apSorted[j-1];
+		apSorted[j] = ppNames[i];
+	}
+
+	for(int p = MemberNamePos(apSorted[0]); p < m_lMemberNames.size(); p++)
+	{
+		const CMember *pMember = &m_lMembers[m_lMemberNames[p]];
+		if(str_comp(pMember->m_aName, apSorted[0]) != 0)
+			break;
+
+		int Team = pMember->m_Team;
+		if(TeamSize(Team) != Num)
+			continue;
+		bool Same = true;
+		for(int i = 0; i < Num && Same; i++)
+			Same = str_comp(TeamMember(Team, i), apSorted[i]) == 0;
+		if(!Same)
+			continue;
+
+		if(Time < m_lTeams[Team].m_Time)
+		{
+			RemoveValue(&m_lTeamOrder, TeamLowerBound(m_lTeams[Team].m_Time), Team);
+			m_lTeams[Team].m_Time = Time;
+			int Pos = TeamLowerBound(Time);
+			while(Pos < m_lTeamOrder.size() && TeamTime(TeamAt(Pos)) == Time)
+				Pos++;
+			InsertAt(&m_lTeamOrder, Pos, Team);
+		}
+		return;
+	}
+
+	CTeam NewTeam;
+	NewTeam.m_Time = Time;
+	NewTeam.m_FirstMember = m_lMembers.size();
+	NewTeam.m_NumMembers = Num;
+	int Team = m_lTeams.add(NewTeam);
+
+	for(int i = 0; i < Num; i++)
+	{
+		CMember Member;
+		str_copy(Member.m_aName, apSorted[i], sizeof(Member.m_aName));
+		Member.m_Team = Team;
+		int Index = m_lMembers.add(Member);
+		InsertAt(&m_lMemberNames, MemberNamePos(apSorted[i]), Index);
+	}
+
+	int Pos = TeamLowerBound(Time);
+	while(Pos < m_lTeamOrder.size() && TeamTime(TeamAt(Pos)) == Time)
+		Pos++;
+	InsertAt(&m_lTeamOrder, Pos, Team);
+}
+
+void CRankCache::LoadTime(const char *pName, float Time)
+{
+	CTimeEntry Entry;
+	str_copy(Entry.m_aName, pName, sizeof(Entry.m_aName));
+	Entry.m_Time = Time;
+	m_lTimes.add(Entry);
+}
+
+void CRankCache::LoadPoints(const char *pName, int Points)
+{
+	CPointsEntry Entry;
+	str_copy(Entry.m_aName, pName, sizeof(Entry.m_aName));
+	Entry.m_Points = Points;
+	m_lPoints.add(Entry);
+}
+
+void CRankCache::FinishLoad()
+{
+	// a repeated name is merged into its first entry, the other one stays unindexed
+	array<int> lNames;
+	SortIndices(&lNames, m_lTimes.size(), SORT_TIME_NAME);
+	m_lTimeNames.clear();
+	m_lTimeNames.hint_size(lNames.size());
+	for(int i = 0; i < lNames.size(); i++)
+	{
+		CTimeEntry *pEntry = &m_lTimes[lNames[i]];
+		if(m_lTimeNames.size())
+		{
+			CTimeEntry *pFirst = &m_lTimes[m_lTimeNames[m_lTimeNames.size()-1]];
+			if(str_comp(pFirst->m_aName, pEntry->m_aName) == 0)
+			{
+				pFirst->m_Time = min(pFirst->m_Time, pEntry->m_Time);
+				continue;
+			}
+		}
+		m_lTimeNames.add(lNames[i]);
+	}
+	m_lTimeOrder = m_lTimeNames;
+	CIndexLess TimeLess;
+	TimeLess.m_pCache = this;
+	TimeLess.m_Sort = SORT_TIME;
+	std::sort(m_lTimeOrder.base_ptr(), m_lTimeOrder.base_ptr() + m_lTimeOrder.size(), TimeLess);
+
+	SortIndices(&lNames, m_lPoints.size(), SORT_POINTS_NAME);
+	m_lPointsNames.clear();
+	m_lPointsNames.hint_size(lNames.size());
+	for(int i = 0; i < lNames.size(); i++)
+	{
+		CPointsEntry *pEntry = &m_lPoints[lNames[i]];
+		if(m_lPointsNames.size())
+		{
+			CPointsEntry *pFirst = &m_lPoints[m_lPointsNames[m_lPointsNames.size()-1]];
+			if(str_comp(pFirst->m_aName, pEntry->m_aName) == 0)
+			{
+				pFirst->m_Points += pEntry->m_Points;
+				continue;
+			}
+		}
+		m_lPointsNames.add(lNames[i]);
+	}
+	m_lPointsOrder = m_lPointsNames;
+	CIndexLess PointsLess;
+	PointsLess.m_pCache = this;
+	PointsLess.m_Sort = SORT_POINTS;
+	std::sort(m_lPointsOrder.base_ptr(), m_lPointsOrder.base_ptr() + m_lPointsOrder.size(), PointsLess);
+}
+
+int CRankCache::FindTeam(const char *pName) const
+{
+	int Best = -1;
+	for(int p = MemberNamePos(pName); p < m_lMemberNames.size(); p++)
+	{
+		const CMember *pMember = &m_lMembers[m_lMemberNames[p]];
+		if(str_comp(pMember->m_aName, pName) != 0)
+			break;
+		if(Best < 0 || TeamTime(pMember->m_Team) < TeamTime(Best))
+			Best = pMember->m_Team;
+	}
+	return Best;
+}
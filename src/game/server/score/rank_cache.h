@@ -0,0 +1,135 @@
+/* (c) Shereef Marzouk. See "licence DDRace.txt" and the readme.txt in the root of the distribution for more information. */
+#ifndef GAME_SERVER_SCORE_RANK_CACHE_H
+#define GAME_SERVER_SCORE_RANK_CACHE_H
+
+#include <base/tl/array.h>
+#include <engine/shared/protocol.h>
+
+/*
+	Class: CRankCache
+		In memory copy of the rankings of one map: the best time per
+		name, the team times and the global points. Every table keeps
+		its entries in a stable array plus index arrays sorted by value
+		and by name, so lookups and ranks are binary searches and an
+		update only moves indices. Ranks count equal values as a tie,
+		like the ranking queries of the database.
+*/
+class CRankCache
+{
+	struct CTimeEntry
+	{
+		char m_aName[MAX_NAME_LENGTH];
+		float m_Time;
+	};
+
+	struct CPointsEntry
+	{
+		char m_aName[MAX_NAME_LENGTH];
+		int m_Points;
+	};
+
+	struct CTeam
+	{
+		float m_Time;
+		int m_FirstMember;
+		int m_NumMembers;
+	};
+
+	struct CMember
+	{
+		char m_aName[MAX_NAME_LENGTH];
+		int m_Team;
+	};
+
+	array<CTimeEntry> m_lTimes;
+	array<int> m_lTimeOrder;
+	array<int> m_lTimeNames;
+
+	array<CPointsEntry> m_lPoints;
+	array<int> m_lPointsOrder;
+	array<int> m_lPointsNames;
+
+	// members of a team are stored next to each other, sorted by name
+	array<CTeam> m_lTeams;
+	array<CMember> m_lMembers;
+	array<int> m_lTeamOrder;
+	array<int> m_lMemberNames;
+
+	int TimeLowerBound(float Time) const;
+	int TimeNamePos(const char *pName) const;
+	int PointsLowerBound(int Points) const;
+	int PointsNamePos(const char *pName) const;
+	int TeamLowerBound(float Time) const;
+	int MemberNamePos(const char *pName) const;
+
+	static void RemoveValue(array<int> *pList, int Pos, int Value);
+	static void InsertAt(array<int> *pList, int Pos, int Value);
+
+	enum
+	{
+		SORT_TIME=0,
+		SORT_TIME_NAME,
+		SORT_POINTS,
+		SORT_POINTS_NAME,
+	};
+
+	// orders entry indices for the single sort after a bulk load
+	struct CIndexLess
+	{
+		const CRankCache *m_pCache;
+		int m_Sort;
+		bool operator()(int a, int b) const;
+	};
+
+	void SortIndices(array<int> *pList, int Num, int Sort);
+
+public:
+	void Clear();
+
+	// keeps the better of the stored and the given time
+	void AddTime(const char *pName, float Time);
+	bool FindTime(const char *pName, float *pTime, int *pRank) const;
+	int NumTimes() const { return m_lTimeOrder.size(); }
+	const char *TimeName(int Pos) const { return m_lTimes[m_lTimeOrder[Pos]].m_aName; }
+	float TimeAt(int Pos) const { return m_lTimes[m_lTimeOrder[Pos]].m_Time; }
+	int TimeRank(int Pos) const { return TimeLowerBound(TimeAt(Pos)) + 1; }
+
+	void AddPoints(const char *pName, int Points);
+	bool FindPoints(const char *pName, int *pPoints, int *pRank) const;
+	int NumPoints() const { return m_lPointsOrder.size(); }
+	const char *PointsName(int Pos) const { return m_lPoints[m_lPointsOrder[Pos]].m_aName; }
+	int PointsAt(int Pos) const { return m_lPoints[m_lPointsOrder[Pos]].m_Points; }
+	int PointsRank(int Pos) const { return PointsLowerBound(PointsAt(Pos)) + 1; }
+
+	/*
+		Function: AddTeam
+			Keeps the better time if a team with exactly these members
+			exists already, otherwise adds a new team.
+	*/
+	void AddTeam(const char *const *ppNames, int Num, float Time);
+
+	/*
+		Function: LoadTime
+			Appends the entry without updating the index arrays, for
+			filling a new cache from the database. <FinishLoad> has to
+			be called once after the last one, before anything else.
+	*/
+	void LoadTime(const char *pName, float Time);
+
+	// like LoadTime, points loaded twice for a name are summed up
+	void LoadPoints(const char *pName, int Points);
+
+	// sorts the loaded times and points once and merges repeated names
+	void FinishLoad();
+
+	// the best ranked team the name is part of, -1 if there is none
+	int FindTeam(const char *pName) const;
+	int NumTeams() const { return m_lTeamOrder.size(); }
+	int TeamAt(int Pos) const { return m_lTeamOrder[Pos]; }
+	float TeamTime(int Team) const { return m_lTeams[Team].m_Time; }
+	int TeamRank(int Team) const { return TeamLowerBound(m_lTeams[Team].m_Time) + 1; }
+	int TeamSize(int Team) const { return m_lTeams[Team].m_NumMembers; }
+	const char *TeamMember(int Team, int Index) const { return m_lMembers[m_lTeams[Team].m_FirstMember + Index].m_aName; }
+};
+
+#endif
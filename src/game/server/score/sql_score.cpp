@@ -13,7 +13,232 @@
 #include <engine/shared/console.h>
 #include "../save.h"
 
-static LOCK gs_SqlLock = 0;
+CSqlPool *CSqlPool::ms_pPool = 0;
+
+CSqlPool::CSqlPool()
+{
+	m_JobLock = lock_create();
+	for(int i = 0; i < NUM_SQLJOBS; i++)
+		m_apJobFirst[i] = m_apJobLast[i] = 0;
+	m_QueueDepth = 0;
+	m_PeakQueueDepth = 0;
+	mem_zero(m_aJobStats, sizeof(m_aJobStats));
+	m_NumJobs = 0;
+	m_Waiting = false;
+
+	m_NumWorkers = clamp(g_Config.m_SvSqlWorkers, 1, (int)MAX_WORKERS);
+	for(int i = 0; i < m_NumWorkers; i++)
+	{
+		m_aWorkers[i].m_pPool = this;
+		m_aWorkers[i].m_pConn = new CSqlConnection(g_Config.m_SvSqlDatabase, g_Config.m_SvSqlUser, g_Config.m_SvSqlPw, g_Config.m_SvSqlIp, g_Config.m_SvSqlPort);
+		m_aWorkers[i].m_pThread = thread_init(WorkerThread, &m_aWorkers[i]);
+	}
+}
+
+CSqlPool *CSqlPool::Get()
+{
+	// only called on the game thread
+	if(!ms_pPool)
+		ms_pPool = new CSqlPool();
+	return ms_pPool;
+}
+
+void CSqlPool::Shutdown()
+{
+	CSqlPool *pSelf = ms_pPool;
+	if(!pSelf)
+		return;
+
+	lock_wait(pSelf->m_JobLock);
+	pSelf->m_Waiting = pSelf->m_NumJobs > 0;
+	bool Wait = pSelf->m_Waiting;
+	lock_unlock(pSelf->m_JobLock);
+	if(Wait)
+	{
+		dbg_msg("SQL", "waiting for the last saves");
+		pSelf->m_IdleSem.wait();
+	}
+}
+
+void CSqlPool::Queue(CSqlJob *pJob)
+{
+	pJob->m_QueueTime = time_get();
+	pJob->m_pNext = 0;
+
+	int Priority = pJob->m_Priority;
+	lock_wait(m_JobLock);
+	if(m_apJobLast[Priority])
+		m_apJobLast[Priority]->m_pNext = pJob;
+	else
+		m_apJobFirst[Priority] = pJob;
+	m_apJobLast[Priority] = pJob;
+	m_QueueDepth++;
+	m_PeakQueueDepth = max(m_PeakQueueDepth, m_QueueDepth);
+	m_NumJobs++;
+	pJob->m_pSqlData->m_NumJobs++;
+	lock_unlock(m_JobLock);
+
+	m_JobSem.signal();
+}
+
+CSqlJob *CSqlPool::PopJob()
+{
+	// m_JobLock has to be held
+	for(int i = 0; i < NUM_SQLJOBS; i++)
+	{
+		CSqlJob *pJob = m_apJobFirst[i];
+		if(!pJob)
+			continue;
+		m_apJobFirst[i] = pJob->m_pNext;
+		if(!m_apJobFirst[i])
+			m_apJobLast[i] = 0;
+		m_QueueDepth--;
+		return pJob;
+	}
+	return 0;
+}
+
+void CSqlPool::Retire(CSqlScore *pOwner)
+{
+	lock_wait(m_JobLock);
+	for(int i = SQLJOB_LOAD; i < NUM_SQLJOBS; i++)
+	{
+		CSqlJob *pPrev = 0;
+		CSqlJob *pJob = m_apJobFirst[i];
+		while(pJob)
+		{
+			CSqlJob *pNext = pJob->m_pNext;
+			if(pJob->m_pSqlData == pOwner)
+			{
+				// the semaphore keeps its count, the worker just finds nothing to do
+				if(pPrev)
+					pPrev->m_pNext = pNext;
+				else
+					m_apJobFirst[i] = pNext;
+				if(m_apJobLast[i] == pJob)
+					m_apJobLast[i] = pPrev;
+				m_QueueDepth--;
+				m_NumJobs--;
+				pOwner->m_NumJobs--;
+				m_aJobStats[i].m_Dropped++;
+				delete pJob;
+			}
+			else
+				pPrev = pJob;
+			pJob = pNext;
+		}
+	}
+	pOwner->m_Retired = true;
+	bool Done = !pOwner->m_NumJobs;
+	lock_unlock(m_JobLock);
+
+	if(Done)
+		delete pOwner;
+}
+
+void CSqlPool::ReleaseJob(CSqlScore *pOwner)
+{
+	lock_wait(m_JobLock);
+	pOwner->m_NumJobs--;
+	bool Free = pOwner->m_Retired && !pOwner->m_NumJobs;
+	m_NumJobs--;
+	bool Idle = m_Waiting && !m_NumJobs;
+	if(Idle)
+		m_Waiting = false;
+	lock_unlock(m_JobLock);
+
+	if(Free)
+		delete pOwner;
+	if(Idle)
+		m_IdleSem.signal();
+}
+
+void CSqlPool::WorkerThread(void *pUser)
+{
+	CSqlWorker *pWorker = (CSqlWorker *)pUser;
+	CSqlPool *pSelf = pWorker->m_pPool;
+	sql::Driver *pDriver = get_driver_instance();
+	pDriver->threadInit();
+
+	// runs until the process ends
+	while(1)
+	{
+		pSelf->m_JobSem.wait();
+
+		lock_wait(pSelf->m_JobLock);
+		CSqlJob *pJob = pSelf->PopJob();
+		lock_unlock(pSelf->m_JobLock);
+
+		if(!pJob)
+			continue;
+
+		CSqlScore *pOwner = pJob->m_pSqlData;
+		int Priority = pJob->m_Priority;
+		int64 Start = time_get();
+		int64 Wait = Start - pJob->m_QueueTime;
+		// loads and queries only answer players, saves always run
+		bool Drop = Priority != SQLJOB_SAVE && (pOwner->m_Closing || (Priority == SQLJOB_QUERY && Wait > g_Config.m_SvSqlTimeout * time_freq()));
+		if(Drop)
+		{
+			if(!pOwner->m_Closing && pJob->m_ClientID >= 0)
+				pOwner->SendChatTarget(pJob->m_ClientID, "The database is busy, please try again later");
+			delete pJob;
+		}
+		else
+		{
+			// the job deletes itself
+			pJob->m_pConn = pWorker->m_pConn;
+			pJob->m_pfnFunc(pJob);
+		}
+		int64 Run = time_get() - Start;
+
+		lock_wait(pSelf->m_JobLock);
+		CJobStats *pStats = &pSelf->m_aJobStats[Priority];
+		if(Drop)
+			pStats->m_Dropped++;
+		else
+		{
+			pStats->m_Done++;
+			pStats->m_RunTotal += Run;
+			pStats->m_RunMax = max(pStats->m_RunMax, Run);
+		}
+		pStats->m_WaitTotal += Wait;
+		pStats->m_WaitMax = max(pStats->m_WaitMax, Wait);
+		lock_unlock(pSelf->m_JobLock);
+
+		pSelf->ReleaseJob(pOwner);
+	}
+}
+
+void CSqlPool::PrintStats(IConsole *pConsole)
+{
+	static const char *s_apNames[NUM_SQLJOBS] = {"saves", "loads", "queries"};
+	char aBuf[256];
+
+	lock_wait(m_JobLock);
+	str_format(aBuf, sizeof(aBuf), "%d workers, %d requests queued, peak %d", m_NumWorkers, m_QueueDepth, m_PeakQueueDepth);
+	pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", aBuf);
+	for(int i = 0; i < NUM_SQLJOBS; i++)
+	{
+		CJobStats *pStats = &m_aJobStats[i];
+		int Waited = pStats->m_Done + pStats->m_Dropped;
+		str_format(aBuf, sizeof(aBuf), "%s: %d done, %d dropped, wait avg %.2fms max %.2fms, run avg %.2fms max %.2fms",
+			s_apNames[i], pStats->m_Done, pStats->m_Dropped,
+			Waited ? pStats->m_WaitTotal*1000.0/time_freq()/Waited : 0.0, pStats->m_WaitMax*1000.0/time_freq(),
+			pStats->m_Done ? pStats->m_RunTotal*1000.0/time_freq()/pStats->m_Done : 0.0, pStats->m_RunMax*1000.0/time_freq());
+		pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", aBuf);
+	}
+	lock_unlock(m_JobLock);
+
+	int Prepares = 0, Reuses = 0;
+	for(int i = 0; i < m_NumWorkers; i++)
+	{
+		Prepares += m_aWorkers[i].m_pConn->m_NumPrepares;
+		Reuses += m_aWorkers[i].m_pConn->m_NumReuses;
+	}
+	str_format(aBuf, sizeof(aBuf), "statements: %d prepared, %d reused", Prepares, Reuses);
+	pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", aBuf);
+}
 
 CSqlScore::CSqlScore(CGameContext *pGameServer) : m_pGameServer(pGameServer),
 		m_pServer(pGameServer->Server()),
@@ -24,23 +249,770 @@ CSqlScore::CSqlScore(CGameContext *pGameServer) : m_pGameServer(pGameServer),
 		m_pIp(g_Config.m_SvSqlIp),
 		m_Port(g_Config.m_SvSqlPort)
 {
-	m_pDriver = NULL;
 	str_copy(m_aMap, g_Config.m_SvMap, sizeof(m_aMap));
+	str_copy(m_aMapName, g_Config.m_SvMap, sizeof(m_aMapName));
 	ClearString(m_aMap);
 
-	if(gs_SqlLock == 0)
-		gs_SqlLock = lock_create();
+	m_Closing = false;
+	m_NumJobs = 0;
+	m_Retired = false;
+	m_ResultLock = lock_create();
+
+	m_BatchLock = lock_create();
+	m_PointsLock = lock_create();
+	m_BatchStart = 0;
+	m_NumBatches = 0;
+	m_NumBatchedRows = 0;
+
+	m_pRankCache = 0;
+	m_RankCacheTime = 0;
+	m_RankCacheRequest = 0;
+	m_RankCacheLoading = false;
+	m_aRankCacheSince[0] = 0;
+	m_RankCacheHits = 0;
+	m_RankCacheMisses = 0;
+	m_RankCacheLoads = 0;
+	m_RankCacheRefreshes = 0;
+	m_RankCacheLoadMs = 0.0f;
 
 	Init();
 }
 
 CSqlScore::~CSqlScore()
 {
-	lock_wait(gs_SqlLock);
-	lock_unlock(gs_SqlLock);
+	// deleted by the pool once no job of this map is left
+	for(int i = 0; i < m_lResults.size(); i++)
+	{
+		delete m_lResults[i].m_pRankCache;
+		if(m_lResults[i].m_pSavegame)
+			mem_free(m_lResults[i].m_pSavegame);
+	}
+	delete m_pRankCache;
+
+	lock_destroy(m_ResultLock);
+	lock_destroy(m_BatchLock);
+	lock_destroy(m_PointsLock);
+}
+
+void CSqlScore::Release()
+{
+	// the game thread is done with this map, results that arrive from now on are dropped
+	lock_wait(m_ResultLock);
+	m_Closing = true;
+	lock_unlock(m_ResultLock);
+
+	// the pending finishes go out as a save like any other batch, the saves
+	// still running flush their own rows once they are batched
+	FlushBatch();
+	CSqlPool::Get()->Retire(this);
+}
+
+void CSqlScore::Queue(void (*pfnFunc)(CSqlJob *pJob), CSqlJob *pJob, int Priority)
+{
+	// only the batch flushes of a closing map still get queued
+	if(m_Closing && Priority != SQLJOB_SAVE)
+	{
+		delete pJob;
+		return;
+	}
+
+	pJob->m_pSqlData = this;
+	pJob->m_pfnFunc = pfnFunc;
+	pJob->m_Priority = Priority;
+	CSqlPool::Get()->Queue(pJob);
+}
 
+void CSqlScore::PostResult(const CSqlResult &Result)
+{
+	lock_wait(m_ResultLock);
+	if(m_Closing)
+	{
+		// nobody reads them anymore
+		delete Result.m_pRankCache;
+		if(Result.m_pSavegame)
+			mem_free(Result.m_pSavegame);
+	}
+	else
+		m_lResults.add(Result);
+	lock_unlock(m_ResultLock);
+}
+
+void CSqlScore::SendChatTarget(int To, const char *pText)
+{
+	CSqlResult Result;
+	Result.m_Type = SQLRESULT_CHAT_TARGET;
+	Result.m_ClientID = To;
+	str_copy(Result.m_aText, pText, sizeof(Result.m_aText));
+	PostResult(Result);
+}
+
+void CSqlScore::SendChatTeam(int Team, const char *pText)
+{
+	CSqlResult Result;
+	Result.m_Type = SQLRESULT_CHAT_TEAM;
+	Result.m_Team = Team;
+	str_copy(Result.m_aText, pText, sizeof(Result.m_aText));
+	PostResult(Result);
+}
+
+void CSqlScore::SendChat(int ClientID, int Team, const char *pText, int SpamProtectionClientID)
+{
+	CSqlResult Result;
+	Result.m_Type = SQLRESULT_CHAT;
+	Result.m_ClientID = ClientID;
+	Result.m_Team = Team;
+	Result.m_SpamProtectionClientID = SpamProtectionClientID;
+	str_copy(Result.m_aText, pText, sizeof(Result.m_aText));
+	PostResult(Result);
+}
+
+void CSqlScore::ExecuteLine(const char *pLine)
+{
+	CSqlResult Result;
+	Result.m_Type = SQLRESULT_EXECUTE;
+	str_copy(Result.m_aText, pLine, sizeof(Result.m_aText));
+	PostResult(Result);
+}
+
+void CSqlScore::SetPlayerScore(int ClientID, float Time, float *pCpTime)
+{
+	CSqlResult Result;
+	Result.m_Type = SQLRESULT_SCORE;
+	Result.m_ClientID = ClientID;
+	Result.m_Time = Time;
+	Result.m_HasCpTime = pCpTime != 0;
+	if(pCpTime)
+		mem_copy(Result.m_aCpTime, pCpTime, sizeof(Result.m_aCpTime));
+	PostResult(Result);
+}
+
+bool CSqlScore::AddRaceRow(CSqlRaceRow *pRow, bool Finished, int Points)
+{
+	lock_wait(m_BatchLock);
+
+	// a finish of this map session may be batched or in an insert that is still running
+	for(int i = 0; i < m_lFinishers.size() && !Finished; i++)
+		Finished = !str_comp(m_lFinishers[i].m_aName, pRow->m_aName) && !str_comp(m_lFinishers[i].m_aMap, pRow->m_aMap);
+	if(!Finished)
+	{
+		CFinisher Finisher;
+		str_copy(Finisher.m_aMap, pRow->m_aMap, sizeof(Finisher.m_aMap));
+		str_copy(Finisher.m_aName, pRow->m_aName, sizeof(Finisher.m_aName));
+		m_lFinishers.add(Finisher);
+		pRow->m_Points = Points;
+		if(Points > 0)
+			AddCachedPoints(pRow->m_aName, Points);
+	}
+
+	if(!m_lRaceBatch.size() && !m_lTeamBatch.size())
+		m_BatchStart = time_get();
+	m_lRaceBatch.add(*pRow);
+	bool Closing = m_Closing;
+	lock_unlock(m_BatchLock);
+
+	// no tick flushes the batch of a map that was left
+	if(Closing)
+		FlushBatch();
+	return !Finished && Points > 0;
+}
+
+void CSqlScore::AddTeamRows(const CSqlTeamRow *pRows, int Num)
+{
+	lock_wait(m_BatchLock);
+	if(!m_lRaceBatch.size() && !m_lTeamBatch.size())
+		m_BatchStart = time_get();
+	for(int i = 0; i < Num; i++)
+		m_lTeamBatch.add(pRows[i]);
+	bool Closing = m_Closing;
+	lock_unlock(m_BatchLock);
+
+	if(Closing)
+		FlushBatch();
+}
+
+CSqlBatchData *CSqlScore::TakeBatch()
+{
+	lock_wait(m_BatchLock);
+	if(!m_lRaceBatch.size() && !m_lTeamBatch.size())
+	{
+		lock_unlock(m_BatchLock);
+		return 0;
+	}
+
+	CSqlBatchData *Tmp = new CSqlBatchData();
+	Tmp->m_lRaceRows = m_lRaceBatch;
+	Tmp->m_lTeamRows = m_lTeamBatch;
+	Tmp->m_pSqlData = this;
+	m_lRaceBatch.clear();
+	m_lTeamBatch.clear();
+	m_lFlushing.add(Tmp);
+	lock_unlock(m_BatchLock);
+	return Tmp;
+}
+
+void CSqlScore::FlushBatch()
+{
+	CSqlBatchData *pBatch = TakeBatch();
+	if(pBatch)
+		Queue(FlushBatchThread, pBatch, SQLJOB_SAVE);
+}
+
+void CSqlScore::FlushBatchThread(CSqlJob *pJob)
+{
+	CSqlBatchData *pData = (CSqlBatchData *)pJob;
+	CSqlScore *pSelf = pData->m_pSqlData;
+
+	// the rank cache counts these points as pending until they are in the table
+	lock_wait(pSelf->m_PointsLock);
+
+	// Connect to database
+	if(pData->m_pConn->Connect())
+	{
+		try
+		{
+			char aBuf[512];
+			char aMap[128*2-1];
+			char aName[MAX_NAME_LENGTH*2-1];
+
+			if(pData->m_lRaceRows.size())
+			{
+				std::string Race, Points;
+				str_format(aBuf, sizeof(aBuf), "INSERT IGNORE INTO %s_race(Map, Name, Timestamp, Time, Server, cp1, cp2, cp3, cp4, cp5, cp6, cp7, cp8, cp9, cp10, cp11, cp12, cp13, cp14, cp15, cp16, cp17, cp18, cp19, cp20, cp21, cp22, cp23, cp24, cp25) VALUES ", pSelf->m_pPrefix);
+				Race = aBuf;
+				for(int i = 0; i < pData->m_lRaceRows.size(); i++)
+				{
+					CSqlRaceRow *pRow = &pData->m_lRaceRows[i];
+					str_copy(aMap, pRow->m_aMap, sizeof(aMap));
+					pSelf->ClearString(aMap, 128);
+					str_copy(aName, pRow->m_aName, sizeof(aName));
+					pSelf->ClearString(aName, MAX_NAME_LENGTH);
+
+					str_format(aBuf, sizeof(aBuf), "%s('%s', '%s', CURRENT_TIMESTAMP(), '%.2f', '%s'", i ? ", " : "", aMap, aName, pRow->m_Time, g_Config.m_SvSqlServerName);
+					Race += aBuf;
+					for(int c = 0; c < NUM_CHECKPOINTS; c++)
+					{
+						str_format(aBuf, sizeof(aBuf), ", '%.2f'", pRow->m_aCpTime[c]);
+						Race += aBuf;
+					}
+					Race += ")";
+
+					if(pRow->m_Points > 0)
+					{
+						str_format(aBuf, sizeof(aBuf), "%s('%s', '%d')", Points.empty() ? "" : ", ", aName, pRow->m_Points);
+						Points += aBuf;
+					}
+				}
+				pData->m_pConn->m_pStatement->execute(Race);
+
+				if(!Points.empty())
+				{
+					str_format(aBuf, sizeof(aBuf), "INSERT INTO %s_points(Name, Points) VALUES ", pSelf->m_pPrefix);
+					pData->m_pConn->m_pStatement->execute(aBuf + Points + " ON duplicate key UPDATE Name=VALUES(Name), Points=Points+VALUES(Points);");
+				}
+			}
+
+			if(pData->m_lTeamRows.size())
+			{
+				std::string Team;
+				str_format(aBuf, sizeof(aBuf), "INSERT IGNORE INTO %s_teamrace(Map, Name, Timestamp, Time, ID) VALUES ", pSelf->m_pPrefix);
+				Team = aBuf;
+				for(int i = 0; i < pData->m_lTeamRows.size(); i++)
+				{
+					CSqlTeamRow *pRow = &pData->m_lTeamRows[i];
+					str_copy(aMap, pRow->m_aMap, sizeof(aMap));
+					pSelf->ClearString(aMap, 128);
+					str_copy(aName, pRow->m_aName, sizeof(aName));
+					pSelf->ClearString(aName, MAX_NAME_LENGTH);
+
+					str_format(aBuf, sizeof(aBuf), "%s('%s', '%s', CURRENT_TIMESTAMP(), '%.2f', '%s')", i ? ", " : "", aMap, aName, pRow->m_Time, pRow->m_aID);
+					Team += aBuf;
+				}
+				pData->m_pConn->m_pStatement->execute(Team);
+			}
+
+			lock_wait(pSelf->m_BatchLock);
+			pSelf->m_NumBatches++;
+			pSelf->m_NumBatchedRows += pData->m_lRaceRows.size() + pData->m_lTeamRows.size();
+			lock_unlock(pSelf->m_BatchLock);
+
+			dbg_msg("SQL", "Inserted %d times and %d team times", pData->m_lRaceRows.size(), pData->m_lTeamRows.size());
+		}
+		catch (sql::SQLException &e)
+		{
+			char aBuf[256];
+			str_format(aBuf, sizeof(aBuf), "MySQL Error: %s", e.what());
+			dbg_msg("SQL", aBuf);
+			dbg_msg("SQL", "ERROR: Could not insert %d times", pData->m_lRaceRows.size() + pData->m_lTeamRows.size());
+		}
+
+		// disconnect from database
+		pData->m_pConn->Disconnect();
+	}
+
+	lock_wait(pSelf->m_BatchLock);
+	pSelf->m_lFlushing.remove(pData);
+	lock_unlock(pSelf->m_BatchLock);
+	lock_unlock(pSelf->m_PointsLock);
+
+	delete pData;
+}
+
+void CSqlScore::OnTick()
+{
+	// hand the pending finishes to a worker once the batch is old or big enough
+	lock_wait(m_BatchLock);
+	int Pending = m_lRaceBatch.size() + m_lTeamBatch.size();
+	bool Flush = Pending >= MAX_BATCH_ROWS || (Pending && time_get() - m_BatchStart >= g_Config.m_SvSqlBatchDelay * time_freq() / 1000);
+	lock_unlock(m_BatchLock);
+	if(Flush)
+		FlushBatch();
+
+	// the ranks are read once per map, local finishes are applied as they happen
+	if(g_Config.m_SvSqlRankCache && !m_RankCacheLoading)
+	{
+		int64 Elapsed = time_get() - m_RankCacheRequest;
+		int Refresh = g_Config.m_SvSqlRankCacheRefresh;
+		if(!m_RankCacheRequest || (!m_pRankCache && Elapsed >= 60 * time_freq()))
+			LoadRankCache("");
+		else if(m_pRankCache && m_aRankCacheSince[0] && Refresh && Elapsed >= Refresh * time_freq())
+			LoadRankCache(m_aRankCacheSince);
+	}
+
+	lock_wait(m_ResultLock);
+	array<CSqlResult> lResults = m_lResults;
+	m_lResults.clear();
+	lock_unlock(m_ResultLock);
+
+	for(int i = 0; i < lResults.size(); i++)
+	{
+		CSqlResult *pResult = &lResults[i];
+		switch(pResult->m_Type)
+		{
+		case SQLRESULT_CHAT_TARGET:
+			GameServer()->SendChatTarget(pResult->m_ClientID, pResult->m_aText);
+			break;
+		case SQLRESULT_CHAT:
+			GameServer()->SendChat(pResult->m_ClientID, pResult->m_Team, pResult->m_aText, pResult->m_SpamProtectionClientID);
+			break;
+		case SQLRESULT_CHAT_TEAM:
+			GameServer()->SendChatTeam(pResult->m_Team, pResult->m_aText);
+			break;
+		case SQLRESULT_EXECUTE:
+			GameServer()->Console()->ExecuteLine(pResult->m_aText);
+			break;
+		case SQLRESULT_SCORE:
+			PlayerData(pResult->m_ClientID)->m_BestTime = pResult->m_Time;
+			PlayerData(pResult->m_ClientID)->m_CurrentTime = pResult->m_Time;
+			if(pResult->m_HasCpTime)
+				mem_copy(PlayerData(pResult->m_ClientID)->m_aBestCpTime, pResult->m_aCpTime, sizeof(pResult->m_aCpTime));
+			if(GameServer()->m_apPlayers[pResult->m_ClientID])
+				GameServer()->m_apPlayers[pResult->m_ClientID]->m_Score = -pResult->m_Time;
+			break;
+		case SQLRESULT_POINTS:
+			if(m_pRankCache)
+				m_pRankCache->AddPoints(pResult->m_aText, pResult->m_Points);
+			break;
+		case SQLRESULT_RANK_CACHE:
+			OnRankCacheLoaded(pResult->m_pRankCache, pResult->m_aText, pResult->m_Time);
+			break;
+		case SQLRESULT_RANK_CACHE_UPDATE:
+			OnRankCacheRefreshed(pResult->m_pRankCache, pResult->m_aText, pResult->m_Time);
+			delete pResult->m_pRankCache;
+			break;
+		case SQLRESULT_MAP_VOTE:
+			OnMapVote(pResult);
+			break;
+		case SQLRESULT_TEAM_SAVED:
+		case SQLRESULT_TEAM_SAVE_FAILED:
+			OnTeamSaved(pResult, pResult->m_Type == SQLRESULT_TEAM_SAVED);
+			break;
+		case SQLRESULT_TEAM_LOAD:
+			OnTeamLoad(pResult);
+			mem_free(pResult->m_pSavegame);
+			break;
+		}
+	}
+}
+
+void CSqlScore::PrintStats(IConsole *pConsole)
+{
+	char aBuf[256];
+	CSqlPool::Get()->PrintStats(pConsole);
+
+	lock_wait(m_BatchLock);
+	str_format(aBuf, sizeof(aBuf), "batches: %d flushed with %d rows, %d rows pending",
+		m_NumBatches, m_NumBatchedRows, m_lRaceBatch.size() + m_lTeamBatch.size());
+	lock_unlock(m_BatchLock);
+	pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", aBuf);
+
+	int Requests = m_RankCacheHits + m_RankCacheMisses;
+	str_format(aBuf, sizeof(aBuf), "rank cache: %d hits, %d misses, %.1f%% hit rate, %d loads, %d refreshes, last took %.2fms",
+		m_RankCacheHits, m_RankCacheMisses, Requests ? m_RankCacheHits*100.0f/Requests : 0.0f, m_RankCacheLoads, m_RankCacheRefreshes, m_RankCacheLoadMs);
+	pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", aBuf);
+	if(m_pRankCache)
+	{
+		str_format(aBuf, sizeof(aBuf), "rank cache: %d times, %d teams, %d points, read from the database %ds ago",
+			m_pRankCache->NumTimes(), m_pRankCache->NumTeams(), m_pRankCache->NumPoints(), (int)((time_get() - m_RankCacheTime) / time_freq()));
+		pConsole->Print(IConsole::OUTPUT_LEVEL_STANDARD, "sql", aBuf);
+	}
+}
+
+void CSqlScore::LoadRankCache(const char *pSince)
+{
+	CSqlRankCacheData *Tmp = new CSqlRankCacheData();
+	str_copy(Tmp->m_aMap, m_aMapName, sizeof(Tmp->m_aMap));
+	str_copy(Tmp->m_aSince, pSince, sizeof(Tmp->m_aSince));
+	Tmp->m_pSqlData = this;
+
+	m_RankCacheRequest = time_get();
+	m_RankCacheLoading = true;
+	Queue(LoadRankCacheThread, Tmp, SQLJOB_LOAD);
+}
+
+void CSqlScore::LoadRankCacheThread(CSqlJob *pJob)
+{
+	CSqlRankCacheData *pData = (CSqlRankCacheData *)pJob;
+	CSqlScore *pSelf = pData->m_pSqlData;
+	bool Refresh = pData->m_aSince[0] != 0;
+	CRankCache *pCache = 0;
+	bool Posted = false;
+	bool PointsLocked = false;
+	int64 Start = time_get();
+
+	if(pData->m_pConn->Connect())
+	{
+		try
+		{
+			char aBuf[512];
+			char aSince[32] = {0};
+			pCache = new CRankCache();
+
+			// rows stamped from here on are read by the next refresh
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery("SELECT CURRENT_TIMESTAMP() AS Now;");
+			if(pData->m_pConn->m_pResults->next())
+				str_copy(aSince, pData->m_pConn->m_pResults->getString("Now").c_str(), sizeof(aSince));
+			delete pData->m_pConn->m_pResults;
+
+			// an insert may commit a moment after its timestamp, reading a few
+			// seconds twice does no harm as the better time is kept
+			sql::PreparedStatement *pStmt;
+			if(Refresh)
+			{
+				str_format(aBuf, sizeof(aBuf), "SELECT Name, MIN(Time) AS Time FROM %s_race WHERE Map=? AND Timestamp >= ? - INTERVAL 10 SECOND GROUP BY Name;", pSelf->m_pPrefix);
+				pStmt = pData->m_pConn->Prepare(SQLSTMT_CACHE_NEW_TIMES, aBuf);
+				pStmt->setString(1, pData->m_aMap);
+				pStmt->setString(2, pData->m_aSince);
+			}
+			else
+			{
+				str_format(aBuf, sizeof(aBuf), "SELECT Name, MIN(Time) AS Time FROM %s_race WHERE Map=? GROUP BY Name;", pSelf->m_pPrefix);
+				pStmt = pData->m_pConn->Prepare(SQLSTMT_CACHE_TIMES, aBuf);
+				pStmt->setString(1, pData->m_aMap);
+			}
+			pData->m_pConn->m_pResults = pStmt->executeQuery();
+			while(pData->m_pConn->m_pResults->next())
+				pCache->LoadTime(pData->m_pConn->m_pResults->getString("Name").c_str(), (float)pData->m_pConn->m_pResults->getDouble("Time"));
+			delete pData->m_pConn->m_pResults;
+
+			if(Refresh)
+			{
+				// all rows of the new teams, older servers insert the members one by one
+				str_format(aBuf, sizeof(aBuf), "SELECT ID, Name, Time FROM %s_teamrace WHERE Map=? AND ID IN (SELECT ID FROM %s_teamrace WHERE Map=? AND Timestamp >= ? - INTERVAL 10 SECOND) ORDER BY ID;", pSelf->m_pPrefix, pSelf->m_pPrefix);
+				pStmt = pData->m_pConn->Prepare(SQLSTMT_CACHE_NEW_TEAMS, aBuf);
+				pStmt->setString(1, pData->m_aMap);
+				pStmt->setString(2, pData->m_aMap);
+				pStmt->setString(3, pData->m_aSince);
+			}
+			else
+			{
+				str_format(aBuf, sizeof(aBuf), "SELECT ID, Name, Time FROM %s_teamrace WHERE Map=? ORDER BY ID;", pSelf->m_pPrefix);
+				pStmt = pData->m_pConn->Prepare(SQLSTMT_CACHE_TEAMS, aBuf);
+				pStmt->setString(1, pData->m_aMap);
+			}
+			pData->m_pConn->m_pResults = pStmt->executeQuery();
+
+			char aID[17] = {0};
+			char aID2[17];
+			char aaNames[MAX_CLIENTS][MAX_NAME_LENGTH];
+			const char *apNames[MAX_CLIENTS];
+			int NumNames = 0;
+			float Time = 0.0f;
+			while(pData->m_pConn->m_pResults->next())
+			{
+				str_copy(aID2, pData->m_pConn->m_pResults->getString("ID").c_str(), sizeof(aID2));
+				if(str_comp(aID, aID2) != 0)
+				{
+					pCache->AddTeam(apNames, NumNames, Time);
+					str_copy(aID, aID2, sizeof(aID));
+					NumNames = 0;
+				}
+				Time = (float)pData->m_pConn->m_pResults->getDouble("Time");
+				if(NumNames < MAX_CLIENTS)
+				{
+					str_copy(aaNames[NumNames], pData->m_pConn->m_pResults->getString("Name").c_str(), sizeof(aaNames[NumNames]));
+					apNames[NumNames] = aaNames[NumNames];
+					NumNames++;
+				}
+			}
+			pCache->AddTeam(apNames, NumNames, Time);
+			delete pData->m_pConn->m_pResults;
+
+			if(Refresh)
+			{
+				// the points table has no timestamps, the points of other servers are read with the next map
+				pCache->FinishLoad();
+
+				CSqlResult Result;
+				Result.m_Type = SQLRESULT_RANK_CACHE_UPDATE;
+				Result.m_pRankCache = pCache;
+				Result.m_Time = (time_get() - Start) * 1000.0f / time_freq();
+				str_copy(Result.m_aText, aSince, sizeof(Result.m_aText));
+				pSelf->PostResult(Result);
+				Posted = true;
+			}
+			else
+			{
+				// no points insert may finish between reading the table and counting the pending ones
+				lock_wait(pSelf->m_PointsLock);
+				PointsLocked = true;
+				str_format(aBuf, sizeof(aBuf), "SELECT Name, Points FROM %s_points;", pSelf->m_pPrefix);
+				pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
+				while(pData->m_pConn->m_pResults->next())
+					pCache->LoadPoints(pData->m_pConn->m_pResults->getString("Name").c_str(), pData->m_pConn->m_pResults->getInt("Points"));
+				delete pData->m_pConn->m_pResults;
+
+				// the points result of a pending row is posted under m_BatchLock as well,
+				// so it is either counted here or handled after the new cache is in place
+				lock_wait(pSelf->m_BatchLock);
+				for(int i = 0; i < pSelf->m_lRaceBatch.size(); i++)
+					if(pSelf->m_lRaceBatch[i].m_Points > 0)
+						pCache->LoadPoints(pSelf->m_lRaceBatch[i].m_aName, pSelf->m_lRaceBatch[i].m_Points);
+				for(int b = 0; b < pSelf->m_lFlushing.size(); b++)
+				{
+					const array<CSqlRaceRow> &lRows = pSelf->m_lFlushing[b]->m_lRaceRows;
+					for(int i = 0; i < lRows.size(); i++)
+						if(lRows[i].m_Points > 0)
+							pCache->LoadPoints(lRows[i].m_aName, lRows[i].m_Points);
+				}
+				pCache->FinishLoad();
+
+				CSqlResult Result;
+				Result.m_Type = SQLRESULT_RANK_CACHE;
+				Result.m_pRankCache = pCache;
+				Result.m_Time = (time_get() - Start) * 1000.0f / time_freq();
+				str_copy(Result.m_aText, aSince, sizeof(Result.m_aText));
+				pSelf->PostResult(Result);
+				Posted = true;
+				lock_unlock(pSelf->m_BatchLock);
+				lock_unlock(pSelf->m_PointsLock);
+				PointsLocked = false;
+			}
+
+			dbg_msg("SQL", Refresh ? "Refreshing rank cache done" : "Loading rank cache done");
+		}
+		catch (sql::SQLException &e)
+		{
+			char aBuf[256];
+			str_format(aBuf, sizeof(aBuf), "MySQL Error: %s", e.what());
+			dbg_msg("SQL", aBuf);
+			dbg_msg("SQL", "ERROR: Could not load rank cache");
+			pData->m_pConn->ResetStatements();
+			if(PointsLocked)
+				lock_unlock(pSelf->m_PointsLock);
+			delete pCache;
+		}
+
+		// disconnect from database
+		pData->m_pConn->Disconnect();
+	}
+
+	if(!Posted)
+	{
+		// only ends the loading, the current cache is kept
+		CSqlResult Result;
+		Result.m_Type = Refresh ? SQLRESULT_RANK_CACHE_UPDATE : SQLRESULT_RANK_CACHE;
+		Result.m_Time = (time_get() - Start) * 1000.0f / time_freq();
+		pSelf->PostResult(Result);
+	}
+
+	delete pData;
+}
+
+void CSqlScore::OnRankCacheLoaded(CRankCache *pCache, const char *pSince, float LoadMs)
+{
+	m_RankCacheLoading = false;
+	if(pCache)
+	{
+		delete m_pRankCache;
+		m_pRankCache = pCache;
+		m_RankCacheTime = m_RankCacheRequest;
+		str_copy(m_aRankCacheSince, pSince, sizeof(m_aRankCacheSince));
+		m_RankCacheLoads++;
+		m_RankCacheLoadMs = LoadMs;
+
+		// finishes of this server that may not have been in the table yet when
+		// it was read, the ones that were are kept as they are
+		for(int i = 0; i < m_lRankUpdates.size(); i++)
+			ApplyRankUpdate(m_lRankUpdates[i]);
+	}
+	m_lRankUpdates.clear();
+}
+
+void CSqlScore::OnRankCacheRefreshed(const CRankCache *pNew, const char *pSince, float LoadMs)
+{
+	m_RankCacheLoading = false;
+	if(!pNew || !m_pRankCache)
+		return;
+
+	// better times only ever replace worse ones, so the local finishes applied meanwhile stay
+	for(int i = 0; i < pNew->NumTimes(); i++)
+		m_pRankCache->AddTime(pNew->TimeName(i), pNew->TimeAt(i));
+	for(int i = 0; i < pNew->NumTeams(); i++)
+	{
+		int Team = pNew->TeamAt(i);
+		const char *apNames[MAX_CLIENTS];
+		int Num = min(pNew->TeamSize(Team), (int)MAX_CLIENTS);
+		for(int m = 0; m < Num; m++)
+			apNames[m] = pNew->TeamMember(Team, m);
+		m_pRankCache->AddTeam(apNames, Num, pNew->TeamTime(Team));
+	}
+
+	m_RankCacheTime = m_RankCacheRequest;
+	str_copy(m_aRankCacheSince, pSince, sizeof(m_aRankCacheSince));
+	m_RankCacheRefreshes++;
+	m_RankCacheLoadMs = LoadMs;
+}
+
+void CSqlScore::UpdateRankCache(const CRankUpdate &Update)
+{
+	// the first load may have read the table before this finish got in
+	if(m_RankCacheLoading && !m_pRankCache)
+		m_lRankUpdates.add(Update);
+	ApplyRankUpdate(Update);
+}
+
+void CSqlScore::ApplyRankUpdate(const CRankUpdate &Update)
+{
+	if(!m_pRankCache)
+		return;
+
+	if(Update.m_Team)
+	{
+		const char *apNames[MAX_CLIENTS];
+		for(int i = 0; i < Update.m_NumNames; i++)
+			apNames[i] = Update.m_aaNames[i];
+		m_pRankCache->AddTeam(apNames, Update.m_NumNames, Update.m_Time);
+	}
+	else
+		m_pRankCache->AddTime(Update.m_aaNames[0], Update.m_Time);
+}
+
+void CSqlScore::AddCachedPoints(const char *pName, int Points)
+{
+	// posted under m_BatchLock, so a loaded cache either counts them or comes first
+	CSqlResult Result;
+	Result.m_Type = SQLRESULT_POINTS;
+	Result.m_Points = Points;
+	str_copy(Result.m_aText, pName, sizeof(Result.m_aText));
+	PostResult(Result);
+}
+
+bool CSqlScore::UseRankCache()
+{
+	if(m_pRankCache && g_Config.m_SvSqlRankCache)
+	{
+		m_RankCacheHits++;
+		return true;
+	}
+	m_RankCacheMisses++;
+	return false;
+}
+
+static void FormatTeamNames(const CRankCache *pCache, int Team, char *pBuf, int BufSize)
+{
+	pBuf[0] = 0;
+	int Num = pCache->TeamSize(Team);
+	for(int i = 0; i < Num; i++)
+	{
+		str_append(pBuf, pCache->TeamMember(Team, i), BufSize);
+		if(i < Num - 2)
+			str_append(pBuf, ", ", BufSize);
+		else if(i < Num - 1)
+			str_append(pBuf, " & ", BufSize);
+	}
+}
+
+void CSqlScore::LoadTestCleanupThread(CSqlJob *pJob)
+{
+	CSqlMapData *pData = (CSqlMapData *)pJob;
+
+	if(pData->m_pConn->Connect())
+	{
+		try
+		{
+			char aBuf[256];
+			str_format(aBuf, sizeof(aBuf), "DELETE FROM %s_race WHERE Map='%s';", pData->m_pSqlData->m_pPrefix, pData->m_aMap);
+			pData->m_pConn->m_pStatement->execute(aBuf);
+		}
+		catch (sql::SQLException &e)
+		{
+			char aBuf[256];
+			str_format(aBuf, sizeof(aBuf), "MySQL Error: %s", e.what());
+			dbg_msg("SQL", aBuf);
+			dbg_msg("SQL", "ERROR: Could not remove the old load test times");
+		}
+
+		pData->m_pConn->Disconnect();
+	}
+
+	delete pData;
+}
+
+void CSqlScore::LoadTest(int Finishes, int Players)
+{
+	// the test map has no points, so nobody gets points for these
+	static const char s_aTestMap[] = "__sql_load_test__";
+
+	CSqlMapData *Tmp = new CSqlMapData();
+	str_copy(Tmp->m_aMap, s_aTestMap, sizeof(Tmp->m_aMap));
+	Tmp->m_pSqlData = this;
+	Queue(LoadTestCleanupThread, Tmp, SQLJOB_SAVE);
+
+	for(int i = 0; i < Finishes; i++)
+	{
+		CSqlScoreData *pData = new CSqlScoreData();
+		str_copy(pData->m_aMap, s_aTestMap, sizeof(pData->m_aMap));
+		str_format(pData->m_aName, sizeof(pData->m_aName), "loadtest%d", i % Players);
+		pData->m_Time = 30.0f + (rand()%100000) / 100.0f;
+		for(int c = 0; c < NUM_CHECKPOINTS; c++)
+			pData->m_aCpCurrent[c] = pData->m_Time * (c+1) / (NUM_CHECKPOINTS+1);
+		pData->m_pSqlData = this;
+		Queue(SaveScoreThread, pData, SQLJOB_SAVE);
+	}
+}
+
+CSqlConnection::CSqlConnection(const char *pDatabase, const char *pUser, const char *pPass, const char *pIp, int Port) :
+		m_pDatabase(pDatabase),
+		m_pUser(pUser),
+		m_pPass(pPass),
+		m_pIp(pIp),
+		m_Port(Port)
+{
+	m_pDriver = NULL;
+	m_pConnection = NULL;
+	m_pStatement = NULL;
+	m_pResults = NULL;
+	for(int i = 0; i < NUM_SQLSTMTS; i++)
+		m_apPrepared[i] = NULL;
+	m_NumPrepares = 0;
+	m_NumReuses = 0;
+}
+
+CSqlConnection::~CSqlConnection()
+{
 	try
 	{
+		ResetStatements();
 		delete m_pStatement;
 		delete m_pConnection;
 		dbg_msg("SQL", "SQL connection disconnected");
@@ -51,7 +1023,7 @@ CSqlScore::~CSqlScore()
 	}
 }
 
-bool CSqlScore::Connect()
+bool CSqlConnection::Connect()
 {
 	if (m_pDriver != NULL && m_pConnection != NULL)
 	{
@@ -86,6 +1058,9 @@ bool CSqlScore::Connect()
 		connection_properties["userName"]      = sql::SQLString(m_pUser);
 		connection_properties["password"]      = sql::SQLString(m_pPass);
 		connection_properties["OPT_RECONNECT"] = true;
+		connection_properties["OPT_CONNECT_TIMEOUT"] = g_Config.m_SvSqlTimeout;
+		connection_properties["OPT_READ_TIMEOUT"] = g_Config.m_SvSqlTimeout;
+		connection_properties["OPT_WRITE_TIMEOUT"] = g_Config.m_SvSqlTimeout;
 
 		// Create connection
 		m_pDriver = get_driver_instance();
@@ -151,18 +1126,54 @@ bool CSqlScore::Connect()
 		dbg_msg("SQL", "ERROR: SQL connection failed");
 		return false;
 	}
-	return false;
+	return false;
+}
+
+void CSqlConnection::Disconnect()
+{
+}
+
+sql::PreparedStatement *CSqlConnection::Prepare(int Stmt, const char *pQuery)
+{
+	if(m_apPrepared[Stmt] && m_aPreparedQuery[Stmt] == pQuery)
+	{
+		m_NumReuses++;
+		return m_apPrepared[Stmt];
+	}
+
+	delete m_apPrepared[Stmt];
+	m_apPrepared[Stmt] = NULL;
+	m_apPrepared[Stmt] = m_pConnection->prepareStatement(pQuery);
+	m_aPreparedQuery[Stmt] = pQuery;
+	m_NumPrepares++;
+	return m_apPrepared[Stmt];
 }
 
-void CSqlScore::Disconnect()
+void CSqlConnection::ResetStatements()
 {
+	// a reconnect invalidates the statements on the server side
+	for(int i = 0; i < NUM_SQLSTMTS; i++)
+	{
+		try
+		{
+			delete m_apPrepared[i];
+		}
+		catch (sql::SQLException &e)
+		{
+		}
+		m_apPrepared[i] = NULL;
+	}
 }
 
 // create tables... should be done only once
 void CSqlScore::Init()
 {
+	// the workers may still run the jobs of the previous map on theirs
+	CSqlConnection Conn(m_pDatabase, m_pUser, m_pPass, m_pIp, m_Port);
+	CSqlConnection *pConn = &Conn;
+
 	// create connection
-	if(Connect())
+	if(pConn->Connect())
 	{
 		try
 		{
@@ -171,36 +1182,36 @@ void CSqlScore::Init()
 			if(g_Config.m_SvSqlCreateTables)
 			{
 				str_format(aBuf, sizeof(aBuf), "CREATE TABLE IF NOT EXISTS %s_race (Map VARCHAR(128) BINARY NOT NULL, Name VARCHAR(%d) BINARY NOT NULL, Timestamp TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP , Time FLOAT DEFAULT 0, Server CHAR(4), cp1 FLOAT DEFAULT 0, cp2 FLOAT DEFAULT 0, cp3 FLOAT DEFAULT 0, cp4 FLOAT DEFAULT 0, cp5 FLOAT DEFAULT 0, cp6 FLOAT DEFAULT 0, cp7 FLOAT DEFAULT 0, cp8 FLOAT DEFAULT 0, cp9 FLOAT DEFAULT 0, cp10 FLOAT DEFAULT 0, cp11 FLOAT DEFAULT 0, cp12 FLOAT DEFAULT 0, cp13 FLOAT DEFAULT 0, cp14 FLOAT DEFAULT 0, cp15 FLOAT DEFAULT 0, cp16 FLOAT DEFAULT 0, cp17 FLOAT DEFAULT 0, cp18 FLOAT DEFAULT 0, cp19 FLOAT DEFAULT 0, cp20 FLOAT DEFAULT 0, cp21 FLOAT DEFAULT 0, cp22 FLOAT DEFAULT 0, cp23 FLOAT DEFAULT 0, cp24 FLOAT DEFAULT 0, cp25 FLOAT DEFAULT 0, KEY (Map, Name)) CHARACTER SET utf8 ;", m_pPrefix, MAX_NAME_LENGTH);
-				m_pStatement->execute(aBuf);
+				pConn->m_pStatement->execute(aBuf);
 
 				str_format(aBuf, sizeof(aBuf), "CREATE TABLE IF NOT EXISTS %s_teamrace (Map VARCHAR(128) BINARY NOT NULL, Name VARCHAR(%d) BINARY NOT NULL, Timestamp TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, Time FLOAT DEFAULT 0, ID VARBINARY(16) NOT NULL, KEY Map (Map)) CHARACTER SET utf8 ;", m_pPrefix, MAX_NAME_LENGTH);
-				m_pStatement->execute(aBuf);
+				pConn->m_pStatement->execute(aBuf);
 
 				str_format(aBuf, sizeof(aBuf), "CREATE TABLE IF NOT EXISTS %s_maps (Map VARCHAR(128) BINARY NOT NULL, Server VARCHAR(32) BINARY NOT NULL, Mapper VARCHAR(128) BINARY NOT NULL, Points INT DEFAULT 0, Stars INT DEFAULT 0, Timestamp TIMESTAMP, UNIQUE KEY Map (Map)) CHARACTER SET utf8 ;", m_pPrefix);
-				m_pStatement->execute(aBuf);
+				pConn->m_pStatement->execute(aBuf);
 
 				str_format(aBuf, sizeof(aBuf), "CREATE TABLE IF NOT EXISTS %s_saves (Savegame TEXT CHARACTER SET utf8 BINARY NOT NULL, Map VARCHAR(128) BINARY NOT NULL, Code VARCHAR(128) BINARY NOT NULL, Timestamp TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, Server CHAR(4), UNIQUE KEY (Map, Code)) CHARACTER SET utf8 ;", m_pPrefix);
-				m_pStatement->execute(aBuf);
+				pConn->m_pStatement->execute(aBuf);
 
 				str_format(aBuf, sizeof(aBuf), "CREATE TABLE IF NOT EXISTS %s_points (Name VARCHAR(%d) BINARY NOT NULL, Points INT DEFAULT 0, UNIQUE KEY Name (Name)) CHARACTER SET utf8 ;", m_pPrefix, MAX_NAME_LENGTH);
-				m_pStatement->execute(aBuf);
+				pConn->m_pStatement->execute(aBuf);
 
 				dbg_msg("SQL", "Tables were created successfully");
 			}
 
 			// get the best time
 			str_format(aBuf, sizeof(aBuf), "SELECT Time FROM %s_race WHERE Map='%s' ORDER BY `Time` ASC LIMIT 0, 1;", m_pPrefix, m_aMap);
-			m_pResults = m_pStatement->executeQuery(aBuf);
+			pConn->m_pResults = pConn->m_pStatement->executeQuery(aBuf);
 
-			if(m_pResults->next())
+			if(pConn->m_pResults->next())
 			{
-				((CGameControllerDDRace*)GameServer()->m_pController)->m_CurrentRecord = (float)m_pResults->getDouble("Time");
+				((CGameControllerDDRace*)GameServer()->m_pController)->m_CurrentRecord = (float)pConn->m_pResults->getDouble("Time");
 
 				dbg_msg("SQL", "Getting best time on server done");
 			}
 
 			// delete statement
-			delete m_pResults;
+			delete pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -211,41 +1222,36 @@ void CSqlScore::Init()
 		}
 
 		// disconnect from database
-		Disconnect();
+		pConn->Disconnect();
 	}
 }
 
-void CSqlScore::CheckBirthdayThread(void *pUser)
+void CSqlScore::CheckBirthdayThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
-			// check strings
-			char originalName[MAX_NAME_LENGTH];
-			strcpy(originalName,pData->m_aName);
-			pData->m_pSqlData->ClearString(pData->m_aName);
-
 			char aBuf[512];
 
-			str_format(aBuf, sizeof(aBuf), "select year(Current) - year(Stamp) as YearsAgo from (select CURRENT_TIMESTAMP as Current, min(Timestamp) as Stamp from %s_race WHERE Name='%s') as l where dayofmonth(Current) = dayofmonth(Stamp) and month(Current) = month(Stamp) and year(Current) > year(Stamp);", pData->m_pSqlData->m_pPrefix, pData->m_aName);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
-			if(pData->m_pSqlData->m_pResults->next())
+			str_format(aBuf, sizeof(aBuf), "select year(Current) - year(Stamp) as YearsAgo from (select CURRENT_TIMESTAMP as Current, min(Timestamp) as Stamp from %s_race WHERE Name=?) as l where dayofmonth(Current) = dayofmonth(Stamp) and month(Current) = month(Stamp) and year(Current) > year(Stamp);", pData->m_pSqlData->m_pPrefix);
+			sql::PreparedStatement *pStmt = pData->m_pConn->Prepare(SQLSTMT_BIRTHDAY, aBuf);
+			pStmt->setString(1, pData->m_aName);
+			pData->m_pConn->m_pResults = pStmt->executeQuery();
+			if(pData->m_pConn->m_pResults->next())
 			{
-				int yearsAgo = (int)pData->m_pSqlData->m_pResults->getInt("YearsAgo");
-				str_format(aBuf, sizeof(aBuf), "Happy DDNet birthday to %s for finishing their first map %d year%s ago!", originalName, yearsAgo, yearsAgo > 1 ? "s" : "");
-				pData->m_pSqlData->GameServer()->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
+				int yearsAgo = (int)pData->m_pConn->m_pResults->getInt("YearsAgo");
+				str_format(aBuf, sizeof(aBuf), "Happy DDNet birthday to %s for finishing their first map %d year%s ago!", pData->m_aName, yearsAgo, yearsAgo > 1 ? "s" : "");
+				pData->m_pSqlData->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
 			}
 
 			dbg_msg("SQL", "Checking birthday done");
 
 			// delete statement and results
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -253,15 +1259,14 @@ void CSqlScore::CheckBirthdayThread(void *pUser)
 			str_format(aBuf, sizeof(aBuf), "MySQL Error: %s", e.what());
 			dbg_msg("SQL", aBuf);
 			dbg_msg("SQL", "ERROR: Could not check birthday");
+			pData->m_pConn->ResetStatements();
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::CheckBirthday(int ClientID)
@@ -271,38 +1276,32 @@ void CSqlScore::CheckBirthday(int ClientID)
 	str_copy(Tmp->m_aName, Server()->ClientName(ClientID), MAX_NAME_LENGTH);
 	Tmp->m_pSqlData = this;
 
-	void *CheckThread = thread_init(CheckBirthdayThread, Tmp);
-	thread_detach(CheckThread);
+	Queue(CheckBirthdayThread, Tmp, SQLJOB_QUERY);
 }
 
 
 // update stuff
-void CSqlScore::LoadScoreThread(void *pUser)
+void CSqlScore::LoadScoreThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
-			// check strings
-			pData->m_pSqlData->ClearString(pData->m_aName);
-
 			char aBuf[512];
 
-			str_format(aBuf, sizeof(aBuf), "SELECT * FROM %s_race WHERE Map='%s' AND Name='%s' ORDER BY time ASC LIMIT 1;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_aName);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
-			if(pData->m_pSqlData->m_pResults->next())
+			str_format(aBuf, sizeof(aBuf), "SELECT * FROM %s_race WHERE Map=? AND Name=? ORDER BY time ASC LIMIT 1;", pData->m_pSqlData->m_pPrefix);
+			sql::PreparedStatement *pStmt = pData->m_pConn->Prepare(SQLSTMT_BEST_TIME, aBuf);
+			pStmt->setString(1, pData->m_pSqlData->m_aMapName);
+			pStmt->setString(2, pData->m_aName);
+			pData->m_pConn->m_pResults = pStmt->executeQuery();
+			if(pData->m_pConn->m_pResults->next())
 			{
-				// get the best time
-				float time = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
-				pData->m_pSqlData->PlayerData(pData->m_ClientID)->m_BestTime = time;
-				pData->m_pSqlData->PlayerData(pData->m_ClientID)->m_CurrentTime = time;
-				if(pData->m_pSqlData->m_pGameServer->m_apPlayers[pData->m_ClientID])
-					pData->m_pSqlData->m_pGameServer->m_apPlayers[pData->m_ClientID]->m_Score = -time;
+				// get the best time, the game thread applies it
+				float time = (float)pData->m_pConn->m_pResults->getDouble("Time");
+				float aCpTime[NUM_CHECKPOINTS];
 
 				char aColumn[8];
 				if(g_Config.m_SvCheckpointSave)
@@ -310,15 +1309,16 @@ void CSqlScore::LoadScoreThread(void *pUser)
 					for(int i = 0; i < NUM_CHECKPOINTS; i++)
 					{
 						str_format(aColumn, sizeof(aColumn), "cp%d", i+1);
-						pData->m_pSqlData->PlayerData(pData->m_ClientID)->m_aBestCpTime[i] = (float)pData->m_pSqlData->m_pResults->getDouble(aColumn);
+						aCpTime[i] = (float)pData->m_pConn->m_pResults->getDouble(aColumn);
 					}
 				}
+				pData->m_pSqlData->SetPlayerScore(pData->m_ClientID, time, g_Config.m_SvCheckpointSave ? aCpTime : 0);
 			}
 
 			dbg_msg("SQL", "Getting best time done");
 
 			// delete statement and results
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -326,15 +1326,14 @@ void CSqlScore::LoadScoreThread(void *pUser)
 			str_format(aBuf, sizeof(aBuf), "MySQL Error: %s", e.what());
 			dbg_msg("SQL", aBuf);
 			dbg_msg("SQL", "ERROR: Could not update account");
+			pData->m_pConn->ResetStatements();
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::LoadScore(int ClientID)
@@ -344,18 +1343,15 @@ void CSqlScore::LoadScore(int ClientID)
 	str_copy(Tmp->m_aName, Server()->ClientName(ClientID), MAX_NAME_LENGTH);
 	Tmp->m_pSqlData = this;
 
-	void *LoadThread = thread_init(LoadScoreThread, Tmp);
-	thread_detach(LoadThread);
+	Queue(LoadScoreThread, Tmp, SQLJOB_LOAD);
 }
 
-void CSqlScore::SaveTeamScoreThread(void *pUser)
+void CSqlScore::SaveTeamScoreThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlTeamScoreData *pData = (CSqlTeamScoreData *)pUser;
+	CSqlTeamScoreData *pData = (CSqlTeamScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
@@ -363,15 +1359,13 @@ void CSqlScore::SaveTeamScoreThread(void *pUser)
 			char aUpdateID[17];
 			aUpdateID[0] = 0;
 
-			for(unsigned int i = 0; i < pData->m_Size; i++)
-			{
-				pData->m_pSqlData->ClearString(pData->m_aNames[i]);
-			}
-
-			str_format(aBuf, sizeof(aBuf), "SELECT Name, l.ID, Time FROM ((SELECT ID FROM %s_teamrace WHERE Map = '%s' AND Name = '%s') as l) LEFT JOIN %s_teamrace as r ON l.ID = r.ID ORDER BY ID;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_aNames[0], pData->m_pSqlData->m_pPrefix);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			str_format(aBuf, sizeof(aBuf), "SELECT Name, l.ID, Time FROM ((SELECT ID FROM %s_teamrace WHERE Map = ? AND Name = ?) as l) LEFT JOIN %s_teamrace as r ON l.ID = r.ID ORDER BY ID;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_pPrefix);
+			sql::PreparedStatement *pStmt = pData->m_pConn->Prepare(SQLSTMT_TEAM_TIMES, aBuf);
+			pStmt->setString(1, pData->m_pSqlData->m_aMapName);
+			pStmt->setString(2, pData->m_aNames[0]);
+			pData->m_pConn->m_pResults = pStmt->executeQuery();
 
-			if (pData->m_pSqlData->m_pResults->rowsCount() > 0)
+			if (pData->m_pConn->m_pResults->rowsCount() > 0)
 			{
 				char aID[17];
 				char aID2[17];
@@ -379,15 +1373,14 @@ void CSqlScore::SaveTeamScoreThread(void *pUser)
 				unsigned int Count = 0;
 				bool ValidNames = true;
 
-				pData->m_pSqlData->m_pResults->first();
-				float Time = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
-				strcpy(aID, pData->m_pSqlData->m_pResults->getString("ID").c_str());
+				pData->m_pConn->m_pResults->first();
+				float Time = (float)pData->m_pConn->m_pResults->getDouble("Time");
+				strcpy(aID, pData->m_pConn->m_pResults->getString("ID").c_str());
 
 				do
 				{
-					strcpy(aID2, pData->m_pSqlData->m_pResults->getString("ID").c_str());
-					strcpy(aName, pData->m_pSqlData->m_pResults->getString("Name").c_str());
-					pData->m_pSqlData->ClearString(aName);
+					strcpy(aID2, pData->m_pConn->m_pResults->getString("ID").c_str());
+					str_copy(aName, pData->m_pConn->m_pResults->getString("Name").c_str(), sizeof(aName));
 					if (str_comp(aID, aID2) != 0)
 					{
 						if (ValidNames && Count == pData->m_Size)
@@ -399,7 +1392,7 @@ void CSqlScore::SaveTeamScoreThread(void *pUser)
 							break;
 						}
 
-						Time = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
+						Time = (float)pData->m_pConn->m_pResults->getDouble("Time");
 						ValidNames = true;
 						Count = 0;
 						strcpy(aID, aID2);
@@ -419,7 +1412,7 @@ void CSqlScore::SaveTeamScoreThread(void *pUser)
 							break;
 						}
 					}
-				} while (pData->m_pSqlData->m_pResults->next());
+				} while (pData->m_pConn->m_pResults->next());
 
 				if (ValidNames && Count == pData->m_Size)
 				{
@@ -432,28 +1425,34 @@ void CSqlScore::SaveTeamScoreThread(void *pUser)
 
 			if (aUpdateID[0])
 			{
-				str_format(aBuf, sizeof(aBuf), "UPDATE %s_teamrace SET Time='%.2f' WHERE ID = '%s';", pData->m_pSqlData->m_pPrefix, pData->m_Time, aUpdateID);
-				dbg_msg("SQL", aBuf);
-				pData->m_pSqlData->m_pStatement->execute(aBuf);
+				str_format(aBuf, sizeof(aBuf), "UPDATE %s_teamrace SET Time=? WHERE ID = ?;", pData->m_pSqlData->m_pPrefix);
+				pStmt = pData->m_pConn->Prepare(SQLSTMT_TEAM_UPDATE, aBuf);
+				pStmt->setDouble(1, pData->m_Time);
+				pStmt->setString(2, aUpdateID);
+				pStmt->execute();
 			}
 			else
 			{
-				pData->m_pSqlData->m_pStatement->execute("SET @id = UUID();");
-
+				// if no entry found... create a new one with the next batch
+				CSqlTeamRow aRows[MAX_CLIENTS];
+				unsigned char aID[8];
+				secure_random_fill(aID, sizeof(aID));
 				for(unsigned int i = 0; i < pData->m_Size; i++)
 				{
-				// if no entry found... create a new one
-					str_format(aBuf, sizeof(aBuf), "INSERT IGNORE INTO %s_teamrace(Map, Name, Timestamp, Time, ID) VALUES ('%s', '%s', CURRENT_TIMESTAMP(), '%.2f', @id);", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_aNames[i], pData->m_Time);
-					dbg_msg("SQL", aBuf);
-					pData->m_pSqlData->m_pStatement->execute(aBuf);
+					str_copy(aRows[i].m_aMap, pData->m_pSqlData->m_aMapName, sizeof(aRows[i].m_aMap));
+					str_copy(aRows[i].m_aName, pData->m_aNames[i], sizeof(aRows[i].m_aName));
+					aRows[i].m_Time = pData->m_Time;
+					for(unsigned j = 0; j < sizeof(aID); j++)
+						str_format(aRows[i].m_aID + j*2, 3, "%02x", aID[j]);
 				}
+				pData->m_pSqlData->AddTeamRows(aRows, pData->m_Size);
 			}
 
 			end:
 			dbg_msg("SQL", "Updating team time done");
 
 			// delete results statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -461,15 +1460,14 @@ void CSqlScore::SaveTeamScoreThread(void *pUser)
 			str_format(aBuf, sizeof(aBuf), "MySQL Error: %s", e.what());
 			dbg_msg("SQL", aBuf);
 			dbg_msg("SQL", "ERROR: Could not update time");
+			pData->m_pConn->ResetStatements();
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::MapVote(int ClientID, const char* MapName)
@@ -479,18 +1477,15 @@ void CSqlScore::MapVote(int ClientID, const char* MapName)
 	str_copy(Tmp->m_aMap, MapName, 128);
 	Tmp->m_pSqlData = this;
 
-	void *VoteThread = thread_init(MapVoteThread, Tmp);
-	thread_detach(VoteThread);
+	Queue(MapVoteThread, Tmp, SQLJOB_QUERY);
 }
 
-void CSqlScore::MapVoteThread(void *pUser)
+void CSqlScore::MapVoteThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlMapData *pData = (CSqlMapData *)pUser;
+	CSqlMapData *pData = (CSqlMapData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		char originalMap[128];
 		strcpy(originalMap,pData->m_aMap);
@@ -503,59 +1498,26 @@ void CSqlScore::MapVoteThread(void *pUser)
 		{
 			char aBuf[768];
 			str_format(aBuf, sizeof(aBuf), "SELECT Map, Server FROM %s_maps WHERE Map LIKE '%s' COLLATE utf8_general_ci ORDER BY CASE WHEN Map = '%s' THEN 0 ELSE 1 END, CASE WHEN Map LIKE '%s%%' THEN 0 ELSE 1 END, LENGTH(Map), Map LIMIT 1;", pData->m_pSqlData->m_pPrefix, pData->m_aMap, clearMap, clearMap);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			CPlayer *pPlayer = pData->m_pSqlData->m_pGameServer->m_apPlayers[pData->m_ClientID];
-
-			int64 Now = pData->m_pSqlData->Server()->Tick();
-			int Timeleft = 0;
-
-			if(!pPlayer)
-				goto end;
-
-			Timeleft = pPlayer->m_LastVoteCall + pData->m_pSqlData->Server()->TickSpeed()*g_Config.m_SvVoteDelay - Now;
-
-			if(pData->m_pSqlData->m_pResults->rowsCount() != 1)
+			if(pData->m_pConn->m_pResults->rowsCount() != 1)
 			{
 				str_format(aBuf, sizeof(aBuf), "No map like \"%s\" found. Try adding a '%%' at the start if you don't know the first character. Example: /map %%castle for \"Out of Castle\"", originalMap);
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
-			}
-			else if(pPlayer->m_LastVoteCall && Timeleft > 0)
-			{
-				char aChatmsg[512] = {0};
-				str_format(aChatmsg, sizeof(aChatmsg), "You must wait %d seconds before making another vote", (Timeleft/pData->m_pSqlData->Server()->TickSpeed())+1);
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aChatmsg);
-			}
-			else if(time_get() < pData->m_pSqlData->GameServer()->m_LastMapVote + (time_freq() * g_Config.m_SvVoteMapTimeDelay))
-			{
-				char chatmsg[512] = {0};
-				str_format(chatmsg, sizeof(chatmsg), "There's a %d second delay between map-votes, please wait %d seconds.", g_Config.m_SvVoteMapTimeDelay,((pData->m_pSqlData->GameServer()->m_LastMapVote+(g_Config.m_SvVoteMapTimeDelay * time_freq()))/time_freq())-(time_get()/time_freq()));
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, chatmsg);
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 			}
 			else
 			{
-				pData->m_pSqlData->m_pResults->next();
-				char aMap[128];
-				strcpy(aMap, pData->m_pSqlData->m_pResults->getString("Map").c_str());
-				char aServer[32];
-				strcpy(aServer, pData->m_pSqlData->m_pResults->getString("Server").c_str());
-
-				for(char *p = aServer; *p; p++)
-					*p = tolower(*p);
-
-				char aCmd[256];
-				str_format(aCmd, sizeof(aCmd), "sv_reset_file types/%s/flexreset.cfg; change_map \"%s\"", aServer, aMap);
-				char aChatmsg[512];
-				str_format(aChatmsg, sizeof(aChatmsg), "'%s' called vote to change server option '%s' (%s)", pData->m_pSqlData->GameServer()->Server()->ClientName(pData->m_ClientID), aMap, "/map");
-
-				pData->m_pSqlData->GameServer()->m_VoteKick = false;
-				pData->m_pSqlData->GameServer()->m_VoteSpec = false;
-				pData->m_pSqlData->GameServer()->m_LastMapVote = time_get();
-				pData->m_pSqlData->GameServer()->CallVote(pData->m_ClientID, aMap, aCmd, "/map", aChatmsg);
+				// the vote delays are checked when the vote is called
+				pData->m_pConn->m_pResults->next();
+				CSqlResult Result;
+				Result.m_Type = SQLRESULT_MAP_VOTE;
+				Result.m_ClientID = pData->m_ClientID;
+				str_copy(Result.m_aText, pData->m_pConn->m_pResults->getString("Map").c_str(), sizeof(Result.m_aText));
+				str_copy(Result.m_aServer, pData->m_pConn->m_pResults->getString("Server").c_str(), sizeof(Result.m_aServer));
+				pData->m_pSqlData->PostResult(Result);
 			}
 
-			end:
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -565,11 +1527,50 @@ void CSqlScore::MapVoteThread(void *pUser)
 			dbg_msg("SQL", "ERROR: Could not update time");
 		}
 
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-	lock_unlock(gs_SqlLock);
+}
+
+void CSqlScore::OnMapVote(const CSqlResult *pResult)
+{
+	CPlayer *pPlayer = GameServer()->m_apPlayers[pResult->m_ClientID];
+	if(!pPlayer)
+		return;
+
+	int64 Now = Server()->Tick();
+	int Timeleft = pPlayer->m_LastVoteCall + Server()->TickSpeed()*g_Config.m_SvVoteDelay - Now;
+
+	if(pPlayer->m_LastVoteCall && Timeleft > 0)
+	{
+		char aChatmsg[512] = {0};
+		str_format(aChatmsg, sizeof(aChatmsg), "You must wait %d seconds before making another vote", (Timeleft/Server()->TickSpeed())+1);
+		GameServer()->SendChatTarget(pResult->m_ClientID, aChatmsg);
+	}
+	else if(time_get() < GameServer()->m_LastMapVote + (time_freq() * g_Config.m_SvVoteMapTimeDelay))
+	{
+		char chatmsg[512] = {0};
+		str_format(chatmsg, sizeof(chatmsg), "There's a %d second delay between map-votes, please wait %d seconds.", g_Config.m_SvVoteMapTimeDelay,((GameServer()->m_LastMapVote+(g_Config.m_SvVoteMapTimeDelay * time_freq()))/time_freq())-(time_get()/time_freq()));
+		GameServer()->SendChatTarget(pResult->m_ClientID, chatmsg);
+	}
+	else
+	{
+		char aServer[32];
+		str_copy(aServer, pResult->m_aServer, sizeof(aServer));
+		for(char *p = aServer; *p; p++)
+			*p = tolower(*p);
+
+		char aCmd[256];
+		str_format(aCmd, sizeof(aCmd), "sv_reset_file types/%s/flexreset.cfg; change_map \"%s\"", aServer, pResult->m_aText);
+		char aChatmsg[512];
+		str_format(aChatmsg, sizeof(aChatmsg), "'%s' called vote to change server option '%s' (%s)", Server()->ClientName(pResult->m_ClientID), pResult->m_aText, "/map");
+
+		GameServer()->m_VoteKick = false;
+		GameServer()->m_VoteSpec = false;
+		GameServer()->m_LastMapVote = time_get();
+		GameServer()->CallVote(pResult->m_ClientID, pResult->m_aText, aCmd, "/map", aChatmsg);
+	}
 }
 
 void CSqlScore::MapInfo(int ClientID, const char* MapName)
@@ -579,18 +1580,15 @@ void CSqlScore::MapInfo(int ClientID, const char* MapName)
 	str_copy(Tmp->m_aMap, MapName, 128);
 	Tmp->m_pSqlData = this;
 
-	void *InfoThread = thread_init(MapInfoThread, Tmp);
-	thread_detach(InfoThread);
+	Queue(MapInfoThread, Tmp, SQLJOB_QUERY);
 }
 
-void CSqlScore::MapInfoThread(void *pUser)
+void CSqlScore::MapInfoThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlMapData *pData = (CSqlMapData *)pUser;
+	CSqlMapData *pData = (CSqlMapData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		char originalMap[128];
 		strcpy(originalMap,pData->m_aMap);
@@ -603,28 +1601,28 @@ void CSqlScore::MapInfoThread(void *pUser)
 		{
 			char aBuf[1024];
 			str_format(aBuf, sizeof(aBuf), "SELECT l.Map, l.Server, Mapper, Points, Stars, (select count(Name) from %s_race where Map = l.Map) as Finishes, (select count(distinct Name) from %s_race where Map = l.Map) as Finishers, (select round(avg(Time)) from %s_race where Map = l.Map) as Average, UNIX_TIMESTAMP(l.Timestamp) as Stamp, UNIX_TIMESTAMP(CURRENT_TIMESTAMP)-UNIX_TIMESTAMP(l.Timestamp) as Ago FROM (SELECT * FROM %s_maps WHERE Map LIKE '%s' COLLATE utf8_general_ci ORDER BY CASE WHEN Map = '%s' THEN 0 ELSE 1 END, CASE WHEN Map LIKE '%s%%' THEN 0 ELSE 1 END, LENGTH(Map), Map LIMIT 1) as l;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_pPrefix, pData->m_aMap, clearMap, clearMap);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			if(pData->m_pSqlData->m_pResults->rowsCount() != 1)
+			if(pData->m_pConn->m_pResults->rowsCount() != 1)
 			{
 				str_format(aBuf, sizeof(aBuf), "No map like \"%s\" found.", originalMap);
 			}
 			else
 			{
-				pData->m_pSqlData->m_pResults->next();
-				int points = (int)pData->m_pSqlData->m_pResults->getInt("Points");
-				int stars = (int)pData->m_pSqlData->m_pResults->getInt("Stars");
-				int finishes = (int)pData->m_pSqlData->m_pResults->getInt("Finishes");
-				int finishers = (int)pData->m_pSqlData->m_pResults->getInt("Finishers");
-				int average = (int)pData->m_pSqlData->m_pResults->getInt("Average");
+				pData->m_pConn->m_pResults->next();
+				int points = (int)pData->m_pConn->m_pResults->getInt("Points");
+				int stars = (int)pData->m_pConn->m_pResults->getInt("Stars");
+				int finishes = (int)pData->m_pConn->m_pResults->getInt("Finishes");
+				int finishers = (int)pData->m_pConn->m_pResults->getInt("Finishers");
+				int average = (int)pData->m_pConn->m_pResults->getInt("Average");
 				char aMap[128];
-				strcpy(aMap, pData->m_pSqlData->m_pResults->getString("Map").c_str());
+				strcpy(aMap, pData->m_pConn->m_pResults->getString("Map").c_str());
 				char aServer[32];
-				strcpy(aServer, pData->m_pSqlData->m_pResults->getString("Server").c_str());
+				strcpy(aServer, pData->m_pConn->m_pResults->getString("Server").c_str());
 				char aMapper[128];
-				strcpy(aMapper, pData->m_pSqlData->m_pResults->getString("Mapper").c_str());
-				int stamp = (int)pData->m_pSqlData->m_pResults->getInt("Stamp");
-				int ago = (int)pData->m_pSqlData->m_pResults->getInt("Ago");
+				strcpy(aMapper, pData->m_pConn->m_pResults->getString("Mapper").c_str());
+				int stamp = (int)pData->m_pConn->m_pResults->getInt("Stamp");
+				int ago = (int)pData->m_pConn->m_pResults->getInt("Ago");
 
 				char pAgoString[40] = "\0";
 				char pReleasedString[60] = "\0";
@@ -655,8 +1653,8 @@ void CSqlScore::MapInfoThread(void *pUser)
 				str_format(aBuf, sizeof(aBuf), "\"%s\" by %s on %s (%s, %d %s, %d %s by %d %s%s%s)", aMap, aMapper, aServer, aStars, points, points == 1 ? "point" : "points", finishes, finishes == 1 ? "finish" : "finishes", finishers, finishers == 1 ? "tee" : "tees", pAverageString, pReleasedString);
 			}
 
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
-			delete pData->m_pSqlData->m_pResults;
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -666,59 +1664,65 @@ void CSqlScore::MapInfoThread(void *pUser)
 			dbg_msg("SQL", "ERROR: Could not update time");
 		}
 
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-	lock_unlock(gs_SqlLock);
 }
 
-void CSqlScore::SaveScoreThread(void *pUser)
+void CSqlScore::SaveScoreThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
+	CSqlScore *pSelf = pData->m_pSqlData;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
 			char aBuf[768];
 
-			// check strings
-			pData->m_pSqlData->ClearString(pData->m_aName);
-
-			str_format(aBuf, sizeof(aBuf), "SELECT * FROM %s_race WHERE Map='%s' AND Name='%s' ORDER BY time ASC LIMIT 1;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_aName);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
-			if(!pData->m_pSqlData->m_pResults->next())
+			str_format(aBuf, sizeof(aBuf), "SELECT 1 FROM %s_race WHERE Map=? AND Name=? LIMIT 1;", pSelf->m_pPrefix);
+			sql::PreparedStatement *pStmt = pData->m_pConn->Prepare(SQLSTMT_HAS_FINISHED, aBuf);
+			pStmt->setString(1, pData->m_aMap);
+			pStmt->setString(2, pData->m_aName);
+			pData->m_pConn->m_pResults = pStmt->executeQuery();
+			bool Finished = pData->m_pConn->m_pResults->next();
+			delete pData->m_pConn->m_pResults;
+
+			CSqlRaceRow Row;
+			str_copy(Row.m_aMap, pData->m_aMap, sizeof(Row.m_aMap));
+			str_copy(Row.m_aName, pData->m_aName, sizeof(Row.m_aName));
+			Row.m_Time = pData->m_Time;
+			mem_copy(Row.m_aCpTime, pData->m_aCpCurrent, sizeof(Row.m_aCpTime));
+			Row.m_Points = 0;
+
+			int points = 0;
+			if(!Finished)
 			{
-				delete pData->m_pSqlData->m_pResults;
-
-				str_format(aBuf, sizeof(aBuf), "SELECT Points FROM %s_maps WHERE Map ='%s'", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap);
-				pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+				str_format(aBuf, sizeof(aBuf), "SELECT Points FROM %s_maps WHERE Map=?;", pSelf->m_pPrefix);
+				sql::PreparedStatement *pStmt = pData->m_pConn->Prepare(SQLSTMT_MAP_POINTS, aBuf);
+				pStmt->setString(1, pData->m_aMap);
+				pData->m_pConn->m_pResults = pStmt->executeQuery();
 
-				if(pData->m_pSqlData->m_pResults->rowsCount() == 1)
+				if(pData->m_pConn->m_pResults->rowsCount() == 1)
 				{
-					pData->m_pSqlData->m_pResults->next();
-					int points = (int)pData->m_pSqlData->m_pResults->getInt("Points");
-					if (points == 1)
-						str_format(aBuf, sizeof(aBuf), "You earned %d point for finishing this map!", points);
-					else
-						str_format(aBuf, sizeof(aBuf), "You earned %d points for finishing this map!", points);
-					pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
-
-					str_format(aBuf, sizeof(aBuf), "INSERT INTO %s_points(Name, Points) VALUES ('%s', '%d') ON duplicate key UPDATE Name=VALUES(Name), Points=Points+VALUES(Points);", pData->m_pSqlData->m_pPrefix, pData->m_aName, points);
-					pData->m_pSqlData->m_pStatement->execute(aBuf);
+					pData->m_pConn->m_pResults->next();
+					points = (int)pData->m_pConn->m_pResults->getInt("Points");
 				}
+				delete pData->m_pConn->m_pResults;
 			}
 
-			delete pData->m_pSqlData->m_pResults;
-
-			// if no entry found... create a new one
-			str_format(aBuf, sizeof(aBuf), "INSERT IGNORE INTO %s_race(Map, Name, Timestamp, Time, Server, cp1, cp2, cp3, cp4, cp5, cp6, cp7, cp8, cp9, cp10, cp11, cp12, cp13, cp14, cp15, cp16, cp17, cp18, cp19, cp20, cp21, cp22, cp23, cp24, cp25) VALUES ('%s', '%s', CURRENT_TIMESTAMP(), '%.2f', '%s', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f');", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_aName, pData->m_Time, g_Config.m_SvSqlServerName, pData->m_aCpCurrent[0], pData->m_aCpCurrent[1], pData->m_aCpCurrent[2], pData->m_aCpCurrent[3], pData->m_aCpCurrent[4], pData->m_aCpCurrent[5], pData->m_aCpCurrent[6], pData->m_aCpCurrent[7], pData->m_aCpCurrent[8], pData->m_aCpCurrent[9], pData->m_aCpCurrent[10], pData->m_aCpCurrent[11], pData->m_aCpCurrent[12], pData->m_aCpCurrent[13], pData->m_aCpCurrent[14], pData->m_aCpCurrent[15], pData->m_aCpCurrent[16], pData->m_aCpCurrent[17], pData->m_aCpCurrent[18], pData->m_aCpCurrent[19], pData->m_aCpCurrent[20], pData->m_aCpCurrent[21], pData->m_aCpCurrent[22], pData->m_aCpCurrent[23], pData->m_aCpCurrent[24]);
-			dbg_msg("SQL", aBuf);
-			pData->m_pSqlData->m_pStatement->execute(aBuf);
+			// the insert itself goes out with the next batch
+			if(pSelf->AddRaceRow(&Row, Finished, points))
+			{
+				if (points == 1)
+					str_format(aBuf, sizeof(aBuf), "You earned %d point for finishing this map!", points);
+				else
+					str_format(aBuf, sizeof(aBuf), "You earned %d points for finishing this map!", points);
+				if(pData->m_ClientID >= 0)
+					pSelf->SendChatTarget(pData->m_ClientID, aBuf);
+			}
 
 			dbg_msg("SQL", "Updating time done");
 		}
@@ -728,15 +1732,14 @@ void CSqlScore::SaveScoreThread(void *pUser)
 			str_format(aBuf, sizeof(aBuf), "MySQL Error: %s", e.what());
 			dbg_msg("SQL", aBuf);
 			dbg_msg("SQL", "ERROR: Could not update time");
+			pData->m_pConn->ResetStatements();
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::SaveScore(int ClientID, float Time, float CpTime[NUM_CHECKPOINTS])
@@ -746,14 +1749,21 @@ void CSqlScore::SaveScore(int ClientID, float Time, float CpTime[NUM_CHECKPOINTS
 		return;
 	CSqlScoreData *Tmp = new CSqlScoreData();
 	Tmp->m_ClientID = ClientID;
+	str_copy(Tmp->m_aMap, m_aMapName, sizeof(Tmp->m_aMap));
 	str_copy(Tmp->m_aName, Server()->ClientName(ClientID), MAX_NAME_LENGTH);
 	Tmp->m_Time = Time;
 	for(int i = 0; i < NUM_CHECKPOINTS; i++)
 		Tmp->m_aCpCurrent[i] = CpTime[i];
 	Tmp->m_pSqlData = this;
 
-	void *SaveThread = thread_init(SaveScoreThread, Tmp);
-	thread_detach(SaveThread);
+	Queue(SaveScoreThread, Tmp, SQLJOB_SAVE);
+
+	CRankUpdate Update;
+	Update.m_Team = false;
+	Update.m_Time = Time;
+	Update.m_NumNames = 1;
+	str_copy(Update.m_aaNames[0], Tmp->m_aName, sizeof(Update.m_aaNames[0]));
+	UpdateRankCache(Update);
 }
 
 void CSqlScore::SaveTeamScore(int* aClientIDs, unsigned int Size, float Time)
@@ -771,18 +1781,23 @@ void CSqlScore::SaveTeamScore(int* aClientIDs, unsigned int Size, float Time)
 	Tmp->m_Time = Time;
 	Tmp->m_pSqlData = this;
 
-	void *SaveTeamThread = thread_init(SaveTeamScoreThread, Tmp);
-	thread_detach(SaveTeamThread);
+	CRankUpdate Update;
+	Update.m_Team = true;
+	Update.m_Time = Time;
+	Update.m_NumNames = Size;
+	for(unsigned int i = 0; i < Size; i++)
+		str_copy(Update.m_aaNames[i], Tmp->m_aNames[i], sizeof(Update.m_aaNames[i]));
+
+	Queue(SaveTeamScoreThread, Tmp, SQLJOB_SAVE);
+	UpdateRankCache(Update);
 }
 
-void CSqlScore::ShowTeamRankThread(void *pUser)
+void CSqlScore::ShowTeamRankThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
@@ -796,31 +1811,31 @@ void CSqlScore::ShowTeamRankThread(void *pUser)
 			char aNames[2300];
 			aNames[0] = '\0';
 
-			pData->m_pSqlData->m_pStatement->execute("SET @prev := NULL;");
-			pData->m_pSqlData->m_pStatement->execute("SET @rank := 1;");
-			pData->m_pSqlData->m_pStatement->execute("SET @pos := 0;");
+			pData->m_pConn->m_pStatement->execute("SET @prev := NULL;");
+			pData->m_pConn->m_pStatement->execute("SET @rank := 1;");
+			pData->m_pConn->m_pStatement->execute("SET @pos := 0;");
 			str_format(aBuf, sizeof(aBuf), "SELECT Rank, Name, Time FROM (SELECT Rank, l2.ID FROM ((SELECT ID, (@pos := @pos+1) pos, (@rank := IF(@prev = Time,@rank,@pos)) rank, (@prev := Time) Time FROM (SELECT ID, Time FROM %s_teamrace WHERE Map = '%s' GROUP BY ID ORDER BY Time) as ll) as l2) LEFT JOIN %s_teamrace as r2 ON l2.ID = r2.ID WHERE Map = '%s' AND Name = '%s' ORDER BY Rank LIMIT 1) as l LEFT JOIN %s_teamrace as r ON l.ID = r.ID ORDER BY Name;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_aName, pData->m_pSqlData->m_pPrefix);
 
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			int Rows = pData->m_pSqlData->m_pResults->rowsCount();
+			int Rows = pData->m_pConn->m_pResults->rowsCount();
 
 			if(Rows < 1)
 			{
 				str_format(aBuf, sizeof(aBuf), "%s has no team ranks", originalName);
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 			}
 			else
 			{
-				pData->m_pSqlData->m_pResults->first();
+				pData->m_pConn->m_pResults->first();
 
-				float Time = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
-				int Rank = (int)pData->m_pSqlData->m_pResults->getInt("Rank");
+				float Time = (float)pData->m_pConn->m_pResults->getDouble("Time");
+				int Rank = (int)pData->m_pConn->m_pResults->getInt("Rank");
 
 				for(int Row = 0; Row < Rows; Row++)
 				{
-					strcat(aNames, pData->m_pSqlData->m_pResults->getString("Name").c_str());
-					pData->m_pSqlData->m_pResults->next();
+					strcat(aNames, pData->m_pConn->m_pResults->getString("Name").c_str());
+					pData->m_pConn->m_pResults->next();
 
 					if (Row < Rows - 2)
 						strcat(aNames, ", ");
@@ -828,24 +1843,24 @@ void CSqlScore::ShowTeamRankThread(void *pUser)
 						strcat(aNames, " & ");
 				}
 
-				pData->m_pSqlData->m_pResults->first();
+				pData->m_pConn->m_pResults->first();
 
 				if(g_Config.m_SvHideScore)
 				{
 					str_format(aBuf, sizeof(aBuf), "Your team time: %02d:%05.02f", (int)(Time/60), Time-((int)Time/60*60));
-					pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+					pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 				}
 				else
 				{
 					str_format(aBuf, sizeof(aBuf), "%d. %s Team time: %02d:%05.02f, requested by %s", Rank, aNames, (int)(Time/60), Time-((int)Time/60*60), pData->m_aRequestingPlayer);
-					pData->m_pSqlData->GameServer()->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
+					pData->m_pSqlData->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
 				}
 			}
 
 			dbg_msg("SQL", "Showing teamrank done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -856,39 +1871,35 @@ void CSqlScore::ShowTeamRankThread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
-void CSqlScore::ShowTeamTop5Thread(void *pUser)
+void CSqlScore::ShowTeamTop5Thread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
 			// check sort methode
 			char aBuf[512];
 
-			pData->m_pSqlData->m_pStatement->execute("SET @prev := NULL;");
-			pData->m_pSqlData->m_pStatement->execute("SET @previd := NULL;");
-			pData->m_pSqlData->m_pStatement->execute("SET @rank := 1;");
-			pData->m_pSqlData->m_pStatement->execute("SET @pos := 0;");
+			pData->m_pConn->m_pStatement->execute("SET @prev := NULL;");
+			pData->m_pConn->m_pStatement->execute("SET @previd := NULL;");
+			pData->m_pConn->m_pStatement->execute("SET @rank := 1;");
+			pData->m_pConn->m_pStatement->execute("SET @pos := 0;");
 			str_format(aBuf, sizeof(aBuf), "SELECT ID, Name, Time, rank FROM (SELECT r.ID, Name, rank, l.Time FROM ((SELECT ID, rank, Time FROM (SELECT ID, (@pos := IF(@previd = ID,@pos,@pos+1)) pos, (@previd := ID), (@rank := IF(@prev = Time,@rank,@pos)) rank, (@prev := Time) Time FROM (SELECT ID, MIN(Time) as Time FROM %s_teamrace WHERE Map = '%s' GROUP BY ID ORDER BY `Time` ASC) as all_top_times) as a LIMIT %d, 5) as l) LEFT JOIN %s_teamrace as r ON l.ID = r.ID ORDER BY Time ASC, r.ID, Name ASC) as a;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_Num-1, pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
 			// show teamtop5
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "------- Team Top 5 -------");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "------- Team Top 5 -------");
 
-			int Rows = pData->m_pSqlData->m_pResults->rowsCount();
+			int Rows = pData->m_pConn->m_pResults->rowsCount();
 
 			if (Rows >= 1) {
 				char aID[17];
@@ -902,52 +1913,52 @@ void CSqlScore::ShowTeamTop5Thread(void *pUser)
 				aNames[0] = '\0';
 				aCuts[0] = -1;
 
-				pData->m_pSqlData->m_pResults->first();
-				strcpy(aID, pData->m_pSqlData->m_pResults->getString("ID").c_str());
+				pData->m_pConn->m_pResults->first();
+				strcpy(aID, pData->m_pConn->m_pResults->getString("ID").c_str());
 				for(int Row = 0; Row < Rows; Row++)
 				{
-					strcpy(aID2, pData->m_pSqlData->m_pResults->getString("ID").c_str());
+					strcpy(aID2, pData->m_pConn->m_pResults->getString("ID").c_str());
 					if (str_comp(aID, aID2) != 0)
 					{
 						strcpy(aID, aID2);
 						aCuts[CutPos++] = Row - 1;
 					}
-					pData->m_pSqlData->m_pResults->next();
+					pData->m_pConn->m_pResults->next();
 				}
 				aCuts[CutPos] = Rows - 1;
 
 				CutPos = 0;
-				pData->m_pSqlData->m_pResults->first();
+				pData->m_pConn->m_pResults->first();
 				for(int Row = 0; Row < Rows; Row++)
 				{
-					strcat(aNames, pData->m_pSqlData->m_pResults->getString("Name").c_str());
+					strcat(aNames, pData->m_pConn->m_pResults->getString("Name").c_str());
 
 					if (Row < aCuts[CutPos] - 1)
 						strcat(aNames, ", ");
 					else if (Row < aCuts[CutPos])
 						strcat(aNames, " & ");
 
-					Time = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
-					Rank = (float)pData->m_pSqlData->m_pResults->getInt("rank");
+					Time = (float)pData->m_pConn->m_pResults->getDouble("Time");
+					Rank = (float)pData->m_pConn->m_pResults->getInt("rank");
 
 					if (Row == aCuts[CutPos])
 					{
 						str_format(aBuf, sizeof(aBuf), "%d. %s Team Time: %02d:%05.2f", Rank, aNames, (int)(Time/60), Time-((int)Time/60*60));
-						pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+						pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 						CutPos++;
 						aNames[0] = '\0';
 					}
 
-					pData->m_pSqlData->m_pResults->next();
+					pData->m_pConn->m_pResults->next();
 				}
 			}
 
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "-------------------------------");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "-------------------------------");
 
 			dbg_msg("SQL", "Showing teamtop5 done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -958,22 +1969,18 @@ void CSqlScore::ShowTeamTop5Thread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
-void CSqlScore::ShowRankThread(void *pUser)
+void CSqlScore::ShowRankThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
@@ -985,40 +1992,40 @@ void CSqlScore::ShowRankThread(void *pUser)
 			// check sort methode
 			char aBuf[600];
 
-			pData->m_pSqlData->m_pStatement->execute("SET @prev := NULL;");
-			pData->m_pSqlData->m_pStatement->execute("SET @rank := 1;");
-			pData->m_pSqlData->m_pStatement->execute("SET @pos := 0;");
+			pData->m_pConn->m_pStatement->execute("SET @prev := NULL;");
+			pData->m_pConn->m_pStatement->execute("SET @rank := 1;");
+			pData->m_pConn->m_pStatement->execute("SET @pos := 0;");
 			str_format(aBuf, sizeof(aBuf), "SELECT Rank, Name, Time FROM (SELECT Name, (@pos := @pos+1) pos, (@rank := IF(@prev = Time,@rank, @pos)) rank, (@prev := Time) Time FROM (SELECT Name, min(Time) as Time FROM %s_race WHERE Map = '%s' GROUP BY Name ORDER BY `Time` ASC) as a) as b WHERE Name = '%s';", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_aName);
 
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			if(pData->m_pSqlData->m_pResults->rowsCount() != 1)
+			if(pData->m_pConn->m_pResults->rowsCount() != 1)
 			{
 				str_format(aBuf, sizeof(aBuf), "%s is not ranked", originalName);
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 			}
 			else
 			{
-				pData->m_pSqlData->m_pResults->next();
+				pData->m_pConn->m_pResults->next();
 
-				float Time = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
-				int Rank = (int)pData->m_pSqlData->m_pResults->getInt("Rank");
+				float Time = (float)pData->m_pConn->m_pResults->getDouble("Time");
+				int Rank = (int)pData->m_pConn->m_pResults->getInt("Rank");
 				if(g_Config.m_SvHideScore)
 				{
 					str_format(aBuf, sizeof(aBuf), "Your time: %02d:%05.2f", (int)(Time/60), Time-((int)Time/60*60));
-					pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+					pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 				}
 				else
 				{
-					str_format(aBuf, sizeof(aBuf), "%d. %s Time: %02d:%05.2f, requested by %s", Rank, pData->m_pSqlData->m_pResults->getString("Name").c_str(), (int)(Time/60), Time-((int)Time/60*60), pData->m_aRequestingPlayer);
-					pData->m_pSqlData->GameServer()->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
+					str_format(aBuf, sizeof(aBuf), "%d. %s Time: %02d:%05.2f, requested by %s", Rank, pData->m_pConn->m_pResults->getString("Name").c_str(), (int)(Time/60), Time-((int)Time/60*60), pData->m_aRequestingPlayer);
+					pData->m_pSqlData->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
 				}
 			}
 
 			dbg_msg("SQL", "Showing rank done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1029,16 +2036,41 @@ void CSqlScore::ShowRankThread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::ShowTeamRank(int ClientID, const char* pName, bool Search)
 {
+	if(UseRankCache())
+	{
+		char aBuf[2400];
+		int Team = m_pRankCache->FindTeam(pName);
+		if(Team < 0)
+		{
+			str_format(aBuf, sizeof(aBuf), "%s has no team ranks", pName);
+			GameServer()->SendChatTarget(ClientID, aBuf);
+			return;
+		}
+
+		char aNames[2300];
+		FormatTeamNames(m_pRankCache, Team, aNames, sizeof(aNames));
+		float Time = m_pRankCache->TeamTime(Team);
+		if(g_Config.m_SvHideScore)
+		{
+			str_format(aBuf, sizeof(aBuf), "Your team time: %02d:%05.02f", (int)(Time/60), Time-((int)Time/60*60));
+			GameServer()->SendChatTarget(ClientID, aBuf);
+		}
+		else
+		{
+			str_format(aBuf, sizeof(aBuf), "%d. %s Team time: %02d:%05.02f, requested by %s", m_pRankCache->TeamRank(Team), aNames, (int)(Time/60), Time-((int)Time/60*60), Server()->ClientName(ClientID));
+			GameServer()->SendChat(-1, CGameContext::CHAT_ALL, aBuf, ClientID);
+		}
+		return;
+	}
+
 	CSqlScoreData *Tmp = new CSqlScoreData();
 	Tmp->m_ClientID = ClientID;
 	str_copy(Tmp->m_aName, pName, MAX_NAME_LENGTH);
@@ -1046,12 +2078,34 @@ void CSqlScore::ShowTeamRank(int ClientID, const char* pName, bool Search)
 	str_format(Tmp->m_aRequestingPlayer, sizeof(Tmp->m_aRequestingPlayer), "%s", Server()->ClientName(ClientID));
 	Tmp->m_pSqlData = this;
 
-	void *TeamRankThread = thread_init(ShowTeamRankThread, Tmp);
-	thread_detach(TeamRankThread);
+	Queue(ShowTeamRankThread, Tmp, SQLJOB_QUERY);
 }
 
 void CSqlScore::ShowRank(int ClientID, const char* pName, bool Search)
 {
+	if(UseRankCache())
+	{
+		char aBuf[600];
+		float Time;
+		int Rank;
+		if(!m_pRankCache->FindTime(pName, &Time, &Rank))
+		{
+			str_format(aBuf, sizeof(aBuf), "%s is not ranked", pName);
+			GameServer()->SendChatTarget(ClientID, aBuf);
+		}
+		else if(g_Config.m_SvHideScore)
+		{
+			str_format(aBuf, sizeof(aBuf), "Your time: %02d:%05.2f", (int)(Time/60), Time-((int)Time/60*60));
+			GameServer()->SendChatTarget(ClientID, aBuf);
+		}
+		else
+		{
+			str_format(aBuf, sizeof(aBuf), "%d. %s Time: %02d:%05.2f, requested by %s", Rank, pName, (int)(Time/60), Time-((int)Time/60*60), Server()->ClientName(ClientID));
+			GameServer()->SendChat(-1, CGameContext::CHAT_ALL, aBuf, ClientID);
+		}
+		return;
+	}
+
 	CSqlScoreData *Tmp = new CSqlScoreData();
 	Tmp->m_ClientID = ClientID;
 	str_copy(Tmp->m_aName, pName, MAX_NAME_LENGTH);
@@ -1059,48 +2113,45 @@ void CSqlScore::ShowRank(int ClientID, const char* pName, bool Search)
 	str_format(Tmp->m_aRequestingPlayer, sizeof(Tmp->m_aRequestingPlayer), "%s", Server()->ClientName(ClientID));
 	Tmp->m_pSqlData = this;
 
-	void *RankThread = thread_init(ShowRankThread, Tmp);
-	thread_detach(RankThread);
+	Queue(ShowRankThread, Tmp, SQLJOB_QUERY);
 }
 
-void CSqlScore::ShowTop5Thread(void *pUser)
+void CSqlScore::ShowTop5Thread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
 			// check sort methode
 			char aBuf[512];
-			pData->m_pSqlData->m_pStatement->execute("SET @prev := NULL;");
-			pData->m_pSqlData->m_pStatement->execute("SET @rank := 1;");
-			pData->m_pSqlData->m_pStatement->execute("SET @pos := 0;");
+			pData->m_pConn->m_pStatement->execute("SET @prev := NULL;");
+			pData->m_pConn->m_pStatement->execute("SET @rank := 1;");
+			pData->m_pConn->m_pStatement->execute("SET @pos := 0;");
 			str_format(aBuf, sizeof(aBuf), "SELECT Name, Time, rank FROM (SELECT Name, (@pos := @pos+1) pos, (@rank := IF(@prev = Time,@rank, @pos)) rank, (@prev := Time) Time FROM (SELECT Name, min(Time) as Time FROM %s_race WHERE Map = '%s' GROUP BY Name ORDER BY `Time` ASC) as a) as b LIMIT %d, 5;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_Num-1);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
 			// show top5
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "----------- Top 5 -----------");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "----------- Top 5 -----------");
 
 			int Rank = 0;
 			float Time = 0;
-			while(pData->m_pSqlData->m_pResults->next())
+			while(pData->m_pConn->m_pResults->next())
 			{
-				Time = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
-				Rank = (float)pData->m_pSqlData->m_pResults->getInt("rank");
-				str_format(aBuf, sizeof(aBuf), "%d. %s Time: %02d:%05.2f", Rank, pData->m_pSqlData->m_pResults->getString("Name").c_str(), (int)(Time/60), Time-((int)Time/60*60));
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+				Time = (float)pData->m_pConn->m_pResults->getDouble("Time");
+				Rank = (float)pData->m_pConn->m_pResults->getInt("rank");
+				str_format(aBuf, sizeof(aBuf), "%d. %s Time: %02d:%05.2f", Rank, pData->m_pConn->m_pResults->getString("Name").c_str(), (int)(Time/60), Time-((int)Time/60*60));
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 				//Rank++;
 			}
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "-------------------------------");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "-------------------------------");
 
 			dbg_msg("SQL", "Showing top5 done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1111,21 +2162,18 @@ void CSqlScore::ShowTop5Thread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
-void CSqlScore::ShowTimesThread(void *pUser)
+void CSqlScore::ShowTimesThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
@@ -1140,28 +2188,28 @@ void CSqlScore::ShowTimesThread(void *pUser)
 			else// last 5 times of server
 				str_format(aBuf, sizeof(aBuf), "SELECT Name, Time, UNIX_TIMESTAMP(CURRENT_TIMESTAMP)-UNIX_TIMESTAMP(Timestamp) as Ago, UNIX_TIMESTAMP(Timestamp) as Stamp FROM %s_race WHERE Map = '%s' ORDER BY Ago ASC LIMIT %d, 5;", pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_aMap, pData->m_Num-1);
 
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
 			// show top5
-			if(pData->m_pSqlData->m_pResults->rowsCount() == 0)
+			if(pData->m_pConn->m_pResults->rowsCount() == 0)
 			{
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "There are no times in the specified range");
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "There are no times in the specified range");
 				goto end;
 			}
 
-			str_format(aBuf, sizeof(aBuf), "------------ Last Times No %d - %d ------------",pData->m_Num,pData->m_Num + pData->m_pSqlData->m_pResults->rowsCount() - 1);
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+			str_format(aBuf, sizeof(aBuf), "------------ Last Times No %d - %d ------------",pData->m_Num,pData->m_Num + pData->m_pConn->m_pResults->rowsCount() - 1);
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 
 			float pTime = 0;
 			int pSince = 0;
 			int pStamp = 0;
 
-			while(pData->m_pSqlData->m_pResults->next())
+			while(pData->m_pConn->m_pResults->next())
 			{
 				char pAgoString[40] = "\0";
-				pSince = (int)pData->m_pSqlData->m_pResults->getInt("Ago");
-				pStamp = (int)pData->m_pSqlData->m_pResults->getInt("Stamp");
-				pTime = (float)pData->m_pSqlData->m_pResults->getDouble("Time");
+				pSince = (int)pData->m_pConn->m_pResults->getInt("Ago");
+				pStamp = (int)pData->m_pConn->m_pResults->getInt("Stamp");
+				pTime = (float)pData->m_pConn->m_pResults->getDouble("Time");
 
 				agoTimeToString(pSince,pAgoString);
 
@@ -1175,18 +2223,18 @@ void CSqlScore::ShowTimesThread(void *pUser)
 				else // last 5 times of the server
 				{
 					if(pStamp == 0) // stamp is 00:00:00 cause it's an old entry from old times where there where no stamps yet
-						str_format(aBuf, sizeof(aBuf), "%s, %02d:%05.02f s, don't know when", pData->m_pSqlData->m_pResults->getString("Name").c_str(), (int)(pTime/60), pTime-((int)pTime/60*60));
+						str_format(aBuf, sizeof(aBuf), "%s, %02d:%05.02f s, don't know when", pData->m_pConn->m_pResults->getString("Name").c_str(), (int)(pTime/60), pTime-((int)pTime/60*60));
 					else
-						str_format(aBuf, sizeof(aBuf), "%s, %s ago, %02d:%05.02f s", pData->m_pSqlData->m_pResults->getString("Name").c_str(), pAgoString, (int)(pTime/60), pTime-((int)pTime/60*60));
+						str_format(aBuf, sizeof(aBuf), "%s, %s ago, %02d:%05.02f s", pData->m_pConn->m_pResults->getString("Name").c_str(), pAgoString, (int)(pTime/60), pTime-((int)pTime/60*60));
 				}
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 			}
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "----------------------------------------------------");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "----------------------------------------------------");
 
 			dbg_msg("SQL", "Showing times done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1197,33 +2245,60 @@ void CSqlScore::ShowTimesThread(void *pUser)
 		}
 		end:
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::ShowTeamTop5(IConsole::IResult *pResult, int ClientID, void *pUserData, int Debut)
 {
+	if(UseRankCache())
+	{
+		char aBuf[2400];
+		char aNames[2300];
+		GameServer()->SendChatTarget(ClientID, "------- Team Top 5 -------");
+		for(int Pos = max(Debut-1, 0); Pos < Debut+4 && Pos < m_pRankCache->NumTeams(); Pos++)
+		{
+			int Team = m_pRankCache->TeamAt(Pos);
+			float Time = m_pRankCache->TeamTime(Team);
+			FormatTeamNames(m_pRankCache, Team, aNames, sizeof(aNames));
+			str_format(aBuf, sizeof(aBuf), "%d. %s Team Time: %02d:%05.2f", m_pRankCache->TeamRank(Team), aNames, (int)(Time/60), Time-((int)Time/60*60));
+			GameServer()->SendChatTarget(ClientID, aBuf);
+		}
+		GameServer()->SendChatTarget(ClientID, "-------------------------------");
+		return;
+	}
+
 	CSqlScoreData *Tmp = new CSqlScoreData();
 	Tmp->m_Num = Debut;
 	Tmp->m_ClientID = ClientID;
 	Tmp->m_pSqlData = this;
 
-	void *TeamTop5Thread = thread_init(ShowTeamTop5Thread, Tmp);
-	thread_detach(TeamTop5Thread);
+	Queue(ShowTeamTop5Thread, Tmp, SQLJOB_QUERY);
 }
 
 void CSqlScore::ShowTop5(IConsole::IResult *pResult, int ClientID, void *pUserData, int Debut)
 {
+	if(UseRankCache())
+	{
+		char aBuf[512];
+		GameServer()->SendChatTarget(ClientID, "----------- Top 5 -----------");
+		for(int Pos = max(Debut-1, 0); Pos < Debut+4 && Pos < m_pRankCache->NumTimes(); Pos++)
+		{
+			float Time = m_pRankCache->TimeAt(Pos);
+			str_format(aBuf, sizeof(aBuf), "%d. %s Time: %02d:%05.2f", m_pRankCache->TimeRank(Pos), m_pRankCache->TimeName(Pos), (int)(Time/60), Time-((int)Time/60*60));
+			GameServer()->SendChatTarget(ClientID, aBuf);
+		}
+		GameServer()->SendChatTarget(ClientID, "-------------------------------");
+		return;
+	}
+
 	CSqlScoreData *Tmp = new CSqlScoreData();
 	Tmp->m_Num = Debut;
 	Tmp->m_ClientID = ClientID;
 	Tmp->m_pSqlData = this;
 
-	void *Top5Thread = thread_init(ShowTop5Thread, Tmp);
-	thread_detach(Top5Thread);
+	Queue(ShowTop5Thread, Tmp, SQLJOB_QUERY);
 }
 
 void CSqlScore::ShowTimes(int ClientID, int Debut)
@@ -1234,8 +2309,7 @@ void CSqlScore::ShowTimes(int ClientID, int Debut)
 	Tmp->m_pSqlData = this;
 	Tmp->m_Search = false;
 
-	void *TimesThread = thread_init(ShowTimesThread, Tmp);
-	thread_detach(TimesThread);
+	Queue(ShowTimesThread, Tmp, SQLJOB_QUERY);
 }
 
 void CSqlScore::ShowTimes(int ClientID, const char* pName, int Debut)
@@ -1247,8 +2321,7 @@ void CSqlScore::ShowTimes(int ClientID, const char* pName, int Debut)
 	Tmp->m_pSqlData = this;
 	Tmp->m_Search = true;
 
-	void *TimesThread = thread_init(ShowTimesThread, Tmp);
-	thread_detach(TimesThread);
+	Queue(ShowTimesThread, Tmp, SQLJOB_QUERY);
 }
 
 void CSqlScore::FuzzyString(char *pString)
@@ -1382,14 +2455,12 @@ void CSqlScore::agoTimeToString(int agoTime, char agoString[])
 	}
 }
 
-void CSqlScore::ShowPointsThread(void *pUser)
+void CSqlScore::ShowPointsThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
@@ -1398,32 +2469,32 @@ void CSqlScore::ShowPointsThread(void *pUser)
 			strcpy(originalName,pData->m_aName);
 			pData->m_pSqlData->ClearString(pData->m_aName);
 
-			pData->m_pSqlData->m_pStatement->execute("SET @prev := NULL;");
-			pData->m_pSqlData->m_pStatement->execute("SET @rank := 1;");
-			pData->m_pSqlData->m_pStatement->execute("SET @pos := 0;");
+			pData->m_pConn->m_pStatement->execute("SET @prev := NULL;");
+			pData->m_pConn->m_pStatement->execute("SET @rank := 1;");
+			pData->m_pConn->m_pStatement->execute("SET @pos := 0;");
 
 			char aBuf[512];
 			str_format(aBuf, sizeof(aBuf), "select Rank, Name, Points from (select (@pos := @pos+1) pos, (@rank := IF(@prev = Points,@rank,@pos)) Rank, Points, Name from (select (@prev := Points) Points, Name from %s_points order by Points desc) as ll) as l where Name = '%s';", pData->m_pSqlData->m_pPrefix, pData->m_aName);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			if(pData->m_pSqlData->m_pResults->rowsCount() != 1)
+			if(pData->m_pConn->m_pResults->rowsCount() != 1)
 			{
 				str_format(aBuf, sizeof(aBuf), "%s has not collected any points so far", originalName);
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 			}
 			else
 			{
-				pData->m_pSqlData->m_pResults->next();
-				int count = (int)pData->m_pSqlData->m_pResults->getInt("Points");
-				int rank = (int)pData->m_pSqlData->m_pResults->getInt("rank");
-				str_format(aBuf, sizeof(aBuf), "%d. %s Points: %d, requested by %s", rank, pData->m_pSqlData->m_pResults->getString("Name").c_str(), count, pData->m_aRequestingPlayer);
-				pData->m_pSqlData->GameServer()->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
+				pData->m_pConn->m_pResults->next();
+				int count = (int)pData->m_pConn->m_pResults->getInt("Points");
+				int rank = (int)pData->m_pConn->m_pResults->getInt("rank");
+				str_format(aBuf, sizeof(aBuf), "%d. %s Points: %d, requested by %s", rank, pData->m_pConn->m_pResults->getString("Name").c_str(), count, pData->m_aRequestingPlayer);
+				pData->m_pSqlData->SendChat(-1, CGameContext::CHAT_ALL, aBuf, pData->m_ClientID);
 			}
 
 			dbg_msg("SQL", "Showing points done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1434,16 +2505,32 @@ void CSqlScore::ShowPointsThread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::ShowPoints(int ClientID, const char* pName, bool Search)
 {
+	if(UseRankCache())
+	{
+		char aBuf[512];
+		int Points;
+		int Rank;
+		if(!m_pRankCache->FindPoints(pName, &Points, &Rank))
+		{
+			str_format(aBuf, sizeof(aBuf), "%s has not collected any points so far", pName);
+			GameServer()->SendChatTarget(ClientID, aBuf);
+		}
+		else
+		{
+			str_format(aBuf, sizeof(aBuf), "%d. %s Points: %d, requested by %s", Rank, pName, Points, Server()->ClientName(ClientID));
+			GameServer()->SendChat(-1, CGameContext::CHAT_ALL, aBuf, ClientID);
+		}
+		return;
+	}
+
 	CSqlScoreData *Tmp = new CSqlScoreData();
 	Tmp->m_ClientID = ClientID;
 	str_copy(Tmp->m_aName, pName, MAX_NAME_LENGTH);
@@ -1451,43 +2538,40 @@ void CSqlScore::ShowPoints(int ClientID, const char* pName, bool Search)
 	str_format(Tmp->m_aRequestingPlayer, sizeof(Tmp->m_aRequestingPlayer), "%s", Server()->ClientName(ClientID));
 	Tmp->m_pSqlData = this;
 
-	void *PointsThread = thread_init(ShowPointsThread, Tmp);
-	thread_detach(PointsThread);
+	Queue(ShowPointsThread, Tmp, SQLJOB_QUERY);
 }
 
-void CSqlScore::ShowTopPointsThread(void *pUser)
+void CSqlScore::ShowTopPointsThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
 			char aBuf[512];
-			pData->m_pSqlData->m_pStatement->execute("SET @prev := NULL;");
-			pData->m_pSqlData->m_pStatement->execute("SET @rank := 1;");
-			pData->m_pSqlData->m_pStatement->execute("SET @pos := 0;");
+			pData->m_pConn->m_pStatement->execute("SET @prev := NULL;");
+			pData->m_pConn->m_pStatement->execute("SET @rank := 1;");
+			pData->m_pConn->m_pStatement->execute("SET @pos := 0;");
 			str_format(aBuf, sizeof(aBuf), "select Rank, Name, Points from (select (@pos := @pos+1) pos, (@rank := IF(@prev = Points,@rank,@pos)) Rank, Points, Name from (select (@prev := Points) Points, Name from %s_points order by Points desc) as ll) as l LIMIT %d, 5;", pData->m_pSqlData->m_pPrefix, pData->m_Num-1);
 
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
 			// show top points
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "-------- Top Points --------");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "-------- Top Points --------");
 
-			while(pData->m_pSqlData->m_pResults->next())
+			while(pData->m_pConn->m_pResults->next())
 			{
-				str_format(aBuf, sizeof(aBuf), "%d. %s Points: %d", pData->m_pSqlData->m_pResults->getInt("rank"), pData->m_pSqlData->m_pResults->getString("Name").c_str(), pData->m_pSqlData->m_pResults->getInt("Points"));
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
+				str_format(aBuf, sizeof(aBuf), "%d. %s Points: %d", pData->m_pConn->m_pResults->getInt("rank"), pData->m_pConn->m_pResults->getString("Name").c_str(), pData->m_pConn->m_pResults->getInt("Points"));
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 			}
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "-------------------------------");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "-------------------------------");
 
 			dbg_msg("SQL", "Showing toppoints done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1498,33 +2582,41 @@ void CSqlScore::ShowTopPointsThread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::ShowTopPoints(IConsole::IResult *pResult, int ClientID, void *pUserData, int Debut)
 {
+	if(UseRankCache())
+	{
+		char aBuf[512];
+		GameServer()->SendChatTarget(ClientID, "-------- Top Points --------");
+		for(int Pos = max(Debut-1, 0); Pos < Debut+4 && Pos < m_pRankCache->NumPoints(); Pos++)
+		{
+			str_format(aBuf, sizeof(aBuf), "%d. %s Points: %d", m_pRankCache->PointsRank(Pos), m_pRankCache->PointsName(Pos), m_pRankCache->PointsAt(Pos));
+			GameServer()->SendChatTarget(ClientID, aBuf);
+		}
+		GameServer()->SendChatTarget(ClientID, "-------------------------------");
+		return;
+	}
+
 	CSqlScoreData *Tmp = new CSqlScoreData();
 	Tmp->m_Num = Debut;
 	Tmp->m_ClientID = ClientID;
 	Tmp->m_pSqlData = this;
 
-	void *TopPointsThread = thread_init(ShowTopPointsThread, Tmp);
-	thread_detach(TopPointsThread);
+	Queue(ShowTopPointsThread, Tmp, SQLJOB_QUERY);
 }
 
-void CSqlScore::RandomMapThread(void *pUser)
+void CSqlScore::RandomMapThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
@@ -1533,26 +2625,26 @@ void CSqlScore::RandomMapThread(void *pUser)
 				str_format(aBuf, sizeof(aBuf), "select * from %s_maps where Server = \"%s\" and Stars = \"%d\" order by RAND() limit 1;", pData->m_pSqlData->m_pPrefix, g_Config.m_SvServerType, pData->m_Num);
 			else
 				str_format(aBuf, sizeof(aBuf), "select * from %s_maps where Server = \"%s\" order by RAND() limit 1;", pData->m_pSqlData->m_pPrefix, g_Config.m_SvServerType);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			if(pData->m_pSqlData->m_pResults->rowsCount() != 1)
+			if(pData->m_pConn->m_pResults->rowsCount() != 1)
 			{
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "No maps found on this server!");
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "No maps found on this server!");
 			}
 			else
 			{
-				pData->m_pSqlData->m_pResults->next();
+				pData->m_pConn->m_pResults->next();
 				char aMap[128];
-				strcpy(aMap, pData->m_pSqlData->m_pResults->getString("Map").c_str());
+				strcpy(aMap, pData->m_pConn->m_pResults->getString("Map").c_str());
 
 				str_format(aBuf, sizeof(aBuf), "change_map \"%s\"", aMap);
-				pData->m_pSqlData->GameServer()->Console()->ExecuteLine(aBuf);
+				pData->m_pSqlData->ExecuteLine(aBuf);
 			}
 
 			dbg_msg("SQL", "Voting random map done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1563,22 +2655,18 @@ void CSqlScore::RandomMapThread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
-void CSqlScore::RandomUnfinishedMapThread(void *pUser)
+void CSqlScore::RandomUnfinishedMapThread(CSqlJob *pJob)
 {
-	lock_wait(gs_SqlLock);
-
-	CSqlScoreData *pData = (CSqlScoreData *)pUser;
+	CSqlScoreData *pData = (CSqlScoreData *)pJob;
 
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
@@ -1591,26 +2679,26 @@ void CSqlScore::RandomUnfinishedMapThread(void *pUser)
 				str_format(aBuf, sizeof(aBuf), "select * from %s_maps where Server = \"%s\" and Stars = \"%d\" and not exists (select * from %s_race where Name = \"%s\" and %s_race.Map = %s_maps.Map) order by RAND() limit 1;", pData->m_pSqlData->m_pPrefix, g_Config.m_SvServerType, pData->m_Num, pData->m_pSqlData->m_pPrefix, pData->m_aName, pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_pPrefix);
 			else
 				str_format(aBuf, sizeof(aBuf), "select * from %s_maps where Server = \"%s\" and not exists (select * from %s_race where Name = \"%s\" and %s_race.Map = %s_maps.Map) order by RAND() limit 1;", pData->m_pSqlData->m_pPrefix, g_Config.m_SvServerType, pData->m_pSqlData->m_pPrefix, pData->m_aName, pData->m_pSqlData->m_pPrefix, pData->m_pSqlData->m_pPrefix);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			if(pData->m_pSqlData->m_pResults->rowsCount() != 1)
+			if(pData->m_pConn->m_pResults->rowsCount() != 1)
 			{
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "You have no unfinished maps on this server!");
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "You have no unfinished maps on this server!");
 			}
 			else
 			{
-				pData->m_pSqlData->m_pResults->next();
+				pData->m_pConn->m_pResults->next();
 				char aMap[128];
-				strcpy(aMap, pData->m_pSqlData->m_pResults->getString("Map").c_str());
+				strcpy(aMap, pData->m_pConn->m_pResults->getString("Map").c_str());
 
 				str_format(aBuf, sizeof(aBuf), "change_map \"%s\"", aMap);
-				pData->m_pSqlData->GameServer()->Console()->ExecuteLine(aBuf);
+				pData->m_pSqlData->ExecuteLine(aBuf);
 			}
 
 			dbg_msg("SQL", "Voting random unfinished map done");
 
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1621,12 +2709,10 @@ void CSqlScore::RandomUnfinishedMapThread(void *pUser)
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 
 	delete pData;
-
-	lock_unlock(gs_SqlLock);
 }
 
 void CSqlScore::RandomMap(int ClientID, int stars)
@@ -1637,8 +2723,7 @@ void CSqlScore::RandomMap(int ClientID, int stars)
 	str_copy(Tmp->m_aName, GameServer()->Server()->ClientName(ClientID), MAX_NAME_LENGTH);
 	Tmp->m_pSqlData = this;
 
-	void *RandomThread = thread_init(RandomMapThread, Tmp);
-	thread_detach(RandomThread);
+	Queue(RandomMapThread, Tmp, SQLJOB_QUERY);
 }
 
 void CSqlScore::RandomUnfinishedMap(int ClientID, int stars)
@@ -1649,17 +2734,16 @@ void CSqlScore::RandomUnfinishedMap(int ClientID, int stars)
 	str_copy(Tmp->m_aName, GameServer()->Server()->ClientName(ClientID), MAX_NAME_LENGTH);
 	Tmp->m_pSqlData = this;
 
-	void *RandomUnfinishedThread = thread_init(RandomUnfinishedMapThread, Tmp);
-	thread_detach(RandomUnfinishedThread);
+	Queue(RandomUnfinishedMapThread, Tmp, SQLJOB_QUERY);
 }
 
 void CSqlScore::SaveTeam(int Team, const char* Code, int ClientID, const char* Server)
 {
-	if((g_Config.m_SvTeam == 3 || (Team > 0 && Team < MAX_CLIENTS)) && ((CGameControllerDDRace*)(GameServer()->m_pController))->m_Teams.Count(Team) > 0)
+	CGameControllerDDRace *pController = (CGameControllerDDRace*)(GameServer()->m_pController);
+	if((g_Config.m_SvTeam == 3 || (Team > 0 && Team < MAX_CLIENTS)) && pController->m_Teams.Count(Team) > 0)
 	{
-		if(((CGameControllerDDRace*)(GameServer()->m_pController))->m_Teams.GetSaving(Team))
+		if(pController->m_Teams.GetSaving(Team))
 			return;
-		((CGameControllerDDRace*)(GameServer()->m_pController))->m_Teams.SetSaving(Team, true);
 	}
 	else
 	{
@@ -1667,90 +2751,81 @@ void CSqlScore::SaveTeam(int Team, const char* Code, int ClientID, const char* S
 		return;
 	}
 
+	// take the snapshot here, the world must not change while it is read
+	CSaveTeam SavedTeam(pController);
+	switch(SavedTeam.save(Team))
+	{
+		case 0:
+			break;
+		case 1:
+			GameServer()->SendChatTarget(ClientID, "You have to be in a Team (from 1-63)");
+			return;
+		case 2:
+			GameServer()->SendChatTarget(ClientID, "Could not find your Team");
+			return;
+		case 3:
+			GameServer()->SendChatTarget(ClientID, "Unable to find all Characters");
+			return;
+		case 4:
+			GameServer()->SendChatTarget(ClientID, "Your team is not started yet");
+			return;
+	}
+
+	static char s_aTeamString[65536];
+	str_copy(s_aTeamString, SavedTeam.GetString(), sizeof(s_aTeamString));
+	ClearString(s_aTeamString, sizeof(s_aTeamString));
+
+	pController->m_Teams.SetSaving(Team, true);
+
 	CSqlTeamSave *Tmp = new CSqlTeamSave();
 	Tmp->m_Team = Team;
 	Tmp->m_ClientID = ClientID;
 	str_copy(Tmp->m_Code, Code, 32);
 	str_copy(Tmp->m_Server, Server, sizeof(Tmp->m_Server));
+	Tmp->m_Savegame = s_aTeamString;
 	Tmp->m_pSqlData = this;
 
-	void *SaveThread = thread_init(SaveTeamThread, Tmp);
-	thread_detach(SaveThread);
+	Queue(SaveTeamThread, Tmp, SQLJOB_SAVE);
 }
 
-void CSqlScore::SaveTeamThread(void *pUser)
+void CSqlScore::SaveTeamThread(CSqlJob *pJob)
 {
-	CSaveTeam* SavedTeam = 0;
-	CSqlTeamSave *pData = (CSqlTeamSave *)pUser;
+	CSqlTeamSave *pData = (CSqlTeamSave *)pJob;
 
-	char TeamString[65536];
-	int Team = pData->m_Team;
 	char OriginalCode[32];
 	str_copy(OriginalCode, pData->m_Code, sizeof(OriginalCode));
 	pData->m_pSqlData->ClearString(pData->m_Code, sizeof(pData->m_Code));
 	char Map[128];
-	str_copy(Map, g_Config.m_SvMap, 128);
+	str_copy(Map, pData->m_pSqlData->m_aMapName, 128);
 	pData->m_pSqlData->ClearString(Map, sizeof(Map));
 
-	int Num = -1;
-
-	if((g_Config.m_SvTeam == 3 || (Team > 0 && Team < MAX_CLIENTS)) && ((CGameControllerDDRace*)(pData->m_pSqlData->GameServer()->m_pController))->m_Teams.Count(Team) > 0)
-	{
-		SavedTeam = new CSaveTeam(pData->m_pSqlData->GameServer()->m_pController);
-		Num = SavedTeam->save(Team);
-		switch (Num)
-		{
-			case 1:
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "You have to be in a Team (from 1-63)");
-				break;
-			case 2:
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "Could not find your Team");
-				break;
-			case 3:
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "Unable to find all Characters");
-				break;
-			case 4:
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "Your team is not started yet");
-				break;
-		}
-		if(!Num)
-		{
-			str_copy(TeamString, SavedTeam->GetString(), sizeof(TeamString));
-			pData->m_pSqlData->ClearString(TeamString, sizeof(TeamString));
-		}
-	}
-	else
-		pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "You have to be in a Team (from 1-63)");
+	bool Saved = false;
 
-	lock_wait(gs_SqlLock);
 	// Connect to database
-	if(!Num && pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
 			char aBuf[512];
 			str_format(aBuf, sizeof(aBuf), "select Savegame from %s_saves where Code = '%s' and Map = '%s';",  pData->m_pSqlData->m_pPrefix, pData->m_Code, Map);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			if (pData->m_pSqlData->m_pResults->rowsCount() == 0)
+			if (pData->m_pConn->m_pResults->rowsCount() == 0)
 			{
 				// delete results and statement
-				delete pData->m_pSqlData->m_pResults;
+				delete pData->m_pConn->m_pResults;
 
 				char aBuf[65536];
-				str_format(aBuf, sizeof(aBuf), "INSERT IGNORE INTO %s_saves(Savegame, Map, Code, Timestamp, Server) VALUES ('%s', '%s', '%s', CURRENT_TIMESTAMP(), '%s')",  pData->m_pSqlData->m_pPrefix, TeamString, Map, pData->m_Code, pData->m_Server);
+				str_format(aBuf, sizeof(aBuf), "INSERT IGNORE INTO %s_saves(Savegame, Map, Code, Timestamp, Server) VALUES ('%s', '%s', '%s', CURRENT_TIMESTAMP(), '%s')",  pData->m_pSqlData->m_pPrefix, pData->m_Savegame.c_str(), Map, pData->m_Code, pData->m_Server);
 				dbg_msg("SQL", aBuf);
-				pData->m_pSqlData->m_pStatement->execute(aBuf);
-
-				char aBuf2[256];
-				str_format(aBuf2, sizeof(aBuf2), "Team successfully saved. Use '/load %s' to continue", OriginalCode);
-				pData->m_pSqlData->GameServer()->SendChatTeam(Team, aBuf2);
-				((CGameControllerDDRace*)(pData->m_pSqlData->GameServer()->m_pController))->m_Teams.KillSavedTeam(Team);
+				pData->m_pConn->m_pStatement->execute(aBuf);
+				Saved = true;
 			}
 			else
 			{
+				delete pData->m_pConn->m_pResults;
 				dbg_msg("SQL", "ERROR: This save-code already exists");
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "This save-code already exists");
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "This save-code already exists");
 			}
 		}
 		catch (sql::SQLException &e)
@@ -1759,25 +2834,40 @@ void CSqlScore::SaveTeamThread(void *pUser)
 			str_format(aBuf2, sizeof(aBuf2), "MySQL Error: %s", e.what());
 			dbg_msg("SQL", aBuf2);
 			dbg_msg("SQL", "ERROR: Could not save the team");
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "MySQL Error: Could not save the team");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "MySQL Error: Could not save the team");
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
-	else if(!Num)
+	else
 	{
 		dbg_msg("SQL", "connection failed");
-		pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "ERROR: Unable to connect to SQL-Server");
+		pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "ERROR: Unable to connect to SQL-Server");
 	}
 
-	((CGameControllerDDRace*)(pData->m_pSqlData->GameServer()->m_pController))->m_Teams.SetSaving(Team, false);
+	// the team is killed and released on the game thread
+	CSqlResult Result;
+	Result.m_Type = Saved ? SQLRESULT_TEAM_SAVED : SQLRESULT_TEAM_SAVE_FAILED;
+	Result.m_ClientID = pData->m_ClientID;
+	Result.m_Team = pData->m_Team;
+	str_copy(Result.m_aText, OriginalCode, sizeof(Result.m_aText));
+	pData->m_pSqlData->PostResult(Result);
 
 	delete pData;
-	if(SavedTeam)
-		delete SavedTeam;
+}
 
-	lock_unlock(gs_SqlLock);
+void CSqlScore::OnTeamSaved(const CSqlResult *pResult, bool Success)
+{
+	CGameControllerDDRace *pController = (CGameControllerDDRace*)(GameServer()->m_pController);
+	if(Success)
+	{
+		char aBuf[256];
+		str_format(aBuf, sizeof(aBuf), "Team successfully saved. Use '/load %s' to continue", pResult->m_aText);
+		GameServer()->SendChatTeam(pResult->m_Team, aBuf);
+		pController->m_Teams.KillSavedTeam(pResult->m_Team);
+	}
+	pController->m_Teams.SetSaving(pResult->m_Team, false);
 }
 
 void CSqlScore::LoadTeam(const char* Code, int ClientID)
@@ -1787,118 +2877,62 @@ void CSqlScore::LoadTeam(const char* Code, int ClientID)
 	Tmp->m_ClientID = ClientID;
 	Tmp->m_pSqlData = this;
 
-	void *LoadThread = thread_init(LoadTeamThread, Tmp);
-	thread_detach(LoadThread);
+	Queue(LoadTeamThread, Tmp, SQLJOB_LOAD);
 }
 
-void CSqlScore::LoadTeamThread(void *pUser)
+void CSqlScore::LoadTeamThread(CSqlJob *pJob)
 {
-	CSaveTeam* SavedTeam;
-	CSqlTeamLoad *pData = (CSqlTeamLoad *)pUser;
-
-	SavedTeam = new CSaveTeam(pData->m_pSqlData->GameServer()->m_pController);
+	CSqlTeamLoad *pData = (CSqlTeamLoad *)pJob;
 
 	pData->m_pSqlData->ClearString(pData->m_Code, sizeof(pData->m_Code));
 	char Map[128];
-	str_copy(Map, g_Config.m_SvMap, 128);
+	str_copy(Map, pData->m_pSqlData->m_aMapName, 128);
 	pData->m_pSqlData->ClearString(Map, sizeof(Map));
-	int Num;
 
-	lock_wait(gs_SqlLock);
 	// Connect to database
-	if(pData->m_pSqlData->Connect())
+	if(pData->m_pConn->Connect())
 	{
 		try
 		{
 			char aBuf[768];
 			str_format(aBuf, sizeof(aBuf), "select Savegame, Server, UNIX_TIMESTAMP(CURRENT_TIMESTAMP)-UNIX_TIMESTAMP(Timestamp) as Ago from %s_saves where Code = '%s' and Map = '%s';",  pData->m_pSqlData->m_pPrefix, pData->m_Code, Map);
-			pData->m_pSqlData->m_pResults = pData->m_pSqlData->m_pStatement->executeQuery(aBuf);
+			pData->m_pConn->m_pResults = pData->m_pConn->m_pStatement->executeQuery(aBuf);
 
-			if (pData->m_pSqlData->m_pResults->rowsCount() > 0)
+			if (pData->m_pConn->m_pResults->rowsCount() > 0)
 			{
-				pData->m_pSqlData->m_pResults->first();
+				pData->m_pConn->m_pResults->first();
 				char ServerName[5];
-				str_copy(ServerName, pData->m_pSqlData->m_pResults->getString("Server").c_str(), sizeof(ServerName));
+				str_copy(ServerName, pData->m_pConn->m_pResults->getString("Server").c_str(), sizeof(ServerName));
+				int since = (int)pData->m_pConn->m_pResults->getInt("Ago");
+
 				if(str_comp(ServerName, g_Config.m_SvSqlServerName))
 				{
 					str_format(aBuf, sizeof(aBuf), "You have to be on the '%s' server to load this savegame", ServerName);
-					pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
-					goto end;
+					pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 				}
-
-				pData->m_pSqlData->m_pResults->getInt("Ago");
-				int since = (int)pData->m_pSqlData->m_pResults->getInt("Ago");
-
-				if(since < g_Config.m_SvSaveGamesDelay)
+				else if(since < g_Config.m_SvSaveGamesDelay)
 				{
 					str_format(aBuf, sizeof(aBuf), "You have to wait %d seconds until you can load this savegame", g_Config.m_SvSaveGamesDelay - since);
-					pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
-					goto end;
+					pData->m_pSqlData->SendChatTarget(pData->m_ClientID, aBuf);
 				}
-
-				Num = SavedTeam->LoadString(pData->m_pSqlData->m_pResults->getString("Savegame").c_str());
-
-				if(Num)
-					pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "Unable to load savegame: data corrupted");
 				else
 				{
-
-					bool found = false;
-					for (int i = 0; i < SavedTeam->GetMembersCount(); i++)
-					{
-						if(str_comp(SavedTeam->SavedTees[i].GetName(), pData->m_pSqlData->Server()->ClientName(pData->m_ClientID)) == 0)
-						{ found = true; break; }
-					}
-					if (!found)
-						pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "You don't belong to this team");
-					else
-					{
-
-						int n;
-						for(n = 1; n<64; n++)
-						{
-							if(((CGameControllerDDRace*)(pData->m_pSqlData->GameServer()->m_pController))->m_Teams.Count(n) == 0)
-								break;
-						}
-
-						if(((CGameControllerDDRace*)(pData->m_pSqlData->GameServer()->m_pController))->m_Teams.Count(n) > 0)
-						{
-							n = ((CGameControllerDDRace*)(pData->m_pSqlData->GameServer()->m_pController))->m_Teams.m_Core.Team(pData->m_ClientID); // if all Teams are full your the only one in your team
-						}
-
-						Num = SavedTeam->load(n);
-
-						if(Num == 1)
-						{
-							pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "You have to be in a team (from 1-63)");
-						}
-						else if(Num >= 10 && Num < 100)
-						{
-							char aBuf[256];
-							str_format(aBuf, sizeof(aBuf), "Unable to find player: '%s'", SavedTeam->SavedTees[Num-10].GetName());
-							pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
-						}
-						else if(Num >= 100)
-						{
-							char aBuf[256];
-							str_format(aBuf, sizeof(aBuf), "%s is racing right now, Team can't be loaded if a Tee is racing already", SavedTeam->SavedTees[Num-100].GetName());
-							pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, aBuf);
-						}
-						else
-						{
-							pData->m_pSqlData->GameServer()->SendChatTeam(n, "Loading successfully done");
-							char aBuf[512];
-							str_format(aBuf, sizeof(aBuf), "DELETE from %s_saves where Code='%s' and Map='%s';", pData->m_pSqlData->m_pPrefix, pData->m_Code, Map);
-							pData->m_pSqlData->m_pStatement->execute(aBuf);
-						}
-					}
+					// the team is placed on the game thread, workers would race for a free team
+					std::string Savegame = pData->m_pConn->m_pResults->getString("Savegame");
+					CSqlResult Result;
+					Result.m_Type = SQLRESULT_TEAM_LOAD;
+					Result.m_ClientID = pData->m_ClientID;
+					Result.m_pSavegame = (char *)mem_alloc(Savegame.size() + 1, 1);
+					mem_copy(Result.m_pSavegame, Savegame.c_str(), Savegame.size() + 1);
+					str_copy(Result.m_aText, pData->m_Code, sizeof(Result.m_aText));
+					pData->m_pSqlData->PostResult(Result);
 				}
 			}
 			else
-				pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "No such savegame for this map");
-			end:
+				pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "No such savegame for this map");
+
 			// delete results and statement
-			delete pData->m_pSqlData->m_pResults;
+			delete pData->m_pConn->m_pResults;
 		}
 		catch (sql::SQLException &e)
 		{
@@ -1906,22 +2940,118 @@ void CSqlScore::LoadTeamThread(void *pUser)
 			str_format(aBuf2, sizeof(aBuf2), "MySQL Error: %s", e.what());
 			dbg_msg("SQL", aBuf2);
 			dbg_msg("SQL", "ERROR: Could not load the team");
-			pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "MySQL Error: Could not load the team");
+			pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "MySQL Error: Could not load the team");
 		}
 
 		// disconnect from database
-		pData->m_pSqlData->Disconnect();
+		pData->m_pConn->Disconnect();
 	}
 	else
 	{
 		dbg_msg("SQL", "connection failed");
-		pData->m_pSqlData->GameServer()->SendChatTarget(pData->m_ClientID, "ERROR: Unable to connect to SQL-Server");
+		pData->m_pSqlData->SendChatTarget(pData->m_ClientID, "ERROR: Unable to connect to SQL-Server");
 	}
 
 	delete pData;
-	delete SavedTeam;
+}
+
+void CSqlScore::OnTeamLoad(const CSqlResult *pResult)
+{
+	int ClientID = pResult->m_ClientID;
+	if(!GameServer()->m_apPlayers[ClientID])
+		return;
+
+	CGameControllerDDRace *pController = (CGameControllerDDRace*)(GameServer()->m_pController);
+	CSaveTeam SavedTeam(pController);
+	if(SavedTeam.LoadString(pResult->m_pSavegame))
+	{
+		GameServer()->SendChatTarget(ClientID, "Unable to load savegame: data corrupted");
+		return;
+	}
+
+	bool found = false;
+	for (int i = 0; i < SavedTeam.GetMembersCount(); i++)
+	{
+		if(str_comp(SavedTeam.SavedTees[i].GetName(), Server()->ClientName(ClientID)) == 0)
+		{ found = true; break; }
+	}
+	if (!found)
+	{
+		GameServer()->SendChatTarget(ClientID, "You don't belong to this team");
+		return;
+	}
+
+	int n;
+	for(n = 1; n<64; n++)
+	{
+		if(pController->m_Teams.Count(n) == 0)
+			break;
+	}
+
+	if(pController->m_Teams.Count(n) > 0)
+	{
+		n = pController->m_Teams.m_Core.Team(ClientID); // if all Teams are full your the only one in your team
+	}
+
+	int Num = SavedTeam.load(n);
+
+	if(Num == 1)
+	{
+		GameServer()->SendChatTarget(ClientID, "You have to be in a team (from 1-63)");
+	}
+	else if(Num >= 10 && Num < 100)
+	{
+		char aBuf[256];
+		str_format(aBuf, sizeof(aBuf), "Unable to find player: '%s'", SavedTeam.SavedTees[Num-10].GetName());
+		GameServer()->SendChatTarget(ClientID, aBuf);
+	}
+	else if(Num >= 100)
+	{
+		char aBuf[256];
+		str_format(aBuf, sizeof(aBuf), "%s is racing right now, Team can't be loaded if a Tee is racing already", SavedTeam.SavedTees[Num-100].GetName());
+		GameServer()->SendChatTarget(ClientID, aBuf);
+	}
+	else
+	{
+		GameServer()->SendChatTeam(n, "Loading successfully done");
+
+		CSqlTeamLoad *Tmp = new CSqlTeamLoad();
+		str_copy(Tmp->m_Code, pResult->m_aText, sizeof(Tmp->m_Code));
+		Tmp->m_ClientID = ClientID;
+		Tmp->m_pSqlData = this;
+		Queue(DeleteTeamSaveThread, Tmp, SQLJOB_SAVE);
+	}
+}
+
+void CSqlScore::DeleteTeamSaveThread(CSqlJob *pJob)
+{
+	CSqlTeamLoad *pData = (CSqlTeamLoad *)pJob;
+
+	// m_Code was escaped by LoadTeamThread already
+	char Map[128];
+	str_copy(Map, pData->m_pSqlData->m_aMapName, 128);
+	pData->m_pSqlData->ClearString(Map, sizeof(Map));
+
+	if(pData->m_pConn->Connect())
+	{
+		try
+		{
+			char aBuf[512];
+			str_format(aBuf, sizeof(aBuf), "DELETE from %s_saves where Code='%s' and Map='%s';", pData->m_pSqlData->m_pPrefix, pData->m_Code, Map);
+			pData->m_pConn->m_pStatement->execute(aBuf);
+		}
+		catch (sql::SQLException &e)
+		{
+			char aBuf2[256];
+			str_format(aBuf2, sizeof(aBuf2), "MySQL Error: %s", e.what());
+			dbg_msg("SQL", aBuf2);
+			dbg_msg("SQL", "ERROR: Could not delete the loaded savegame");
+		}
+
+		pData->m_pConn->Disconnect();
+	}
 
-	lock_unlock(gs_SqlLock);
+	delete pData;
 }
 
 #endif
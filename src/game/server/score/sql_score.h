@@ -9,19 +9,262 @@
 #include <cppconn/driver.h>
 #include <cppconn/exception.h>
 #include <cppconn/statement.h>
+#include <cppconn/prepared_statement.h>
+
+#include <string>
+
+#include <base/tl/array.h>
+#include <base/tl/threading.h>
 
 #include "../score.h"
+#include "rank_cache.h"
 
-class CSqlScore: public IScore
+enum
 {
-	CGameContext *m_pGameServer;
-	IServer *m_pServer;
+	SQLSTMT_BEST_TIME=0,
+	SQLSTMT_HAS_FINISHED,
+	SQLSTMT_MAP_POINTS,
+	SQLSTMT_BIRTHDAY,
+	SQLSTMT_TEAM_TIMES,
+	SQLSTMT_TEAM_UPDATE,
+	SQLSTMT_CACHE_TIMES,
+	SQLSTMT_CACHE_TEAMS,
+	SQLSTMT_CACHE_NEW_TIMES,
+	SQLSTMT_CACHE_NEW_TEAMS,
+	NUM_SQLSTMTS,
+};
+
+class CSqlConnection
+{
+	const char* m_pDatabase;
+	const char* m_pUser;
+	const char* m_pPass;
+	const char* m_pIp;
+	int m_Port;
+
+public:
+	CSqlConnection(const char *pDatabase, const char *pUser, const char *pPass, const char *pIp, int Port);
+	~CSqlConnection();
 
 	sql::Driver *m_pDriver;
 	sql::Connection *m_pConnection;
 	sql::Statement *m_pStatement;
 	sql::ResultSet *m_pResults;
 
+	// prepared statements of this connection, one slot per query
+	sql::PreparedStatement *m_apPrepared[NUM_SQLSTMTS];
+	std::string m_aPreparedQuery[NUM_SQLSTMTS];
+	int m_NumPrepares;
+	int m_NumReuses;
+
+	bool Connect();
+	void Disconnect();
+
+	/*
+		Function: Prepare
+			Returns the cached statement of the slot, the query is
+			only sent to the server again when its text changed.
+	*/
+	sql::PreparedStatement *Prepare(int Stmt, const char *pQuery);
+	void ResetStatements();
+};
+
+enum
+{
+	// lower values are taken from the queue first
+	SQLJOB_SAVE=0,
+	SQLJOB_LOAD,
+	SQLJOB_QUERY,
+	NUM_SQLJOBS,
+};
+
+// base of the request data, a worker sets m_pConn before running it
+struct CSqlJob
+{
+	CSqlJob() : m_pSqlData(0), m_ClientID(-1), m_pConn(0), m_pfnFunc(0), m_Priority(SQLJOB_QUERY), m_QueueTime(0), m_pNext(0) {}
+	virtual ~CSqlJob() {}
+
+	class CSqlScore *m_pSqlData;
+	int m_ClientID;
+	CSqlConnection *m_pConn;
+
+	void (*m_pfnFunc)(CSqlJob *pJob);
+	int m_Priority;
+	int64 m_QueueTime;
+	CSqlJob *m_pNext;
+};
+
+struct CSqlRaceRow;
+struct CSqlTeamRow;
+struct CSqlBatchData;
+
+// the worker threads and their connections, created with the first score object
+// and kept until the process ends so a map change never has to wait for them
+class CSqlPool
+{
+	enum
+	{
+		MAX_WORKERS=8,
+	};
+
+	struct CSqlWorker
+	{
+		CSqlPool *m_pPool;
+		CSqlConnection *m_pConn;
+		void *m_pThread;
+	};
+
+	struct CJobStats
+	{
+		int m_Done;
+		int m_Dropped;
+		int64 m_WaitTotal;
+		int64 m_WaitMax;
+		int64 m_RunTotal;
+		int64 m_RunMax;
+	};
+
+	static CSqlPool *ms_pPool;
+
+	CSqlWorker m_aWorkers[MAX_WORKERS];
+	int m_NumWorkers;
+
+	// jobs queued per priority, guarded by m_JobLock
+	semaphore m_JobSem;
+	LOCK m_JobLock;
+	CSqlJob *m_apJobFirst[NUM_SQLJOBS];
+	CSqlJob *m_apJobLast[NUM_SQLJOBS];
+	int m_QueueDepth;
+	int m_PeakQueueDepth;
+	CJobStats m_aJobStats[NUM_SQLJOBS];
+
+	// queued or running, Shutdown waits on m_IdleSem for this to reach 0
+	int m_NumJobs;
+	bool m_Waiting;
+	semaphore m_IdleSem;
+
+	CSqlPool();
+
+	CSqlJob *PopJob();
+	void ReleaseJob(class CSqlScore *pOwner);
+	static void WorkerThread(void *pUser);
+
+public:
+	static CSqlPool *Get();
+
+	/*
+		Function: Shutdown
+			Waits until the jobs of all score objects are done,
+			called once when the process ends.
+	*/
+	static void Shutdown();
+
+	void Queue(CSqlJob *pJob);
+
+	/*
+		Function: Retire
+			Drops the queued loads and queries of the score object
+			and hands it to the pool, the save that finishes last
+			deletes it.
+	*/
+	void Retire(class CSqlScore *pOwner);
+	void PrintStats(IConsole *pConsole);
+};
+
+class CSqlScore: public IScore
+{
+	friend class CSqlPool;
+
+	CGameContext *m_pGameServer;
+	IServer *m_pServer;
+
+	enum
+	{
+		MAX_BATCH_ROWS=64,
+
+		SQLRESULT_CHAT_TARGET=0,
+		SQLRESULT_CHAT,
+		SQLRESULT_CHAT_TEAM,
+		SQLRESULT_EXECUTE,
+		SQLRESULT_SCORE,
+		SQLRESULT_POINTS,
+		SQLRESULT_RANK_CACHE,
+		SQLRESULT_RANK_CACHE_UPDATE,
+		SQLRESULT_MAP_VOTE,
+		SQLRESULT_TEAM_SAVED,
+		SQLRESULT_TEAM_SAVE_FAILED,
+		SQLRESULT_TEAM_LOAD,
+	};
+
+	// posted by the workers, handled on the game thread in OnTick
+	struct CSqlResult
+	{
+		CSqlResult() : m_Type(SQLRESULT_CHAT_TARGET), m_ClientID(-1), m_Team(0), m_SpamProtectionClientID(-1), m_Time(0.0f), m_HasCpTime(false), m_Points(0), m_pRankCache(0), m_pSavegame(0) { m_aText[0] = 0; m_aServer[0] = 0; }
+
+		int m_Type;
+		int m_ClientID;
+		int m_Team;
+		int m_SpamProtectionClientID;
+		float m_Time;
+		bool m_HasCpTime;
+		float m_aCpTime[NUM_CHECKPOINTS];
+		int m_Points;
+		CRankCache *m_pRankCache;
+		char *m_pSavegame; // mem_alloc'd, freed by the game thread
+		char m_aText[512];
+		char m_aServer[32];
+	};
+
+	// a local finish, replayed onto the rank cache if it was loading meanwhile
+	struct CRankUpdate
+	{
+		bool m_Team;
+		float m_Time;
+		int m_NumNames;
+		char m_aaNames[MAX_CLIENTS][MAX_NAME_LENGTH];
+	};
+
+	struct CFinisher
+	{
+		char m_aMap[128];
+		char m_aName[MAX_NAME_LENGTH];
+	};
+
+	volatile bool m_Closing; // set on the game thread, no new requests are queued
+
+	// guarded by the job lock of the pool
+	int m_NumJobs;
+	bool m_Retired;
+
+	LOCK m_ResultLock;
+	array<CSqlResult> m_lResults;
+
+	// finishes waiting for the next multi row insert, guarded by m_BatchLock
+	LOCK m_BatchLock;
+	array<CSqlRaceRow> m_lRaceBatch;
+	array<CSqlTeamRow> m_lTeamBatch;
+	array<CFinisher> m_lFinishers; // got the points of their map already, kept for the whole map
+	array<CSqlBatchData *> m_lFlushing; // handed to a worker, not inserted yet
+	int64 m_BatchStart;
+	int m_NumBatches;
+	int m_NumBatchedRows;
+
+	// held while points are inserted and while the rank cache reads them
+	LOCK m_PointsLock;
+
+	// answers the rank requests, only used on the game thread
+	CRankCache *m_pRankCache;
+	int64 m_RankCacheTime;
+	int64 m_RankCacheRequest;
+	bool m_RankCacheLoading;
+	char m_aRankCacheSince[32]; // database time the last load or refresh started at
+	array<CRankUpdate> m_lRankUpdates; // local finishes while the first load runs
+	int m_RankCacheHits;
+	int m_RankCacheMisses;
+	int m_RankCacheLoads;
+	int m_RankCacheRefreshes;
+	float m_RankCacheLoadMs;
+
 	// copy of config vars
 	const char* m_pDatabase;
 	const char* m_pPrefix;
@@ -29,6 +272,7 @@ class CSqlScore: public IScore
 	const char* m_pPass;
 	const char* m_pIp;
 	char m_aMap[64];
+	char m_aMapName[64]; // unescaped, for prepared statements
 	int m_Port;
 
 	CGameContext *GameServer()
@@ -40,28 +284,79 @@ class CSqlScore: public IScore
 		return m_pServer;
 	}
 
-	static void MapInfoThread(void *pUser);
-	static void MapVoteThread(void *pUser);
-	static void CheckBirthdayThread(void *pUser);
-	static void LoadScoreThread(void *pUser);
-	static void SaveScoreThread(void *pUser);
-	static void SaveTeamScoreThread(void *pUser);
-	static void ShowRankThread(void *pUser);
-	static void ShowTop5Thread(void *pUser);
-	static void ShowTeamRankThread(void *pUser);
-	static void ShowTeamTop5Thread(void *pUser);
-	static void ShowTimesThread(void *pUser);
-	static void ShowPointsThread(void *pUser);
-	static void ShowTopPointsThread(void *pUser);
-	static void RandomMapThread(void *pUser);
-	static void RandomUnfinishedMapThread(void *pUser);
-	static void SaveTeamThread(void *pUser);
-	static void LoadTeamThread(void *pUser);
+	static void MapInfoThread(CSqlJob *pJob);
+	static void MapVoteThread(CSqlJob *pJob);
+	static void CheckBirthdayThread(CSqlJob *pJob);
+	static void LoadScoreThread(CSqlJob *pJob);
+	static void SaveScoreThread(CSqlJob *pJob);
+	static void SaveTeamScoreThread(CSqlJob *pJob);
+	static void ShowRankThread(CSqlJob *pJob);
+	static void ShowTop5Thread(CSqlJob *pJob);
+	static void ShowTeamRankThread(CSqlJob *pJob);
+	static void ShowTeamTop5Thread(CSqlJob *pJob);
+	static void ShowTimesThread(CSqlJob *pJob);
+	static void ShowPointsThread(CSqlJob *pJob);
+	static void ShowTopPointsThread(CSqlJob *pJob);
+	static void RandomMapThread(CSqlJob *pJob);
+	static void RandomUnfinishedMapThread(CSqlJob *pJob);
+	static void SaveTeamThread(CSqlJob *pJob);
+	static void LoadTeamThread(CSqlJob *pJob);
+	static void DeleteTeamSaveThread(CSqlJob *pJob);
+	static void FlushBatchThread(CSqlJob *pJob);
+	static void LoadTestCleanupThread(CSqlJob *pJob);
+	static void LoadRankCacheThread(CSqlJob *pJob);
 
-	void Init();
+	void Queue(void (*pfnFunc)(CSqlJob *pJob), CSqlJob *pJob, int Priority);
 
-	bool Connect();
-	void Disconnect();
+	void PostResult(const CSqlResult &Result);
+	void SendChatTarget(int To, const char *pText);
+	void SendChatTeam(int Team, const char *pText);
+	void SendChat(int ClientID, int Team, const char *pText, int SpamProtectionClientID = -1);
+	void ExecuteLine(const char *pLine);
+	void SetPlayerScore(int ClientID, float Time, float *pCpTime);
+
+	// the parts of the requests that touch the game world, run on the game thread
+	void OnMapVote(const CSqlResult *pResult);
+	void OnTeamSaved(const CSqlResult *pResult, bool Success);
+	void OnTeamLoad(const CSqlResult *pResult);
+
+	/*
+		Function: AddRaceRow
+			Adds the finish to the batch. The first finish of a
+			player on a map gets its points, deciding that and
+			queuing the row is one step so two saves of the same
+			player can't both hand them out.
+
+		Returns:
+			Whether the row got the points.
+	*/
+	bool AddRaceRow(CSqlRaceRow *pRow, bool Finished, int Points);
+	void AddTeamRows(const CSqlTeamRow *pRows, int Num);
+	CSqlBatchData *TakeBatch();
+	void FlushBatch();
+
+	/*
+		Function: LoadRankCache
+			Queues reading the ranks of the map. With a since time
+			only the times added after it are read and merged into
+			the current cache, points are not read again then.
+	*/
+	void LoadRankCache(const char *pSince);
+	void OnRankCacheLoaded(CRankCache *pCache, const char *pSince, float LoadMs);
+	void OnRankCacheRefreshed(const CRankCache *pNew, const char *pSince, float LoadMs);
+	void UpdateRankCache(const CRankUpdate &Update);
+	void ApplyRankUpdate(const CRankUpdate &Update);
+	void AddCachedPoints(const char *pName, int Points);
+
+	/*
+		Function: UseRankCache
+			Whether a rank request can be answered from the cache,
+			which is the case once it is loaded and sv_sql_rank_cache
+			is set.
+	*/
+	bool UseRankCache();
+
+	void Init();
 
 	void FuzzyString(char *pString);
 	// anti SQL injection
@@ -97,19 +392,29 @@ public:
 	virtual void SaveTeam(int Team, const char* Code, int ClientID, const char* Server);
 	virtual void LoadTeam(const char* Code, int ClientID);
 	static void agoTimeToString(int agoTime, char agoString[]);
+
+	virtual void Release();
+	virtual void OnTick();
+	virtual void PrintStats(IConsole *pConsole);
+
+	// queues synthetic finishes on a separate map to measure the save path
+	void LoadTest(int Finishes, int Players);
 };
 
-struct CSqlMapData
+struct CSqlMapData : CSqlJob
 {
-	CSqlScore *m_pSqlData;
-	int m_ClientID;
 	char m_aMap[128];
 };
 
-struct CSqlScoreData
+struct CSqlRankCacheData : CSqlJob
 {
-	CSqlScore *m_pSqlData;
-	int m_ClientID;
+	char m_aMap[128];
+	char m_aSince[32]; // empty for a full load
+};
+
+struct CSqlScoreData : CSqlJob
+{
+	char m_aMap[128];
 #if defined(CONF_FAMILY_WINDOWS)
 	char m_aName[16]; // Don't edit this, or all your teeth will fall http://bugs.mysql.com/bug.php?id=50046
 #else
@@ -123,9 +428,8 @@ struct CSqlScoreData
 	char m_aRequestingPlayer[MAX_NAME_LENGTH];
 };
 
-struct CSqlTeamScoreData
+struct CSqlTeamScoreData : CSqlJob
 {
-	CSqlScore *m_pSqlData;
 	unsigned int m_Size;
 	int m_aClientIDs[MAX_CLIENTS];
 #if defined(CONF_FAMILY_WINDOWS)
@@ -141,20 +445,40 @@ struct CSqlTeamScoreData
 	char m_aRequestingPlayer[MAX_NAME_LENGTH];
 };
 
-struct CSqlTeamSave
+struct CSqlRaceRow
+{
+	char m_aMap[128];
+	char m_aName[MAX_NAME_LENGTH];
+	float m_Time;
+	float m_aCpTime[NUM_CHECKPOINTS];
+	int m_Points;
+};
+
+struct CSqlTeamRow
+{
+	char m_aMap[128];
+	char m_aName[MAX_NAME_LENGTH];
+	float m_Time;
+	char m_aID[17];
+};
+
+struct CSqlBatchData : CSqlJob
+{
+	array<CSqlRaceRow> m_lRaceRows;
+	array<CSqlTeamRow> m_lTeamRows;
+};
+
+struct CSqlTeamSave : CSqlJob
 {
 	int m_Team;
-	int m_ClientID;
 	char m_Code[128];
 	char m_Server[5];
-	CSqlScore *m_pSqlData;
+	std::string m_Savegame; // already escaped
 };
 
-struct CSqlTeamLoad
+struct CSqlTeamLoad : CSqlJob
 {
 	char m_Code[128];
-	int m_ClientID;
-	CSqlScore *m_pSqlData;
 };
 
 #endif
@@ -172,4 +172,5 @@ MACRO_CONFIG_INT(SvRescueDelay, sv_rescue_delay, 5, 0, 1000, CFGFLAG_SERVER, "Nu
 
 MACRO_CONFIG_INT(DbgFocus, dbg_focus, 0, 0, 1, CFGFLAG_CLIENT, "")
 MACRO_CONFIG_INT(DbgTuning, dbg_tuning, 0, 0, 1, CFGFLAG_CLIENT, "")
+MACRO_CONFIG_INT(DbgOldMoveBox, dbg_old_move_box, 0, 0, 1, CFGFLAG_CLIENT|CFGFLAG_SERVER, "Test every step of a box movement against the map, to compare with the swept check")
 #endif